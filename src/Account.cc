@@ -6,6 +6,7 @@
 #include <phosg/Hash.hh>
 #include <phosg/Random.hh>
 #include <phosg/Time.hh>
+#include <phosg/Tools.hh>
 
 #include "Account.hh"
 
@@ -386,17 +387,35 @@ void Account::print(FILE* stream) const {
 }
 
 void Account::save() const {
-  if (!this->is_temporary) {
-    auto json = this->json();
-    string json_data = json.serialize(JSON::SerializeOption::FORMAT | JSON::SerializeOption::HEX_INTEGERS);
-    string filename = string_printf("system/licenses/%010" PRIu32 ".json", this->account_id);
-    save_file(filename, json_data);
+  if (this->is_temporary) {
+    return;
+  }
+  if (this->account_log) {
+    this->account_log->save(this->account_id, this->json().serialize());
+    return;
+  }
+
+  auto json = this->json();
+  string json_data = json.serialize(JSON::SerializeOption::FORMAT | JSON::SerializeOption::HEX_INTEGERS);
+  string filename = string_printf("system/licenses/%010" PRIu32 ".json", this->account_id);
+  if (this->file_writer) {
+    this->file_writer->write(filename, std::move(json_data));
+  } else {
+    DurableFileWriter::write_file(filename, json_data);
   }
 }
 
 void Account::delete_file() const {
+  if (this->account_log) {
+    this->account_log->remove(this->account_id);
+    return;
+  }
   string filename = string_printf("system/licenses/%010" PRIu32 ".json", this->account_id);
-  remove(filename.c_str());
+  if (this->file_writer) {
+    this->file_writer->remove(filename);
+  } else {
+    remove(filename.c_str());
+  }
 }
 
 size_t AccountIndex::count() const {
@@ -760,6 +779,12 @@ void AccountIndex::add_locked(shared_ptr<Account> a) {
   if (this->force_all_temporary) {
     a->is_temporary = true;
   }
+  if (!a->file_writer) {
+    a->file_writer = this->file_writer;
+  }
+  if (!a->account_log) {
+    a->account_log = this->account_log;
+  }
 
   for (const auto& it : a->dc_nte_licenses) {
     if (this->by_dc_nte_serial_number.count(it.second->serial_number)) {
@@ -981,23 +1006,71 @@ shared_ptr<Account> AccountIndex::create_temporary_account_for_shared_account(
   return ret;
 }
 
-AccountIndex::AccountIndex(bool force_all_temporary)
-    : force_all_temporary(force_all_temporary) {
-  if (!this->force_all_temporary) {
+AccountIndex::AccountIndex(
+    bool force_all_temporary, shared_ptr<DurableFileWriter> file_writer, shared_ptr<AccountLog> account_log)
+    : force_all_temporary(force_all_temporary),
+      file_writer(file_writer),
+      account_log(account_log) {
+  if (this->force_all_temporary) {
+    this->account_log.reset();
+
+  } else if (this->account_log) {
+    auto records = this->account_log->all_records();
+    auto results = parse_accounts_parallel(records.size(), [&](size_t z) -> shared_ptr<Account> {
+      return make_shared<Account>(JSON::parse(records[z].second));
+    });
+    for (size_t z = 0; z < records.size(); z++) {
+      try {
+        this->add_parsed_account(results[z]);
+      } catch (const exception& e) {
+        log_error("Failed to index account %010" PRIu32 " from %s", records[z].first, this->account_log->get_filename().c_str());
+        throw;
+      }
+    }
+
+  } else {
     if (!isdir("system/licenses")) {
       mkdir("system/licenses", 0755);
     } else {
+      vector<string> filenames;
       for (const auto& item : list_directory("system/licenses")) {
         if (ends_with(item, ".json")) {
-          try {
-            JSON json = JSON::parse(load_file("system/licenses/" + item));
-            this->add(make_shared<Account>(json));
-          } catch (const exception& e) {
-            log_error("Failed to index account %s", item.c_str());
-            throw;
-          }
+          filenames.emplace_back(item);
         }
       }
+      auto results = parse_accounts_parallel(filenames.size(), [&](size_t z) -> shared_ptr<Account> {
+        return make_shared<Account>(JSON::parse(load_file("system/licenses/" + filenames[z])));
+      });
+      for (size_t z = 0; z < filenames.size(); z++) {
+        try {
+          this->add_parsed_account(results[z]);
+        } catch (const exception& e) {
+          log_error("Failed to index account %s", filenames[z].c_str());
+          throw;
+        }
+      }
+    }
+  }
+}
+
+vector<AccountIndex::ParsedAccount> AccountIndex::parse_accounts_parallel(
+    size_t count, function<shared_ptr<Account>(size_t)> parse) {
+  vector<ParsedAccount> ret(count);
+  parallel_range<size_t>([&](size_t z, size_t) -> bool {
+    try {
+      ret[z].account = parse(z);
+    } catch (const exception&) {
+      ret[z].exc = current_exception();
     }
+    return false;
+  },
+      0, count, 0);
+  return ret;
+}
+
+void AccountIndex::add_parsed_account(const ParsedAccount& parsed) {
+  if (parsed.exc) {
+    rethrow_exception(parsed.exc);
   }
+  this->add(parsed.account);
 }
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <exception>
+#include <functional>
 #include <memory>
 #include <mutex>
 #include <phosg/JSON.hh>
@@ -8,6 +10,8 @@
 #include <unordered_map>
 #include <vector>
 
+#include "AccountLog.hh"
+#include "DurableFileWriter.hh"
 #include "Text.hh"
 
 class LicenseIndex;
@@ -90,6 +94,12 @@ struct Account {
 
   uint32_t bb_team_id = 0;
   bool is_temporary = false; // If true, isn't saved to disk
+  // These are set by AccountIndex when the account is added to it. If
+  // account_log is not null, the account is saved there instead of in its own
+  // file; otherwise, if file_writer is null, save() writes the account's file
+  // synchronously.
+  std::shared_ptr<DurableFileWriter> file_writer;
+  std::shared_ptr<AccountLog> account_log;
 
   std::unordered_set<std::string> auto_patches_enabled;
 
@@ -160,7 +170,16 @@ public:
     missing_account() : invalid_argument("missing account") {}
   };
 
-  explicit AccountIndex(bool force_all_temporary);
+  // If account_log is given, accounts are loaded from and saved to it;
+  // otherwise, each account is stored in its own file in system/licenses.
+  // Account files are read and parsed on multiple threads, then added to the
+  // index in order on the calling thread, so errors (including duplicate
+  // licenses) are reported for the same account as if the files were loaded
+  // one at a time.
+  explicit AccountIndex(
+      bool force_all_temporary,
+      std::shared_ptr<DurableFileWriter> file_writer = nullptr,
+      std::shared_ptr<AccountLog> account_log = nullptr);
   virtual ~AccountIndex() = default;
 
   std::shared_ptr<Account> create_account(bool is_temporary) const;
@@ -223,6 +242,8 @@ public:
 
 protected:
   bool force_all_temporary;
+  std::shared_ptr<DurableFileWriter> file_writer;
+  std::shared_ptr<AccountLog> account_log;
 
   // This class must be thread-safe because it's used by both the patch server
   // and game server threads
@@ -235,6 +256,14 @@ protected:
   std::unordered_map<std::string, std::shared_ptr<Account>> by_xb_gamertag;
   std::unordered_map<std::string, std::shared_ptr<Account>> by_bb_username;
 
+  struct ParsedAccount {
+    std::shared_ptr<Account> account; // Null if parsing failed
+    std::exception_ptr exc;
+  };
+  static std::vector<ParsedAccount> parse_accounts_parallel(
+      size_t count, std::function<std::shared_ptr<Account>(size_t)> parse);
+  void add_parsed_account(const ParsedAccount& parsed);
+
   void add_locked(std::shared_ptr<Account> a);
 
   std::shared_ptr<Login> from_dc_nte_credentials_locked(
@@ -0,0 +1,226 @@
+#include "AccountLog.hh"
+
+#include <errno.h>
+#include <unistd.h>
+
+#include <phosg/Filesystem.hh>
+#include <phosg/Strings.hh>
+#include <stdexcept>
+
+#include "CRC32.hh"
+#include "DurableFileWriter.hh"
+#include "Loggers.hh"
+
+using namespace std;
+
+AccountLog::AccountLog(const string& filename)
+    : filename(filename),
+      f(nullptr, nullptr) {
+  string data;
+  try {
+    data = load_file(this->filename);
+  } catch (const cannot_open_file&) {
+  }
+
+  // A record that is cut off by the end of the file, or that fails its
+  // checksum and ends exactly at the end of the file, was torn by a crash
+  // during an append; this is expected, and the record is discarded. Damage
+  // anywhere else means the records after it can't be trusted to be found
+  // correctly, so the log isn't loaded at all (and the file isn't modified).
+  auto throw_damaged = [&](size_t offset, const char* what) -> void {
+    throw runtime_error(string_printf(
+        "account log %s is damaged at offset %zX (%s); the file has not been modified, and must be repaired or restored manually",
+        this->filename.c_str(), offset, what));
+  };
+
+  StringReader r(data);
+  bool is_damaged = false;
+  size_t num_records = 0;
+  size_t record_offset = 0;
+  while (!r.eof()) {
+    record_offset = r.where();
+    if (r.remaining() < sizeof(RecordHeader)) {
+      is_damaged = true;
+      break;
+    }
+    const auto& header = r.get<RecordHeader>();
+    if (header.signature != RECORD_SIGNATURE) {
+      // Some filesystems can leave zeroes at the end of a file that was being
+      // extended during a crash; these are also a torn append
+      if (data.find_first_not_of('\0', record_offset) != string::npos) {
+        throw_damaged(record_offset, "incorrect record signature");
+      }
+      is_damaged = true;
+      break;
+    }
+    if (r.remaining() < header.data_size) {
+      is_damaged = true;
+      break;
+    }
+    string json_data = r.read(header.data_size);
+    uint32_t checksum = crc32_fast(&header.account_id, sizeof(header.account_id) + sizeof(header.data_size));
+    if (crc32_fast(json_data.data(), json_data.size(), checksum) != header.checksum) {
+      if (!r.eof()) {
+        throw_damaged(record_offset, "incorrect record checksum");
+      }
+      is_damaged = true;
+      break;
+    }
+    if (json_data.empty()) {
+      this->records.erase(header.account_id);
+    } else {
+      this->records[header.account_id] = std::move(json_data);
+    }
+    num_records++;
+  }
+
+  this->file_size = data.size();
+  for (const auto& it : this->records) {
+    this->live_size += sizeof(RecordHeader) + it.second.size();
+  }
+  config_log.info("Loaded %zu account(s) from %zu record(s) in %s", this->records.size(), num_records, this->filename.c_str());
+
+  // If the last record is torn, rewrite the file without it, so that future
+  // appends can be read
+  if (is_damaged) {
+    config_log.warning("Account log %s ends with an incomplete record at offset %zX; discarding it",
+        this->filename.c_str(), record_offset);
+    this->compact_locked();
+  } else {
+    this->f = fopen_unique(this->filename, "ab");
+    this->compact_if_needed_locked();
+  }
+}
+
+vector<pair<uint32_t, string>> AccountLog::all_records() const {
+  lock_guard g(this->lock);
+  vector<pair<uint32_t, string>> ret;
+  ret.reserve(this->records.size());
+  for (const auto& it : this->records) {
+    ret.emplace_back(it.first, it.second);
+  }
+  return ret;
+}
+
+size_t AccountLog::count() const {
+  lock_guard g(this->lock);
+  return this->records.size();
+}
+
+void AccountLog::save(uint32_t account_id, string&& json_data) {
+  if (json_data.empty()) {
+    throw logic_error("account JSON data is empty");
+  }
+
+  lock_guard g(this->lock);
+  this->append_record_locked(account_id, json_data);
+  auto emplace_ret = this->records.emplace(account_id, "");
+  if (!emplace_ret.second) {
+    this->live_size -= sizeof(RecordHeader) + emplace_ret.first->second.size();
+  }
+  this->live_size += sizeof(RecordHeader) + json_data.size();
+  emplace_ret.first->second = std::move(json_data);
+  this->compact_if_needed_locked();
+}
+
+void AccountLog::remove(uint32_t account_id) {
+  lock_guard g(this->lock);
+  auto it = this->records.find(account_id);
+  if (it == this->records.end()) {
+    return;
+  }
+  this->append_record_locked(account_id, "");
+  this->live_size -= sizeof(RecordHeader) + it->second.size();
+  this->records.erase(it);
+  this->compact_if_needed_locked();
+}
+
+void AccountLog::compact() {
+  lock_guard g(this->lock);
+  this->compact_locked();
+}
+
+void AccountLog::close() {
+  lock_guard g(this->lock);
+  this->f.reset();
+  this->closed = true;
+}
+
+string AccountLog::encode_record(uint32_t account_id, const string& json_data) {
+  RecordHeader header;
+  header.signature = RECORD_SIGNATURE;
+  header.account_id = account_id;
+  header.data_size = json_data.size();
+  header.checksum = crc32_fast(json_data.data(), json_data.size(),
+      crc32_fast(&header.account_id, sizeof(header.account_id) + sizeof(header.data_size)));
+
+  string ret(reinterpret_cast<const char*>(&header), sizeof(header));
+  ret += json_data;
+  return ret;
+}
+
+void AccountLog::append_record_locked(uint32_t account_id, const string& json_data) {
+  // Appends are flushed immediately, so they survive if the server crashes,
+  // but they aren't synced (unlike compactions), since this happens on the
+  // event thread
+  if (this->closed || !this->f) {
+    throw runtime_error("account log " + this->filename + " is not open for writing");
+  }
+  string record = this->encode_record(account_id, json_data);
+  try {
+    fwritex(this->f.get(), record);
+    if (fflush(this->f.get())) {
+      throw runtime_error("cannot write account log: " + string_for_error(errno));
+    }
+  } catch (const exception&) {
+    // Part of the record may have been written. Later appends would follow
+    // it and be unreadable, so cut the file back to its previous size. If
+    // that fails, no further appends are allowed.
+    this->f.reset();
+    if (truncate(this->filename.c_str(), this->file_size) == 0) {
+      try {
+        this->f = fopen_unique(this->filename, "ab");
+      } catch (const exception& e) {
+        config_log.error("Cannot reopen account log %s: %s", this->filename.c_str(), e.what());
+      }
+    } else {
+      config_log.error("Cannot truncate account log %s after failed append: %s",
+          this->filename.c_str(), string_for_error(errno).c_str());
+    }
+    throw;
+  }
+  this->file_size += record.size();
+}
+
+void AccountLog::compact_locked() {
+  if (this->closed) {
+    throw runtime_error("account log " + this->filename + " is closed");
+  }
+  string data;
+  data.reserve(this->live_size);
+  for (const auto& it : this->records) {
+    data += this->encode_record(it.first, it.second);
+  }
+
+  // The new file is written in full and renamed over the old one, so if this
+  // fails partway through, the old file is still intact (and still open for
+  // appending)
+  DurableFileWriter::write_file(this->filename, data);
+  this->f = fopen_unique(this->filename, "ab");
+  config_log.info("Compacted account log %s from %zu bytes to %zu bytes", this->filename.c_str(), this->file_size, data.size());
+  this->file_size = data.size();
+  this->live_size = data.size();
+}
+
+void AccountLog::compact_if_needed_locked() {
+  if ((this->file_size >= MIN_COMPACTION_SIZE) && (this->file_size > 2 * this->live_size)) {
+    // The records are already appended at this point, so it's not necessary
+    // to report this failure to the caller; compaction will be retried on the
+    // next change
+    try {
+      this->compact_locked();
+    } catch (const exception& e) {
+      config_log.warning("Failed to compact account log %s: %s", this->filename.c_str(), e.what());
+    }
+  }
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <memory>
+#include <mutex>
+#include <phosg/Encoding.hh>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// An alternative to storing each account in its own JSON file (in
+// system/licenses). All accounts are stored in a single file, which is only
+// ever appended to: each save appends a record containing the account's
+// entire JSON representation, and each deletion appends an empty record. The
+// newest record for each account ID is the current one.
+//
+// The entire file is read sequentially when the log is opened, and the
+// current record for each account is kept in memory. When the file has grown
+// to more than twice the size of the current records (and is at least
+// MIN_COMPACTION_SIZE bytes), it's compacted by rewriting it with only the
+// current records.
+//
+// Each record has a checksum. If the server crashes in the middle of an
+// append, the partial record at the end of the file is detected and
+// discarded the next time the log is opened. Damage anywhere else in the
+// file makes the constructor throw, without modifying the file.
+//
+// All public functions are thread-safe.
+class AccountLog {
+public:
+  static constexpr size_t MIN_COMPACTION_SIZE = 0x100000;
+
+  explicit AccountLog(const std::string& filename);
+  AccountLog(const AccountLog&) = delete;
+  AccountLog(AccountLog&&) = delete;
+  AccountLog& operator=(const AccountLog&) = delete;
+  AccountLog& operator=(AccountLog&&) = delete;
+  ~AccountLog() = default;
+
+  inline const std::string& get_filename() const {
+    return this->filename;
+  }
+
+  // Returns the current JSON data for all accounts
+  std::vector<std::pair<uint32_t, std::string>> all_records() const;
+  size_t count() const;
+
+  void save(uint32_t account_id, std::string&& json_data);
+  void remove(uint32_t account_id);
+  void compact();
+  // Closes the file. After this, save(), remove(), and compact() throw. This
+  // is used after this process has handed off its files to another process
+  // (see SocketHandoff.hh).
+  void close();
+
+private:
+  struct RecordHeader {
+    be_uint32_t signature; // RECORD_SIGNATURE
+    le_uint32_t account_id;
+    le_uint32_t data_size; // 0 = account was deleted
+    le_uint32_t checksum; // crc32 of account_id, data_size, and the data
+  } __packed_ws__(RecordHeader, 0x10);
+
+  static constexpr uint32_t RECORD_SIGNATURE = 0x41434354; // 'ACCT'
+
+  std::string filename;
+  mutable std::mutex lock;
+  std::unique_ptr<FILE, void (*)(FILE*)> f;
+  std::unordered_map<uint32_t, std::string> records;
+  size_t file_size = 0;
+  size_t live_size = 0; // Size of the current records, including headers
+  bool closed = false;
+
+  static std::string encode_record(uint32_t account_id, const std::string& json_data);
+  void append_record_locked(uint32_t account_id, const std::string& json_data);
+  void compact_locked();
+  void compact_if_needed_locked();
+};
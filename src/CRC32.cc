@@ -0,0 +1,278 @@
+#include "CRC32.hh"
+
+#include <string.h>
+
+#include <array>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define HAVE_CRC32_PCLMUL
+#include <immintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#define HAVE_CRC32_ARMV8
+#include <arm_acle.h>
+#endif
+
+using namespace std;
+
+static constexpr uint32_t CRC32_POLYNOMIAL = 0xEDB88320;
+
+////////////////////////////////////////////////////////////////////////////////
+// Table implementation (slicing-by-8)
+
+using CRC32Tables = array<array<uint32_t, 0x100>, 8>;
+
+static constexpr CRC32Tables make_crc32_tables() {
+  CRC32Tables ret{};
+  for (uint32_t z = 0; z < 0x100; z++) {
+    uint32_t crc = z;
+    for (size_t bit = 0; bit < 8; bit++) {
+      crc = (crc & 1) ? ((crc >> 1) ^ CRC32_POLYNOMIAL) : (crc >> 1);
+    }
+    ret[0][z] = crc;
+  }
+  for (uint32_t z = 0; z < 0x100; z++) {
+    for (size_t t = 1; t < 8; t++) {
+      ret[t][z] = (ret[t - 1][z] >> 8) ^ ret[0][ret[t - 1][z] & 0xFF];
+    }
+  }
+  return ret;
+}
+
+static constexpr CRC32Tables crc32_tables = make_crc32_tables();
+
+// Like all the internal functions in this file, crc is the raw CRC state (that
+// is, the inverse of the checksum value)
+static uint32_t crc32_bytewise(const uint8_t* data, size_t size, uint32_t crc) {
+  for (size_t z = 0; z < size; z++) {
+    crc = crc32_tables[0][(crc ^ data[z]) & 0xFF] ^ (crc >> 8);
+  }
+  return crc;
+}
+
+static uint32_t crc32_slice8(const uint8_t* data, size_t size, uint32_t crc) {
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+  for (; size >= 8; data += 8, size -= 8) {
+    uint32_t lo, hi;
+    memcpy(&lo, data, 4);
+    memcpy(&hi, data + 4, 4);
+    lo ^= crc;
+    crc = crc32_tables[7][lo & 0xFF] ^
+        crc32_tables[6][(lo >> 8) & 0xFF] ^
+        crc32_tables[5][(lo >> 16) & 0xFF] ^
+        crc32_tables[4][lo >> 24] ^
+        crc32_tables[3][hi & 0xFF] ^
+        crc32_tables[2][(hi >> 8) & 0xFF] ^
+        crc32_tables[1][(hi >> 16) & 0xFF] ^
+        crc32_tables[0][hi >> 24];
+  }
+#endif
+  return crc32_bytewise(data, size, crc);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// x86-64 implementation (PCLMULQDQ folding; see Intel's "Fast CRC Computation
+// for Generic Polynomials Using PCLMULQDQ Instruction")
+
+#ifdef HAVE_CRC32_PCLMUL
+
+__attribute__((target("pclmul,sse4.1"))) static inline __m128i crc32_pclmul_fold16(
+    __m128i acc, __m128i next, __m128i k) {
+  __m128i lo = _mm_clmulepi64_si128(acc, k, 0x00);
+  __m128i hi = _mm_clmulepi64_si128(acc, k, 0x11);
+  return _mm_xor_si128(_mm_xor_si128(hi, next), lo);
+}
+
+// Processes size bytes, which must be a multiple of 16 and at least 64
+__attribute__((target("pclmul,sse4.1"))) static uint32_t crc32_pclmul_blocks(
+    const uint8_t* data, size_t size, uint32_t crc) {
+  // Folding constants for the reflected polynomial: k1 = x^(4*128+32) mod P,
+  // k2 = x^(4*128-32) mod P, k3 = x^(128+32) mod P, k4 = x^(128-32) mod P,
+  // k5 = x^64 mod P, and the Barrett reduction constants (P' and mu)
+  alignas(16) static const uint64_t k1k2[2] = {0x0154442BD4, 0x01C6E41596};
+  alignas(16) static const uint64_t k3k4[2] = {0x01751997D0, 0x00CCAA009E};
+  alignas(16) static const uint64_t k5k0[2] = {0x0163CD6124, 0x0000000000};
+  alignas(16) static const uint64_t poly[2] = {0x01DB710641, 0x01F7011641};
+
+  __m128i x1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 0x00));
+  __m128i x2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 0x10));
+  __m128i x3 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 0x20));
+  __m128i x4 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 0x30));
+  x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(crc));
+  data += 0x40;
+  size -= 0x40;
+
+  // Fold 64 bytes at a time into four independent accumulators
+  __m128i k = _mm_load_si128(reinterpret_cast<const __m128i*>(k1k2));
+  for (; size >= 0x40; data += 0x40, size -= 0x40) {
+    __m128i x5 = _mm_clmulepi64_si128(x1, k, 0x00);
+    __m128i x6 = _mm_clmulepi64_si128(x2, k, 0x00);
+    __m128i x7 = _mm_clmulepi64_si128(x3, k, 0x00);
+    __m128i x8 = _mm_clmulepi64_si128(x4, k, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, k, 0x11);
+    x2 = _mm_clmulepi64_si128(x2, k, 0x11);
+    x3 = _mm_clmulepi64_si128(x3, k, 0x11);
+    x4 = _mm_clmulepi64_si128(x4, k, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 0x00)));
+    x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 0x10)));
+    x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 0x20)));
+    x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 0x30)));
+  }
+
+  // Fold the four accumulators into one
+  k = _mm_load_si128(reinterpret_cast<const __m128i*>(k3k4));
+  x1 = crc32_pclmul_fold16(x1, x2, k);
+  x1 = crc32_pclmul_fold16(x1, x3, k);
+  x1 = crc32_pclmul_fold16(x1, x4, k);
+
+  // Fold any remaining 16-byte blocks
+  for (; size >= 0x10; data += 0x10, size -= 0x10) {
+    x1 = crc32_pclmul_fold16(x1, _mm_loadu_si128(reinterpret_cast<const __m128i*>(data)), k);
+  }
+
+  // Fold 128 bits down to 64 bits
+  __m128i mask32 = _mm_setr_epi32(~0, 0, ~0, 0);
+  x2 = _mm_clmulepi64_si128(x1, k, 0x10);
+  x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+  k = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(k5k0));
+  x2 = _mm_srli_si128(x1, 4);
+  x1 = _mm_and_si128(x1, mask32);
+  x1 = _mm_clmulepi64_si128(x1, k, 0x00);
+  x1 = _mm_xor_si128(x1, x2);
+
+  // Barrett-reduce 64 bits down to 32 bits
+  k = _mm_load_si128(reinterpret_cast<const __m128i*>(poly));
+  x2 = _mm_and_si128(x1, mask32);
+  x2 = _mm_clmulepi64_si128(x2, k, 0x10);
+  x2 = _mm_and_si128(x2, mask32);
+  x2 = _mm_clmulepi64_si128(x2, k, 0x00);
+  x1 = _mm_xor_si128(x1, x2);
+  return _mm_extract_epi32(x1, 1);
+}
+
+static uint32_t crc32_pclmul(const uint8_t* data, size_t size, uint32_t crc) {
+  if (size >= 0x40) {
+    size_t block_bytes = size & ~static_cast<size_t>(0x0F);
+    crc = crc32_pclmul_blocks(data, block_bytes, crc);
+    data += block_bytes;
+    size -= block_bytes;
+  }
+  return crc32_slice8(data, size, crc);
+}
+
+static bool cpu_supports_pclmul() {
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1");
+}
+
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+// ARMv8 implementation (CRC32 instructions)
+
+#ifdef HAVE_CRC32_ARMV8
+
+static uint32_t crc32_armv8(const uint8_t* data, size_t size, uint32_t crc) {
+  for (; size && (reinterpret_cast<uintptr_t>(data) & 7); data++, size--) {
+    crc = __crc32b(crc, *data);
+  }
+  for (; size >= 8; data += 8, size -= 8) {
+    uint64_t v;
+    memcpy(&v, data, 8);
+    crc = __crc32d(crc, v);
+  }
+  for (; size; data++, size--) {
+    crc = __crc32b(crc, *data);
+  }
+  return crc;
+}
+
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+// Dispatch
+
+using CRC32Implementation = uint32_t (*)(const uint8_t*, size_t, uint32_t);
+
+struct CRC32Dispatch {
+  CRC32Implementation fn;
+  const char* name;
+
+  CRC32Dispatch() {
+#if defined(HAVE_CRC32_PCLMUL)
+    if (cpu_supports_pclmul()) {
+      this->fn = crc32_pclmul;
+      this->name = "pclmulqdq";
+      return;
+    }
+#elif defined(HAVE_CRC32_ARMV8)
+    this->fn = crc32_armv8;
+    this->name = "armv8-crc32";
+    return;
+#endif
+    this->fn = crc32_slice8;
+    this->name = "slicing-by-8";
+  }
+};
+
+static const CRC32Dispatch& crc32_dispatch() {
+  static const CRC32Dispatch dispatch;
+  return dispatch;
+}
+
+uint32_t crc32_fast(const void* data, size_t size, uint32_t cs) {
+  return ~crc32_dispatch().fn(reinterpret_cast<const uint8_t*>(data), size, ~cs);
+}
+
+const char* crc32_fast_implementation_name() {
+  return crc32_dispatch().name;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Combination (same approach as zlib's crc32_combine)
+
+// Returns a(x) * b(x) mod P(x), in the reflected bit order
+static constexpr uint32_t multiply_mod_p(uint32_t a, uint32_t b) {
+  uint32_t m = 0x80000000;
+  uint32_t p = 0;
+  for (;;) {
+    if (a & m) {
+      p ^= b;
+      if ((a & (m - 1)) == 0) {
+        break;
+      }
+    }
+    m >>= 1;
+    b = (b & 1) ? ((b >> 1) ^ CRC32_POLYNOMIAL) : (b >> 1);
+  }
+  return p;
+}
+
+// x2n_table[z] = x^(2^z) mod P(x)
+static constexpr array<uint32_t, 32> make_x2n_table() {
+  array<uint32_t, 32> ret{};
+  uint32_t p = 0x40000000; // x^1
+  ret[0] = p;
+  for (size_t z = 1; z < 32; z++) {
+    p = multiply_mod_p(p, p);
+    ret[z] = p;
+  }
+  return ret;
+}
+
+static constexpr array<uint32_t, 32> x2n_table = make_x2n_table();
+
+// Returns x^(n * 2^k) mod P(x)
+static uint32_t x2n_mod_p(size_t n, size_t k) {
+  uint32_t p = 0x80000000; // x^0
+  for (; n; n >>= 1, k++) {
+    if (n & 1) {
+      p = multiply_mod_p(x2n_table[k & 31], p);
+    }
+  }
+  return p;
+}
+
+uint32_t crc32_combine(uint32_t crc_a, uint32_t crc_b, size_t size_b) {
+  // Appending size_b bytes to A multiplies its polynomial by x^(8 * size_b)
+  return multiply_mod_p(x2n_mod_p(size_b, 3), crc_a) ^ crc_b;
+}
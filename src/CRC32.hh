@@ -0,0 +1,25 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// These functions compute the standard CRC32 (reflected polynomial
+// 0xEDB88320), which PSO uses for patch file checksums, the BB stream file
+// index, and various save files. crc32_fast returns exactly the same values as
+// phosg's crc32 (including the behavior of the cs argument, which continues a
+// previous checksum), but uses carryless multiplication (PCLMULQDQ) on x86-64
+// CPUs or the CRC32 instructions on ARMv8 CPUs when available. On other CPUs,
+// it uses a slicing-by-8 table implementation, which is still several times
+// faster than a byte-at-a-time loop.
+uint32_t crc32_fast(const void* data, size_t size, uint32_t cs = 0);
+
+// Returns the CRC32 of the concatenation of two byte strings A and B, given
+// only the CRC32 of A, the CRC32 of B, and the size of B. This takes time
+// proportional to the logarithm of size_b, so (for example) a whole-file
+// checksum can be computed from chunk checksums without reading the data
+// again.
+uint32_t crc32_combine(uint32_t crc_a, uint32_t crc_b, size_t size_b);
+
+// Returns a short description of the implementation crc32_fast uses on this
+// CPU (e.g. "pclmulqdq"), for logging.
+const char* crc32_fast_implementation_name();
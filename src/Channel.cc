@@ -84,6 +84,7 @@ void Channel::replace_with(
   this->terminal_recv_color = other.terminal_recv_color;
   this->on_command_received = on_command_received;
   this->on_error = on_error;
+  this->on_output_drained = nullptr;
   this->context_obj = context_obj;
   other.disconnect(); // Clears crypts, addrs, etc.
 }
@@ -101,7 +102,7 @@ void Channel::set_bufferevent(struct bufferevent* bev, uint64_t virtual_network_
       get_socket_addresses(fd, &this->local_addr, &this->remote_addr);
     }
 
-    bufferevent_setcb(this->bev.get(), &Channel::dispatch_on_input, nullptr, &Channel::dispatch_on_error, this);
+    bufferevent_setcb(this->bev.get(), &Channel::dispatch_on_input, &Channel::dispatch_on_output, &Channel::dispatch_on_error, this);
     bufferevent_enable(this->bev.get(), EV_READ | EV_WRITE);
 
   } else {
@@ -411,6 +412,13 @@ void Channel::dispatch_on_input(struct bufferevent*, void* ctx) {
   }
 }
 
+void Channel::dispatch_on_output(struct bufferevent*, void* ctx) {
+  Channel* ch = reinterpret_cast<Channel*>(ctx);
+  if (ch->on_output_drained) {
+    ch->on_output_drained(*ch);
+  }
+}
+
 void Channel::dispatch_on_error(struct bufferevent*, short events, void* ctx) {
   Channel* ch = reinterpret_cast<Channel*>(ctx);
   if (ch->on_error) {
@@ -32,9 +32,15 @@ struct Channel {
 
   typedef void (*on_command_received_t)(Channel&, uint16_t, uint32_t, std::string&);
   typedef void (*on_error_t)(Channel&, short);
+  typedef void (*on_output_drained_t)(Channel&);
 
   on_command_received_t on_command_received;
   on_error_t on_error;
+  // If set, called whenever all data in the output buffer has been sent (or
+  // the buffer drops below its low write watermark, if one was set). This can
+  // be used to send large amounts of data incrementally instead of buffering
+  // all of it at once.
+  on_output_drained_t on_output_drained = nullptr;
   void* context_obj;
 
   // Creates an unconnected channel
@@ -99,5 +105,6 @@ struct Channel {
 
 private:
   static void dispatch_on_input(struct bufferevent*, void* ctx);
+  static void dispatch_on_output(struct bufferevent*, void* ctx);
   static void dispatch_on_error(struct bufferevent*, short events, void* ctx);
 };
@@ -371,6 +371,7 @@ static void server_command_swset_swclear(shared_ptr<Client> c, const std::string
   } else {
     l->switch_flags->clear(floor, flag_num);
   }
+  l->state_change_count++;
 
   uint8_t cmd_flags = should_set ? 0x01 : 0x00;
   G_SwitchStateChanged_6x05 cmd = {{0x05, 0x03, 0xFFFF}, 0, 0, flag_num, floor, cmd_flags};
@@ -427,6 +428,7 @@ static void server_command_swsetall(shared_ptr<Client> c, const std::string&) {
   }
 
   l->switch_flags->data[c->floor].clear(0xFF);
+  l->state_change_count++;
 
   parray<G_SwitchStateChanged_6x05, 0x100> cmds;
   for (size_t z = 0; z < cmds.size(); z++) {
@@ -482,6 +484,7 @@ static void server_command_qset_qclear(shared_ptr<Client> c, const std::string&
     } else {
       l->quest_flag_values->clear(l->difficulty, flag_num);
     }
+    l->state_change_count++;
   }
 
   auto p = c->character(false);
@@ -1848,16 +1851,16 @@ static void server_command_what(shared_ptr<Client> c, const std::string&) {
   }
 
   float min_dist2 = 0.0f;
-  shared_ptr<const Lobby::FloorItem> nearest_fi;
-  for (const auto& it : l->floor_item_managers.at(c->floor).items) {
-    if (!it.second->visible_to_client(c->lobby_client_id)) {
+  const Lobby::FloorItem* nearest_fi = nullptr;
+  for (const auto& fi : l->floor_item_managers.at(c->floor).items) {
+    if (!fi.visible_to_client(c->lobby_client_id)) {
       continue;
     }
-    float dx = it.second->x - c->x;
-    float dz = it.second->z - c->z;
+    float dx = fi.x - c->x;
+    float dz = fi.z - c->z;
     float dist2 = (dx * dx) + (dz * dz);
     if (!nearest_fi || (dist2 < min_dist2)) {
-      nearest_fi = it.second;
+      nearest_fi = &fi;
       min_dist2 = dist2;
     }
   }
@@ -213,6 +213,7 @@ Client::Client(
       card_battle_table_seat_number(0),
       card_battle_table_seat_state(0),
       last_game_info_requested(0),
+      game_creation_in_progress(false),
       should_update_play_time(false),
       bb_character_index(-1),
       next_exp_value(0),
@@ -224,6 +225,8 @@ Client::Client(
 
   this->config.set_flags_for_version(version, -1);
   auto s = server->get_state();
+  this->file_writer = s->file_writer;
+  this->files_manager = s->player_files_manager;
   if (is_v1_or_v2(this->version()) ? s->default_rare_notifs_enabled_v1_v2 : s->default_rare_notifs_enabled_v3_v4) {
     this->config.set_drop_notification_mode(ItemDropNotificationMode::RARES_ONLY);
   }
@@ -712,10 +715,39 @@ void Client::create_character_file(
     uint8_t language,
     const PlayerDispDataBBPreview& preview,
     shared_ptr<const LevelTable> level_table) {
+  // The new character replaces any previously-cached file for this slot
+  auto files_manager = this->require_server_state()->player_files_manager;
+  string filename = this->character_filename();
+  if (!files_manager->evict_character(filename)) {
+    throw runtime_error("character file is in use");
+  }
   this->character_data = PSOBBCharacterFile::create_from_preview(guild_card_number, language, preview, level_table);
+  files_manager->set_character(filename, this->character_data);
   this->save_character_file();
 }
 
+template <typename T>
+static T parse_object_file(const string& filename, const string& data, bool allow_oversize = false) {
+  if ((data.size() < sizeof(T)) || (!allow_oversize && (data.size() != sizeof(T)))) {
+    throw runtime_error(string_printf("%s has incorrect size (expected 0x%zX bytes, received 0x%zX bytes)",
+        filename.c_str(), sizeof(T), data.size()));
+  }
+  return StringReader(data).get<T>();
+}
+
+static void check_character_file_header(StringReader& r) {
+  const auto& header = r.get<PSOCommandHeaderBB>();
+  if (header.size != 0x399C) {
+    throw runtime_error("incorrect size in character file header");
+  }
+  if (header.command != 0x00E7) {
+    throw runtime_error("incorrect command in character file header");
+  }
+  if (header.flag != 0x00000000) {
+    throw runtime_error("incorrect flag in character file header");
+  }
+}
+
 void Client::load_all_files() {
   if (this->version() != Version::BB_V4) {
     this->system_data = make_shared<PSOBBBaseSystemFile>();
@@ -737,8 +769,8 @@ void Client::load_all_files() {
   this->system_data = files_manager->get_system(sys_filename);
   if (this->system_data) {
     player_data_log.info("Using loaded system file %s", sys_filename.c_str());
-  } else if (isfile(sys_filename)) {
-    this->system_data = make_shared<PSOBBBaseSystemFile>(load_object_file<PSOBBBaseSystemFile>(sys_filename, true));
+  } else if (auto data = files_manager->read_file(sys_filename)) {
+    this->system_data = make_shared<PSOBBBaseSystemFile>(parse_object_file<PSOBBBaseSystemFile>(sys_filename, *data, true));
     files_manager->set_system(sys_filename, this->system_data);
     player_data_log.info("Loaded system data from %s", sys_filename.c_str());
   } else {
@@ -750,27 +782,18 @@ void Client::load_all_files() {
     this->character_data = files_manager->get_character(char_filename);
     if (this->character_data) {
       player_data_log.info("Using loaded character file %s", char_filename.c_str());
-    } else if (isfile(char_filename)) {
-      auto f = fopen_unique(char_filename, "rb");
-      auto header = freadx<PSOCommandHeaderBB>(f.get());
-      if (header.size != 0x399C) {
-        throw runtime_error("incorrect size in character file header");
-      }
-      if (header.command != 0x00E7) {
-        throw runtime_error("incorrect command in character file header");
-      }
-      if (header.flag != 0x00000000) {
-        throw runtime_error("incorrect flag in character file header");
-      }
+    } else if (auto data = files_manager->read_character_file(char_filename)) {
+      StringReader r(*data);
+      check_character_file_header(r);
       static_assert(sizeof(PSOBBCharacterFile) + sizeof(PSOBBFullSystemFile) == 0x3994, ".psochar size is incorrect");
-      this->character_data = make_shared<PSOBBCharacterFile>(freadx<PSOBBCharacterFile>(f.get()));
+      this->character_data = make_shared<PSOBBCharacterFile>(r.get<PSOBBCharacterFile>());
       files_manager->set_character(char_filename, this->character_data);
       player_data_log.info("Loaded character data from %s", char_filename.c_str());
 
       // If there was no .psosys file, load the system file from the .psochar
       // file instead
       if (!this->system_data) {
-        this->system_data = make_shared<PSOBBBaseSystemFile>(freadx<PSOBBBaseSystemFile>(f.get()));
+        this->system_data = make_shared<PSOBBBaseSystemFile>(r.get<PSOBBBaseSystemFile>());
         files_manager->set_system(sys_filename, this->system_data);
         player_data_log.info("Loaded system data from %s", char_filename.c_str());
       }
@@ -787,8 +810,8 @@ void Client::load_all_files() {
   this->guild_card_data = files_manager->get_guild_card(card_filename);
   if (this->guild_card_data) {
     player_data_log.info("Using loaded Guild Card file %s", card_filename.c_str());
-  } else if (isfile(card_filename)) {
-    this->guild_card_data = make_shared<PSOBBGuildCardFile>(load_object_file<PSOBBGuildCardFile>(card_filename));
+  } else if (auto data = files_manager->read_file(card_filename)) {
+    this->guild_card_data = make_shared<PSOBBGuildCardFile>(parse_object_file<PSOBBGuildCardFile>(card_filename, *data));
     files_manager->set_guild_card(card_filename, this->guild_card_data);
     player_data_log.info("Loaded Guild Card data from %s", card_filename.c_str());
   } else {
@@ -910,7 +933,7 @@ void Client::save_all() {
   }
   if (this->external_bank) {
     string filename = this->shared_bank_filename();
-    save_object_file<PlayerBank200>(filename, *this->external_bank);
+    this->file_writer->write_object(filename, *this->external_bank);
     player_data_log.info("Saved shared bank file %s", filename.c_str());
   }
   if (this->external_bank_character) {
@@ -926,19 +949,18 @@ void Client::save_system_file() const {
     throw logic_error("no system file loaded");
   }
   string filename = this->system_filename();
-  save_object_file(filename, *this->system_data);
+  this->file_writer->write_object(filename, *this->system_data);
   player_data_log.info("Saved system file %s", filename.c_str());
 }
 
-void Client::save_character_file(
-    const string& filename,
+string Client::character_file_data(
     shared_ptr<const PSOBBBaseSystemFile> system,
     shared_ptr<const PSOBBCharacterFile> character) {
-  auto f = fopen_unique(filename, "wb");
+  StringWriter w;
   PSOCommandHeaderBB header = {sizeof(PSOCommandHeaderBB) + sizeof(PSOBBCharacterFile) + sizeof(PSOBBBaseSystemFile) + sizeof(PSOBBTeamMembership), 0x00E7, 0x00000000};
-  fwritex(f.get(), header);
-  fwritex(f.get(), *character);
-  fwritex(f.get(), *system);
+  w.put(header);
+  w.put(*character);
+  w.put(*system);
   // TODO: Technically, we should write the actual team membership struct to the
   // file here, but that would cause Client to depend on Account, which
   // it currently does not. This data doesn't matter at all for correctness
@@ -950,7 +972,19 @@ void Client::save_character_file(
   // of teams with a different set of team IDs anyway, so the membership struct
   // here would be useless either way.
   static const PSOBBTeamMembership empty_membership;
-  fwritex(f.get(), empty_membership);
+  w.put(empty_membership);
+  return std::move(w.str());
+}
+
+void Client::save_character_file(
+    const string& filename,
+    shared_ptr<const PSOBBBaseSystemFile> system,
+    shared_ptr<const PSOBBCharacterFile> character) const {
+  if (this->files_manager) {
+    this->files_manager->save_character_file(filename, this->character_file_data(system, character));
+  } else {
+    this->file_writer->write(filename, this->character_file_data(system, character));
+  }
   player_data_log.info("Saved character file %s", filename.c_str());
 }
 
@@ -979,12 +1013,13 @@ void Client::save_guild_card_file() const {
     throw logic_error("no Guild Card file loaded");
   }
   string filename = this->guild_card_filename();
-  save_object_file(filename, *this->guild_card_data);
+  this->file_writer->write_object(filename, *this->guild_card_data);
   player_data_log.info("Saved Guild Card file %s", filename.c_str());
 }
 
 void Client::load_backup_character(uint32_t account_id, size_t index) {
   string filename = this->backup_character_filename(account_id, index);
+  this->file_writer->flush(filename);
   auto f = fopen_unique(filename, "rb");
   auto header = freadx<PSOCommandHeaderBB>(f.get());
   if (header.size != 0x399C) {
@@ -1025,7 +1060,7 @@ std::shared_ptr<PSOBBCharacterFile> Client::current_bank_character() {
 void Client::use_default_bank() {
   if (this->external_bank) {
     string filename = this->shared_bank_filename();
-    save_object_file<PlayerBank200>(filename, *this->external_bank);
+    this->file_writer->write_object(filename, *this->external_bank);
     this->external_bank.reset();
     player_data_log.info("Detached shared bank %s", filename.c_str());
   }
@@ -1046,8 +1081,8 @@ bool Client::use_shared_bank() {
   if (this->external_bank) {
     player_data_log.info("Using loaded shared bank %s", filename.c_str());
     return true;
-  } else if (isfile(filename)) {
-    this->external_bank = make_shared<PlayerBank200>(load_object_file<PlayerBank200>(filename));
+  } else if (auto data = files_manager->read_file(filename)) {
+    this->external_bank = make_shared<PlayerBank200>(parse_object_file<PlayerBank200>(filename, *data));
     files_manager->set_bank(filename, this->external_bank);
     player_data_log.info("Loaded shared bank %s", filename.c_str());
     return true;
@@ -1069,19 +1104,10 @@ void Client::use_character_bank(int8_t index) {
     if (this->external_bank_character) {
       this->external_bank_character_index = index;
       player_data_log.info("Using loaded character file %s for external bank", filename.c_str());
-    } else if (isfile(filename)) {
-      auto f = fopen_unique(filename, "rb");
-      auto header = freadx<PSOCommandHeaderBB>(f.get());
-      if (header.size != 0x399C) {
-        throw runtime_error("incorrect size in character file header");
-      }
-      if (header.command != 0x00E7) {
-        throw runtime_error("incorrect command in character file header");
-      }
-      if (header.flag != 0x00000000) {
-        throw runtime_error("incorrect flag in character file header");
-      }
-      this->external_bank_character = make_shared<PSOBBCharacterFile>(freadx<PSOBBCharacterFile>(f.get()));
+    } else if (auto data = files_manager->read_character_file(filename)) {
+      StringReader r(*data);
+      check_character_file_header(r);
+      this->external_bank_character = make_shared<PSOBBCharacterFile>(r.get<PSOBBCharacterFile>());
       this->update_character_data_after_load(this->external_bank_character);
       this->external_bank_character_index = index;
       files_manager->set_character(filename, this->external_bank_character);
@@ -8,6 +8,7 @@
 #include "Account.hh"
 #include "Channel.hh"
 #include "CommandFormats.hh"
+#include "DurableFileWriter.hh"
 #include "Episode3/BattleRecord.hh"
 #include "Episode3/Tournament.hh"
 #include "FileContentsCache.hh"
@@ -15,6 +16,7 @@
 #include "PSOEncryption.hh"
 #include "PSOProtocol.hh"
 #include "PatchFileIndex.hh"
+#include "PlayerFilesManager.hh"
 #include "Quest.hh"
 #include "QuestScript.hh"
 #include "TeamIndex.hh"
@@ -228,6 +230,9 @@ public:
     std::string data;
   };
   std::unique_ptr<std::deque<JoinCommand>> game_join_command_queue;
+  // True while the maps for a game this client created are being generated
+  // (see join_created_game in ReceiveCommands.cc)
+  bool game_creation_in_progress;
 
   // Character / game data
   struct PendingItemTrade {
@@ -370,12 +375,18 @@ public:
   std::string legacy_player_filename() const;
   std::string legacy_account_filename() const;
 
+  // These functions only take snapshots of the files; the files are written
+  // to disk later by the server's DurableFileWriter
   void save_all();
   void save_system_file() const;
-  static void save_character_file(
-      const std::string& filename,
+  // Returns the contents of a .psochar file
+  static std::string character_file_data(
       std::shared_ptr<const PSOBBBaseSystemFile> sys,
       std::shared_ptr<const PSOBBCharacterFile> character);
+  void save_character_file(
+      const std::string& filename,
+      std::shared_ptr<const PSOBBBaseSystemFile> sys,
+      std::shared_ptr<const PSOBBCharacterFile> character) const;
   // Note: This function is not const because it updates the player's play time.
   void save_character_file();
   void save_guild_card_file() const;
@@ -404,6 +415,11 @@ private:
   std::shared_ptr<PSOBBCharacterFile> external_bank_character;
   int8_t external_bank_character_index;
   uint64_t last_play_time_update;
+  // These are held here (rather than looked up from the ServerState when
+  // needed) because the destructor saves the player's files, and the
+  // ServerState may already be gone by then
+  std::shared_ptr<DurableFileWriter> file_writer;
+  std::shared_ptr<PlayerFilesManager> files_manager; // Used for saving character files
 
   void save_and_clear_external_bank();
 
@@ -53,6 +53,13 @@ void DNSServer::add_socket(int fd) {
   this->fd_to_receive_event.emplace(fd, std::move(e));
 }
 
+void DNSServer::stop_listening() {
+  for (const auto& it : this->fd_to_receive_event) {
+    event_del(it.second.get());
+  }
+  dns_server_log.info("Stopped receiving queries");
+}
+
 void DNSServer::dispatch_on_receive_message(evutil_socket_t fd,
     short events, void* ctx) {
   reinterpret_cast<DNSServer*>(ctx)->on_receive_message(fd, events);
@@ -28,6 +28,9 @@ public:
   void listen(const std::string& addr, int port);
   void listen(int port);
   void add_socket(int fd);
+  // Stops accepting new connections, but doesn't close the listening sockets
+  // (they may have been handed off to another process)
+  void stop_listening();
 
   static std::string response_for_query(const void* vdata, size_t size, uint32_t resolved_address);
   static std::string response_for_query(const std::string& query, uint32_t resolved_address);
@@ -0,0 +1,357 @@
+#include "DurableFileWriter.hh"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <phosg/Filesystem.hh>
+#include <phosg/Strings.hh>
+#include <phosg/Time.hh>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "Loggers.hh"
+
+using namespace std;
+
+JSON DurableFileWriter::Stats::json() const {
+  return JSON::dict({
+      {"NumCommits", this->num_commits},
+      {"NumFilesWritten", this->num_files_written},
+      {"NumWritesCoalesced", this->num_writes_coalesced},
+      {"NumWriteErrors", this->num_write_errors},
+      {"MaxFilesPerCommit", this->max_files_per_commit},
+      {"TotalWriteUsecs", this->total_write_usecs},
+      {"MaxWriteUsecs", this->max_write_usecs},
+      {"TotalSyncUsecs", this->total_sync_usecs},
+      {"MaxSyncUsecs", this->max_sync_usecs},
+  });
+}
+
+// Each write uses a different temporary file, so concurrent writes of the
+// same file (e.g. by write_sync on another thread while the writer thread is
+// committing it) can't write into each other's temporary files
+static string temp_filename_for_filename(const string& filename) {
+  static atomic<uint64_t> next_temp_file_num(0);
+  return string_printf("%s.%d.%" PRIu64 ".tmp", filename.c_str(), getpid(), next_temp_file_num++);
+}
+
+static string directory_for_filename(const string& filename) {
+  size_t slash_pos = filename.rfind('/');
+  return (slash_pos == string::npos) ? "." : filename.substr(0, slash_pos);
+}
+
+// Flushes, syncs, and closes the file. If any of these steps fails (e.g. with
+// ENOSPC or EIO), the file may be incomplete, so this throws, and the caller
+// must not rename it over the original file.
+static void sync_and_close_file(unique_ptr<FILE, void (*)(FILE*)>&& f, const string& filename) {
+  FILE* raw_f = f.release();
+  if (fflush(raw_f)) {
+    string error = string_for_error(errno);
+    fclose(raw_f);
+    throw runtime_error(string_printf("cannot write %s: %s", filename.c_str(), error.c_str()));
+  }
+  if (fsync(fileno(raw_f))) {
+    string error = string_for_error(errno);
+    fclose(raw_f);
+    throw runtime_error(string_printf("cannot sync %s: %s", filename.c_str(), error.c_str()));
+  }
+  if (fclose(raw_f)) {
+    string error = string_for_error(errno);
+    throw runtime_error(string_printf("cannot close %s: %s", filename.c_str(), error.c_str()));
+  }
+}
+
+static void fsync_directory(const string& dirname) {
+  // Some systems don't allow syncing directories; there's nothing we can do
+  // about that, so errors are ignored here
+  int fd = open(dirname.c_str(), O_RDONLY);
+  if (fd >= 0) {
+    fsync(fd);
+    close(fd);
+  }
+}
+
+static void rename_file(const string& from_filename, const string& to_filename) {
+  if (rename(from_filename.c_str(), to_filename.c_str())) {
+    string error = string_for_error(errno);
+    throw runtime_error(string_printf("cannot rename %s to %s: %s", from_filename.c_str(), to_filename.c_str(), error.c_str()));
+  }
+}
+
+void DurableFileWriter::write(const string& filename, string&& data) {
+  {
+    lock_guard g(this->lock);
+    if (this->writes_disabled) {
+      player_data_log.warning("Not writing %s because writes are disabled", filename.c_str());
+      return;
+    }
+    // This snapshot replaces any earlier one that couldn't be written
+    this->failed_writes.erase(filename);
+    if (!this->should_stop) {
+      auto it = this->pending_data.find(filename);
+      if (it != this->pending_data.end()) {
+        // The file is already queued; only the newest snapshot matters
+        it->second = std::move(data);
+        this->current_stats.num_writes_coalesced++;
+        return;
+      }
+      this->pending_data.emplace(filename, std::move(data));
+      this->queue.emplace_back(filename);
+      this->num_enqueued++;
+      if (!this->thread_started) {
+        thread t([self = this->shared_from_this()]() -> void { self->thread_fn(); });
+        t.detach();
+        this->thread_started = true;
+      }
+      this->queue_cv.notify_one();
+      return;
+    }
+  }
+
+  try {
+    this->write_sync(filename, data);
+  } catch (const exception& e) {
+    player_data_log.error("Failed to write %s: %s", filename.c_str(), e.what());
+  }
+}
+
+void DurableFileWriter::write_sync(const string& filename, const string& data) {
+  {
+    lock_guard g(this->lock);
+    if (this->writes_disabled) {
+      player_data_log.warning("Not writing %s because writes are disabled", filename.c_str());
+      return;
+    }
+    this->failed_writes.erase(filename);
+  }
+  this->flush(filename);
+  this->write_file(filename, data);
+}
+
+void DurableFileWriter::remove(const string& filename) {
+  {
+    unique_lock g(this->lock);
+    if (this->writes_disabled) {
+      player_data_log.warning("Not deleting %s because writes are disabled", filename.c_str());
+      return;
+    }
+    this->pending_data.erase(filename);
+    this->failed_writes.erase(filename);
+    this->written_cv.wait(g, [&]() -> bool { return !this->committing_filenames.count(filename); });
+  }
+  ::remove(filename.c_str());
+}
+
+void DurableFileWriter::flush(const string& filename) {
+  unique_lock g(this->lock);
+  this->written_cv.wait(g, [&]() -> bool {
+    return !this->committing_filenames.count(filename) && !this->pending_data.count(filename);
+  });
+  auto it = this->failed_writes.find(filename);
+  if (it != this->failed_writes.end()) {
+    this->retry_failed_write_locked(it);
+  }
+}
+
+void DurableFileWriter::flush() {
+  // Only wait for the writes that were queued before this call; waiting for
+  // the queue to be empty could take forever if files are saved continuously
+  unique_lock g(this->lock);
+  uint64_t target = this->num_enqueued;
+  this->written_cv.wait(g, [&]() -> bool { return this->num_completed >= target; });
+
+  size_t num_failed = 0;
+  string first_error;
+  for (auto it = this->failed_writes.begin(); it != this->failed_writes.end();) {
+    // If a newer write of the file is in progress, the failed one doesn't
+    // matter anymore; it's removed when the newer one is done
+    if (this->committing_filenames.count(it->first)) {
+      it++;
+      continue;
+    }
+    try {
+      it = this->retry_failed_write_locked(it);
+    } catch (const exception& e) {
+      if (num_failed++ == 0) {
+        first_error = e.what();
+      }
+      it++;
+    }
+  }
+  if (num_failed) {
+    throw runtime_error(string_printf("%zu file(s) could not be written (%s)", num_failed, first_error.c_str()));
+  }
+}
+
+void DurableFileWriter::stop() {
+  {
+    lock_guard g(this->lock);
+    this->should_stop = true;
+    this->queue_cv.notify_one();
+  }
+  try {
+    this->flush();
+  } catch (const exception& e) {
+    player_data_log.error("Failed to write pending files during shutdown: %s", e.what());
+  }
+}
+
+void DurableFileWriter::disable_writes() {
+  // Writes that were already queued are still done
+  try {
+    this->flush();
+  } catch (const exception& e) {
+    player_data_log.error("Failed to write pending files before disabling writes: %s", e.what());
+  }
+  lock_guard g(this->lock);
+  this->writes_disabled = true;
+}
+
+unordered_map<string, DurableFileWriter::FailedWrite>::iterator DurableFileWriter::retry_failed_write_locked(
+    unordered_map<string, FailedWrite>::iterator it) {
+  // This is done while holding the lock, so a newer write of the same file
+  // can't be committed before this one (which would then overwrite it). This
+  // only happens after a write has already failed, so it's rare.
+  try {
+    this->write_file(it->first, it->second.data);
+  } catch (const exception& e) {
+    it->second.error = e.what();
+    this->current_stats.num_write_errors++;
+    throw runtime_error(string_printf("cannot write %s: %s", it->first.c_str(), e.what()));
+  }
+  player_data_log.info("Wrote %s after an earlier failure", it->first.c_str());
+  this->current_stats.num_files_written++;
+  return this->failed_writes.erase(it);
+}
+
+size_t DurableFileWriter::num_pending_writes() const {
+  lock_guard g(this->lock);
+  return this->pending_data.size() + this->committing_filenames.size();
+}
+
+DurableFileWriter::Stats DurableFileWriter::stats() const {
+  lock_guard g(this->lock);
+  return this->current_stats;
+}
+
+void DurableFileWriter::write_file(const string& filename, const string& data) {
+  string temp_filename = temp_filename_for_filename(filename);
+  try {
+    auto f = fopen_unique(temp_filename, "wb");
+    fwritex(f.get(), data);
+    sync_and_close_file(std::move(f), temp_filename);
+    rename_file(temp_filename, filename);
+  } catch (const exception&) {
+    ::remove(temp_filename.c_str());
+    throw;
+  }
+  fsync_directory(directory_for_filename(filename));
+}
+
+void DurableFileWriter::commit(deque<PendingWrite>& writes) {
+  uint64_t start_time = now();
+
+  // Write all the temporary files, but don't sync them yet. If any write
+  // fails, that file is skipped (and kept in failed_writes, so it can be
+  // retried and reported to the caller by flush()), but the others are still
+  // committed.
+  struct OpenTempFile {
+    PendingWrite* write;
+    string temp_filename;
+    unique_ptr<FILE, void (*)(FILE*)> f;
+  };
+  vector<OpenTempFile> files;
+  vector<pair<PendingWrite*, string>> failed;
+  for (auto& write : writes) {
+    string temp_filename = temp_filename_for_filename(write.filename);
+    try {
+      auto f = fopen_unique(temp_filename, "wb");
+      fwritex(f.get(), write.data);
+      files.emplace_back(OpenTempFile{.write = &write, .temp_filename = std::move(temp_filename), .f = std::move(f)});
+    } catch (const exception& e) {
+      player_data_log.error("Failed to write %s: %s", temp_filename.c_str(), e.what());
+      ::remove(temp_filename.c_str());
+      failed.emplace_back(&write, e.what());
+    }
+  }
+  uint64_t write_end_time = now();
+
+  unordered_set<string> dirnames;
+  for (auto& file : files) {
+    try {
+      sync_and_close_file(std::move(file.f), file.temp_filename);
+      rename_file(file.temp_filename, file.write->filename);
+      dirnames.emplace(directory_for_filename(file.write->filename));
+    } catch (const exception& e) {
+      player_data_log.error("Failed to commit %s: %s", file.write->filename.c_str(), e.what());
+      ::remove(file.temp_filename.c_str());
+      failed.emplace_back(file.write, e.what());
+    }
+  }
+  for (const auto& dirname : dirnames) {
+    fsync_directory(dirname);
+  }
+  uint64_t end_time = now();
+
+  uint64_t write_usecs = write_end_time - start_time;
+  uint64_t sync_usecs = end_time - write_end_time;
+  lock_guard g(this->lock);
+  for (auto& [write, error] : failed) {
+    // If the file was saved again during the commit, the newer snapshot
+    // replaces the failed one
+    if (!this->pending_data.count(write->filename)) {
+      this->failed_writes[write->filename] = FailedWrite{.data = std::move(write->data), .error = std::move(error)};
+    }
+  }
+  auto& stats = this->current_stats;
+  stats.num_commits++;
+  stats.num_files_written += writes.size() - failed.size();
+  stats.num_write_errors += failed.size();
+  stats.max_files_per_commit = max<size_t>(stats.max_files_per_commit, writes.size());
+  stats.total_write_usecs += write_usecs;
+  stats.max_write_usecs = max<uint64_t>(stats.max_write_usecs, write_usecs);
+  stats.total_sync_usecs += sync_usecs;
+  stats.max_sync_usecs = max<uint64_t>(stats.max_sync_usecs, sync_usecs);
+}
+
+void DurableFileWriter::thread_fn() {
+  for (;;) {
+    deque<PendingWrite> writes;
+    size_t num_dequeued = 0;
+    {
+      unique_lock g(this->lock);
+      this->queue_cv.wait(g, [&]() -> bool { return this->should_stop || !this->queue.empty(); });
+      if (this->queue.empty()) { // should_stop must be true
+        this->thread_started = false;
+        return;
+      }
+      while (!this->queue.empty() && (writes.size() < MAX_FILES_PER_COMMIT)) {
+        string filename = std::move(this->queue.front());
+        this->queue.pop_front();
+        num_dequeued++;
+        auto it = this->pending_data.find(filename);
+        if (it == this->pending_data.end()) {
+          continue; // Removed before it could be written
+        }
+        this->committing_filenames.emplace(filename);
+        writes.emplace_back(PendingWrite{.filename = std::move(filename), .data = std::move(it->second)});
+        this->pending_data.erase(it);
+      }
+    }
+
+    if (!writes.empty()) {
+      this->commit(writes);
+    }
+
+    lock_guard g(this->lock);
+    this->committing_filenames.clear();
+    this->num_completed += num_dequeued;
+    this->written_cv.notify_all();
+  }
+}
@@ -0,0 +1,140 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <phosg/JSON.hh>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+
+// Writes player data files (system, character, Guild Card, and bank files),
+// account files, team files, and tournament state on a background thread, so
+// that slow disks don't cause lag on the event thread. Callers pass an
+// immutable snapshot of the file's contents; if the same file is saved again
+// before its previous snapshot has been written, the older snapshot is
+// discarded and only the newest one is written.
+//
+// Every file is written to a uniquely-named temporary file, synced to disk, and
+// then renamed over the original, so a crash never leaves a truncated file
+// behind. Writes
+// are done in groups (commits): the thread writes all of the queued files (up
+// to MAX_FILES_PER_COMMIT) before syncing any of them, so the filesystem can
+// flush their data together, then syncs and renames each file, and finally
+// syncs each directory involved once per commit (rather than once per file).
+// Files enqueued while a commit is running are written in the next commit,
+// so the cost of syncing is shared by all the saves that happen during it,
+// and no file waits for more than about two commits.
+//
+// If a file can't be written, its data is kept in memory until the file is
+// saved again (which replaces it), removed, or written successfully by a retry
+// in flush(). flush() retries failed writes and throws if they fail again, so
+// callers that are about to read a file (or that need all data to be on disk)
+// find out that it's out of date.
+//
+// Like WorkerPool, the thread holds a reference to the writer and is only
+// started when needed. After stop() is called, all pending writes are
+// completed before it returns, and any later writes happen synchronously on
+// the calling thread (this is the case for saves done by Client destructors
+// during shutdown).
+class DurableFileWriter : public std::enable_shared_from_this<DurableFileWriter> {
+public:
+  struct Stats {
+    uint64_t num_commits = 0;
+    uint64_t num_files_written = 0;
+    uint64_t num_writes_coalesced = 0;
+    uint64_t num_write_errors = 0;
+    size_t max_files_per_commit = 0;
+    // Time spent writing data to temporary files
+    uint64_t total_write_usecs = 0;
+    uint64_t max_write_usecs = 0;
+    // Time spent syncing and renaming files and syncing directories
+    uint64_t total_sync_usecs = 0;
+    uint64_t max_sync_usecs = 0;
+
+    JSON json() const;
+  };
+
+  static constexpr size_t MAX_FILES_PER_COMMIT = 0x40;
+
+  DurableFileWriter() = default;
+  DurableFileWriter(const DurableFileWriter&) = delete;
+  DurableFileWriter(DurableFileWriter&&) = delete;
+  DurableFileWriter& operator=(const DurableFileWriter&) = delete;
+  DurableFileWriter& operator=(DurableFileWriter&&) = delete;
+  ~DurableFileWriter() = default;
+
+  // Errors are logged, and reported by the next flush() call that covers the
+  // file (see above)
+  void write(const std::string& filename, std::string&& data);
+  template <typename T>
+  void write_object(const std::string& filename, const T& obj) {
+    this->write(filename, std::string(reinterpret_cast<const char*>(&obj), sizeof(T)));
+  }
+  // Waits for any pending write of the same file, then writes the file on the
+  // calling thread. Unlike write(), this throws if the file can't be written.
+  void write_sync(const std::string& filename, const std::string& data);
+  // Cancels any pending write of the file, then deletes it
+  void remove(const std::string& filename);
+
+  // Waits until the given file has been written. This must be called before
+  // reading a file from disk that may have been saved recently. If the last
+  // write of the file failed, retries it, and throws if it fails again.
+  void flush(const std::string& filename);
+  // Waits until all writes queued before the call have been written. Writes
+  // queued during the call are not waited for. Then retries all failed
+  // writes, and throws if any of them fail again.
+  void flush();
+  // Like flush(), but errors are only logged
+  void stop();
+  // Makes all later writes and removals do nothing (they're only logged).
+  // Failed writes are retried first, but errors are only logged.
+  // This is used after this process has handed off its files to another
+  // process (see SocketHandoff.hh).
+  void disable_writes();
+
+  size_t num_pending_writes() const;
+  Stats stats() const;
+
+  // Atomically replaces the file's contents and syncs it to disk. This is
+  // used when there is no DurableFileWriter (e.g. when running actions that
+  // don't start the server).
+  static void write_file(const std::string& filename, const std::string& data);
+
+private:
+  struct PendingWrite {
+    std::string filename;
+    std::string data;
+  };
+
+  mutable std::mutex lock;
+  std::condition_variable queue_cv;
+  std::condition_variable written_cv;
+  // The queue may contain filenames that aren't in pending_data (if they were
+  // removed before being written); these are skipped
+  std::deque<std::string> queue;
+  std::unordered_map<std::string, std::string> pending_data;
+  std::unordered_set<std::string> committing_filenames;
+  struct FailedWrite {
+    std::string data;
+    std::string error;
+  };
+  std::unordered_map<std::string, FailedWrite> failed_writes;
+  // Number of queue entries ever added, and number whose commits are done
+  // (including entries that were skipped); used by flush()
+  uint64_t num_enqueued = 0;
+  uint64_t num_completed = 0;
+  Stats current_stats;
+  bool should_stop = false;
+  bool writes_disabled = false;
+  bool thread_started = false;
+
+  void commit(std::deque<PendingWrite>& writes);
+  std::unordered_map<std::string, FailedWrite>::iterator retry_failed_write_locked(
+      std::unordered_map<std::string, FailedWrite>::iterator it);
+  void thread_fn();
+};
@@ -1,8 +1,12 @@
 #include "Tournament.hh"
 
+#include <errno.h>
+
+#include <phosg/Filesystem.hh>
 #include <phosg/Random.hh>
 
 #include "../CommandFormats.hh"
+#include "../Loggers.hh"
 #include "../SendCommands.hh"
 
 using namespace std;
@@ -180,6 +184,28 @@ size_t Tournament::Team::num_com_players() const {
   return ret;
 }
 
+JSON Tournament::Team::json() const {
+  auto players_list = JSON::list();
+  for (const auto& player : this->players) {
+    if (player.is_human()) {
+      if (!player.player_name.empty()) {
+        players_list.emplace_back(JSON::list({player.account_id, player.player_name}));
+      } else {
+        players_list.emplace_back(player.account_id);
+      }
+    } else {
+      players_list.emplace_back(player.com_deck->deck_name);
+    }
+  }
+  return JSON::dict({
+      {"max_players", this->max_players},
+      {"player_specs", std::move(players_list)},
+      {"name", this->name},
+      {"password", this->password},
+      {"num_rounds_cleared", this->num_rounds_cleared},
+  });
+}
+
 Tournament::Match::Match(
     shared_ptr<Tournament> tournament,
     shared_ptr<Match> preceding_a,
@@ -504,37 +530,22 @@ void Tournament::create_bracket_matches() {
   this->final_match = current_round_matches.at(0);
 }
 
-JSON Tournament::json() const {
-  auto teams_list = JSON::list();
-  for (auto team : this->teams) {
-    auto players_list = JSON::list();
-    for (const auto& player : team->players) {
-      if (player.is_human()) {
-        if (!player.player_name.empty()) {
-          players_list.emplace_back(JSON::list({player.account_id, player.player_name}));
-        } else {
-          players_list.emplace_back(player.account_id);
-        }
-      } else {
-        players_list.emplace_back(player.com_deck->deck_name);
-      }
-    }
-    teams_list.emplace_back(JSON::dict({
-        {"max_players", team->max_players},
-        {"player_specs", std::move(players_list)},
-        {"name", team->name},
-        {"password", team->password},
-        {"num_rounds_cleared", team->num_rounds_cleared},
-    }));
-  }
-  return JSON::dict({
+JSON Tournament::json(bool include_teams) const {
+  auto ret = JSON::dict({
       {"name", this->name},
       {"map_number", this->map->map_number},
       {"rules", this->rules.json()},
       {"flags", this->flags},
       {"is_registration_complete", (this->current_state != State::REGISTRATION)},
-      {"teams", std::move(teams_list)},
   });
+  if (include_teams) {
+    auto teams_list = JSON::list();
+    for (auto team : this->teams) {
+      teams_list.emplace_back(team->json());
+    }
+    ret.emplace("teams", std::move(teams_list));
+  }
+  return ret;
 }
 
 shared_ptr<Tournament::Team> Tournament::get_winner_team() const {
@@ -779,14 +790,27 @@ void Tournament::print_bracket(FILE* stream) const {
   }
 }
 
+TournamentIndex::SavedState::SavedState(const Tournament& tourn)
+    : header_data(tourn.json(false).serialize()) {
+  for (const auto& team : tourn.all_teams()) {
+    this->team_data.emplace_back(team->json().serialize());
+  }
+}
+
 TournamentIndex::TournamentIndex(
     shared_ptr<const MapIndex> map_index,
     shared_ptr<const COMDeckIndex> com_deck_index,
     const string& state_filename,
-    bool skip_load_state)
+    bool skip_load_state,
+    shared_ptr<DurableFileWriter> file_writer)
     : map_index(map_index),
       com_deck_index(com_deck_index),
-      state_filename(state_filename) {
+      state_filename(state_filename),
+      journal_filename(state_filename.empty() ? "" : (state_filename + ".journal")),
+      file_writer(file_writer),
+      journal(nullptr, nullptr),
+      journal_size(0),
+      generation(0) {
   if (this->state_filename.empty() || skip_load_state) {
     return;
   }
@@ -798,19 +822,31 @@ TournamentIndex::TournamentIndex(
     json = JSON::list();
   }
 
+  // Snapshots written by older versions are a list or dict of tournaments,
+  // and have no generation number (so their generation is 0)
+  if (json.is_dict()) {
+    const auto& dict = json.as_dict();
+    auto gen_it = dict.find("Generation");
+    if ((gen_it != dict.end()) && gen_it->second->is_int()) {
+      this->generation = gen_it->second->as_int();
+      JSON tournaments_json = std::move(json.at("Tournaments"));
+      json = std::move(tournaments_json);
+    }
+  }
+
+  // Collect the tournaments' JSON from the snapshot, then apply the changes
+  // from the journal before creating any Tournament objects
+  map<string, JSON> tournament_jsons;
   if (json.is_list()) {
     if (json.size() > 0x20) {
       throw runtime_error("tournament JSON list length is incorrect");
     }
     for (size_t z = 0; z < min<size_t>(json.size(), 0x20); z++) {
       if (!json.at(z).is_null()) {
-        auto tourn = make_shared<Tournament>(this->map_index, this->com_deck_index, json.at(z));
-        tourn->init();
-        if (!this->name_to_tournament.emplace(tourn->get_name(), tourn).second) {
-          throw runtime_error("multiple tournaments have the same name: " + tourn->get_name());
+        string name = json.at(z).get_string("name");
+        if (!tournament_jsons.emplace(name, std::move(json.at(z))).second) {
+          throw runtime_error("multiple tournaments have the same name: " + name);
         }
-        tourn->set_menu_item_id(this->menu_item_id_to_tournament.size());
-        this->menu_item_id_to_tournament.emplace_back(tourn);
       }
     }
   } else if (json.is_dict()) {
@@ -818,31 +854,198 @@ TournamentIndex::TournamentIndex(
       throw runtime_error("tournament JSON dict length is incorrect");
     }
     for (const auto& it : json.as_dict()) {
-      auto tourn = make_shared<Tournament>(this->map_index, this->com_deck_index, *it.second);
-      tourn->init();
-      if (!this->name_to_tournament.emplace(tourn->get_name(), tourn).second) {
-        // This is logic_error instead of runtime_error because JSON dicts are
-        // supposed to already have unique keys
-        throw logic_error("multiple tournaments have the same name: " + tourn->get_name());
+      string name = it.second->get_string("name");
+      if (!tournament_jsons.emplace(name, std::move(*it.second)).second) {
+        throw runtime_error("multiple tournaments have the same name: " + name);
       }
-      tourn->set_menu_item_id(this->menu_item_id_to_tournament.size());
-      this->menu_item_id_to_tournament.emplace_back(tourn);
     }
   } else {
     throw runtime_error("tournament state root JSON is not a list or dict");
   }
+
+  string journal_data;
+  try {
+    journal_data = load_file(this->journal_filename);
+  } catch (const cannot_open_file&) {
+  }
+  size_t offset = 0;
+  size_t num_records = 0;
+  size_t num_stale_records = 0;
+  bool journal_damaged = false;
+  while (offset < journal_data.size()) {
+    // Each record is written along with its terminating newline, so only the
+    // last record can be incomplete (from a crash during an append). A
+    // complete record that can't be applied means the journal is corrupt, and
+    // ignoring it (and everything after it) would lose data, so the files are
+    // left alone and loading fails instead.
+    size_t end_offset = journal_data.find('\n', offset);
+    if (end_offset == string::npos) {
+      journal_damaged = true;
+      break;
+    }
+    try {
+      // Records from an earlier generation were written before the snapshot,
+      // so they're already included in it (and may be older than changes that
+      // are also included in it). These are left behind if the server
+      // crashes after writing a snapshot, but before clearing the journal.
+      auto record = JSON::parse(journal_data.substr(offset, end_offset - offset));
+      uint64_t record_generation = record.get_int("Generation", 0);
+      if (record_generation < this->generation) {
+        num_stale_records++;
+      } else if (record_generation > this->generation) {
+        throw runtime_error(string_printf("record generation %" PRIu64 " is newer than snapshot generation %" PRIu64,
+            record_generation, this->generation));
+      } else {
+        this->apply_journal_record(tournament_jsons, record);
+        num_records++;
+      }
+    } catch (const exception& e) {
+      throw runtime_error(string_printf(
+          "tournament journal %s is damaged at offset %zX (%s); the file has not been modified, and must be repaired or restored manually",
+          this->journal_filename.c_str(), offset, e.what()));
+    }
+    offset = end_offset + 1;
+  }
+  if (num_records) {
+    config_log.info("Applied %zu record(s) from tournament journal", num_records);
+  }
+
+  if (tournament_jsons.size() > 0x20) {
+    throw runtime_error("too many tournaments in tournament state");
+  }
+  for (const auto& it : tournament_jsons) {
+    auto tourn = make_shared<Tournament>(this->map_index, this->com_deck_index, it.second);
+    tourn->init();
+    if (!this->name_to_tournament.emplace(tourn->get_name(), tourn).second) {
+      throw runtime_error("multiple tournaments have the same name: " + tourn->get_name());
+    }
+    tourn->set_menu_item_id(this->menu_item_id_to_tournament.size());
+    this->menu_item_id_to_tournament.emplace_back(tourn);
+    this->saved_states.emplace(tourn->get_name(), SavedState(*tourn));
+  }
+
+  // If the journal ends with an incomplete record, write a new snapshot so
+  // the incomplete record isn't followed by new records. If it contains
+  // records from an earlier generation, write a new snapshot to get rid of
+  // them.
+  if (journal_damaged) {
+    config_log.warning("Tournament journal %s ends with an incomplete record at offset %zX; writing a new snapshot",
+        this->journal_filename.c_str(), offset);
+    this->write_snapshot();
+  } else if (num_stale_records) {
+    config_log.warning("Skipped %zu record(s) from before the last snapshot in tournament journal %s; writing a new snapshot",
+        num_stale_records, this->journal_filename.c_str());
+    this->write_snapshot();
+  } else {
+    this->journal = fopen_unique(this->journal_filename, "ab");
+    this->journal_size = journal_data.size();
+  }
+}
+
+void TournamentIndex::apply_journal_record(map<string, JSON>& tournament_jsons, const JSON& record) {
+  string op = record.get_string("Op");
+  string name = record.get_string("Name");
+  if (op == "set") {
+    tournament_jsons[name] = record.at("State");
+  } else if (op == "team") {
+    auto it = tournament_jsons.find(name);
+    if (it == tournament_jsons.end()) {
+      throw runtime_error("team record refers to missing tournament " + name);
+    }
+    auto& teams_json = it->second.at("teams");
+    size_t index = record.get_int("Index");
+    if (index >= teams_json.size()) {
+      throw runtime_error(string_printf("team record refers to missing team %zu in tournament %s", index, name.c_str()));
+    }
+    teams_json.at(index) = record.at("State");
+  } else if (op == "delete") {
+    tournament_jsons.erase(name);
+  } else {
+    throw runtime_error("unknown journal record type: " + op);
+  }
+}
+
+JSON TournamentIndex::json() const {
+  auto ret = JSON::dict();
+  for (const auto& it : this->name_to_tournament) {
+    ret.emplace(it.second->get_name(), it.second->json());
+  }
+  return ret;
 }
 
-void TournamentIndex::save() const {
+void TournamentIndex::write_snapshot() {
+  uint64_t new_generation = this->generation + 1;
+  auto json = JSON::dict({{"Generation", new_generation}, {"Tournaments", this->json()}});
+  string data = json.serialize(JSON::SerializeOption::FORMAT | JSON::SerializeOption::HEX_INTEGERS | JSON::SerializeOption::ESCAPE_CONTROLS_ONLY);
+  if (this->file_writer) {
+    this->file_writer->write_sync(this->state_filename, data);
+  } else {
+    DurableFileWriter::write_file(this->state_filename, data);
+  }
+  // The snapshot is already on disk, so all records in the journal can be
+  // discarded. If the server crashes before the journal is cleared, the
+  // records are skipped when loading, since their generation is older than
+  // the snapshot's.
+  this->generation = new_generation;
+  this->journal = fopen_unique(this->journal_filename, "wb");
+  this->journal_size = 0;
+}
+
+void TournamentIndex::save() {
   if (this->state_filename.empty()) {
     return;
   }
 
-  auto json = JSON::dict();
-  for (const auto& it : this->name_to_tournament) {
-    json.emplace(it.second->get_name(), it.second->json());
+  string journal_data;
+  unordered_map<string, SavedState> new_saved_states;
+  for (const auto& [name, tourn] : this->name_to_tournament) {
+    SavedState new_state(*tourn);
+    auto saved_it = this->saved_states.find(name);
+    if ((saved_it == this->saved_states.end()) ||
+        (saved_it->second.header_data != new_state.header_data) ||
+        (saved_it->second.team_data.size() != new_state.team_data.size())) {
+      journal_data += JSON::dict({{"Generation", this->generation}, {"Op", "set"}, {"Name", name}, {"State", tourn->json()}}).serialize();
+      journal_data.push_back('\n');
+    } else {
+      for (size_t z = 0; z < new_state.team_data.size(); z++) {
+        if (saved_it->second.team_data[z] != new_state.team_data[z]) {
+          journal_data += JSON::dict({{"Generation", this->generation}, {"Op", "team"}, {"Name", name}, {"Index", z}, {"State", tourn->get_team(z)->json()}}).serialize();
+          journal_data.push_back('\n');
+        }
+      }
+    }
+    new_saved_states.emplace(name, std::move(new_state));
+  }
+  for (const auto& it : this->saved_states) {
+    if (!this->name_to_tournament.count(it.first)) {
+      journal_data += JSON::dict({{"Generation", this->generation}, {"Op", "delete"}, {"Name", it.first}}).serialize();
+      journal_data.push_back('\n');
+    }
+  }
+  this->saved_states = std::move(new_saved_states);
+
+  if (journal_data.empty() && this->journal) {
+    return;
+  }
+
+  try {
+    if (!this->journal || (this->journal_size + journal_data.size() > MAX_JOURNAL_SIZE)) {
+      this->write_snapshot();
+    } else {
+      // Appends are flushed but not synced, since this happens on the event
+      // thread (snapshots are synced)
+      fwritex(this->journal.get(), journal_data);
+      if (fflush(this->journal.get())) {
+        throw runtime_error("cannot write tournament journal: " + string_for_error(errno));
+      }
+      this->journal_size += journal_data.size();
+    }
+  } catch (const exception& e) {
+    // The journal may end with a partial record now, so write a new snapshot
+    // on the next save instead of appending to it
+    player_data_log.error("Failed to save tournament state: %s", e.what());
+    this->journal.reset();
   }
-  save_file(this->state_filename, json.serialize(JSON::SerializeOption::FORMAT | JSON::SerializeOption::HEX_INTEGERS | JSON::SerializeOption::ESCAPE_CONTROLS_ONLY));
 }
 
 shared_ptr<Tournament> TournamentIndex::create_tournament(
@@ -3,6 +3,7 @@
 #include <event2/event.h>
 #include <stdint.h>
 
+#include <map>
 #include <memory>
 #include <phosg/JSON.hh>
 #include <phosg/Strings.hh>
@@ -10,6 +11,7 @@
 #include <unordered_set>
 #include <vector>
 
+#include "../DurableFileWriter.hh"
 #include "DataIndexes.hh"
 
 struct Lobby;
@@ -78,6 +80,8 @@ public:
     bool has_any_human_players() const;
     size_t num_human_players() const;
     size_t num_com_players() const;
+
+    JSON json() const;
   };
 
   struct Match : public std::enable_shared_from_this<Match> {
@@ -119,7 +123,7 @@ public:
   ~Tournament() = default;
   void init();
 
-  JSON json() const;
+  JSON json(bool include_teams = true) const;
 
   inline const std::string& get_name() const {
     return this->name;
@@ -194,16 +198,45 @@ private:
   std::shared_ptr<Match> final_match;
 };
 
+// The tournament state is stored in two files: a snapshot of all tournaments
+// (state_filename), and a journal of changes made since the snapshot was
+// written (state_filename + ".journal"). Each line in the journal is a JSON
+// record that replaces an entire tournament, replaces one team within a
+// tournament, or deletes a tournament. save() compares each tournament to its
+// state as of the previous save and appends records only for the parts that
+// changed, so (for example) saving a match result appends only the records for
+// the teams involved. When the journal grows beyond MAX_JOURNAL_SIZE, a new
+// snapshot is written and the journal is cleared.
+//
+// Each snapshot has a generation number, which is one more than the previous
+// snapshot's, and each journal record contains the generation of the snapshot
+// it follows. The snapshot is written (and renamed into place) before the
+// journal is cleared, so if the server crashes in between, the journal still
+// contains records from before the snapshot; these are skipped when loading,
+// since replaying them could undo later changes that are in the snapshot. An
+// incomplete record at the end of the journal (from a crash during an append)
+// is also ignored when loading; any other damage to the journal makes loading
+// fail, without modifying the files.
 class TournamentIndex {
 public:
+  static constexpr size_t MAX_JOURNAL_SIZE = 0x40000;
+
   explicit TournamentIndex(
       std::shared_ptr<const MapIndex> map_index,
       std::shared_ptr<const COMDeckIndex> com_deck_index,
       const std::string& state_filename,
-      bool skip_load_state = false);
+      bool skip_load_state = false,
+      std::shared_ptr<DurableFileWriter> file_writer = nullptr);
+  TournamentIndex(const TournamentIndex&) = delete;
+  TournamentIndex(TournamentIndex&&) = delete;
+  TournamentIndex& operator=(const TournamentIndex&) = delete;
+  TournamentIndex& operator=(TournamentIndex&&) = delete;
   ~TournamentIndex() = default;
 
-  void save() const;
+  void save();
+  // Returns the state of all tournaments, in the same format as the snapshot
+  // (without the generation number)
+  JSON json() const;
 
   inline const std::unordered_map<std::string, std::shared_ptr<Tournament>>& all_tournaments() const {
     return this->name_to_tournament;
@@ -237,11 +270,30 @@ public:
   void link_all_clients(std::shared_ptr<ServerState> s);
 
 private:
+  // Serialized state of a tournament as of the last save, used to determine
+  // which records need to be appended to the journal
+  struct SavedState {
+    std::string header_data; // Tournament JSON without teams
+    std::vector<std::string> team_data;
+
+    explicit SavedState(const Tournament& tourn);
+  };
+
   std::shared_ptr<const MapIndex> map_index;
   std::shared_ptr<const COMDeckIndex> com_deck_index;
   std::string state_filename;
+  std::string journal_filename;
+  std::shared_ptr<DurableFileWriter> file_writer; // If null, snapshots are written directly
   std::unordered_map<std::string, std::shared_ptr<Tournament>> name_to_tournament;
   std::vector<std::shared_ptr<Tournament>> menu_item_id_to_tournament;
+
+  std::unique_ptr<FILE, void (*)(FILE*)> journal;
+  size_t journal_size;
+  uint64_t generation; // Of the current snapshot
+  std::unordered_map<std::string, SavedState> saved_states;
+
+  static void apply_journal_record(std::map<std::string, JSON>& tournament_jsons, const JSON& record);
+  void write_snapshot();
 };
 
 } // namespace Episode3
@@ -75,17 +75,106 @@ FileContentsCache::GetResult FileContentsCache::get(const char* name,
   return this->get(string(name), generate);
 }
 
+ThreadSafeFileCache::ThreadSafeFileCache(size_t max_bytes)
+    : max_bytes(max_bytes),
+      bytes(0),
+      hits(0),
+      misses(0),
+      evictions(0) {}
+
 shared_ptr<const string> ThreadSafeFileCache::get(
     const string& name, std::function<shared_ptr<const string>(const std::string&)> generate) {
+  shared_ptr<Entry> entry;
+  promise<shared_ptr<const string>> result_promise;
+  bool should_generate = false;
+  {
+    lock_guard g(this->lock);
+    auto it = this->entries.find(name);
+    if (it != this->entries.end()) {
+      this->hits++;
+      entry = it->second;
+      if (entry->ready) {
+        this->lru.splice(this->lru.begin(), this->lru, entry->lru_it);
+      }
+    } else {
+      this->misses++;
+      entry = make_shared<Entry>();
+      entry->future = result_promise.get_future().share();
+      this->entries.emplace(name, entry);
+      should_generate = true;
+    }
+  }
+
+  if (!should_generate) {
+    // If another thread is still generating the file, this waits for it (and
+    // rethrows its exception, if generate() failed)
+    return entry->future.get();
+  }
+
+  shared_ptr<const string> data;
   try {
-    shared_lock g(this->lock);
-    return this->name_to_file.at(name);
-  } catch (const out_of_range&) {
-    unique_lock g(this->lock);
-    auto it = this->name_to_file.find(name);
-    if (it == this->name_to_file.end()) {
-      it = this->name_to_file.emplace(name, generate(name)).first;
+    data = generate(name);
+  } catch (...) {
+    // Any exception must be passed to the waiting threads, or they would
+    // wait forever
+    result_promise.set_exception(current_exception());
+    lock_guard g(this->lock);
+    auto it = this->entries.find(name);
+    if ((it != this->entries.end()) && (it->second == entry)) {
+      this->entries.erase(it);
     }
-    return it->second;
+    throw;
+  }
+  result_promise.set_value(data);
+
+  lock_guard g(this->lock);
+  auto it = this->entries.find(name);
+  // If erase() was called while the file was being generated, don't cache the
+  // result, since it may be out of date
+  if ((it != this->entries.end()) && (it->second == entry)) {
+    entry->ready = true;
+    entry->size = data ? data->size() : 0;
+    entry->lru_it = this->lru.emplace(this->lru.begin(), name);
+    this->bytes += entry->size;
+    this->evict_locked();
+  }
+  return data;
+}
+
+bool ThreadSafeFileCache::erase(const string& name) {
+  lock_guard g(this->lock);
+  auto it = this->entries.find(name);
+  if (it == this->entries.end()) {
+    return false;
+  }
+  if (it->second->ready) {
+    this->lru.erase(it->second->lru_it);
+    this->bytes -= it->second->size;
+  }
+  this->entries.erase(it);
+  return true;
+}
+
+ThreadSafeFileCache::Stats ThreadSafeFileCache::stats() const {
+  lock_guard g(this->lock);
+  return Stats{
+      .num_files = this->entries.size(),
+      .bytes = this->bytes,
+      .max_bytes = this->max_bytes,
+      .hits = this->hits,
+      .misses = this->misses,
+      .evictions = this->evictions};
+}
+
+void ThreadSafeFileCache::evict_locked() {
+  if (this->max_bytes == 0) {
+    return;
+  }
+  while ((this->bytes > this->max_bytes) && !this->lru.empty()) {
+    auto it = this->entries.find(this->lru.back());
+    this->bytes -= it->second->size;
+    this->entries.erase(it);
+    this->lru.pop_back();
+    this->evictions++;
   }
 }
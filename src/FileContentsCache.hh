@@ -1,9 +1,10 @@
 #pragma once
 
 #include <functional>
+#include <future>
+#include <list>
 #include <memory>
 #include <mutex>
-#include <shared_mutex>
 #include <string>
 #include <unordered_map>
 
@@ -107,18 +108,54 @@ private:
 
 class ThreadSafeFileCache {
 public:
-  explicit ThreadSafeFileCache() = default;
+  // If max_bytes is nonzero, the least recently used files are evicted when
+  // the total size of all cached files exceeds it.
+  explicit ThreadSafeFileCache(size_t max_bytes = 0);
   ThreadSafeFileCache(const ThreadSafeFileCache&) = delete;
   ThreadSafeFileCache(ThreadSafeFileCache&&) = delete;
   ThreadSafeFileCache& operator=(const ThreadSafeFileCache&) = delete;
   ThreadSafeFileCache& operator=(ThreadSafeFileCache&&) = delete;
   ~ThreadSafeFileCache() = default;
 
-  // Warning: generate() is called while the lock is held for writing, so it
-  // will block other threads.
+  // generate() is called without holding the cache's lock, so different files
+  // can be loaded in parallel. If other threads request the same file while
+  // it's being generated, they wait for the result instead of calling
+  // generate() again. If generate() throws, all of the waiting callers
+  // receive the exception and nothing is cached. generate() may return null
+  // (e.g. if the file doesn't exist); null results are cached too.
   std::shared_ptr<const std::string> get(const std::string& name, std::function<std::shared_ptr<const std::string>(const std::string&)> generate);
+  // Removes a single file from the cache, so the next get() call for it will
+  // call generate() again. Returns true if the file was present. If the file
+  // is currently being generated, threads already waiting for it still
+  // receive the result, but the result is not cached.
+  bool erase(const std::string& name);
+
+  struct Stats {
+    size_t num_files;
+    size_t bytes;
+    size_t max_bytes;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+  };
+  Stats stats() const;
 
 private:
-  std::shared_mutex lock;
-  std::unordered_map<std::string, std::shared_ptr<const std::string>> name_to_file;
+  struct Entry {
+    std::shared_future<std::shared_ptr<const std::string>> future;
+    bool ready = false; // If false, generate() is still running
+    size_t size = 0;
+    std::list<std::string>::iterator lru_it; // Valid only if ready is true
+  };
+
+  mutable std::mutex lock;
+  std::unordered_map<std::string, std::shared_ptr<Entry>> entries;
+  std::list<std::string> lru; // Most recently used first
+  size_t max_bytes;
+  size_t bytes;
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t evictions;
+
+  void evict_locked();
 };
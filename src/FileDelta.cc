@@ -0,0 +1,96 @@
+#include "FileDelta.hh"
+
+#include <string.h>
+
+#include <phosg/Strings.hh>
+#include <stdexcept>
+
+#include "CRC32.hh"
+
+using namespace std;
+
+// Changed ranges separated by fewer than this many unchanged bytes are merged
+// into a single range, since that's no larger than writing a second header
+static constexpr size_t MIN_RANGE_GAP = sizeof(FileDeltaRange);
+
+string encode_file_delta(const string& base, const string& data) {
+  StringWriter ranges_w;
+  size_t num_ranges = 0;
+  size_t common_size = min<size_t>(base.size(), data.size());
+  size_t offset = 0;
+  while (offset < data.size()) {
+    // Skip unchanged bytes
+    while ((offset < common_size) && (base[offset] == data[offset])) {
+      offset++;
+    }
+    if (offset >= data.size()) {
+      break;
+    }
+
+    // Find the end of the changed range, including any short unchanged runs
+    // within it. Bytes past the end of base are always considered changed.
+    size_t end_offset = offset + 1;
+    size_t unchanged_run = 0;
+    while (end_offset + unchanged_run < data.size()) {
+      size_t z = end_offset + unchanged_run;
+      if ((z < common_size) && (base[z] == data[z])) {
+        if (++unchanged_run >= MIN_RANGE_GAP) {
+          break;
+        }
+      } else {
+        end_offset = z + 1;
+        unchanged_run = 0;
+      }
+    }
+
+    ranges_w.put<FileDeltaRange>({.offset = offset, .size = end_offset - offset});
+    ranges_w.write(data.data() + offset, end_offset - offset);
+    num_ranges++;
+    offset = end_offset;
+  }
+
+  const string& ranges_data = ranges_w.str();
+  StringWriter w;
+  w.put<FileDeltaHeader>({
+      .signature = FileDeltaHeader::SIGNATURE,
+      .base_size = base.size(),
+      .base_checksum = crc32_fast(base.data(), base.size()),
+      .data_size = data.size(),
+      .num_ranges = num_ranges,
+      .checksum = crc32_fast(ranges_data.data(), ranges_data.size()),
+  });
+  w.write(ranges_data);
+  return std::move(w.str());
+}
+
+bool apply_file_delta(string& data, const string& delta) {
+  StringReader r(delta);
+  if (r.remaining() < sizeof(FileDeltaHeader)) {
+    throw runtime_error("delta is too small");
+  }
+  const auto& header = r.get<FileDeltaHeader>();
+  if (header.signature != FileDeltaHeader::SIGNATURE) {
+    throw runtime_error("delta signature is incorrect");
+  }
+  if (crc32_fast(r.getv(r.remaining(), false), r.remaining()) != header.checksum) {
+    throw runtime_error("delta checksum is incorrect");
+  }
+  if ((header.base_size != data.size()) || (header.base_checksum != crc32_fast(data.data(), data.size()))) {
+    return false;
+  }
+
+  string ret = data;
+  ret.resize(header.data_size, '\0');
+  for (size_t z = 0; z < header.num_ranges; z++) {
+    const auto& range = r.get<FileDeltaRange>();
+    if ((range.offset > ret.size()) || (range.size > ret.size() - range.offset)) {
+      throw runtime_error(string_printf("delta range %zu is out of bounds", z));
+    }
+    memcpy(ret.data() + range.offset, r.getv(range.size), range.size);
+  }
+  if (!r.eof()) {
+    throw runtime_error("delta contains extra data");
+  }
+  data = std::move(ret);
+  return true;
+}
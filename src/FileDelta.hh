@@ -0,0 +1,44 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <phosg/Encoding.hh>
+#include <string>
+
+// Binary deltas between two versions of a file. A delta lists the byte ranges
+// that differ between the two versions, so it's much smaller than the file if
+// only a few fields have changed (as is usually the case for BB character
+// files between saves). Ranges that are separated by only a few unchanged
+// bytes are merged, since each range has an 8-byte header.
+//
+// Each delta contains the checksum and size of the version it was made from,
+// and can only be applied to that version. This makes it safe to keep a delta
+// file next to a snapshot file: if the snapshot is replaced, the old delta
+// doesn't match it anymore, and is ignored.
+
+struct FileDeltaHeader {
+  be_uint32_t signature; // SIGNATURE
+  le_uint32_t base_size;
+  le_uint32_t base_checksum; // crc32 of the version this delta applies to
+  le_uint32_t data_size; // Size of the version this delta produces
+  le_uint32_t num_ranges;
+  le_uint32_t checksum; // crc32 of everything after this header
+
+  static constexpr uint32_t SIGNATURE = 0x444C5441; // 'DLTA'
+} __packed_ws__(FileDeltaHeader, 0x18);
+
+struct FileDeltaRange {
+  le_uint32_t offset;
+  le_uint32_t size;
+  // Followed by (size) bytes of data
+} __packed_ws__(FileDeltaRange, 0x08);
+
+// Returns a delta that transforms base into data. base and data may have
+// different sizes.
+std::string encode_file_delta(const std::string& base, const std::string& data);
+
+// Applies a delta made by encode_file_delta to data. Returns false (and does
+// not modify data) if the delta was made from a different version of the
+// file. Throws runtime_error if the delta is malformed.
+bool apply_file_delta(std::string& data, const std::string& delta);
@@ -0,0 +1,132 @@
+#include "FileWatcher.hh"
+
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+#include <phosg/Filesystem.hh>
+#include <phosg/Time.hh>
+
+#include "Loggers.hh"
+
+using namespace std;
+
+FileWatcher::FileWatcher(shared_ptr<struct event_base> base, ChangeHandler on_change, uint64_t debounce_usecs)
+    : base(base),
+      on_change(std::move(on_change)),
+      debounce_usecs(debounce_usecs),
+      fd(-1),
+      read_event(nullptr, event_free),
+      debounce_event(event_new(this->base.get(), -1, EV_TIMEOUT, &FileWatcher::dispatch_on_debounce_timeout, this), event_free) {
+#ifdef __linux__
+  this->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (this->fd < 0) {
+    throw runtime_error("cannot create inotify instance");
+  }
+  this->read_event.reset(event_new(this->base.get(), this->fd, EV_READ | EV_PERSIST, &FileWatcher::dispatch_on_readable, this));
+  event_add(this->read_event.get(), nullptr);
+#endif
+}
+
+FileWatcher::~FileWatcher() {
+  this->read_event.reset();
+  if (this->fd >= 0) {
+    close(this->fd);
+  }
+}
+
+bool FileWatcher::is_available() {
+#ifdef __linux__
+  return true;
+#else
+  return false;
+#endif
+}
+
+void FileWatcher::add_directory(const string& path) {
+  if (!isdir(path)) {
+    return;
+  }
+  this->add_watch(path);
+  for (const auto& item : list_directory(path)) {
+    string item_path = path + "/" + item;
+    if (isdir(item_path)) {
+      this->add_directory(item_path);
+    }
+  }
+}
+
+void FileWatcher::add_watch(const string& path) {
+#ifdef __linux__
+  int wd = inotify_add_watch(this->fd, path.c_str(),
+      IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO);
+  if (wd < 0) {
+    config_log.warning("Cannot watch directory %s for changes", path.c_str());
+    return;
+  }
+  this->wd_to_path[wd] = path;
+#else
+  (void)path;
+#endif
+}
+
+void FileWatcher::on_readable() {
+#ifdef __linux__
+  alignas(struct inotify_event) char buf[0x1000];
+  for (;;) {
+    ssize_t bytes_read = read(this->fd, buf, sizeof(buf));
+    if (bytes_read <= 0) {
+      break;
+    }
+
+    for (ssize_t offset = 0; offset < bytes_read;) {
+      const auto* ev = reinterpret_cast<const struct inotify_event*>(buf + offset);
+      offset += sizeof(struct inotify_event) + ev->len;
+
+      if (ev->mask & IN_Q_OVERFLOW) {
+        // Some events were lost, so we can't know exactly what changed; report
+        // all watched directories instead
+        for (const auto& it : this->wd_to_path) {
+          this->pending_paths.emplace(it.second);
+        }
+        continue;
+      }
+      if (ev->mask & IN_IGNORED) {
+        this->wd_to_path.erase(ev->wd);
+        continue;
+      }
+
+      auto dir_it = this->wd_to_path.find(ev->wd);
+      if (dir_it == this->wd_to_path.end()) {
+        continue;
+      }
+      string path = ev->len ? (dir_it->second + "/" + ev->name) : dir_it->second;
+      if ((ev->mask & IN_ISDIR) && (ev->mask & (IN_CREATE | IN_MOVED_TO))) {
+        this->add_directory(path);
+      }
+      this->pending_paths.emplace(std::move(path));
+    }
+  }
+
+  if (!this->pending_paths.empty()) {
+    // Restart the debounce timer; the handler runs only after no further
+    // changes have occurred for debounce_usecs
+    auto tv = usecs_to_timeval(this->debounce_usecs);
+    event_add(this->debounce_event.get(), &tv);
+  }
+#endif
+}
+
+void FileWatcher::dispatch_on_readable(evutil_socket_t, short, void* ctx) {
+  reinterpret_cast<FileWatcher*>(ctx)->on_readable();
+}
+
+void FileWatcher::dispatch_on_debounce_timeout(evutil_socket_t, short, void* ctx) {
+  auto* self = reinterpret_cast<FileWatcher*>(ctx);
+  if (!self->pending_paths.empty()) {
+    unordered_set<string> paths;
+    paths.swap(self->pending_paths);
+    self->on_change(std::move(paths));
+  }
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <event2/event.h>
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+
+// Watches directory trees for changes and calls a function on the event thread
+// with the set of changed paths. Changes are debounced, so a quest writer
+// saving several files in quick succession produces only one callback. On
+// non-Linux systems (where inotify is not available), this class does nothing
+// and is_available() returns false.
+class FileWatcher {
+public:
+  using ChangeHandler = std::function<void(std::unordered_set<std::string>&& changed_paths)>;
+
+  FileWatcher(std::shared_ptr<struct event_base> base, ChangeHandler on_change, uint64_t debounce_usecs = 500000);
+  FileWatcher(const FileWatcher&) = delete;
+  FileWatcher(FileWatcher&&) = delete;
+  FileWatcher& operator=(const FileWatcher&) = delete;
+  FileWatcher& operator=(FileWatcher&&) = delete;
+  ~FileWatcher();
+
+  static bool is_available();
+
+  // Adds watches for the given directory and all of its subdirectories.
+  // Subdirectories created later are watched automatically.
+  void add_directory(const std::string& path);
+
+private:
+  std::shared_ptr<struct event_base> base;
+  ChangeHandler on_change;
+  uint64_t debounce_usecs;
+  int fd;
+  std::unique_ptr<struct event, void (*)(struct event*)> read_event;
+  std::unique_ptr<struct event, void (*)(struct event*)> debounce_event;
+  std::unordered_map<int, std::string> wd_to_path;
+  std::unordered_set<std::string> pending_paths;
+
+  void add_watch(const std::string& path);
+  void on_readable();
+
+  static void dispatch_on_readable(evutil_socket_t fd, short events, void* ctx);
+  static void dispatch_on_debounce_timeout(evutil_socket_t fd, short events, void* ctx);
+};
@@ -0,0 +1,517 @@
+#include "GameCheckpointManager.hh"
+
+#include <algorithm>
+#include <phosg/Filesystem.hh>
+#include <phosg/Strings.hh>
+#include <stdexcept>
+
+#include "CRC32.hh"
+#include "Loggers.hh"
+#include "ServerState.hh"
+
+using namespace std;
+
+struct CheckpointFloorItem {
+  uint8_t floor;
+  uint8_t unused;
+  le_uint16_t flags;
+  le_float x;
+  le_float z;
+  ItemData data;
+} __packed_ws__(CheckpointFloorItem, 0x20);
+
+struct CheckpointMapStateHeader {
+  le_uint32_t num_objects;
+  le_uint32_t num_enemies;
+  le_uint32_t num_enemy_sets;
+  le_uint32_t num_events;
+  // crc32 of all object types, enemy types, and event IDs. If this doesn't
+  // match the regenerated map, the saved state belongs to a different layout
+  // and can't be applied.
+  le_uint32_t layout_checksum;
+  // Followed by:
+  //   CheckpointObjectState[num_objects]
+  //   CheckpointEnemyState[num_enemies]
+  //   le_uint16_t enemy_set_flags[num_enemy_sets]
+  //   le_uint16_t event_flags[num_events]
+} __packed_ws__(CheckpointMapStateHeader, 0x14);
+
+struct CheckpointObjectState {
+  le_uint16_t game_flags;
+  le_uint16_t set_flags;
+  uint8_t item_drop_checked;
+  uint8_t unused;
+} __packed_ws__(CheckpointObjectState, 0x06);
+
+struct CheckpointEnemyState {
+  le_uint32_t game_flags;
+  le_uint16_t total_damage;
+  uint8_t server_flags;
+  uint8_t unused;
+} __packed_ws__(CheckpointEnemyState, 0x08);
+
+// Flags that are saved in checkpoints. The other flags describe transient
+// states (quests, map loading) or types of games that aren't checkpointed.
+static constexpr uint32_t CHECKPOINT_FLAGS_MASK =
+    static_cast<uint32_t>(Lobby::Flag::PERSISTENT) |
+    static_cast<uint32_t>(Lobby::Flag::CHEATS_ENABLED) |
+    static_cast<uint32_t>(Lobby::Flag::IS_CLIENT_CUSTOMIZATION) |
+    static_cast<uint32_t>(Lobby::Flag::CANNOT_CHANGE_CHEAT_MODE) |
+    static_cast<uint32_t>(Lobby::Flag::USE_CREATOR_SECTION_ID) |
+    static_cast<uint32_t>(Lobby::Flag::RESTORED_FROM_CHECKPOINT);
+
+template <typename T>
+static T parse_checkpoint_struct(const string& hex_data) {
+  string data = parse_data_string(hex_data);
+  if (data.size() != sizeof(T)) {
+    throw runtime_error(string_printf("checkpoint data has incorrect size (expected %zu bytes, received %zu bytes)",
+        sizeof(T), data.size()));
+  }
+  return *reinterpret_cast<const T*>(data.data());
+}
+
+static uint32_t map_layout_checksum(const Map& map) {
+  StringWriter w;
+  for (const auto& obj : map.objects) {
+    w.put_u16l(obj.base_type);
+  }
+  for (const auto& enemy : map.enemies) {
+    w.put_u16l(static_cast<uint16_t>(enemy.type));
+  }
+  for (const auto& event : map.events) {
+    w.put_u32l(event.event_id);
+  }
+  return crc32_fast(w.str().data(), w.size());
+}
+
+GameCheckpointManager::GameCheckpointManager(shared_ptr<ServerState> s, const string& filename)
+    : server_state(s),
+      filename(filename),
+      interval_usecs(0),
+      checkpoint_event(event_new(s->base.get(), -1, EV_TIMEOUT | EV_PERSIST, &GameCheckpointManager::dispatch_checkpoint, this), event_free),
+      written_clean(false),
+      file_written(false),
+      checkpoints_written(0),
+      games_encoded(0),
+      games_reused(0),
+      bytes_written(0) {}
+
+void GameCheckpointManager::set_interval(uint64_t interval_usecs) {
+  // Disabling checkpoints always deletes the file, even if they were already
+  // disabled, so a stale checkpoint isn't restored if they're enabled later
+  if (interval_usecs && (interval_usecs == this->interval_usecs)) {
+    return;
+  }
+  this->interval_usecs = interval_usecs;
+  event_del(this->checkpoint_event.get());
+
+  if (this->interval_usecs) {
+    auto tv = usecs_to_timeval(this->interval_usecs);
+    event_add(this->checkpoint_event.get(), &tv);
+  } else {
+    auto s = this->server_state.lock();
+    if (s) {
+      s->file_writer->remove(this->filename);
+    }
+    this->cached_games.clear();
+    this->written_lobby_ids.clear();
+    this->file_written = false;
+  }
+}
+
+bool GameCheckpointManager::can_checkpoint(shared_ptr<const Lobby> l) {
+  return l->is_game() &&
+      !l->is_ep3() &&
+      (l->mode == GameMode::NORMAL) &&
+      !l->quest &&
+      l->map &&
+      !l->check_flag(Lobby::Flag::IS_SPECTATOR_TEAM) &&
+      !l->check_flag(Lobby::Flag::MAPS_LOADING) &&
+      !l->check_flag(Lobby::Flag::QUEST_IN_PROGRESS) &&
+      !l->check_flag(Lobby::Flag::JOINABLE_QUEST_IN_PROGRESS) &&
+      !l->check_flag(Lobby::Flag::BATTLE_IN_PROGRESS);
+}
+
+JSON GameCheckpointManager::game_metadata_json(shared_ptr<const Lobby> l) {
+  auto variations_json = JSON::list();
+  for (size_t z = 0; z < l->variations.size(); z++) {
+    variations_json.emplace_back(l->variations[z].load());
+  }
+  return JSON::dict({
+      {"Name", l->name},
+      {"Password", l->password},
+      {"BaseVersion", name_for_enum(l->base_version)},
+      {"AllowedVersions", l->allowed_versions},
+      {"Episode", static_cast<uint8_t>(l->episode)},
+      {"Mode", static_cast<uint8_t>(l->mode)},
+      {"Difficulty", l->difficulty},
+      {"CreatorSectionID", l->creator_section_id},
+      {"OverrideSectionID", l->override_section_id},
+      {"Event", l->event},
+      {"MinLevel", l->min_level},
+      {"MaxLevel", l->max_level},
+      {"BaseEXPMultiplier", l->base_exp_multiplier},
+      {"EXPShareMultiplier", l->exp_share_multiplier},
+      {"Flags", l->enabled_flags & CHECKPOINT_FLAGS_MASK},
+      {"RandomSeed", l->random_seed},
+      {"UsesOverrideRandomSeed", !!l->opt_rand_crypt},
+      {"Variations", std::move(variations_json)},
+      {"AllowedDropModes", l->allowed_drop_modes},
+      {"DropMode", name_for_enum(l->drop_mode)},
+      {"NextGameItemID", l->next_game_item_id},
+  });
+}
+
+string GameCheckpointManager::encode_floor_items(shared_ptr<const Lobby> l) {
+  // Private items are deleted when the last player leaves a game, so only
+  // items that all players can see are saved. Items are saved in drop order,
+  // so the oldest items are still evicted first after the game is restored.
+  vector<pair<uint64_t, CheckpointFloorItem>> items;
+  for (size_t floor = 0; floor < l->floor_item_managers.size(); floor++) {
+    for (const auto& fi : l->floor_item_managers[floor].items) {
+      if ((fi.flags & 0x00F) != 0x00F) {
+        continue;
+      }
+      auto& item = items.emplace_back(fi.drop_number, CheckpointFloorItem{}).second;
+      item.floor = floor;
+      item.unused = 0;
+      item.flags = fi.flags;
+      item.x = fi.x;
+      item.z = fi.z;
+      item.data = fi.data;
+    }
+  }
+  sort(items.begin(), items.end(), [](const auto& a, const auto& b) -> bool {
+    return a.first < b.first;
+  });
+
+  StringWriter w;
+  for (const auto& it : items) {
+    w.put(it.second);
+  }
+  return std::move(w.str());
+}
+
+string GameCheckpointManager::encode_map_state(shared_ptr<const Map> map) {
+  StringWriter w;
+  w.put<CheckpointMapStateHeader>({
+      .num_objects = map->objects.size(),
+      .num_enemies = map->enemies.size(),
+      .num_enemy_sets = map->enemy_set_flags.size(),
+      .num_events = map->events.size(),
+      .layout_checksum = map_layout_checksum(*map),
+  });
+  for (const auto& obj : map->objects) {
+    w.put<CheckpointObjectState>({
+        .game_flags = obj.game_flags,
+        .set_flags = obj.set_flags,
+        .item_drop_checked = obj.item_drop_checked,
+        .unused = 0,
+    });
+  }
+  for (const auto& enemy : map->enemies) {
+    w.put<CheckpointEnemyState>({
+        .game_flags = enemy.game_flags,
+        .total_damage = enemy.total_damage,
+        .server_flags = enemy.server_flags,
+        .unused = 0,
+    });
+  }
+  for (uint16_t flags : map->enemy_set_flags) {
+    w.put_u16l(flags);
+  }
+  for (const auto& event : map->events) {
+    w.put_u16l(event.flags);
+  }
+  return std::move(w.str());
+}
+
+bool GameCheckpointManager::apply_map_state(shared_ptr<Map> map, const string& data) {
+  StringReader r(data);
+  const auto& header = r.get<CheckpointMapStateHeader>();
+  if ((header.num_objects != map->objects.size()) ||
+      (header.num_enemies != map->enemies.size()) ||
+      (header.num_enemy_sets != map->enemy_set_flags.size()) ||
+      (header.num_events != map->events.size()) ||
+      (header.layout_checksum != map_layout_checksum(*map))) {
+    return false;
+  }
+
+  for (auto& obj : map->objects) {
+    const auto& state = r.get<CheckpointObjectState>();
+    obj.game_flags = state.game_flags;
+    obj.set_flags = state.set_flags;
+    obj.item_drop_checked = state.item_drop_checked;
+  }
+  for (auto& enemy : map->enemies) {
+    const auto& state = r.get<CheckpointEnemyState>();
+    enemy.game_flags = state.game_flags;
+    enemy.total_damage = state.total_damage;
+    enemy.server_flags = state.server_flags;
+  }
+  for (auto& flags : map->enemy_set_flags) {
+    flags = r.get_u16l();
+  }
+  for (auto& event : map->events) {
+    event.flags = r.get_u16l();
+  }
+  if (!r.eof()) {
+    throw runtime_error("map state contains extra data");
+  }
+  return true;
+}
+
+void GameCheckpointManager::checkpoint(bool clean) {
+  auto s = this->server_state.lock();
+  if (!s) {
+    return;
+  }
+
+  unordered_map<uint32_t, CachedGame> new_cached_games;
+  vector<uint32_t> lobby_ids;
+  bool any_game_changed = false;
+  for (const auto& it : s->id_to_lobby) {
+    const auto& l = it.second;
+    if (!GameCheckpointManager::can_checkpoint(l)) {
+      continue;
+    }
+
+    // The metadata is small, so it's cheaper to compare it than to track all
+    // the places it can be changed. The rest of the game's state is only
+    // encoded if the lobby's change count is different from when it was last
+    // encoded.
+    auto metadata_json = GameCheckpointManager::game_metadata_json(l);
+    string metadata = metadata_json.serialize();
+    auto cache_it = this->cached_games.find(l->lobby_id);
+    if ((cache_it != this->cached_games.end()) &&
+        (cache_it->second.lobby.lock() == l) &&
+        (cache_it->second.state_change_count == l->state_change_count) &&
+        (cache_it->second.metadata == metadata)) {
+      new_cached_games.emplace(l->lobby_id, std::move(cache_it->second));
+      this->games_reused++;
+    } else {
+      string floor_items_data = GameCheckpointManager::encode_floor_items(l);
+      string map_state_data = GameCheckpointManager::encode_map_state(l->map);
+      metadata_json.emplace("FloorItems", format_data_string(floor_items_data.data(), floor_items_data.size()));
+      metadata_json.emplace("MapState", format_data_string(map_state_data.data(), map_state_data.size()));
+      metadata_json.emplace("QuestFlagValues", l->quest_flag_values
+              ? JSON(format_data_string(l->quest_flag_values.get(), sizeof(QuestFlags)))
+              : JSON(nullptr));
+      metadata_json.emplace("QuestFlagsKnown", l->quest_flags_known
+              ? JSON(format_data_string(l->quest_flags_known.get(), sizeof(QuestFlags)))
+              : JSON(nullptr));
+      metadata_json.emplace("SwitchFlags", l->switch_flags
+              ? JSON(format_data_string(l->switch_flags.get(), sizeof(SwitchFlags)))
+              : JSON(nullptr));
+      CachedGame game;
+      game.lobby = l;
+      game.state_change_count = l->state_change_count;
+      game.metadata = std::move(metadata);
+      game.json_text = metadata_json.serialize();
+      new_cached_games.emplace(l->lobby_id, std::move(game));
+      this->games_encoded++;
+      any_game_changed = true;
+    }
+    lobby_ids.emplace_back(l->lobby_id);
+  }
+  this->cached_games = std::move(new_cached_games);
+
+  if (!any_game_changed &&
+      this->file_written &&
+      (clean == this->written_clean) &&
+      (lobby_ids == this->written_lobby_ids)) {
+    return;
+  }
+
+  string data = clean ? "{\"Clean\": true, \"Games\": [" : "{\"Clean\": false, \"Games\": [";
+  for (size_t z = 0; z < lobby_ids.size(); z++) {
+    data += (z == 0) ? "\n" : ",\n";
+    data += this->cached_games.at(lobby_ids[z]).json_text;
+  }
+  data += "\n]}\n";
+
+  lobby_log.info("Writing %s checkpoint with %zu games (%zu bytes)",
+      clean ? "clean" : "periodic", lobby_ids.size(), data.size());
+  this->bytes_written += data.size();
+  this->checkpoints_written++;
+  s->file_writer->write(this->filename, std::move(data));
+  this->written_lobby_ids = std::move(lobby_ids);
+  this->written_clean = clean;
+  this->file_written = true;
+}
+
+shared_ptr<Lobby> GameCheckpointManager::restore_game(
+    shared_ptr<ServerState> s, const JSON& json, bool clean, uint64_t restore_timeout_usecs) {
+  Version base_version = enum_for_name<Version>(json.get_string("BaseVersion").c_str());
+  Episode episode = static_cast<Episode>(json.get_int("Episode"));
+  GameMode mode = static_cast<GameMode>(json.get_int("Mode"));
+  uint8_t difficulty = json.get_int("Difficulty");
+  if (is_patch(base_version) || is_ep3(base_version) || (episode == Episode::NONE) || (episode == Episode::EP3)) {
+    throw runtime_error("game version or episode cannot be restored");
+  }
+  if (mode != GameMode::NORMAL) {
+    throw runtime_error("game mode cannot be restored");
+  }
+  if (difficulty > 3) {
+    throw runtime_error("invalid difficulty");
+  }
+  const auto& variations_json = json.get_list("Variations");
+
+  auto l = s->create_lobby(true);
+  try {
+    l->name = json.get_string("Name");
+    l->password = json.get_string("Password");
+    l->base_version = base_version;
+    l->allowed_versions = json.get_int("AllowedVersions");
+    l->episode = episode;
+    l->mode = mode;
+    l->difficulty = difficulty;
+    l->creator_section_id = json.get_int("CreatorSectionID");
+    l->override_section_id = json.get_int("OverrideSectionID");
+    l->event = json.get_int("Event");
+    l->block = 0xFF;
+    l->max_clients = 4;
+    l->min_level = json.get_int("MinLevel");
+    l->max_level = json.get_int("MaxLevel");
+    l->base_exp_multiplier = json.get_int("BaseEXPMultiplier");
+    l->exp_share_multiplier = json.get_float("EXPShareMultiplier");
+    l->random_seed = json.get_int("RandomSeed");
+    if (json.get_bool("UsesOverrideRandomSeed")) {
+      l->opt_rand_crypt = make_shared<PSOV2Encryption>(l->random_seed);
+    }
+    if (variations_json.size() != l->variations.size()) {
+      throw runtime_error("incorrect variation count");
+    }
+    for (size_t z = 0; z < l->variations.size(); z++) {
+      l->variations[z] = variations_json[z]->as_int();
+    }
+
+    uint32_t flags = json.get_int("Flags") & CHECKPOINT_FLAGS_MASK;
+    bool was_persistent = (flags & static_cast<uint32_t>(Lobby::Flag::PERSISTENT)) &&
+        !(flags & static_cast<uint32_t>(Lobby::Flag::RESTORED_FROM_CHECKPOINT));
+    l->enabled_flags |= flags;
+    if (!was_persistent) {
+      // Keep the game alive until someone rejoins it (or the restore timeout
+      // expires); see Lobby::add_client
+      l->set_flag(Lobby::Flag::PERSISTENT);
+      l->set_flag(Lobby::Flag::RESTORED_FROM_CHECKPOINT);
+      l->idle_timeout_usecs = restore_timeout_usecs;
+    }
+
+    l->allowed_drop_modes = json.get_int("AllowedDropModes");
+    l->set_drop_mode(enum_for_name<Lobby::DropMode>(json.get_string("DropMode").c_str()));
+    while (l->floor_item_managers.size() < 0x12) {
+      l->floor_item_managers.emplace_back(l->lobby_id, l->floor_item_managers.size());
+    }
+    l->rare_enemy_rates = s->rare_enemy_rates_by_difficulty.at(l->difficulty);
+
+    // The map is regenerated from the variations and random seed, which
+    // should produce the same layout as before; the saved object and enemy
+    // states are only applied if it does
+    l->load_maps();
+    if (!GameCheckpointManager::apply_map_state(l->map, parse_data_string(json.get_string("MapState")))) {
+      l->log.warning("Map layout does not match checkpoint; object and enemy states were not restored");
+    }
+
+    const auto& quest_flag_values_json = json.at("QuestFlagValues");
+    l->quest_flag_values = make_unique<QuestFlags>(quest_flag_values_json.is_null()
+            ? QuestFlags()
+            : parse_checkpoint_struct<QuestFlags>(quest_flag_values_json.as_string()));
+    const auto& quest_flags_known_json = json.at("QuestFlagsKnown");
+    if (quest_flags_known_json.is_null()) {
+      l->quest_flags_known = nullptr;
+    } else {
+      l->quest_flags_known = make_unique<QuestFlags>(parse_checkpoint_struct<QuestFlags>(quest_flags_known_json.as_string()));
+    }
+    const auto& switch_flags_json = json.at("SwitchFlags");
+    l->switch_flags = make_unique<SwitchFlags>(switch_flags_json.is_null()
+            ? SwitchFlags()
+            : parse_checkpoint_struct<SwitchFlags>(switch_flags_json.as_string()));
+
+    // Item IDs don't need to match the original game, since they're all
+    // reassigned when the first player joins. Floor items are only restored
+    // from clean checkpoints: a periodic checkpoint may contain items that
+    // players picked up (and saved to their characters) after it was
+    // written, so restoring them would duplicate those items. Items dropped
+    // after the checkpoint are lost either way.
+    if (clean) {
+      string floor_items_data = parse_data_string(json.get_string("FloorItems"));
+      StringReader r(floor_items_data);
+      while (!r.eof()) {
+        const auto& item = r.get<CheckpointFloorItem>();
+        l->floor_item_managers.at(item.floor).add(item.data, item.x, item.z, item.flags);
+      }
+    }
+    l->next_game_item_id = json.get_int("NextGameItemID");
+
+  } catch (const exception&) {
+    s->remove_lobby(l);
+    throw;
+  }
+
+  if (l->idle_timeout_usecs > 0) {
+    auto tv = usecs_to_timeval(l->idle_timeout_usecs);
+    event_add(l->idle_timeout_event.get(), &tv);
+  }
+  return l;
+}
+
+size_t GameCheckpointManager::restore(uint64_t restore_timeout_usecs) {
+  auto s = this->server_state.lock();
+  if (!s) {
+    throw logic_error("server is deleted");
+  }
+
+  JSON json;
+  try {
+    json = JSON::parse(load_file(this->filename));
+  } catch (const cannot_open_file&) {
+    lobby_log.info("No game checkpoint to restore");
+    return 0;
+  }
+
+  // Checkpoints written by older versions of newserv are a list of games
+  // with no clean marker, so they're treated as periodic checkpoints
+  bool clean = false;
+  const JSON* games_json = &json;
+  if (json.is_dict()) {
+    clean = json.get_bool("Clean");
+    games_json = &json.at("Games");
+  }
+  if (!clean) {
+    lobby_log.warning("Game checkpoint was not written at shutdown; floor items will not be restored");
+  }
+
+  size_t num_restored = 0;
+  for (const auto& game_json : games_json->as_list()) {
+    try {
+      auto l = this->restore_game(s, *game_json, clean, restore_timeout_usecs);
+      l->log.info("Restored from checkpoint");
+      num_restored++;
+    } catch (const exception& e) {
+      lobby_log.warning("Cannot restore game from checkpoint: %s", e.what());
+    }
+  }
+  lobby_log.info("Restored %zu of %zu games from checkpoint", num_restored, games_json->as_list().size());
+  return num_restored;
+}
+
+GameCheckpointManager::Stats GameCheckpointManager::stats() const {
+  return Stats{
+      .num_games = this->file_written ? this->written_lobby_ids.size() : 0,
+      .interval_usecs = this->interval_usecs,
+      .checkpoints_written = this->checkpoints_written,
+      .games_encoded = this->games_encoded,
+      .games_reused = this->games_reused,
+      .bytes_written = this->bytes_written,
+  };
+}
+
+void GameCheckpointManager::dispatch_checkpoint(evutil_socket_t, short, void* ctx) {
+  auto* m = reinterpret_cast<GameCheckpointManager*>(ctx);
+  try {
+    m->checkpoint();
+  } catch (const exception& e) {
+    lobby_log.error("Failed to write game checkpoint: %s", e.what());
+  }
+}
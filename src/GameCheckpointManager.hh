@@ -0,0 +1,118 @@
+#pragma once
+
+#include <event2/event.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <memory>
+#include <phosg/JSON.hh>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "Lobby.hh"
+
+struct ServerState;
+
+// Periodically saves the state of running games to a file, so they can be
+// recreated when the server is restarted. For each game, the checkpoint
+// contains the game's configuration (name, password, versions, episode,
+// difficulty, random seed, variations, drop mode, etc.), the items on the
+// floor, the quest and switch flags, and the state of the map's objects,
+// enemies, and events. Games that can't be recreated from this state aren't
+// checkpointed: these are Episode 3 games, spectator teams, games in any mode
+// other than Normal, and games in which a quest has been loaded.
+//
+// Client sessions are not saved; when the server is restarted, all clients
+// have to reconnect. Restored games are marked persistent until the first
+// player joins (and are deleted if no one joins them before the restore
+// timeout expires), so players can find their game in the game list and
+// rejoin it. The first player to join receives the saved item, object, enemy,
+// set, and flag state, as if they were joining an empty persistent game.
+//
+// Floor items are only restored from clean checkpoints, which are written at
+// shutdown and before a handoff, when no player can pick anything up after
+// the checkpoint is written. Periodic checkpoints are marked as not clean;
+// after a crash, restoring their floor items could duplicate items that
+// players had picked up since the checkpoint was written.
+//
+// Checkpoints are incremental: each game's state is kept in the encoded form
+// written in the previous checkpoint, and is only re-encoded if the game's
+// state_change_count or metadata has changed. If no game has changed (and no
+// game has been created or deleted, and the clean marker is the same), the
+// file is not written at all.
+//
+// This class must only be used from the event thread.
+class GameCheckpointManager {
+public:
+  struct Stats {
+    size_t num_games;
+    uint64_t interval_usecs;
+    uint64_t checkpoints_written;
+    uint64_t games_encoded;
+    uint64_t games_reused;
+    uint64_t bytes_written;
+  };
+
+  GameCheckpointManager(std::shared_ptr<ServerState> s, const std::string& filename);
+  GameCheckpointManager(const GameCheckpointManager&) = delete;
+  GameCheckpointManager(GameCheckpointManager&&) = delete;
+  GameCheckpointManager& operator=(const GameCheckpointManager&) = delete;
+  GameCheckpointManager& operator=(GameCheckpointManager&&) = delete;
+  ~GameCheckpointManager() = default;
+
+  // Sets how often checkpoints are written. If interval_usecs is zero,
+  // periodic checkpoints are disabled and the checkpoint file is deleted, so
+  // games from an old checkpoint won't be restored after the next restart.
+  void set_interval(uint64_t interval_usecs);
+
+  // Writes the checkpoint file if any game has changed since the previous
+  // checkpoint. At shutdown and before a handoff, clean should be true, so
+  // floor items will be restored from this checkpoint.
+  void checkpoint(bool clean = false);
+
+  // Recreates the games in the checkpoint file. Games that can't be restored
+  // are skipped. Returns the number of games restored.
+  size_t restore(uint64_t restore_timeout_usecs);
+
+  Stats stats() const;
+
+  static bool can_checkpoint(std::shared_ptr<const Lobby> l);
+
+private:
+  struct CachedGame {
+    // If the lobby is the same, its state_change_count hasn't changed, and its
+    // serialized metadata is the same, json_text is reused
+    std::weak_ptr<const Lobby> lobby;
+    uint64_t state_change_count;
+    std::string metadata;
+    std::string json_text;
+  };
+
+  std::weak_ptr<ServerState> server_state;
+  std::string filename;
+  uint64_t interval_usecs;
+  std::unique_ptr<struct event, void (*)(struct event*)> checkpoint_event;
+
+  // Keys are lobby IDs
+  std::unordered_map<uint32_t, CachedGame> cached_games;
+  // Lobby IDs of the games in the checkpoint file, in order; only valid if
+  // file_written is true
+  std::vector<uint32_t> written_lobby_ids;
+  bool written_clean;
+  bool file_written;
+
+  uint64_t checkpoints_written;
+  uint64_t games_encoded;
+  uint64_t games_reused;
+  uint64_t bytes_written;
+
+  static JSON game_metadata_json(std::shared_ptr<const Lobby> l);
+  static std::string encode_floor_items(std::shared_ptr<const Lobby> l);
+  static std::string encode_map_state(std::shared_ptr<const Map> map);
+  static bool apply_map_state(std::shared_ptr<Map> map, const std::string& data);
+  std::shared_ptr<Lobby> restore_game(
+      std::shared_ptr<ServerState> s, const JSON& json, bool clean, uint64_t restore_timeout_usecs);
+
+  static void dispatch_checkpoint(evutil_socket_t fd, short events, void* ctx);
+};
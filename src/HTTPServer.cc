@@ -3,6 +3,7 @@
 #include <event2/buffer.h>
 #include <event2/event.h>
 #include <event2/http.h>
+#include <event2/listener.h>
 #include <inttypes.h>
 #include <stdlib.h>
 
@@ -193,7 +194,20 @@ void HTTPServer::listen(int port) {
 }
 
 void HTTPServer::add_socket(int fd) {
-  evhttp_accept_socket(this->http.get(), fd);
+  auto* bound_socket = evhttp_accept_socket_with_handle(this->http.get(), fd);
+  if (!bound_socket) {
+    throw runtime_error("cannot accept connections on socket");
+  }
+  this->bound_sockets.emplace_back(bound_socket);
+}
+
+void HTTPServer::stop_listening() {
+  forward_to_event_thread(this->base, [this]() -> void {
+    for (auto* bound_socket : this->bound_sockets) {
+      evconnlistener_disable(evhttp_bound_socket_get_listener(bound_socket));
+    }
+    server_log.info("Stopped accepting connections (HTTP)");
+  });
 }
 
 void HTTPServer::schedule_stop() {
@@ -354,6 +368,14 @@ JSON HTTPServer::generate_game_client_json_st(shared_ptr<const Client> c, shared
           ret.emplace("NumLuckMaterialsUsed", p->get_material_usage(PSOBBCharacterFile::MaterialType::LUCK));
         }
       }
+      vector<string> descriptions;
+      if (item_name_index) {
+        vector<ItemData> items;
+        for (size_t z = 0; z < p->inventory.num_items; z++) {
+          items.emplace_back(p->inventory.items[z].data);
+        }
+        descriptions = item_name_index->describe_items(items, false);
+      }
       JSON items_json = JSON::list();
       for (size_t z = 0; z < p->inventory.num_items; z++) {
         const auto& item = p->inventory.items[z];
@@ -363,7 +385,7 @@ JSON HTTPServer::generate_game_client_json_st(shared_ptr<const Client> c, shared
             {"ItemID", item.data.id.load()},
         });
         if (item_name_index) {
-          item_dict.emplace("Description", item_name_index->describe_item(item.data, false));
+          item_dict.emplace("Description", std::move(descriptions[z]));
         }
         items_json.emplace_back(std::move(item_dict));
       }
@@ -613,22 +635,33 @@ JSON HTTPServer::generate_lobby_json_st(shared_ptr<const Lobby> l, shared_ptr<co
         }
       }
 
+      vector<string> descriptions;
+      if (item_name_index) {
+        vector<ItemData> items;
+        for (const auto& m : l->floor_item_managers) {
+          for (const auto& item : m.items) {
+            items.emplace_back(item.data);
+          }
+        }
+        descriptions = item_name_index->describe_items(items, false);
+      }
       auto floor_items_json = JSON::list();
+      size_t item_index = 0;
       for (size_t floor = 0; floor < l->floor_item_managers.size(); floor++) {
-        for (const auto& it : l->floor_item_managers[floor].items) {
-          const auto& item = it.second;
+        for (const auto& item : l->floor_item_managers[floor].items) {
           auto item_dict = JSON::dict({
               {"LocationFloor", floor},
-              {"LocationX", item->x},
-              {"LocationZ", item->z},
-              {"DropNumber", item->drop_number},
-              {"Flags", item->flags},
-              {"Data", item->data.hex()},
-              {"ItemID", item->data.id.load()},
+              {"LocationX", item.x},
+              {"LocationZ", item.z},
+              {"DropNumber", item.drop_number},
+              {"Flags", item.flags},
+              {"Data", item.data.hex()},
+              {"ItemID", item.data.id.load()},
           });
           if (item_name_index) {
-            item_dict.emplace("Description", item_name_index->describe_item(item->data, false));
+            item_dict.emplace("Description", std::move(descriptions[item_index]));
           }
+          item_index++;
           floor_items_json.emplace_back(std::move(item_dict));
         }
       }
@@ -782,6 +815,7 @@ JSON HTTPServer::generate_server_info_json() const {
         {"ClientCount", this->state->channel_to_client.size()},
         {"ProxySessionCount", this->state->proxy_server ? this->state->proxy_server->num_sessions() : 0},
         {"ServerName", this->state->name},
+        {"FileWriter", this->state->file_writer->stats().json()},
     });
   });
 }
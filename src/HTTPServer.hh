@@ -24,6 +24,9 @@ public:
   void listen(const std::string& addr, int port);
   void listen(int port);
   void add_socket(int fd);
+  // Stops accepting new connections, but doesn't close the listening sockets
+  // (they may have been handed off to another process)
+  void stop_listening();
 
   void schedule_stop();
   void wait_for_stop();
@@ -38,6 +41,7 @@ protected:
   std::shared_ptr<ServerState> state;
   std::shared_ptr<struct event_base> base;
   std::shared_ptr<struct evhttp> http;
+  std::vector<struct evhttp_bound_socket*> bound_sockets;
   std::thread th;
 
   void thread_fn();
@@ -170,6 +170,13 @@ void IPStackSimulator::add_socket(const string& name, int fd, Protocol proto) {
   this->listening_sockets.emplace(piecewise_construct, forward_as_tuple(fd), forward_as_tuple(name, proto, std::move(l)));
 }
 
+void IPStackSimulator::stop_listening() {
+  for (const auto& it : this->listening_sockets) {
+    evconnlistener_disable(it.second.listener.get());
+    ip_stack_simulator_log.info("Stopped accepting connections on %s", it.second.name.c_str());
+  }
+}
+
 shared_ptr<IPStackSimulator::IPClient> IPStackSimulator::get_network(uint64_t network_id) const {
   return this->network_id_to_client.at(network_id);
 }
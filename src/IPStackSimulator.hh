@@ -91,6 +91,9 @@ public:
   void listen(const std::string& name, const std::string& addr, int port, Protocol protocol);
   void listen(const std::string& name, int port, Protocol protocol);
   void add_socket(const std::string& name, int fd, Protocol protocol);
+  // Stops accepting new connections, but doesn't close the listening sockets
+  // (they may have been handed off to another process)
+  void stop_listening();
 
   static uint32_t connect_address_for_remote_address(uint32_t remote_addr);
 
@@ -54,6 +54,7 @@ ItemCreator::ItemCreator(
       restrictions(restrictions),
       opt_rand_crypt(opt_rand_crypt ? make_shared<PSOV2Encryption>(opt_rand_crypt->seed()) : nullptr) {
   this->generate_unit_stars_tables();
+  this->compile_drop_tables();
 }
 
 void ItemCreator::set_random_crypt(shared_ptr<PSOLFGEncryption> new_random_crypt) {
@@ -70,9 +71,51 @@ void ItemCreator::set_section_id(uint8_t new_section_id) {
         abbreviation_for_difficulty(difficulty),
         this->section_id);
     this->pt = common_item_set->get_table(this->episode, this->mode, this->difficulty, this->section_id);
+    this->compile_drop_tables();
   }
 }
 
+void ItemCreator::compile_drop_tables() {
+  auto& c = this->compiled_tables;
+
+  c.enemy_rare_specs.clear();
+  for (size_t rt_index = 0; rt_index < c.enemy_rare_spec_offsets.size() - 1; rt_index++) {
+    c.enemy_rare_spec_offsets[rt_index] = c.enemy_rare_specs.size();
+    for (const auto& spec : this->rare_item_set->get_enemy_specs(
+             this->mode, this->episode, this->difficulty, this->section_id, rt_index)) {
+      c.enemy_rare_specs.emplace_back(spec);
+    }
+  }
+  c.enemy_rare_spec_offsets.back() = c.enemy_rare_specs.size();
+
+  // Box specs are looked up by area number, which is area_norm + 1
+  c.box_rare_specs.clear();
+  for (size_t area_norm = 0; area_norm < c.box_rare_spec_offsets.size() - 1; area_norm++) {
+    c.box_rare_spec_offsets[area_norm] = c.box_rare_specs.size();
+    for (const auto& spec : this->rare_item_set->get_box_specs(
+             this->mode, this->episode, this->difficulty, this->section_id, area_norm + 1)) {
+      c.box_rare_specs.emplace_back(spec);
+    }
+  }
+  c.box_rare_spec_offsets.back() = c.box_rare_specs.size();
+
+  auto compile_weights = [&]<size_t NumValues, size_t NumAreas, typename IntT, size_t X, size_t Y>(
+                             array<array<uint64_t, NumValues>, NumAreas>& weights,
+                             const parray<parray<IntT, X>, Y>& tables) -> void {
+    static_assert((NumValues == Y) && (NumAreas == X), "compiled weights do not match table dimensions");
+    for (size_t area_norm = 0; area_norm < NumAreas; area_norm++) {
+      uint64_t total = 0;
+      for (size_t z = 0; z < NumValues; z++) {
+        total += tables[z][area_norm];
+        weights[area_norm][z] = total;
+      }
+    }
+  };
+  compile_weights(c.box_item_class_weights, this->pt->box_item_class_prob_table);
+  compile_weights(c.tool_class_weights, this->pt->tool_class_prob_table);
+  compile_weights(c.technique_index_weights, this->pt->technique_index_prob_table);
+}
+
 bool ItemCreator::are_rare_drops_allowed() const {
   // Note: The client has an additional check here, which appears to be a subtle
   // anti-cheating measure. There is a flag on the client, initially zero, which
@@ -144,35 +187,49 @@ uint8_t ItemCreator::normalize_area_number(uint8_t area) const {
 }
 
 ItemCreator::DropResult ItemCreator::on_box_item_drop(uint8_t area) {
+  DropResult res;
   try {
-    return this->on_box_item_drop_with_area_norm(this->normalize_area_number(area));
+    this->on_box_item_drop(res, area);
   } catch (const exception& e) {
     this->log.error("Exception in item creation: %s", e.what());
     return DropResult();
   }
+  return res;
 }
 
 ItemCreator::DropResult ItemCreator::on_monster_item_drop(uint32_t enemy_type, uint8_t area) {
+  DropResult res;
   try {
-    return this->on_monster_item_drop_with_area_norm(enemy_type, this->normalize_area_number(area));
+    this->on_monster_item_drop(res, enemy_type, area);
   } catch (const exception& e) {
     this->log.error("Exception in item creation: %s", e.what());
     return DropResult();
   }
+  return res;
+}
+
+void ItemCreator::on_box_item_drop(DropResult& res, uint8_t area) {
+  res = DropResult();
+  this->on_box_item_drop_with_area_norm(res, this->normalize_area_number(area));
 }
 
-ItemCreator::DropResult ItemCreator::on_box_item_drop_with_area_norm(uint8_t area_norm) {
+void ItemCreator::on_monster_item_drop(DropResult& res, uint32_t enemy_type, uint8_t area) {
+  res = DropResult();
+  this->on_monster_item_drop_with_area_norm(res, enemy_type, this->normalize_area_number(area));
+}
+
+void ItemCreator::on_box_item_drop_with_area_norm(DropResult& res, uint8_t area_norm) {
   this->log.info("Box drop checks for area_norm %02hhX", area_norm);
   if (this->opt_rand_crypt) {
     this->log.info("Random state: %08" PRIX32 " %08" PRIX32,
         this->opt_rand_crypt->seed(), this->opt_rand_crypt->absolute_offset());
   }
-  DropResult res;
   res.item = this->check_rare_specs_and_create_rare_box_item(area_norm);
   if (!res.item.empty()) {
     res.is_from_rare_table = true;
   } else {
-    uint8_t item_class = this->get_rand_from_weighted_tables_2d_vertical(this->pt->box_item_class_prob_table, area_norm);
+    uint8_t item_class = this->get_rand_from_compiled_weights(
+        this->compiled_tables.box_item_class_weights, this->pt->box_item_class_prob_table, area_norm);
     this->log.info("Item class is %02hhX", item_class);
     switch (item_class) {
       case 0: // Weapon
@@ -205,13 +262,12 @@ ItemCreator::DropResult ItemCreator::on_box_item_drop_with_area_norm(uint8_t are
       this->generate_common_item_variances(area_norm, res.item);
     }
   }
-  return res;
 }
 
-ItemCreator::DropResult ItemCreator::on_monster_item_drop_with_area_norm(uint32_t enemy_type, uint8_t area_norm) {
+void ItemCreator::on_monster_item_drop_with_area_norm(DropResult& res, uint32_t enemy_type, uint8_t area_norm) {
   if (enemy_type > 0x58) {
     this->log.warning("Invalid enemy type: %" PRIX32, enemy_type);
-    return DropResult();
+    return;
   }
   this->log.info("Enemy type: %" PRIX32 "", enemy_type);
   if (this->opt_rand_crypt) {
@@ -223,12 +279,11 @@ ItemCreator::DropResult ItemCreator::on_monster_item_drop_with_area_norm(uint32_
   uint8_t drop_sample = this->rand_int(100);
   if (drop_sample >= type_drop_prob) {
     this->log.info("Drop not chosen (%hhu >= %hhu)", drop_sample, type_drop_prob);
-    return DropResult();
+    return;
   } else {
     this->log.info("Drop chosen (%hhu < %hhu)", drop_sample, type_drop_prob);
   }
 
-  DropResult res;
   res.item = this->check_rare_spec_and_create_rare_enemy_item(enemy_type, area_norm);
   if (!res.item.empty()) {
     res.is_from_rare_table = true;
@@ -276,15 +331,13 @@ ItemCreator::DropResult ItemCreator::on_monster_item_drop_with_area_norm(uint32_
         res.item.data2d = this->choose_meseta_amount(this->pt->enemy_meseta_ranges, enemy_type) & 0xFFFF;
         break;
       default:
-        return res;
+        return;
     }
 
     if (res.item.data1[0] != 0x04) {
       this->generate_common_item_variances(area_norm, res.item);
     }
   }
-
-  return res;
 }
 
 ItemData ItemCreator::check_rare_specs_and_create_rare_box_item(uint8_t area_norm) {
@@ -293,8 +346,20 @@ ItemData ItemCreator::check_rare_specs_and_create_rare_box_item(uint8_t area_nor
     return item;
   }
 
-  auto rare_specs = this->rare_item_set->get_box_specs(
-      this->mode, this->episode, this->difficulty, this->section_id, area_norm + 1);
+  // Areas beyond the compiled range can only occur via BattleRules'
+  // box_drop_area; for those, we look up the specs directly
+  const auto& c = this->compiled_tables;
+  vector<RareItemSet::ExpandedDrop> uncompiled_specs;
+  span<const RareItemSet::ExpandedDrop> rare_specs;
+  if (area_norm < c.box_rare_spec_offsets.size() - 1) {
+    rare_specs = span<const RareItemSet::ExpandedDrop>(
+        c.box_rare_specs.data() + c.box_rare_spec_offsets[area_norm],
+        c.box_rare_spec_offsets[area_norm + 1] - c.box_rare_spec_offsets[area_norm]);
+  } else {
+    uncompiled_specs = this->rare_item_set->get_box_specs(
+        this->mode, this->episode, this->difficulty, this->section_id, area_norm + 1);
+    rare_specs = uncompiled_specs;
+  }
   for (const auto& spec : rare_specs) {
     item = this->check_rate_and_create_rare_item(spec, area_norm);
     if (!item.empty()) {
@@ -354,8 +419,10 @@ ItemData ItemCreator::check_rare_spec_and_create_rare_enemy_item(uint32_t enemy_
     // rare drop. In our implementation, they can have multiple rare drops if
     // JSONRareItemSet is used (the other RareItemSet implementations never
     // return multiple drops for an enemy type).
-    auto rare_specs = this->rare_item_set->get_enemy_specs(
-        this->mode, this->episode, this->difficulty, this->section_id, enemy_type);
+    const auto& c = this->compiled_tables;
+    span<const RareItemSet::ExpandedDrop> rare_specs(
+        c.enemy_rare_specs.data() + c.enemy_rare_spec_offsets[enemy_type],
+        c.enemy_rare_spec_offsets[enemy_type + 1] - c.enemy_rare_spec_offsets[enemy_type]);
     for (const auto& spec : rare_specs) {
       item = this->check_rate_and_create_rare_item(spec, area_norm);
       if (!item.empty()) {
@@ -687,7 +754,8 @@ void ItemCreator::generate_common_armor_slot_count(ItemData& item) {
 void ItemCreator::generate_common_tool_variances(uint32_t area_norm, ItemData& item) {
   item.clear();
 
-  uint8_t tool_class = this->get_rand_from_weighted_tables_2d_vertical(this->pt->tool_class_prob_table, area_norm);
+  uint8_t tool_class = this->get_rand_from_compiled_weights(
+      this->compiled_tables.tool_class_weights, this->pt->tool_class_prob_table, area_norm);
   if ((!is_v1_or_v2(this->logic_version) || (this->logic_version == Version::GC_NTE)) && (tool_class == 0x1A)) {
     tool_class = 0x73;
   }
@@ -712,7 +780,8 @@ void ItemCreator::generate_common_tool_variances(uint32_t area_norm, ItemData& i
   }
 
   if (item.data1[1] == 0x02) { // Tech disk
-    item.data1[4] = this->get_rand_from_weighted_tables_2d_vertical(this->pt->technique_index_prob_table, area_norm);
+    item.data1[4] = this->get_rand_from_compiled_weights(
+        this->compiled_tables.technique_index_weights, this->pt->technique_index_prob_table, area_norm);
     item.data1[2] = this->generate_tech_disk_level(item.data1[4], area_norm);
     this->clear_tool_item_if_invalid(item);
   }
@@ -970,6 +1039,30 @@ IntT ItemCreator::get_rand_from_weighted_tables_2d_vertical(const parray<parray<
   return ItemCreator::get_rand_from_weighted_tables<IntT>(tables[0].data(), offset, Y, X);
 }
 
+// This returns the same results as get_rand_from_weighted_tables_2d_vertical
+// (and consumes the same random values), but uses the cumulative weights
+// built by compile_drop_tables instead of summing the table on every call.
+template <size_t NumValues, size_t NumAreas, typename IntT, size_t X, size_t Y>
+size_t ItemCreator::get_rand_from_compiled_weights(
+    const array<array<uint64_t, NumValues>, NumAreas>& weights,
+    const parray<parray<IntT, X>, Y>& tables,
+    size_t offset) {
+  if (offset >= NumAreas) {
+    return this->get_rand_from_weighted_tables_2d_vertical(tables, offset);
+  }
+
+  const auto& area_weights = weights[offset];
+  uint64_t rand_max = area_weights.back();
+  if (rand_max == 0) {
+    throw runtime_error("weighted table is empty");
+  }
+  // The weights are nondecreasing, so this finds the first value whose
+  // cumulative weight is greater than x, just like the subtraction loop in
+  // get_rand_from_weighted_tables does
+  uint64_t x = this->rand_int(rand_max);
+  return upper_bound(area_weights.begin(), area_weights.end(), x) - area_weights.begin();
+}
+
 vector<ItemData> ItemCreator::generate_armor_shop_contents(size_t player_level) {
   vector<ItemData> shop;
   this->generate_armor_shop_armors(shop, player_level);
@@ -1715,6 +1808,13 @@ void ItemCreator::generate_weapon_shop_item_bonus2(ItemData& item, size_t player
 ItemCreator::DropResult ItemCreator::on_specialized_box_item_drop(
     uint8_t area, float def_z, uint32_t def0, uint32_t def1, uint32_t def2) {
   DropResult res;
+  this->on_specialized_box_item_drop(res, area, def_z, def0, def1, def2);
+  return res;
+}
+
+void ItemCreator::on_specialized_box_item_drop(
+    DropResult& res, uint8_t area, float def_z, uint32_t def0, uint32_t def1, uint32_t def2) {
+  res = DropResult();
   res.item = this->base_item_for_specialized_box(def0, def1, def2);
   if (def_z == 0.0f) {
     uint16_t type = res.item.data1w[0];
@@ -1722,7 +1822,6 @@ ItemCreator::DropResult ItemCreator::on_specialized_box_item_drop(
     res.item.data1w[0] = type;
     this->generate_common_item_variances(this->normalize_area_number(area), res.item);
   }
-  return res;
 }
 
 ItemData ItemCreator::base_item_for_specialized_box(uint32_t def0, uint32_t def1, uint32_t def2) const {
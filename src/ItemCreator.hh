@@ -1,6 +1,9 @@
 #pragma once
 
+#include <array>
 #include <memory>
+#include <span>
+#include <vector>
 
 #include "CommonItemSet.hh"
 #include "ItemParameterTable.hh"
@@ -39,8 +42,21 @@ public:
   DropResult on_box_item_drop(uint8_t area);
   DropResult on_specialized_box_item_drop(uint8_t area, float def_z, uint32_t def0, uint32_t def1, uint32_t def2);
 
+  // These are the same as the above functions, but they write the result to
+  // res instead of returning it, and they throw instead of logging an error
+  // and returning an empty result. They don't allocate any memory (unless the
+  // log level is INFO or lower, or a box area outside the compiled tables
+  // is given via BattleRules), so they're suitable for simulating many drops.
+  void on_monster_item_drop(DropResult& res, uint32_t enemy_type, uint8_t area);
+  void on_box_item_drop(DropResult& res, uint8_t area);
+  void on_specialized_box_item_drop(DropResult& res, uint8_t area, float def_z, uint32_t def0, uint32_t def1, uint32_t def2);
+
   ItemData base_item_for_specialized_box(uint32_t def0, uint32_t def1, uint32_t def2) const;
 
+  // Returns the area number used to index the drop tables (this is also the
+  // box area number used in the rare item set, minus 1)
+  uint8_t normalize_area_number(uint8_t area) const;
+
   std::vector<ItemData> generate_armor_shop_contents(size_t player_level);
   std::vector<ItemData> generate_tool_shop_contents(size_t player_level);
   std::vector<ItemData> generate_weapon_shop_contents(size_t player_level);
@@ -75,6 +91,28 @@ private:
   std::shared_ptr<const CommonItemSet::Table> pt;
   std::shared_ptr<const BattleRules> restrictions;
 
+  // Flattened copies of the rare specs and weighted tables that are used for
+  // every drop, for this ItemCreator's mode, episode, difficulty, and section
+  // ID. These are built when the ItemCreator is created or its section ID
+  // changes, so resolving a drop doesn't allocate or look anything up in the
+  // RareItemSet. The weighted tables are stored as cumulative weights indexed
+  // by [area_norm][value].
+  struct CompiledDropTables {
+    // The specs for rt_index are enemy_rare_specs[enemy_rare_spec_offsets[rt_index]]
+    // up to (but not including) enemy_rare_specs[enemy_rare_spec_offsets[rt_index + 1]].
+    // Box specs are organized the same way, but indexed by area_norm.
+    std::vector<RareItemSet::ExpandedDrop> enemy_rare_specs;
+    std::array<uint32_t, 0x59> enemy_rare_spec_offsets;
+    std::vector<RareItemSet::ExpandedDrop> box_rare_specs;
+    std::array<uint32_t, 0x13> box_rare_spec_offsets;
+    // The sums are 64-bit (as in get_rand_from_weighted_tables), since large
+    // weights in the table can add up to more than 0xFFFFFFFF
+    std::array<std::array<uint64_t, 7>, 10> box_item_class_weights;
+    std::array<std::array<uint64_t, 0x1C>, 10> tool_class_weights;
+    std::array<std::array<uint64_t, 0x13>, 10> technique_index_weights;
+  };
+  CompiledDropTables compiled_tables;
+
   struct UnitResult {
     uint8_t unit;
     int8_t modifier;
@@ -103,11 +141,11 @@ private:
   //   [0x10] - apparently unused
   std::shared_ptr<PSOLFGEncryption> opt_rand_crypt;
 
+  void compile_drop_tables();
   bool are_rare_drops_allowed() const;
-  uint8_t normalize_area_number(uint8_t area) const;
 
-  DropResult on_monster_item_drop_with_area_norm(uint32_t enemy_type, uint8_t area_norm);
-  DropResult on_box_item_drop_with_area_norm(uint8_t area_norm);
+  void on_monster_item_drop_with_area_norm(DropResult& res, uint32_t enemy_type, uint8_t area_norm);
+  void on_box_item_drop_with_area_norm(DropResult& res, uint8_t area_norm);
 
   uint32_t rand_int(uint64_t max);
   float rand_float_0_1_from_crypt();
@@ -184,4 +222,9 @@ private:
   template <typename IntT, size_t X, size_t Y>
   IntT get_rand_from_weighted_tables_2d_vertical(
       const parray<parray<IntT, X>, Y>& tables, size_t offset);
+  template <size_t NumValues, size_t NumAreas, typename IntT, size_t X, size_t Y>
+  size_t get_rand_from_compiled_weights(
+      const std::array<std::array<uint64_t, NumValues>, NumAreas>& weights,
+      const parray<parray<IntT, X>, Y>& tables,
+      size_t offset);
 };
@@ -1,34 +1,11 @@
 #include "ItemNameIndex.hh"
 
+#include <algorithm>
+
 #include "StaticGameData.hh"
 
 using namespace std;
 
-ItemNameIndex::ItemNameIndex(
-    std::shared_ptr<const ItemParameterTable> item_parameter_table,
-    std::shared_ptr<const ItemData::StackLimits> limits,
-    const std::vector<std::string>& name_coll)
-    : item_parameter_table(item_parameter_table),
-      limits(limits) {
-
-  for (uint32_t primary_identifier : item_parameter_table->compute_all_valid_primary_identifiers()) {
-    const string* name = nullptr;
-    try {
-      ItemData item = ItemData::from_primary_identifier(*this->limits, primary_identifier);
-      name = &name_coll.at(item_parameter_table->get_item_id(item));
-    } catch (const out_of_range&) {
-    }
-
-    if (name) {
-      auto meta = make_shared<ItemMetadata>();
-      meta->primary_identifier = primary_identifier;
-      meta->name = *name;
-      this->primary_identifier_index.emplace(meta->primary_identifier, meta);
-      this->name_index.emplace(tolower(meta->name), meta);
-    }
-  }
-}
-
 static const char* s_rank_name_characters = "\0ABCDEFGHIJKLMNOPQRSTUVWXYZ[\\]^_";
 
 // clang-format off
@@ -97,7 +74,193 @@ const array<const char*, 0x11> name_for_s_rank_special = {
     "King\'s",
 };
 
+ItemNameIndex::ItemNameIndex(
+    std::shared_ptr<const ItemParameterTable> item_parameter_table,
+    std::shared_ptr<const ItemData::StackLimits> limits,
+    const std::vector<std::string>& name_coll,
+    size_t max_description_cache_entries)
+    : item_parameter_table(item_parameter_table),
+      limits(limits),
+      max_description_cache_entries(max_description_cache_entries) {
+
+  for (uint32_t primary_identifier : item_parameter_table->compute_all_valid_primary_identifiers()) {
+    const string* name = nullptr;
+    try {
+      ItemData item = ItemData::from_primary_identifier(*this->limits, primary_identifier);
+      name = &name_coll.at(item_parameter_table->get_item_id(item));
+    } catch (const out_of_range&) {
+    }
+
+    if (name) {
+      auto meta = make_shared<ItemMetadata>();
+      meta->primary_identifier = primary_identifier;
+      meta->name = *name;
+      this->primary_identifier_index.emplace(meta->primary_identifier, meta);
+      this->name_index.emplace(tolower(meta->name), meta);
+    }
+  }
+
+  for (const auto& it : this->name_index) {
+    this->name_prefix_tree.add(it.first, it.second->primary_identifier);
+  }
+  this->name_prefix_tree.compile();
+  for (size_t z = 0; z < name_for_weapon_special.size(); z++) {
+    if (name_for_weapon_special[z]) {
+      this->special_prefix_tree.add(tolower(name_for_weapon_special[z]) + " ", z);
+    }
+  }
+  this->special_prefix_tree.compile();
+}
+
+ItemNameIndex::PrefixTree::PrefixTree() : nodes(1), uncompiled_edges(1) {}
+
+void ItemNameIndex::PrefixTree::add(const string& key, uint32_t value) {
+  uint32_t node_index = 0;
+  for (char ch : key) {
+    auto& node_edges = this->uncompiled_edges[node_index];
+    auto edge_it = find_if(node_edges.begin(), node_edges.end(), [&](const Edge& e) -> bool {
+      return e.ch == static_cast<uint8_t>(ch);
+    });
+    if (edge_it != node_edges.end()) {
+      node_index = edge_it->node_index;
+    } else {
+      uint32_t new_node_index = this->nodes.size();
+      node_edges.emplace_back(Edge{.ch = static_cast<uint8_t>(ch), .node_index = new_node_index});
+      this->nodes.emplace_back();
+      this->uncompiled_edges.emplace_back();
+      node_index = new_node_index;
+    }
+  }
+  if (this->nodes[node_index].value == NO_VALUE) {
+    this->nodes[node_index].value = value;
+  }
+}
+
+void ItemNameIndex::PrefixTree::compile() {
+  this->edges.clear();
+  for (size_t z = 0; z < this->nodes.size(); z++) {
+    auto& node_edges = this->uncompiled_edges[z];
+    sort(node_edges.begin(), node_edges.end(), [](const Edge& a, const Edge& b) -> bool {
+      return a.ch < b.ch;
+    });
+    this->nodes[z].edges_begin = this->edges.size();
+    this->edges.insert(this->edges.end(), node_edges.begin(), node_edges.end());
+    this->nodes[z].edges_end = this->edges.size();
+  }
+  this->uncompiled_edges.clear();
+  this->uncompiled_edges.shrink_to_fit();
+}
+
+pair<uint32_t, size_t> ItemNameIndex::PrefixTree::find_longest_prefix(string_view s) const {
+  pair<uint32_t, size_t> ret = make_pair(this->nodes[0].value, 0);
+  uint32_t node_index = 0;
+  for (size_t z = 0; z < s.size(); z++) {
+    const auto& node = this->nodes[node_index];
+    auto edges_begin = this->edges.begin() + node.edges_begin;
+    auto edges_end = this->edges.begin() + node.edges_end;
+    uint8_t ch = s[z];
+    auto edge_it = lower_bound(edges_begin, edges_end, ch, [](const Edge& e, uint8_t ch) -> bool {
+      return e.ch < ch;
+    });
+    if ((edge_it == edges_end) || (edge_it->ch != ch)) {
+      break;
+    }
+    node_index = edge_it->node_index;
+    if (this->nodes[node_index].value != NO_VALUE) {
+      ret = make_pair(this->nodes[node_index].value, z + 1);
+    }
+  }
+  return ret;
+}
+
+ItemNameIndex::DescriptionCacheKey::DescriptionCacheKey(const ItemData& item, bool include_color_escapes)
+    : data1_lo(item.data1d[0].load() | (static_cast<uint64_t>(item.data1d[1].load()) << 32)),
+      data1_hi_data2(item.data1d[2].load() | (static_cast<uint64_t>(item.data2d.load()) << 32)),
+      include_color_escapes(include_color_escapes) {}
+
+size_t ItemNameIndex::DescriptionCacheKeyHash::operator()(const DescriptionCacheKey& key) const {
+  // Most of the variation is in the low bytes of each half, so mix the halves
+  // before combining them
+  uint64_t h = key.data1_lo * 0x9E3779B97F4A7C15;
+  h ^= (h >> 32) ^ key.data1_hi_data2;
+  h *= 0xC2B2AE3D27D4EB4F;
+  return (h ^ (h >> 29)) + key.include_color_escapes;
+}
+
+const string* ItemNameIndex::find_cached_description_locked(const DescriptionCacheKey& key) const {
+  auto it = this->description_cache.find(key);
+  if (it == this->description_cache.end()) {
+    return nullptr;
+  }
+  this->description_cache_lru.splice(this->description_cache_lru.begin(), this->description_cache_lru, it->second.second);
+  return &it->second.first;
+}
+
+void ItemNameIndex::add_cached_description_locked(const DescriptionCacheKey& key, const string& description) const {
+  if (this->max_description_cache_entries == 0) {
+    return;
+  }
+  // Another thread may have described the same item while the lock wasn't
+  // held; in that case the existing entry is kept
+  auto emplace_ret = this->description_cache.emplace(key, make_pair(description, this->description_cache_lru.end()));
+  if (!emplace_ret.second) {
+    return;
+  }
+  this->description_cache_lru.emplace_front(key);
+  emplace_ret.first->second.second = this->description_cache_lru.begin();
+  while (this->description_cache.size() > this->max_description_cache_entries) {
+    this->description_cache.erase(this->description_cache_lru.back());
+    this->description_cache_lru.pop_back();
+  }
+}
+
 std::string ItemNameIndex::describe_item(const ItemData& item, bool include_color_escapes) const {
+  DescriptionCacheKey key(item, include_color_escapes);
+  {
+    lock_guard g(this->description_cache_lock);
+    const string* cached = this->find_cached_description_locked(key);
+    if (cached) {
+      return *cached;
+    }
+  }
+
+  // describe_item_uncached may throw; in that case nothing is cached
+  string ret = this->describe_item_uncached(item, include_color_escapes);
+  lock_guard g(this->description_cache_lock);
+  this->add_cached_description_locked(key, ret);
+  return ret;
+}
+
+std::vector<std::string> ItemNameIndex::describe_items(const std::vector<ItemData>& items, bool include_color_escapes) const {
+  vector<string> ret(items.size());
+  vector<size_t> uncached_indexes;
+  {
+    lock_guard g(this->description_cache_lock);
+    for (size_t z = 0; z < items.size(); z++) {
+      const string* cached = this->find_cached_description_locked(DescriptionCacheKey(items[z], include_color_escapes));
+      if (cached) {
+        ret[z] = *cached;
+      } else {
+        uncached_indexes.emplace_back(z);
+      }
+    }
+  }
+  if (uncached_indexes.empty()) {
+    return ret;
+  }
+
+  for (size_t z : uncached_indexes) {
+    ret[z] = this->describe_item_uncached(items[z], include_color_escapes);
+  }
+
+  lock_guard g(this->description_cache_lock);
+  for (size_t z : uncached_indexes) {
+    this->add_cached_description_locked(DescriptionCacheKey(items[z], include_color_escapes), ret[z]);
+  }
+  return ret;
+}
+
+std::string ItemNameIndex::describe_item_uncached(const ItemData& item, bool include_color_escapes) const {
   if (item.data1[0] == 0x04) {
     return string_printf("%s%" PRIu32 " Meseta", include_color_escapes ? "$C7" : "", item.data2d.load());
   }
@@ -354,10 +517,16 @@ std::string ItemNameIndex::describe_item(const ItemData& item, bool include_colo
 
 ItemData ItemNameIndex::parse_item_description(const std::string& desc) const {
   ItemData ret;
+  bool special_was_parsed = false;
   try {
-    ret = this->parse_item_description_phase(desc, false);
+    ret = this->parse_item_description_phase(desc, false, &special_was_parsed);
   } catch (const exception& e1) {
     try {
+      // The second phase only differs from the first if a weapon special was
+      // parsed, so it can't succeed otherwise
+      if (!special_was_parsed) {
+        throw;
+      }
       ret = this->parse_item_description_phase(desc, true);
     } catch (const exception& e2) {
       try {
@@ -377,7 +546,22 @@ ItemData ItemNameIndex::parse_item_description(const std::string& desc) const {
   return ret;
 }
 
-ItemData ItemNameIndex::parse_item_description_phase(const std::string& description, bool skip_special) const {
+vector<ItemData> ItemNameIndex::parse_item_descriptions(const vector<string>& descriptions) const {
+  unordered_map<string, ItemData> parsed;
+  vector<ItemData> ret;
+  ret.reserve(descriptions.size());
+  for (const auto& desc : descriptions) {
+    auto it = parsed.find(desc);
+    if (it == parsed.end()) {
+      it = parsed.emplace(desc, this->parse_item_description(desc)).first;
+    }
+    ret.emplace_back(it->second);
+  }
+  return ret;
+}
+
+ItemData ItemNameIndex::parse_item_description_phase(
+    const std::string& description, bool skip_special, bool* special_was_parsed) const {
   ItemData ret;
   ret.data1d.clear(0);
   ret.id = 0xFFFFFFFF;
@@ -416,65 +600,53 @@ ItemData ItemNameIndex::parse_item_description_phase(const std::string& descript
     return ret;
   }
 
-  bool is_wrapped = starts_with(desc, "wrapped ");
+  // The prefixes (wrapped, unidentified, special, and item name) are parsed
+  // from a view of desc, so no intermediate strings are created
+  string_view remaining = desc;
+  bool is_wrapped = remaining.starts_with("wrapped ");
   if (is_wrapped) {
-    desc = desc.substr(8);
+    remaining.remove_prefix(8);
   }
-  bool is_unidentified = starts_with(desc, "?");
+  bool is_unidentified = remaining.starts_with("?");
   if (is_unidentified) {
     size_t z;
-    for (z = 1; z < desc.size(); z++) {
-      if (desc[z] != ' ' && desc[z] != '?') {
+    for (z = 1; z < remaining.size(); z++) {
+      if (remaining[z] != ' ' && remaining[z] != '?') {
         break;
       }
     }
-    desc = desc.substr(z);
+    remaining.remove_prefix(z);
   }
 
   // TODO: It'd be nice to be able to parse S-rank weapon specials here too.
   uint8_t weapon_special = 0;
   if (!skip_special) {
-    for (size_t z = 0; z < name_for_weapon_special.size(); z++) {
-      if (!name_for_weapon_special[z]) {
-        continue;
-      }
-      string prefix = tolower(name_for_weapon_special[z]);
-      prefix += ' ';
-      if (starts_with(desc, prefix)) {
-        weapon_special = z;
-        desc = desc.substr(prefix.size());
-        break;
+    auto special_match = this->special_prefix_tree.find_longest_prefix(remaining);
+    if (special_match.first != PrefixTree::NO_VALUE) {
+      weapon_special = special_match.first;
+      remaining.remove_prefix(special_match.second);
+      if (special_was_parsed) {
+        *special_was_parsed = true;
       }
     }
   }
 
-  auto name_it = this->name_index.lower_bound(desc);
-  // Look up to 3 places before the lower bound. We have to do this to catch
-  // cases like Sange vs. Sange & Yasha - if the input is like "Sange 0/...",
-  // then we'll see Sange & Yasha first, which we should skip.
-  size_t lookback = 0;
-  while (lookback < 4) {
-    if (name_it != this->name_index.end() && desc.starts_with(name_it->first)) {
-      break;
-    } else if (name_it == this->name_index.begin()) {
-      throw runtime_error("no such item");
-    } else {
-      name_it--;
-      lookback++;
-    }
-  }
-  if (lookback >= 4) {
-    throw runtime_error("item not found: " + desc);
+  // This finds the longest matching name, which handles cases like Sange vs.
+  // Sange & Yasha - if the input is like "Sange 0/...", then Sange & Yasha
+  // doesn't match, but Sange does.
+  auto name_match = this->name_prefix_tree.find_longest_prefix(remaining);
+  if (name_match.first == PrefixTree::NO_VALUE) {
+    throw runtime_error("item not found: " + string(remaining));
   }
-
-  desc = desc.substr(name_it->first.size());
-  if (starts_with(desc, " ")) {
-    desc = desc.substr(1);
+  remaining.remove_prefix(name_match.second);
+  if (remaining.starts_with(" ")) {
+    remaining.remove_prefix(1);
   }
+  desc.erase(0, desc.size() - remaining.size());
 
   // Tech disks should have already been handled above, so we don't need to
   // special-case 0302xxxx identifiers here.
-  uint32_t primary_identifier = name_it->second->primary_identifier;
+  uint32_t primary_identifier = name_match.first;
   ret.data1[0] = (primary_identifier >> 24) & 0xFF;
   ret.data1[1] = (primary_identifier >> 16) & 0xFF;
   ret.data1[2] = (primary_identifier >> 8) & 0xFF;
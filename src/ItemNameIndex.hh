@@ -3,9 +3,12 @@
 #include <stdint.h>
 
 #include <array>
+#include <list>
 #include <memory>
+#include <mutex>
 #include <phosg/JSON.hh>
 #include <string>
+#include <string_view>
 #include <unordered_map>
 #include <vector>
 
@@ -22,7 +25,13 @@ public:
   ItemNameIndex(
       std::shared_ptr<const ItemParameterTable> pmt,
       std::shared_ptr<const ItemData::StackLimits> limits,
-      const std::vector<std::string>& name_coll);
+      const std::vector<std::string>& name_coll,
+      size_t max_description_cache_entries = 0x1000);
+  ItemNameIndex(const ItemNameIndex&) = delete;
+  ItemNameIndex(ItemNameIndex&&) = delete;
+  ItemNameIndex& operator=(const ItemNameIndex&) = delete;
+  ItemNameIndex& operator=(ItemNameIndex&&) = delete;
+  ~ItemNameIndex() = default;
 
   inline size_t entry_count() const {
     return this->primary_identifier_index.size();
@@ -35,17 +44,94 @@ public:
     return this->name_index;
   }
 
+  // Descriptions are cached, keyed on the item's contents (data1 and data2;
+  // the item ID is ignored), so describing the same item repeatedly (as the
+  // HTTP server does when it's polled) is cheap. describe_items describes
+  // many items at once, taking the cache's lock only twice in total. Both of
+  // these functions are thread-safe.
   std::string describe_item(const ItemData& item, bool include_color_escapes = false) const;
+  std::vector<std::string> describe_items(const std::vector<ItemData>& items, bool include_color_escapes = false) const;
   ItemData parse_item_description(const std::string& description) const;
+  // Parses many descriptions at once, returning the results in the same
+  // order. Each distinct description is only parsed once, which helps when
+  // loading rare item tables (which repeat the same descriptions many times).
+  std::vector<ItemData> parse_item_descriptions(const std::vector<std::string>& descriptions) const;
 
   void print_table(FILE* stream) const;
 
 private:
-  ItemData parse_item_description_phase(const std::string& description, bool skip_special) const;
+  // Finds the longest key that is a prefix of a string, without allocating
+  // or copying anything. Keys are added with add(); compile() must then be
+  // called before find_longest_prefix() is used. compile() packs the children
+  // of each node into a contiguous range (sorted by character) of a single
+  // array of edges.
+  class PrefixTree {
+  public:
+    static constexpr uint32_t NO_VALUE = 0xFFFFFFFF;
+
+    PrefixTree();
+    ~PrefixTree() = default;
+
+    // If the key is already present, its value is not changed
+    void add(const std::string& key, uint32_t value);
+    void compile();
+
+    // Returns the value and length of the longest key that is a prefix of s,
+    // or (NO_VALUE, 0) if there is no such key
+    std::pair<uint32_t, size_t> find_longest_prefix(std::string_view s) const;
+
+  private:
+    struct Edge {
+      uint8_t ch;
+      uint32_t node_index;
+    };
+    struct Node {
+      uint32_t edges_begin = 0;
+      uint32_t edges_end = 0;
+      uint32_t value = NO_VALUE;
+    };
+    std::vector<Node> nodes;
+    std::vector<Edge> edges;
+    std::vector<std::vector<Edge>> uncompiled_edges; // Empty after compile()
+  };
+
+  struct DescriptionCacheKey {
+    uint64_t data1_lo; // data1[0-7]
+    uint64_t data1_hi_data2; // data1[8-11] and data2[0-3]
+    bool include_color_escapes;
+
+    DescriptionCacheKey(const ItemData& item, bool include_color_escapes);
+    bool operator==(const DescriptionCacheKey& other) const = default;
+  };
+  struct DescriptionCacheKeyHash {
+    size_t operator()(const DescriptionCacheKey& key) const;
+  };
+
+  std::string describe_item_uncached(const ItemData& item, bool include_color_escapes) const;
+  // The caller must hold description_cache_lock for both of these
+  const std::string* find_cached_description_locked(const DescriptionCacheKey& key) const;
+  void add_cached_description_locked(const DescriptionCacheKey& key, const std::string& description) const;
+
+  ItemData parse_item_description_phase(
+      const std::string& description, bool skip_special, bool* special_was_parsed = nullptr) const;
 
   std::shared_ptr<const ItemParameterTable> item_parameter_table;
   std::shared_ptr<const ItemData::StackLimits> limits;
 
   std::unordered_map<uint32_t, std::shared_ptr<const ItemMetadata>> primary_identifier_index;
   std::map<std::string, std::shared_ptr<const ItemMetadata>> name_index;
+  // Keys are lowercase item names; values are primary identifiers
+  PrefixTree name_prefix_tree;
+  // Keys are lowercase weapon special names followed by a space; values are
+  // special numbers
+  PrefixTree special_prefix_tree;
+
+  mutable std::mutex description_cache_lock;
+  size_t max_description_cache_entries;
+  mutable std::list<DescriptionCacheKey> description_cache_lru; // Most recently used first
+  mutable std::unordered_map<
+      DescriptionCacheKey,
+      std::pair<std::string, std::list<DescriptionCacheKey>::iterator>,
+      DescriptionCacheKeyHash>
+      description_cache;
 };
@@ -2,6 +2,21 @@
 
 using namespace std;
 
+struct ItemParameterTable::ParsedTables {
+  vector<WeaponV4> weapons;
+  vector<uint32_t> weapon_class_starts;
+  vector<ArmorOrShieldV4> armors_and_shields;
+  vector<uint32_t> armor_or_shield_class_starts;
+  vector<UnitV4> units;
+  vector<MagV4> mags;
+  vector<ToolV4> tools;
+  vector<uint32_t> tool_class_starts;
+  vector<Special> specials;
+  vector<uint8_t> item_stars;
+  vector<uint8_t> weapon_v1_replacements;
+  vector<float> weapon_sale_divisors;
+};
+
 ItemParameterTable::ItemParameterTable(shared_ptr<const string> data, Version version)
     : version(version),
       data(data),
@@ -107,6 +122,32 @@ ItemParameterTable::ItemParameterTable(shared_ptr<const string> data, Version ve
   }
 
   this->first_rare_mag_index = 0x28;
+
+  ParsedTables parsed;
+  if (this->offsets_dc_protos) {
+    this->parse_tables_t<WeaponDCProtos, ArmorOrShieldDCProtos, UnitDCProtos, MagV1, ToolV1V2, false>(
+        parsed, this->offsets_dc_protos);
+  } else if (this->offsets_v1_v2) {
+    if (is_v1(this->version)) {
+      this->parse_tables_t<WeaponV1V2, ArmorOrShieldV1V2, UnitV1V2, MagV1, ToolV1V2, false>(
+          parsed, this->offsets_v1_v2);
+    } else {
+      this->parse_tables_t<WeaponV1V2, ArmorOrShieldV1V2, UnitV1V2, MagV2, ToolV1V2, false>(
+          parsed, this->offsets_v1_v2);
+    }
+  } else if (this->offsets_gc_nte) {
+    this->parse_tables_t<WeaponGCNTE, ArmorOrShieldV3BE, UnitV3BE, MagV3BE, ToolV3BE, true>(
+        parsed, this->offsets_gc_nte);
+  } else if (this->offsets_v3_le) {
+    this->parse_tables_t<WeaponV3, ArmorOrShieldV3, UnitV3, MagV3, ToolV3, false>(parsed, this->offsets_v3_le);
+  } else if (this->offsets_v3_be) {
+    this->parse_tables_t<WeaponV3BE, ArmorOrShieldV3BE, UnitV3BE, MagV3BE, ToolV3BE, true>(parsed, this->offsets_v3_be);
+  } else if (this->offsets_v4) {
+    this->parse_tables_t<WeaponV4, ArmorOrShieldV4, UnitV4, MagV4, ToolV4, false>(parsed, this->offsets_v4);
+  } else {
+    throw logic_error("table is not v2, v3, or v4");
+  }
+  this->compile_tables(parsed);
 }
 
 set<uint32_t> ItemParameterTable::compute_all_valid_primary_identifiers() const {
@@ -414,384 +455,245 @@ ItemParameterTable::ToolV4 ItemParameterTable::ToolV3T<IsBigEndian>::to_v4() con
   return ret;
 }
 
-template <bool IsBigEndian>
-size_t indirect_lookup_2d_count(const StringReader& r, size_t root_offset, size_t co_index) {
+template <typename DefT, bool IsBigEndian, typename V4T>
+static void parse_definitions_2d(
+    vector<V4T>& defs, vector<uint32_t>& class_starts, const StringReader& r, size_t root_offset, size_t num_classes) {
   using ArrayRefT = typename std::conditional_t<IsBigEndian, ItemParameterTable::ArrayRefBE, ItemParameterTable::ArrayRef>;
-  return r.pget<ArrayRefT>(root_offset + sizeof(ArrayRefT) * co_index).count;
+
+  for (size_t z = 0; z < num_classes; z++) {
+    class_starts.emplace_back(defs.size());
+    const auto& co = r.pget<ArrayRefT>(root_offset + sizeof(ArrayRefT) * z);
+    if (co.count == 0) {
+      continue;
+    }
+    const auto* class_defs = &r.pget<DefT>(co.offset, sizeof(DefT) * co.count);
+    for (size_t y = 0; y < co.count; y++) {
+      if constexpr (std::is_same_v<DefT, V4T>) {
+        defs.emplace_back(class_defs[y]);
+      } else {
+        defs.emplace_back(class_defs[y].to_v4());
+      }
+    }
+  }
+  class_starts.emplace_back(defs.size());
 }
 
-template <typename T, bool IsBigEndian>
-const T& indirect_lookup_2d(const StringReader& r, size_t root_offset, size_t co_index, size_t item_index) {
-  using ArrayRefT = typename std::conditional_t<IsBigEndian, ItemParameterTable::ArrayRefBE, ItemParameterTable::ArrayRef>;
+template <typename WeaponT, typename ArmorOrShieldT, typename UnitT, typename MagT, typename ToolT, bool IsBigEndian, typename OffsetsT>
+void ItemParameterTable::parse_tables_t(ParsedTables& parsed, const OffsetsT* offsets) {
+  using FloatT = typename std::conditional<IsBigEndian, be_float, le_float>::type;
+
+  vector<uint32_t> unused_class_starts;
+  parse_definitions_2d<WeaponT, IsBigEndian>(
+      parsed.weapons, parsed.weapon_class_starts, this->r, offsets->weapon_table, this->num_weapon_classes);
+  parse_definitions_2d<ArmorOrShieldT, IsBigEndian>(
+      parsed.armors_and_shields, parsed.armor_or_shield_class_starts, this->r, offsets->armor_table, 2);
+  parse_definitions_2d<UnitT, IsBigEndian>(parsed.units, unused_class_starts, this->r, offsets->unit_table, 1);
+  parse_definitions_2d<MagT, IsBigEndian>(parsed.mags, unused_class_starts, this->r, offsets->mag_table, 1);
+  parse_definitions_2d<ToolT, IsBigEndian>(
+      parsed.tools, parsed.tool_class_starts, this->r, offsets->tool_table, this->num_tool_classes);
+
+  for (size_t z = 0; z < this->num_specials; z++) {
+    const auto& sp = this->r.pget<SpecialT<IsBigEndian>>(offsets->special_data_table + sizeof(SpecialT<IsBigEndian>) * z);
+    auto& sp_le = parsed.specials.emplace_back();
+    sp_le.type = sp.type.load();
+    sp_le.amount = sp.amount.load();
+  }
+
+  size_t num_item_stars = this->item_stars_last_id - this->item_stars_first_id;
+  const auto* stars = &this->r.pget<uint8_t>(offsets->star_value_table, num_item_stars);
+  parsed.item_stars.assign(stars, stars + num_item_stars);
+
+  const auto* v1_replacements = &this->r.pget<uint8_t>(offsets->v1_replacement_table, this->num_weapon_classes);
+  parsed.weapon_v1_replacements.assign(v1_replacements, v1_replacements + this->num_weapon_classes);
+
+  const auto* weapon_divisors = &this->r.pget<FloatT>(
+      offsets->weapon_sale_divisor_table, this->num_weapon_classes * sizeof(FloatT));
+  for (size_t z = 0; z < this->num_weapon_classes; z++) {
+    parsed.weapon_sale_divisors.emplace_back(weapon_divisors[z].load());
+  }
+
+  const auto& divisors = this->r.pget<NonWeaponSaleDivisorsT<IsBigEndian>>(offsets->sale_divisor_table);
+  this->non_weapon_sale_divisors.armor_divisor = divisors.armor_divisor.load();
+  this->non_weapon_sale_divisors.shield_divisor = divisors.shield_divisor.load();
+  this->non_weapon_sale_divisors.unit_divisor = divisors.unit_divisor.load();
+  this->non_weapon_sale_divisors.mag_divisor = divisors.mag_divisor.load();
+
+  const auto& feed_table_offsets = this->r.pget<MagFeedResultsListOffsetsT<IsBigEndian>>(offsets->mag_feed_table);
+  for (size_t z = 0; z < 8; z++) {
+    this->mag_feed_results[z] = this->r.pget<MagFeedResultsList>(feed_table_offsets.offsets[z]);
+  }
+
+  if constexpr (std::is_same_v<OffsetsT, TableOffsetsDCProtos> || std::is_same_v<OffsetsT, TableOffsetsV1V2>) {
+    // V1 and V2 don't have this table; the limits are hardcoded instead
+    for (size_t tech_num = 0; tech_num < 19; tech_num++) {
+      for (size_t char_class = 0; char_class < 12; char_class++) {
+        if ((tech_num == 14) || (tech_num == 17)) { // Ryuker or Reverser
+          this->max_tech_levels[tech_num][char_class] = 0;
+        } else {
+          bool is_force = ((char_class == 6) || (char_class == 7) || (char_class == 8) || (char_class == 10));
+          this->max_tech_levels[tech_num][char_class] = is_force ? 29 : 14;
+        }
+      }
+    }
+  } else {
+    this->max_tech_levels = this->r.pget<MaxTechniqueLevels>(offsets->max_tech_level_table);
+  }
+
+  // GC NTE has a combination table, but we don't use it (as before)
+  if constexpr (std::is_same_v<OffsetsT, TableOffsetsV3V4> || std::is_same_v<OffsetsT, TableOffsetsV3V4BE>) {
+    const auto& co = this->r.pget<ArrayRefT<IsBigEndian>>(offsets->combination_table);
+    const auto* defs = &this->r.pget<ItemCombination>(co.offset, co.count * sizeof(ItemCombination));
+    for (size_t z = 0; z < co.count; z++) {
+      const auto& def = defs[z];
+      uint32_t key = (def.used_item[0] << 16) | (def.used_item[1] << 8) | def.used_item[2];
+      this->item_combination_index[key].emplace_back(def);
+    }
+  }
+}
 
-  const auto& co = r.pget<ArrayRefT>(root_offset + sizeof(ArrayRefT) * co_index);
-  if (item_index >= co.count) {
+void ItemParameterTable::compile_tables(const ParsedTables& parsed) {
+  // The first pass computes the offset of each array within compiled_data;
+  // the second pass copies the arrays into it
+  uint8_t* base = nullptr;
+  size_t offset = 0;
+  auto place = [&]<typename T>(span<const T>& dest, const vector<T>& src) -> void {
+    if (base) {
+      T* items = reinterpret_cast<T*>(base + offset);
+      uninitialized_copy(src.begin(), src.end(), items);
+      dest = span<const T>(items, src.size());
+    }
+    offset += ((src.size() * sizeof(T)) + sizeof(CacheLine) - 1) & ~(sizeof(CacheLine) - 1);
+  };
+  for (size_t pass = 0; pass < 2; pass++) {
+    offset = 0;
+    place(this->weapons, parsed.weapons);
+    place(this->weapon_class_starts, parsed.weapon_class_starts);
+    place(this->armors_and_shields, parsed.armors_and_shields);
+    place(this->armor_or_shield_class_starts, parsed.armor_or_shield_class_starts);
+    place(this->units, parsed.units);
+    place(this->mags, parsed.mags);
+    place(this->tools, parsed.tools);
+    place(this->tool_class_starts, parsed.tool_class_starts);
+    place(this->specials, parsed.specials);
+    place(this->item_stars, parsed.item_stars);
+    place(this->weapon_v1_replacements, parsed.weapon_v1_replacements);
+    place(this->weapon_sale_divisors, parsed.weapon_sale_divisors);
+    if (pass == 0) {
+      this->compiled_data = make_unique<CacheLine[]>(offset / sizeof(CacheLine));
+      base = reinterpret_cast<uint8_t*>(this->compiled_data.get());
+    }
+  }
+
+  for (size_t data1_1 = 0; data1_1 < this->num_tool_classes; data1_1++) {
+    for (size_t index = this->tool_class_starts[data1_1]; index < this->tool_class_starts[data1_1 + 1]; index++) {
+      this->tool_index_for_id.emplace(
+          this->tools[index].base.id, make_pair(data1_1, index - this->tool_class_starts[data1_1]));
+    }
+  }
+}
+
+template <typename T>
+static const T& lookup_compiled_2d(span<const T> defs, span<const uint32_t> class_starts, size_t co_index, size_t item_index) {
+  size_t index = class_starts[co_index] + item_index;
+  if (index >= class_starts[co_index + 1]) {
     throw out_of_range("item ID out of range");
   }
-  return r.pget<T>(co.offset + sizeof(T) * item_index);
+  return defs[index];
 }
 
 size_t ItemParameterTable::num_weapons_in_class(uint8_t data1_1) const {
   if (data1_1 >= this->num_weapon_classes) {
     throw out_of_range("weapon ID out of range");
   }
-  if (this->offsets_dc_protos) {
-    return indirect_lookup_2d_count<false>(this->r, this->offsets_dc_protos->weapon_table, data1_1);
-  } else if (this->offsets_v1_v2) {
-    return indirect_lookup_2d_count<false>(this->r, this->offsets_v1_v2->weapon_table, data1_1);
-  } else if (this->offsets_gc_nte) {
-    return indirect_lookup_2d_count<true>(this->r, this->offsets_gc_nte->weapon_table, data1_1);
-  } else if (this->offsets_v3_le) {
-    return indirect_lookup_2d_count<false>(this->r, this->offsets_v3_le->weapon_table, data1_1);
-  } else if (this->offsets_v3_be) {
-    return indirect_lookup_2d_count<true>(this->r, this->offsets_v3_be->weapon_table, data1_1);
-  } else if (this->offsets_v4) {
-    return indirect_lookup_2d_count<false>(this->r, this->offsets_v4->weapon_table, data1_1);
-  } else {
-    throw logic_error("table is not v2, v3, or v4");
-  }
+  return this->weapon_class_starts[data1_1 + 1] - this->weapon_class_starts[data1_1];
 }
 
 const ItemParameterTable::WeaponV4& ItemParameterTable::get_weapon(uint8_t data1_1, uint8_t data1_2) const {
   if (data1_1 >= this->num_weapon_classes) {
     throw out_of_range("weapon ID out of range");
   }
-
-  if (this->offsets_v4) {
-    return indirect_lookup_2d<WeaponV4, false>(this->r, this->offsets_v4->weapon_table, data1_1, data1_2);
-  }
-
-  uint16_t key = (data1_1 << 8) | data1_2;
-  try {
-    return this->parsed_weapons.at(key);
-  } catch (const std::out_of_range&) {
-    WeaponV4 def_v4;
-    if (this->offsets_dc_protos) {
-      def_v4 = indirect_lookup_2d<WeaponDCProtos, false>(this->r, this->offsets_dc_protos->weapon_table, data1_1, data1_2).to_v4();
-    } else if (this->offsets_v1_v2) {
-      def_v4 = indirect_lookup_2d<WeaponV1V2, false>(this->r, this->offsets_v1_v2->weapon_table, data1_1, data1_2).to_v4();
-    } else if (this->offsets_gc_nte) {
-      def_v4 = indirect_lookup_2d<WeaponGCNTE, true>(this->r, this->offsets_gc_nte->weapon_table, data1_1, data1_2).to_v4();
-    } else if (this->offsets_v3_le) {
-      def_v4 = indirect_lookup_2d<WeaponV3, false>(this->r, this->offsets_v3_le->weapon_table, data1_1, data1_2).to_v4();
-    } else if (this->offsets_v3_be) {
-      def_v4 = indirect_lookup_2d<WeaponV3BE, true>(this->r, this->offsets_v3_be->weapon_table, data1_1, data1_2).to_v4();
-    } else {
-      throw logic_error("table is not v2, v3, or v4");
-    }
-    return this->parsed_weapons.emplace(key, def_v4).first->second;
-  }
+  return lookup_compiled_2d(this->weapons, this->weapon_class_starts, data1_1, data1_2);
 }
 
 size_t ItemParameterTable::num_armors_or_shields_in_class(uint8_t data1_1) const {
   if ((data1_1 < 1) || (data1_1 > 2)) {
     throw out_of_range("armor/shield class ID out of range");
   }
-  if (this->offsets_dc_protos) {
-    return indirect_lookup_2d_count<false>(this->r, this->offsets_dc_protos->armor_table, data1_1 - 1);
-  } else if (this->offsets_v1_v2) {
-    return indirect_lookup_2d_count<false>(this->r, this->offsets_v1_v2->armor_table, data1_1 - 1);
-  } else if (this->offsets_gc_nte) {
-    return indirect_lookup_2d_count<true>(this->r, this->offsets_gc_nte->armor_table, data1_1 - 1);
-  } else if (this->offsets_v3_le) {
-    return indirect_lookup_2d_count<false>(this->r, this->offsets_v3_le->armor_table, data1_1 - 1);
-  } else if (this->offsets_v3_be) {
-    return indirect_lookup_2d_count<true>(this->r, this->offsets_v3_be->armor_table, data1_1 - 1);
-  } else if (this->offsets_v4) {
-    return indirect_lookup_2d_count<false>(this->r, this->offsets_v4->armor_table, data1_1 - 1);
-  } else {
-    throw logic_error("table is not v2, v3, or v4");
-  }
+  return this->armor_or_shield_class_starts[data1_1] - this->armor_or_shield_class_starts[data1_1 - 1];
 }
 
 const ItemParameterTable::ArmorOrShieldV4& ItemParameterTable::get_armor_or_shield(uint8_t data1_1, uint8_t data1_2) const {
   if ((data1_1 < 1) || (data1_1 > 2)) {
     throw out_of_range("armor/shield class ID out of range");
   }
-
-  if (this->offsets_v4) {
-    return indirect_lookup_2d<ArmorOrShieldV4, false>(this->r, this->offsets_v4->armor_table, data1_1 - 1, data1_2);
-  }
-
-  auto& parsed_vec = (data1_1 == 2) ? this->parsed_shields : this->parsed_armors;
-  try {
-    const auto& ret = parsed_vec.at(data1_2);
-    if (ret.base.id == 0xFFFFFFFF) {
-      throw out_of_range("cache entry not populated");
-    }
-    return ret;
-  } catch (const std::out_of_range&) {
-    ArmorOrShieldV4 def_v4;
-
-    if (this->offsets_dc_protos) {
-      def_v4 = indirect_lookup_2d<ArmorOrShieldDCProtos, false>(this->r, this->offsets_dc_protos->armor_table, data1_1 - 1, data1_2).to_v4();
-    } else if (this->offsets_v1_v2) {
-      def_v4 = indirect_lookup_2d<ArmorOrShieldV1V2, false>(this->r, this->offsets_v1_v2->armor_table, data1_1 - 1, data1_2).to_v4();
-    } else if (this->offsets_gc_nte) {
-      def_v4 = indirect_lookup_2d<ArmorOrShieldV3BE, true>(this->r, this->offsets_gc_nte->armor_table, data1_1 - 1, data1_2).to_v4();
-    } else if (this->offsets_v3_le) {
-      def_v4 = indirect_lookup_2d<ArmorOrShieldV3, false>(this->r, this->offsets_v3_le->armor_table, data1_1 - 1, data1_2).to_v4();
-    } else if (this->offsets_v3_be) {
-      def_v4 = indirect_lookup_2d<ArmorOrShieldV3BE, true>(this->r, this->offsets_v3_be->armor_table, data1_1 - 1, data1_2).to_v4();
-    } else {
-      throw logic_error("table is not v2, v3, or v4");
-    }
-    if (data1_2 >= parsed_vec.size()) {
-      parsed_vec.resize(data1_2 + 1);
-    }
-    parsed_vec[data1_2] = def_v4;
-    return parsed_vec[data1_2];
-  }
+  return lookup_compiled_2d(this->armors_and_shields, this->armor_or_shield_class_starts, data1_1 - 1, data1_2);
 }
 
 size_t ItemParameterTable::num_units() const {
-  if (this->offsets_dc_protos) {
-    return indirect_lookup_2d_count<false>(this->r, this->offsets_dc_protos->unit_table, 0);
-  } else if (this->offsets_v1_v2) {
-    return indirect_lookup_2d_count<false>(this->r, this->offsets_v1_v2->unit_table, 0);
-  } else if (this->offsets_gc_nte) {
-    return indirect_lookup_2d_count<true>(this->r, this->offsets_gc_nte->unit_table, 0);
-  } else if (this->offsets_v3_le) {
-    return indirect_lookup_2d_count<false>(this->r, this->offsets_v3_le->unit_table, 0);
-  } else if (this->offsets_v3_be) {
-    return indirect_lookup_2d_count<true>(this->r, this->offsets_v3_be->unit_table, 0);
-  } else if (this->offsets_v4) {
-    return indirect_lookup_2d_count<false>(this->r, this->offsets_v4->unit_table, 0);
-  } else {
-    throw logic_error("table is not v2, v3, or v4");
-  }
+  return this->units.size();
 }
 
 const ItemParameterTable::UnitV4& ItemParameterTable::get_unit(uint8_t data1_2) const {
-  if (this->offsets_v4) {
-    return indirect_lookup_2d<UnitV4, false>(this->r, this->offsets_v4->unit_table, 0, data1_2);
-  }
-
-  try {
-    const auto& ret = this->parsed_units.at(data1_2);
-    if (ret.base.id == 0xFFFFFFFF) {
-      throw out_of_range("cache entry not populated");
-    }
-    return ret;
-  } catch (const std::out_of_range&) {
-    UnitV4 def_v4;
-    if (this->offsets_dc_protos) {
-      def_v4 = indirect_lookup_2d<UnitDCProtos, false>(this->r, this->offsets_dc_protos->unit_table, 0, data1_2).to_v4();
-    } else if (this->offsets_v1_v2) {
-      def_v4 = indirect_lookup_2d<UnitV1V2, false>(this->r, this->offsets_v1_v2->unit_table, 0, data1_2).to_v4();
-    } else if (this->offsets_gc_nte) {
-      def_v4 = indirect_lookup_2d<UnitV3BE, true>(this->r, this->offsets_gc_nte->unit_table, 0, data1_2).to_v4();
-    } else if (this->offsets_v3_le) {
-      def_v4 = indirect_lookup_2d<UnitV3, false>(this->r, this->offsets_v3_le->unit_table, 0, data1_2).to_v4();
-    } else if (this->offsets_v3_be) {
-      def_v4 = indirect_lookup_2d<UnitV3BE, true>(this->r, this->offsets_v3_be->unit_table, 0, data1_2).to_v4();
-    } else {
-      throw logic_error("table is not v2, v3, or v4");
-    }
-    if (data1_2 >= this->parsed_units.size()) {
-      this->parsed_units.resize(data1_2 + 1);
-    }
-    this->parsed_units[data1_2] = def_v4;
-    return this->parsed_units[data1_2];
+  if (data1_2 >= this->units.size()) {
+    throw out_of_range("item ID out of range");
   }
+  return this->units[data1_2];
 }
 
 size_t ItemParameterTable::num_mags() const {
-  if (this->offsets_dc_protos) {
-    return indirect_lookup_2d_count<false>(this->r, this->offsets_dc_protos->mag_table, 0);
-  } else if (this->offsets_v1_v2) {
-    return indirect_lookup_2d_count<false>(this->r, this->offsets_v1_v2->mag_table, 0);
-  } else if (this->offsets_gc_nte) {
-    return indirect_lookup_2d_count<true>(this->r, this->offsets_gc_nte->mag_table, 0);
-  } else if (this->offsets_v3_le) {
-    return indirect_lookup_2d_count<false>(this->r, this->offsets_v3_le->mag_table, 0);
-  } else if (this->offsets_v3_be) {
-    return indirect_lookup_2d_count<true>(this->r, this->offsets_v3_be->mag_table, 0);
-  } else if (this->offsets_v4) {
-    return indirect_lookup_2d_count<false>(this->r, this->offsets_v4->mag_table, 0);
-  } else {
-    throw logic_error("table is not v2, v3, or v4");
-  }
+  return this->mags.size();
 }
 
 const ItemParameterTable::MagV4& ItemParameterTable::get_mag(uint8_t data1_1) const {
-  if (this->offsets_v4) {
-    return indirect_lookup_2d<MagV4, false>(this->r, this->offsets_v4->mag_table, 0, data1_1);
-  }
-
-  try {
-    const auto& ret = this->parsed_mags.at(data1_1);
-    if (ret.base.id == 0xFFFFFFFF) {
-      throw out_of_range("cache entry not populated");
-    }
-    return ret;
-  } catch (const std::out_of_range&) {
-    MagV4 def_v4;
-    if (this->offsets_dc_protos) {
-      def_v4 = indirect_lookup_2d<MagV1, false>(this->r, this->offsets_dc_protos->mag_table, 0, data1_1).to_v4();
-    } else if (this->offsets_v1_v2) {
-      if (is_v1(this->version)) {
-        def_v4 = indirect_lookup_2d<MagV1, false>(this->r, this->offsets_v1_v2->mag_table, 0, data1_1).to_v4();
-      } else {
-        def_v4 = indirect_lookup_2d<MagV2, false>(this->r, this->offsets_v1_v2->mag_table, 0, data1_1).to_v4();
-      }
-    } else if (this->offsets_gc_nte) {
-      def_v4 = indirect_lookup_2d<MagV3BE, true>(this->r, this->offsets_gc_nte->mag_table, 0, data1_1).to_v4();
-    } else if (this->offsets_v3_le) {
-      def_v4 = indirect_lookup_2d<MagV3, false>(this->r, this->offsets_v3_le->mag_table, 0, data1_1).to_v4();
-    } else if (this->offsets_v3_be) {
-      def_v4 = indirect_lookup_2d<MagV3BE, true>(this->r, this->offsets_v3_be->mag_table, 0, data1_1).to_v4();
-    } else {
-      throw logic_error("table is not v2, v3, or v4");
-    }
-    if (data1_1 >= this->parsed_mags.size()) {
-      this->parsed_mags.resize(data1_1 + 1);
-    }
-    this->parsed_mags[data1_1] = def_v4;
-    return this->parsed_mags[data1_1];
+  if (data1_1 >= this->mags.size()) {
+    throw out_of_range("item ID out of range");
   }
+  return this->mags[data1_1];
 }
 
 size_t ItemParameterTable::num_tools_in_class(uint8_t data1_1) const {
   if (data1_1 >= this->num_tool_classes) {
     throw out_of_range("tool class ID out of range");
   }
-  if (this->offsets_dc_protos) {
-    return indirect_lookup_2d_count<false>(this->r, this->offsets_dc_protos->tool_table, data1_1);
-  } else if (this->offsets_v1_v2) {
-    return indirect_lookup_2d_count<false>(this->r, this->offsets_v1_v2->tool_table, data1_1);
-  } else if (this->offsets_gc_nte) {
-    return indirect_lookup_2d_count<true>(this->r, this->offsets_gc_nte->tool_table, data1_1);
-  } else if (this->offsets_v3_le) {
-    return indirect_lookup_2d_count<false>(this->r, this->offsets_v3_le->tool_table, data1_1);
-  } else if (this->offsets_v3_be) {
-    return indirect_lookup_2d_count<true>(this->r, this->offsets_v3_be->tool_table, data1_1);
-  } else if (this->offsets_v4) {
-    return indirect_lookup_2d_count<false>(this->r, this->offsets_v4->tool_table, data1_1);
-  } else {
-    throw logic_error("table is not v2, v3, or v4");
-  }
+  return this->tool_class_starts[data1_1 + 1] - this->tool_class_starts[data1_1];
 }
 
 const ItemParameterTable::ToolV4& ItemParameterTable::get_tool(uint8_t data1_1, uint8_t data1_2) const {
   if (data1_1 >= this->num_tool_classes) {
     throw out_of_range("tool class ID out of range");
   }
-
-  if (this->offsets_v4) {
-    return indirect_lookup_2d<ToolV4, false>(this->r, this->offsets_v4->tool_table, data1_1, data1_2);
-  }
-
-  uint16_t key = (data1_1 << 8) | data1_2;
-  try {
-    return this->parsed_tools.at(key);
-  } catch (const std::out_of_range&) {
-    ToolV4 def_v4;
-
-    if (this->offsets_dc_protos) {
-      def_v4 = indirect_lookup_2d<ToolV1V2, false>(this->r, this->offsets_dc_protos->tool_table, data1_1, data1_2).to_v4();
-    } else if (this->offsets_v1_v2) {
-      def_v4 = indirect_lookup_2d<ToolV1V2, false>(this->r, this->offsets_v1_v2->tool_table, data1_1, data1_2).to_v4();
-    } else if (this->offsets_gc_nte) {
-      def_v4 = indirect_lookup_2d<ToolV3BE, true>(this->r, this->offsets_gc_nte->tool_table, data1_1, data1_2).to_v4();
-    } else if (this->offsets_v3_le) {
-      def_v4 = indirect_lookup_2d<ToolV3, false>(this->r, this->offsets_v3_le->tool_table, data1_1, data1_2).to_v4();
-    } else if (this->offsets_v3_be) {
-      def_v4 = indirect_lookup_2d<ToolV3BE, true>(this->r, this->offsets_v3_be->tool_table, data1_1, data1_2).to_v4();
-    } else {
-      throw logic_error("table is not v2, v3, or v4");
-    }
-
-    return this->parsed_tools.emplace(key, def_v4).first->second;
-  }
-}
-
-template <typename ToolDefT, bool IsBigEndian>
-pair<uint8_t, uint8_t> ItemParameterTable::find_tool_by_id_t(uint32_t tool_table_offset, uint32_t item_id) const {
-  const auto* cos = &this->r.pget<ArrayRefT<IsBigEndian>>(
-      tool_table_offset, this->num_tool_classes * sizeof(ArrayRefT<IsBigEndian>));
-  for (size_t z = 0; z < this->num_tool_classes; z++) {
-    const auto& co = cos[z];
-    const auto* defs = &this->r.pget<ToolDefT>(co.offset, sizeof(ToolDefT) * co.count);
-    for (size_t y = 0; y < co.count; y++) {
-      if (defs[y].base.id == item_id) {
-        return make_pair(z, y);
-      }
-    }
-  }
-  throw out_of_range(string_printf("invalid tool class %08" PRIX32, item_id));
+  return lookup_compiled_2d(this->tools, this->tool_class_starts, data1_1, data1_2);
 }
 
 pair<uint8_t, uint8_t> ItemParameterTable::find_tool_by_id(uint32_t item_id) const {
-  if (this->offsets_dc_protos) {
-    return this->find_tool_by_id_t<ToolV1V2, false>(this->offsets_dc_protos->tool_table, item_id);
-  } else if (this->offsets_v1_v2) {
-    return this->find_tool_by_id_t<ToolV1V2, false>(this->offsets_v1_v2->tool_table, item_id);
-  } else if (this->offsets_gc_nte) {
-    return this->find_tool_by_id_t<ToolV3BE, true>(this->offsets_gc_nte->tool_table, item_id);
-  } else if (this->offsets_v3_le) {
-    return this->find_tool_by_id_t<ToolV3, false>(this->offsets_v3_le->tool_table, item_id);
-  } else if (this->offsets_v3_be) {
-    return this->find_tool_by_id_t<ToolV3BE, true>(this->offsets_v3_be->tool_table, item_id);
-  } else if (this->offsets_v4) {
-    return this->find_tool_by_id_t<ToolV4, false>(this->offsets_v4->tool_table, item_id);
-  } else {
-    throw logic_error("table is not v2, v3, or v4");
+  auto it = this->tool_index_for_id.find(item_id);
+  if (it == this->tool_index_for_id.end()) {
+    throw out_of_range(string_printf("invalid tool class %08" PRIX32, item_id));
   }
+  return it->second;
 }
 
-template <bool IsBigEndian, typename OffsetsT>
-float ItemParameterTable::get_sale_divisor_t(const OffsetsT* offsets, uint8_t data1_0, uint8_t data1_1) const {
-  using FloatT = typename std::conditional<IsBigEndian, be_float, le_float>::type;
-
+float ItemParameterTable::get_sale_divisor(uint8_t data1_0, uint8_t data1_1) const {
   switch (data1_0) {
     case 0:
-      if (data1_1 >= this->num_weapon_classes) {
-        return 0.0f;
-      }
-      return this->r.pget<FloatT>(offsets->weapon_sale_divisor_table + data1_1 * sizeof(FloatT));
-
-    case 1: {
-      const auto& divisors = this->r.pget<NonWeaponSaleDivisorsT<IsBigEndian>>(offsets->sale_divisor_table);
+      return (data1_1 < this->num_weapon_classes) ? this->weapon_sale_divisors[data1_1] : 0.0f;
+    case 1:
       switch (data1_1) {
         case 1:
-          return divisors.armor_divisor;
+          return this->non_weapon_sale_divisors.armor_divisor;
         case 2:
-          return divisors.shield_divisor;
+          return this->non_weapon_sale_divisors.shield_divisor;
         case 3:
-          return divisors.unit_divisor;
+          return this->non_weapon_sale_divisors.unit_divisor;
       }
       return 0.0f;
-    }
-
-    case 2: {
-      const auto& divisors = this->r.pget<NonWeaponSaleDivisorsT<IsBigEndian>>(offsets->sale_divisor_table);
-      return divisors.mag_divisor;
-    }
-
+    case 2:
+      return this->non_weapon_sale_divisors.mag_divisor;
     default:
       return 0.0f;
   }
 }
 
-float ItemParameterTable::get_sale_divisor(uint8_t data1_0, uint8_t data1_1) const {
-  if (this->offsets_dc_protos) {
-    return this->get_sale_divisor_t<false>(this->offsets_dc_protos, data1_0, data1_1);
-  } else if (this->offsets_v1_v2) {
-    return this->get_sale_divisor_t<false>(this->offsets_v1_v2, data1_0, data1_1);
-  } else if (this->offsets_gc_nte) {
-    return this->get_sale_divisor_t<true>(this->offsets_gc_nte, data1_0, data1_1);
-  } else if (this->offsets_v3_le) {
-    return this->get_sale_divisor_t<false>(this->offsets_v3_le, data1_0, data1_1);
-  } else if (this->offsets_v3_be) {
-    return this->get_sale_divisor_t<true>(this->offsets_v3_be, data1_0, data1_1);
-  } else if (this->offsets_v4) {
-    return this->get_sale_divisor_t<false>(this->offsets_v4, data1_0, data1_1);
-  } else {
-    throw logic_error("table is not v2, v3, or v4");
-  }
-}
-
 const ItemParameterTable::MagFeedResult& ItemParameterTable::get_mag_feed_result(
     uint8_t table_index, uint8_t item_index) const {
   if (table_index >= 8) {
@@ -800,53 +702,12 @@ const ItemParameterTable::MagFeedResult& ItemParameterTable::get_mag_feed_result
   if (item_index >= 11) {
     throw out_of_range("invalid mag feed item index");
   }
-
-  uint32_t offset;
-  if (this->offsets_dc_protos) {
-    const auto& table_offsets = this->r.pget<MagFeedResultsListOffsets>(this->offsets_dc_protos->mag_feed_table);
-    offset = table_offsets.offsets[table_index];
-  } else if (this->offsets_v1_v2) {
-    const auto& table_offsets = this->r.pget<MagFeedResultsListOffsets>(this->offsets_v1_v2->mag_feed_table);
-    offset = table_offsets.offsets[table_index];
-  } else if (this->offsets_gc_nte) {
-    const auto& table_offsets = this->r.pget<MagFeedResultsListOffsetsBE>(this->offsets_gc_nte->mag_feed_table);
-    offset = table_offsets.offsets[table_index];
-  } else if (this->offsets_v3_le) {
-    const auto& table_offsets = this->r.pget<MagFeedResultsListOffsets>(this->offsets_v3_le->mag_feed_table);
-    offset = table_offsets.offsets[table_index];
-  } else if (this->offsets_v3_be) {
-    const auto& table_offsets = this->r.pget<MagFeedResultsListOffsetsBE>(this->offsets_v3_be->mag_feed_table);
-    offset = table_offsets.offsets[table_index];
-  } else if (this->offsets_v4) {
-    const auto& table_offsets = this->r.pget<MagFeedResultsListOffsets>(this->offsets_v4->mag_feed_table);
-    offset = table_offsets.offsets[table_index];
-  } else {
-    throw logic_error("table is not v2, v3, or v4");
-  }
-
-  return this->r.pget<MagFeedResultsList>(offset)[item_index];
+  return this->mag_feed_results[table_index][item_index];
 }
 
 uint8_t ItemParameterTable::get_item_stars(uint32_t item_id) const {
-  uint32_t base_offset;
-  if (this->offsets_dc_protos) {
-    base_offset = this->offsets_dc_protos->star_value_table;
-  } else if (this->offsets_v1_v2) {
-    base_offset = this->offsets_v1_v2->star_value_table;
-  } else if (this->offsets_gc_nte) {
-    base_offset = this->offsets_gc_nte->star_value_table;
-  } else if (this->offsets_v3_le) {
-    base_offset = this->offsets_v3_le->star_value_table;
-  } else if (this->offsets_v3_be) {
-    base_offset = this->offsets_v3_be->star_value_table;
-  } else if (this->offsets_v4) {
-    base_offset = this->offsets_v4->star_value_table;
-  } else {
-    throw logic_error("table is not v2, v3, or v4");
-  }
-
   return ((item_id >= this->item_stars_first_id) && (item_id < this->item_stars_last_id))
-      ? this->r.pget_u8(base_offset + item_id - this->item_stars_first_id)
+      ? this->item_stars[item_id - this->item_stars_first_id]
       : 0;
 }
 
@@ -861,38 +722,7 @@ const ItemParameterTable::Special& ItemParameterTable::get_special(uint8_t speci
   if (special >= this->num_specials) {
     throw out_of_range("invalid special index");
   }
-
-  if (this->offsets_dc_protos) {
-    return this->r.pget<Special>(this->offsets_dc_protos->special_data_table + sizeof(Special) * special);
-  } else if (this->offsets_v1_v2) {
-    return this->r.pget<Special>(this->offsets_v1_v2->special_data_table + sizeof(Special) * special);
-  } else if (this->offsets_v3_le) {
-    return this->r.pget<Special>(this->offsets_v3_le->special_data_table + sizeof(Special) * special);
-  } else if (this->offsets_gc_nte) {
-    if ((special >= this->parsed_specials.size()) || (this->parsed_specials[special].type != 0xFFFF)) {
-      if (special >= this->parsed_specials.size()) {
-        this->parsed_specials.resize(special + 1);
-      }
-      const auto& sp_be = this->r.pget<SpecialBE>(this->offsets_gc_nte->special_data_table + sizeof(SpecialBE) * special);
-      this->parsed_specials[special].type = sp_be.type.load();
-      this->parsed_specials[special].amount = sp_be.amount.load();
-    }
-    return this->parsed_specials[special];
-  } else if (this->offsets_v3_be) {
-    if ((special >= this->parsed_specials.size()) || (this->parsed_specials[special].type != 0xFFFF)) {
-      if (special >= this->parsed_specials.size()) {
-        this->parsed_specials.resize(special + 1);
-      }
-      const auto& sp_be = this->r.pget<SpecialBE>(this->offsets_v3_be->special_data_table + sizeof(SpecialBE) * special);
-      this->parsed_specials[special].type = sp_be.type.load();
-      this->parsed_specials[special].amount = sp_be.amount.load();
-    }
-    return this->parsed_specials[special];
-  } else if (this->offsets_v4) {
-    return this->r.pget<Special>(this->offsets_v4->special_data_table + sizeof(Special) * special);
-  } else {
-    throw logic_error("table is not v2, v3, or v4");
-  }
+  return this->specials[special];
 }
 
 uint8_t ItemParameterTable::get_max_tech_level(uint8_t char_class, uint8_t tech_num) const {
@@ -902,47 +732,11 @@ uint8_t ItemParameterTable::get_max_tech_level(uint8_t char_class, uint8_t tech_
   if (tech_num >= 19) {
     throw out_of_range("invalid technique number");
   }
-
-  if (this->offsets_dc_protos || this->offsets_v1_v2) {
-    if ((tech_num == 14) || (tech_num == 17)) { // Ryuker or Reverser
-      return 0;
-    } else {
-      return ((char_class == 6) || (char_class == 7) || (char_class == 8) || (char_class == 10)) ? 29 : 14;
-    }
-  } else if (this->offsets_gc_nte) {
-    return r.pget_u8(this->offsets_gc_nte->max_tech_level_table + tech_num * 12 + char_class);
-  } else if (this->offsets_v3_le) {
-    return r.pget_u8(this->offsets_v3_le->max_tech_level_table + tech_num * 12 + char_class);
-  } else if (this->offsets_v3_be) {
-    return r.pget_u8(this->offsets_v3_be->max_tech_level_table + tech_num * 12 + char_class);
-  } else if (this->offsets_v4) {
-    return r.pget_u8(this->offsets_v4->max_tech_level_table + tech_num * 12 + char_class);
-  } else {
-    throw logic_error("table is not v2, v3, or v4");
-  }
+  return this->max_tech_levels[tech_num][char_class];
 }
 
 uint8_t ItemParameterTable::get_weapon_v1_replacement(uint8_t data1_1) const {
-  uint32_t offset;
-  if (this->offsets_dc_protos) {
-    offset = this->offsets_dc_protos->v1_replacement_table;
-  } else if (this->offsets_v1_v2) {
-    offset = this->offsets_v1_v2->v1_replacement_table;
-  } else if (this->offsets_gc_nte) {
-    offset = this->offsets_gc_nte->v1_replacement_table;
-  } else if (this->offsets_v3_le) {
-    offset = this->offsets_v3_le->v1_replacement_table;
-  } else if (this->offsets_v3_be) {
-    offset = this->offsets_v3_be->v1_replacement_table;
-  } else if (this->offsets_v4) {
-    offset = this->offsets_v4->v1_replacement_table;
-  } else {
-    throw logic_error("table is not v2, v3, or v4");
-  }
-
-  return (data1_1 < this->num_weapon_classes)
-      ? this->r.pget_u8(offset + data1_1)
-      : 0x00;
+  return (data1_1 < this->num_weapon_classes) ? this->weapon_v1_replacements[data1_1] : 0x00;
 }
 
 uint32_t ItemParameterTable::get_item_id(const ItemData& item) const {
@@ -1105,34 +899,6 @@ const std::vector<ItemParameterTable::ItemCombination>& ItemParameterTable::get_
 }
 
 const std::map<uint32_t, std::vector<ItemParameterTable::ItemCombination>>& ItemParameterTable::get_all_item_combinations() const {
-  if (this->item_combination_index.empty()) {
-    uint32_t offset, count;
-    if (this->offsets_dc_protos || this->offsets_v1_v2 || this->offsets_gc_nte) {
-      static const std::map<uint32_t, std::vector<ItemParameterTable::ItemCombination>> empty_map;
-      return empty_map;
-    } else if (this->offsets_v3_le) {
-      const auto& co = this->r.pget<ArrayRef>(this->offsets_v3_le->combination_table);
-      offset = co.offset;
-      count = co.count;
-    } else if (this->offsets_v3_be) {
-      const auto& co = this->r.pget<ArrayRefBE>(this->offsets_v3_be->combination_table);
-      offset = co.offset;
-      count = co.count;
-    } else if (this->offsets_v4) {
-      const auto& co = this->r.pget<ArrayRef>(this->offsets_v4->combination_table);
-      offset = co.offset;
-      count = co.count;
-    } else {
-      throw logic_error("table is not v2, v3, or v4");
-    }
-
-    const auto* defs = &this->r.pget<ItemCombination>(offset, count * sizeof(ItemCombination));
-    for (size_t z = 0; z < count; z++) {
-      const auto& def = defs[z];
-      uint32_t key = (def.used_item[0] << 16) | (def.used_item[1] << 8) | def.used_item[2];
-      this->item_combination_index[key].emplace_back(def);
-    }
-  }
   return this->item_combination_index;
 }
 
@@ -6,7 +6,9 @@
 #include <memory>
 #include <phosg/Encoding.hh>
 #include <set>
+#include <span>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 #include "ItemData.hh"
@@ -14,9 +16,12 @@
 
 class ItemParameterTable {
 public:
-  // TODO: This implementation is ugly. We should use real classes and virtual
-  // functions instead of manually branching on various offset table pointers
-  // being null or not in each public function. Rewrite this and make it better.
+  // All of the item definitions and the tables that are indexed by item
+  // (stars, specials, sale divisors, etc.) are converted to V4 formats when
+  // the table is constructed, so the accessors for them are simple array
+  // lookups and don't depend on the version. The item combination table is
+  // also read when the table is constructed, and is indexed by used item. The
+  // event and unsealable item tables are still read from the original data.
 
   template <bool IsBigEndian>
   struct ArrayRefT {
@@ -468,6 +473,10 @@ public:
   check_struct_size(NonWeaponSaleDivisorsBE, 0x10);
 
   ItemParameterTable(std::shared_ptr<const std::string> data, Version version);
+  ItemParameterTable(const ItemParameterTable&) = delete;
+  ItemParameterTable(ItemParameterTable&&) = delete;
+  ItemParameterTable& operator=(const ItemParameterTable&) = delete;
+  ItemParameterTable& operator=(ItemParameterTable&&) = delete;
   ~ItemParameterTable() = default;
 
   void print(FILE* stream) const;
@@ -630,24 +639,42 @@ private:
   const TableOffsetsV3V4BE* offsets_v3_be;
   const TableOffsetsV3V4* offsets_v4;
 
-  // These are unused if offsets_v4 is not null (in that case, we just return
-  // references pointing inside the data string)
-  mutable std::unordered_map<uint16_t, WeaponV4> parsed_weapons;
-  mutable std::vector<ArmorOrShieldV4> parsed_armors;
-  mutable std::vector<ArmorOrShieldV4> parsed_shields;
-  mutable std::vector<UnitV4> parsed_units;
-  mutable std::vector<MagV4> parsed_mags;
-  mutable std::unordered_map<uint16_t, ToolV4> parsed_tools;
-  mutable std::vector<Special> parsed_specials;
+  // The compiled tables. All of the variable-size arrays are stored in
+  // compiled_data (a single allocation), and each begins on a cache line
+  // boundary. The *_class_starts arrays give the index of the first
+  // definition in each class, and have one more entry than there are classes,
+  // so the definitions for class C are [starts[C], starts[C + 1]).
+  struct alignas(64) CacheLine {
+    uint8_t data[64];
+  };
+  std::unique_ptr<CacheLine[]> compiled_data;
+  std::span<const WeaponV4> weapons;
+  std::span<const uint32_t> weapon_class_starts;
+  std::span<const ArmorOrShieldV4> armors_and_shields;
+  std::span<const uint32_t> armor_or_shield_class_starts;
+  std::span<const UnitV4> units;
+  std::span<const MagV4> mags;
+  std::span<const ToolV4> tools;
+  std::span<const uint32_t> tool_class_starts;
+  std::span<const Special> specials;
+  std::span<const uint8_t> item_stars; // Indexed by (id - item_stars_first_id)
+  std::span<const uint8_t> weapon_v1_replacements;
+  std::span<const float> weapon_sale_divisors;
+  NonWeaponSaleDivisors non_weapon_sale_divisors;
+  parray<MagFeedResultsList, 8> mag_feed_results;
+  MaxTechniqueLevels max_tech_levels;
+  // Key is tool ID; value is (data1_1, data1_2) of the first tool with that ID
+  std::unordered_map<uint32_t, std::pair<uint8_t, uint8_t>> tool_index_for_id;
 
   // Key is used_item. We can't index on (used_item, equipped_item) because
   // equipped_item may contain wildcards, and the matching order matters.
-  mutable std::map<uint32_t, std::vector<ItemCombination>> item_combination_index;
+  std::map<uint32_t, std::vector<ItemCombination>> item_combination_index;
+
+  struct ParsedTables;
+  template <typename WeaponT, typename ArmorOrShieldT, typename UnitT, typename MagT, typename ToolT, bool IsBigEndian, typename OffsetsT>
+  void parse_tables_t(ParsedTables& parsed, const OffsetsT* offsets);
+  void compile_tables(const ParsedTables& parsed);
 
-  template <typename ToolDefT, bool IsBigEndian>
-  std::pair<uint8_t, uint8_t> find_tool_by_id_t(uint32_t tool_table_offset, uint32_t id) const;
-  template <bool IsBigEndian, typename OffsetsT>
-  float get_sale_divisor_t(const OffsetsT* offsets, uint8_t data1_0, uint8_t data1_1) const;
   template <bool IsBigEndian>
   size_t num_events_t(uint32_t base_offset) const;
   template <bool IsBigEndian>
@@ -2,6 +2,7 @@
 
 #include <string.h>
 
+#include <algorithm>
 #include <phosg/Random.hh>
 
 #include "Compression.hh"
@@ -17,69 +18,119 @@ bool Lobby::FloorItem::visible_to_client(uint8_t client_id) const {
 
 Lobby::FloorItemManager::FloorItemManager(uint32_t lobby_id, uint8_t floor)
     : log(string_printf("[Lobby:%08" PRIX32 ":FloorItems:%02hhX] ", lobby_id, floor), lobby_log.min_level),
-      next_drop_number(0) {}
+      next_drop_number(0) {
+  this->num_items_visible_to_client.fill(0);
+}
+
+size_t Lobby::FloorItemManager::lower_bound_index(uint32_t item_id) const {
+  auto it = lower_bound(this->items.begin(), this->items.end(), item_id, [](const FloorItem& fi, uint32_t id) -> bool {
+    return fi.data.id < id;
+  });
+  return it - this->items.begin();
+}
 
 bool Lobby::FloorItemManager::exists(uint32_t item_id) const {
-  return this->items.count(item_id);
+  size_t index = this->lower_bound_index(item_id);
+  return (index < this->items.size()) && (this->items[index].data.id == item_id);
 }
 
-shared_ptr<Lobby::FloorItem> Lobby::FloorItemManager::find(uint32_t item_id) const {
-  return this->items.at(item_id);
+const Lobby::FloorItem& Lobby::FloorItemManager::find(uint32_t item_id) const {
+  size_t index = this->lower_bound_index(item_id);
+  if ((index >= this->items.size()) || (this->items[index].data.id != item_id)) {
+    throw out_of_range("item not present");
+  }
+  return this->items[index];
 }
 
 void Lobby::FloorItemManager::add(const ItemData& item, float x, float z, uint16_t flags) {
-  auto fi = make_shared<FloorItem>();
-  fi->data = item;
-  fi->x = x;
-  fi->z = z;
-  fi->drop_number = this->next_drop_number++;
-  fi->flags = flags;
+  FloorItem fi;
+  fi.data = item;
+  fi.x = x;
+  fi.z = z;
+  fi.drop_number = this->next_drop_number++;
+  fi.flags = flags;
   this->add(fi);
 }
 
-void Lobby::FloorItemManager::add(shared_ptr<Lobby::FloorItem> fi) {
-  if (fi->flags == 0) {
+void Lobby::FloorItemManager::add(const FloorItem& fi) {
+  if (fi.flags == 0) {
     throw logic_error("floor item is not visible to any player");
   }
 
-  auto emplace_ret = this->items.emplace(fi->data.id, fi);
-  if (!emplace_ret.second) {
+  // Item IDs are usually allocated in increasing order, so this is almost
+  // always an append
+  size_t index = this->lower_bound_index(fi.data.id);
+  if ((index < this->items.size()) && (this->items[index].data.id == fi.data.id)) {
     throw runtime_error("floor item already exists with the same ID");
   }
+  this->items.emplace(this->items.begin() + index, fi);
   for (size_t z = 0; z < 12; z++) {
-    if (fi->visible_to_client(z)) {
-      this->queue_for_client[z].emplace(fi->drop_number, fi);
+    if (fi.visible_to_client(z)) {
+      this->num_items_visible_to_client[z]++;
     }
   }
   this->log.info("Added floor item %08" PRIX32 " at %g, %g with drop number %" PRIu64 " with flags %03hX",
-      fi->data.id.load(), fi->x, fi->z, fi->drop_number, fi->flags);
+      fi.data.id.load(), fi.x, fi.z, fi.drop_number, fi.flags);
+}
+
+Lobby::FloorItem Lobby::FloorItemManager::remove_at(size_t index) {
+  FloorItem fi = this->items[index];
+  this->items.erase(this->items.begin() + index);
+  for (size_t z = 0; z < 12; z++) {
+    if (fi.visible_to_client(z)) {
+      if (this->num_items_visible_to_client[z] == 0) {
+        throw logic_error("item count for client is inconsistent");
+      }
+      this->num_items_visible_to_client[z]--;
+    }
+  }
+  this->log.info("Removed floor item %08" PRIX32 " at %g, %g with drop number %" PRIu64 " with flags %03hX",
+      fi.data.id.load(), fi.x, fi.z, fi.drop_number, fi.flags);
+  return fi;
 }
 
-std::shared_ptr<Lobby::FloorItem> Lobby::FloorItemManager::remove(uint32_t item_id, uint8_t client_id) {
-  auto item_it = this->items.find(item_id);
-  if (item_it == this->items.end()) {
+Lobby::FloorItem Lobby::FloorItemManager::remove(uint32_t item_id, uint8_t client_id) {
+  size_t index = this->lower_bound_index(item_id);
+  if ((index >= this->items.size()) || (this->items[index].data.id != item_id)) {
     throw out_of_range("item not present");
   }
-  auto fi = item_it->second;
-  if ((client_id != 0xFF) && !fi->visible_to_client(client_id)) {
+  if ((client_id != 0xFF) && !this->items[index].visible_to_client(client_id)) {
     throw runtime_error("client does not have access to item");
   }
-  for (size_t z = 0; z < 12; z++) {
-    if (fi->visible_to_client(z) && !this->queue_for_client[z].erase(fi->drop_number)) {
-      throw logic_error("item queue for client is inconsistent");
+  return this->remove_at(index);
+}
+
+size_t Lobby::FloorItemManager::remove_if(function<bool(const FloorItem&)> pred) {
+  size_t num_removed = 0;
+  for (size_t z = 0; z < this->items.size();) {
+    if (pred(this->items[z])) {
+      this->remove_at(z);
+      num_removed++;
+    } else {
+      z++;
     }
   }
-  this->items.erase(item_it);
-  this->log.info("Removed floor item %08" PRIX32 " at %g, %g with drop number %" PRIu64 " with flags %03hX",
-      fi->data.id.load(), fi->x, fi->z, fi->drop_number, fi->flags);
-  return fi;
+  return num_removed;
 }
 
-std::unordered_set<std::shared_ptr<Lobby::FloorItem>> Lobby::FloorItemManager::evict() {
-  unordered_set<shared_ptr<FloorItem>> ret;
+vector<Lobby::FloorItem> Lobby::FloorItemManager::evict() {
+  // Each client can see at most 48 items on each floor; if there are more
+  // than that, the items with the lowest drop numbers are removed first
+  vector<FloorItem> ret;
   for (size_t z = 0; z < 12; z++) {
-    while (this->queue_for_client[z].size() > 48) {
-      ret.emplace(this->remove(this->queue_for_client[z].begin()->second->data.id, 0xFF));
+    while (this->num_items_visible_to_client[z] > 48) {
+      size_t oldest_index = this->items.size();
+      for (size_t index = 0; index < this->items.size(); index++) {
+        const auto& fi = this->items[index];
+        if (fi.visible_to_client(z) &&
+            ((oldest_index == this->items.size()) || (fi.drop_number < this->items[oldest_index].drop_number))) {
+          oldest_index = index;
+        }
+      }
+      if (oldest_index == this->items.size()) {
+        throw logic_error("item count for client is inconsistent");
+      }
+      ret.emplace_back(this->remove_at(oldest_index));
     }
   }
   this->log.info("Evicted %zu items", ret.size());
@@ -87,50 +138,32 @@ std::unordered_set<std::shared_ptr<Lobby::FloorItem>> Lobby::FloorItemManager::e
 }
 
 void Lobby::FloorItemManager::clear_inaccessible(uint16_t remaining_clients_mask) {
-  unordered_set<uint32_t> item_ids_to_delete;
-  for (const auto& it : this->items) {
-    if ((it.second->flags & remaining_clients_mask) == 0) {
-      item_ids_to_delete.emplace(it.first);
-    }
-  }
-  for (uint32_t item_id : item_ids_to_delete) {
-    this->remove(item_id, 0xFF);
-  }
-  this->log.info("Deleted %zu inaccessible items", item_ids_to_delete.size());
+  size_t num_removed = this->remove_if([&](const FloorItem& fi) -> bool {
+    return (fi.flags & remaining_clients_mask) == 0;
+  });
+  this->log.info("Deleted %zu inaccessible items", num_removed);
 }
 
 void Lobby::FloorItemManager::clear_private() {
-  unordered_set<uint32_t> item_ids_to_delete;
-  for (const auto& it : this->items) {
-    if ((it.second->flags & 0x00F) != 0x00F) {
-      item_ids_to_delete.emplace(it.first);
-    }
-  }
-  for (uint32_t item_id : item_ids_to_delete) {
-    this->remove(item_id, 0xFF);
-  }
-  this->log.info("Deleted %zu private items", item_ids_to_delete.size());
+  size_t num_removed = this->remove_if([&](const FloorItem& fi) -> bool {
+    return (fi.flags & 0x00F) != 0x00F;
+  });
+  this->log.info("Deleted %zu private items", num_removed);
 }
 
 void Lobby::FloorItemManager::clear() {
   size_t num_items = this->items.size();
   this->items.clear();
-  for (auto& queue : this->queue_for_client) {
-    queue.clear();
-  }
+  this->num_items_visible_to_client.fill(0);
   this->next_drop_number = 0;
   this->log.info("Deleted %zu items", num_items);
 }
 
 uint32_t Lobby::FloorItemManager::reassign_all_item_ids(uint32_t next_item_id) {
-  ::map<uint32_t, shared_ptr<FloorItem>> old_items;
-  old_items.swap(this->items);
-  for (auto& queue : this->queue_for_client) {
-    queue.clear();
-  }
-  for (auto& it : old_items) {
-    it.second->data.id = next_item_id++;
-    this->add(it.second);
+  // The new IDs are increasing in the same order as the old ones, so the items
+  // remain sorted
+  for (auto& fi : this->items) {
+    fi.data.id = next_item_id++;
   }
   return next_item_id;
 }
@@ -142,6 +175,7 @@ Lobby::Lobby(shared_ptr<ServerState> s, uint32_t id, bool is_game)
       min_level(0),
       max_level(0xFFFFFFFF),
       next_game_item_id(0xCC000000),
+      state_change_count(0),
       base_version(Version::GC_V3),
       allowed_versions(0x0000),
       override_section_id(0xFF),
@@ -211,43 +245,18 @@ void Lobby::set_drop_mode(DropMode new_mode) {
 void Lobby::create_item_creator() {
   auto s = this->require_server_state();
 
-  shared_ptr<const RareItemSet> rare_item_set;
-  shared_ptr<const CommonItemSet> common_item_set;
   switch (this->base_version) {
     case Version::PC_PATCH:
     case Version::BB_PATCH:
     case Version::GC_EP3_NTE:
     case Version::GC_EP3:
       throw runtime_error("cannot create item creator for this base version");
-    case Version::DC_NTE:
-    case Version::DC_V1_11_2000_PROTOTYPE:
-    case Version::DC_V1:
-      // TODO: We should probably have a v1 common item set at some point too
-      common_item_set = s->common_item_set_v2;
-      rare_item_set = s->rare_item_sets.at("rare-table-v1");
-      break;
-    case Version::DC_V2:
-    case Version::PC_NTE:
-    case Version::PC_V2:
-      common_item_set = s->common_item_set_v2;
-      rare_item_set = s->rare_item_sets.at("rare-table-v2");
-      break;
-    case Version::GC_NTE:
-    case Version::GC_V3:
-    case Version::XB_V3:
-      common_item_set = s->common_item_set_v3_v4;
-      rare_item_set = s->rare_item_sets.at("rare-table-v3");
-      break;
-    case Version::BB_V4:
-      common_item_set = s->common_item_set_v3_v4;
-      rare_item_set = s->rare_item_sets.at("rare-table-v4");
-      break;
     default:
-      throw logic_error("invalid lobby base version");
+      break;
   }
   this->item_creator = make_shared<ItemCreator>(
-      common_item_set,
-      rare_item_set,
+      s->common_item_set(this->base_version),
+      s->rare_item_set(this->base_version),
       s->armor_random_set,
       s->tool_random_set,
       s->weapon_random_sets.at(this->difficulty),
@@ -309,6 +318,7 @@ shared_ptr<Map> Lobby::load_maps(
       quest_dat_contents_decompressed->data(),
       quest_dat_contents_decompressed->size(),
       rare_rates);
+  map->build_indexes();
   return map;
 }
 
@@ -325,7 +335,8 @@ shared_ptr<Map> Lobby::load_maps(
     uint32_t random_seed,
     shared_ptr<PSOLFGEncryption> opt_rand_crypt,
     const parray<le_uint32_t, 0x20>& variations,
-    const PrefixedLogger* log) {
+    const PrefixedLogger* log,
+    shared_ptr<MapTemplateCache> template_cache) {
   auto enemy_filenames = sdt->map_filenames_for_variations(variations, episode, mode, SetDataTable::FilenameType::ENEMIES);
   auto object_filenames = sdt->map_filenames_for_variations(variations, episode, mode, SetDataTable::FilenameType::OBJECTS);
   auto event_filenames = sdt->map_filenames_for_variations(variations, episode, mode, SetDataTable::FilenameType::EVENTS);
@@ -343,38 +354,28 @@ shared_ptr<Map> Lobby::load_maps(
       rare_rates,
       random_seed,
       opt_rand_crypt,
-      log);
+      log,
+      template_cache);
 }
 
-shared_ptr<Map> Lobby::load_maps(
+static void add_free_roam_entities(
+    Map& map,
     const vector<string>& enemy_filenames,
     const vector<string>& object_filenames,
     const vector<string>& event_filenames,
     Version version,
     Episode episode,
-    GameMode mode,
     uint8_t difficulty,
     uint8_t event,
-    uint32_t lobby_id,
     function<shared_ptr<const string>(Version, const string&)> get_file_data,
     shared_ptr<const Map::RareEnemyRates> rare_rates,
-    uint32_t rare_seed,
-    shared_ptr<PSOLFGEncryption> opt_rand_crypt,
     const PrefixedLogger* log) {
-  auto map = make_shared<Map>(version, lobby_id, rare_seed, opt_rand_crypt);
-
-  // Don't load free-roam maps in Challenge mode, since players can't go to
-  // Ragol without a quest loaded
-  if (mode == GameMode::CHALLENGE) {
-    return map;
-  }
-
   for (size_t floor = 0; floor < 0x12; floor++) {
     const auto& floor_enemy_filename = enemy_filenames.at(floor);
     if (!floor_enemy_filename.empty()) {
       auto map_data = get_file_data(version, floor_enemy_filename);
       if (map_data) {
-        map->add_enemies_from_map_data(
+        map.add_enemies_from_map_data(
             episode,
             difficulty,
             event,
@@ -396,7 +397,7 @@ shared_ptr<Map> Lobby::load_maps(
     if (!floor_object_filename.empty()) {
       auto map_data = get_file_data(version, floor_object_filename);
       if (map_data) {
-        map->add_objects_from_map_data(floor, map_data->data(), map_data->size());
+        map.add_objects_from_map_data(floor, map_data->data(), map_data->size());
         if (log) {
           log->info("Loaded objects map %s for floor %02zX", floor_object_filename.c_str(), floor);
         }
@@ -411,7 +412,7 @@ shared_ptr<Map> Lobby::load_maps(
     if (!floor_event_filename.empty()) {
       auto map_data = get_file_data(version, floor_event_filename);
       if (map_data) {
-        map->add_events_from_map_data(floor, map_data->data(), map_data->size());
+        map.add_events_from_map_data(floor, map_data->data(), map_data->size());
         if (log) {
           log->info("Loaded events map %s for floor %02zX", floor_event_filename.c_str(), floor);
         }
@@ -423,7 +424,63 @@ shared_ptr<Map> Lobby::load_maps(
     }
   }
 
-  return map;
+  map.build_indexes();
+}
+
+shared_ptr<Map> Lobby::load_maps(
+    const vector<string>& enemy_filenames,
+    const vector<string>& object_filenames,
+    const vector<string>& event_filenames,
+    Version version,
+    Episode episode,
+    GameMode mode,
+    uint8_t difficulty,
+    uint8_t event,
+    uint32_t lobby_id,
+    function<shared_ptr<const string>(Version, const string&)> get_file_data,
+    shared_ptr<const Map::RareEnemyRates> rare_rates,
+    uint32_t rare_seed,
+    shared_ptr<PSOLFGEncryption> opt_rand_crypt,
+    const PrefixedLogger* log,
+    shared_ptr<MapTemplateCache> template_cache) {
+  // Don't load free-roam maps in Challenge mode, since players can't go to
+  // Ragol without a quest loaded
+  if (mode == GameMode::CHALLENGE) {
+    return make_shared<Map>(version, lobby_id, rare_seed, opt_rand_crypt);
+  }
+
+  if (!template_cache) {
+    auto map = make_shared<Map>(version, lobby_id, rare_seed, opt_rand_crypt);
+    add_free_roam_entities(*map, enemy_filenames, object_filenames, event_filenames,
+        version, episode, difficulty, event, get_file_data, rare_rates, log);
+    return map;
+  }
+
+  // The parsed map depends only on these parameters and the files' contents,
+  // so games that use the same files can share a template. The rare enemy
+  // rolls depend on the game's random state, so they're done separately for
+  // each game in instantiate().
+  string key = string_printf("%s/%s/%s/%hhu/%hhu",
+      name_for_enum(version), name_for_episode(episode), name_for_mode(mode), difficulty, event);
+  for (const auto* filenames : {&enemy_filenames, &object_filenames, &event_filenames}) {
+    for (const auto& filename : *filenames) {
+      key.push_back('/');
+      key += filename;
+    }
+  }
+  bool generate_called = false;
+  auto tmpl = template_cache->get(key, [&]() -> shared_ptr<const Map> {
+    auto map = make_shared<Map>(version, lobby_id, 0, nullptr);
+    map->defer_rare_enemies = true;
+    add_free_roam_entities(*map, enemy_filenames, object_filenames, event_filenames,
+        version, episode, difficulty, event, get_file_data, rare_rates, log);
+    return map;
+  }, &generate_called);
+  if (!generate_called && log) {
+    log->info("Using cached map template (%zu objects, %zu enemies, %zu events)",
+        tmpl->objects.size(), tmpl->enemies.size(), tmpl->events.size());
+  }
+  return tmpl->instantiate(lobby_id, rare_seed, opt_rand_crypt, rare_rates);
 }
 
 void Lobby::load_maps() {
@@ -441,7 +498,7 @@ void Lobby::load_maps() {
     if (!vq->dat_contents_decompressed) {
       throw runtime_error("quest does not have DAT data");
     }
-    this->map = this->load_maps(
+    this->set_map(this->load_maps(
         this->base_version,
         this->episode,
         this->difficulty,
@@ -450,28 +507,52 @@ void Lobby::load_maps() {
         rare_rates,
         this->random_seed,
         this->opt_rand_crypt,
-        vq->dat_contents_decompressed);
+        vq->dat_contents_decompressed));
 
   } else if (this->mode != GameMode::CHALLENGE) {
-    auto s = this->require_server_state();
-    this->map = this->load_maps(
-        this->base_version,
-        this->episode,
-        this->mode,
-        this->difficulty,
-        this->event,
-        this->lobby_id,
-        s->set_data_table(this->base_version, this->episode, this->mode, this->difficulty),
-        bind(&ServerState::load_map_file, s.get(), placeholders::_1, placeholders::_2),
-        rare_rates,
-        this->random_seed,
-        this->opt_rand_crypt,
-        this->variations,
-        &this->log);
+    this->set_map(this->free_roam_map_generator()());
 
   } else {
-    this->map = make_shared<Map>(this->base_version, this->lobby_id, this->random_seed, this->opt_rand_crypt);
+    this->set_map(make_shared<Map>(this->base_version, this->lobby_id, this->random_seed, this->opt_rand_crypt));
   }
+}
+
+function<shared_ptr<Map>()> Lobby::free_roam_map_generator() const {
+  auto rare_rates = ((this->base_version == Version::BB_V4) && this->rare_enemy_rates)
+      ? this->rare_enemy_rates
+      : Map::DEFAULT_RARE_ENEMIES;
+
+  // The server's map file caches and set data tables may be replaced on the
+  // event thread while the generator runs, so we look them up now
+  auto s = this->require_server_state();
+  auto sdt = s->set_data_table(this->base_version, this->episode, this->mode, this->difficulty);
+  auto file_cache = s->map_file_caches.at(static_cast<size_t>(this->base_version));
+  auto get_file_data = [s, file_cache](Version version, const string& filename) -> shared_ptr<const string> {
+    return file_cache->get(filename, bind(&ServerState::load_map_file_uncached, s.get(), version, placeholders::_1));
+  };
+
+  return [l = this->shared_from_this(), sdt, get_file_data, rare_rates, template_cache = s->map_template_cache]() -> shared_ptr<Map> {
+    return Lobby::load_maps(
+        l->base_version,
+        l->episode,
+        l->mode,
+        l->difficulty,
+        l->event,
+        l->lobby_id,
+        sdt,
+        get_file_data,
+        rare_rates,
+        l->random_seed,
+        l->opt_rand_crypt,
+        l->variations,
+        &l->log,
+        template_cache);
+  };
+}
+
+void Lobby::set_map(shared_ptr<Map> map) {
+  this->map = map;
+  this->state_change_count++;
 
   this->log.info("Generated objects list (%zu entries):", this->map->objects.size());
   for (size_t z = 0; z < this->map->objects.size(); z++) {
@@ -627,6 +708,7 @@ void Lobby::add_client(shared_ptr<Client> c, ssize_t required_client_id) {
     for (auto& m : this->floor_item_managers) {
       this->next_game_item_id = m.reassign_all_item_ids(this->next_game_item_id);
     }
+    this->state_change_count++;
   }
 
   // If this is not a game or the joining client is the leader, they will assign
@@ -677,6 +759,14 @@ void Lobby::add_client(shared_ptr<Client> c, ssize_t required_client_id) {
     event_del(this->idle_timeout_event.get());
     this->log.info("Idle timeout cancelled");
   }
+
+  // Games restored from a checkpoint are only kept alive until someone
+  // rejoins them; after that, they're deleted when empty as usual
+  if (this->check_flag(Flag::RESTORED_FROM_CHECKPOINT)) {
+    this->clear_flag(Flag::RESTORED_FROM_CHECKPOINT);
+    this->clear_flag(Flag::PERSISTENT);
+    this->idle_timeout_usecs = this->require_server_state()->persistent_game_idle_timeout_usecs;
+  }
 }
 
 void Lobby::remove_client(shared_ptr<Client> c) {
@@ -736,6 +826,7 @@ void Lobby::remove_client(shared_ptr<Client> c) {
       m.clear_private();
     }
   }
+  this->state_change_count++;
 
   if (!remaining_clients_mask &&
       this->check_flag(Flag::PERSISTENT) &&
@@ -838,7 +929,7 @@ Lobby::JoinError Lobby::join_error_for_client(std::shared_ptr<Client> c, const s
     }
     // Only prevent joining during loading if the client is actually trying to
     // join (not just loading the game list)
-    if (password && this->any_client_loading()) {
+    if (password && (this->any_client_loading() || this->check_flag(Flag::MAPS_LOADING))) {
       return JoinError::LOADING;
     }
   }
@@ -852,19 +943,21 @@ bool Lobby::item_exists(uint8_t floor, uint32_t item_id) const {
   return this->floor_item_managers.at(floor).exists(item_id);
 }
 
-shared_ptr<Lobby::FloorItem> Lobby::find_item(uint8_t floor, uint32_t item_id) const {
+const Lobby::FloorItem& Lobby::find_item(uint8_t floor, uint32_t item_id) const {
   return this->floor_item_managers.at(floor).find(item_id);
 }
 
 void Lobby::add_item(uint8_t floor, const ItemData& data, float x, float z, uint16_t flags) {
   auto& m = this->floor_item_managers.at(floor);
   m.add(data, x, z, flags);
+  this->state_change_count++;
   this->evict_items_from_floor(floor);
 }
 
-void Lobby::add_item(uint8_t floor, shared_ptr<FloorItem> fi) {
+void Lobby::add_item(uint8_t floor, const FloorItem& fi) {
   auto& m = this->floor_item_managers.at(floor);
   m.add(fi);
+  this->state_change_count++;
   this->evict_items_from_floor(floor);
 }
 
@@ -872,20 +965,23 @@ void Lobby::evict_items_from_floor(uint8_t floor) {
   auto& m = this->floor_item_managers.at(floor);
   auto evicted = m.evict();
   if (!evicted.empty()) {
+    this->state_change_count++;
     auto l = this->shared_from_this();
     for (const auto& fi : evicted) {
       for (size_t z = 0; z < 12; z++) {
         auto lc = this->clients[z];
-        if (lc && fi->visible_to_client(z)) {
-          send_destroy_floor_item_to_client(lc, fi->data.id, floor);
+        if (lc && fi.visible_to_client(z)) {
+          send_destroy_floor_item_to_client(lc, fi.data.id, floor);
         }
       }
     }
   }
 }
 
-shared_ptr<Lobby::FloorItem> Lobby::remove_item(uint8_t floor, uint32_t item_id, uint8_t requesting_client_id) {
-  return this->floor_item_managers.at(floor).remove(item_id, requesting_client_id);
+Lobby::FloorItem Lobby::remove_item(uint8_t floor, uint32_t item_id, uint8_t requesting_client_id) {
+  auto fi = this->floor_item_managers.at(floor).remove(item_id, requesting_client_id);
+  this->state_change_count++;
+  return fi;
 }
 
 uint32_t Lobby::generate_item_id(uint8_t client_id) {
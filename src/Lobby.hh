@@ -42,24 +42,35 @@ struct Lobby : public std::enable_shared_from_this<Lobby> {
   struct FloorItemManager {
     PrefixedLogger log;
     uint64_t next_drop_number;
-    // It's important that this is a map and not an unordered_map. See the
-    // comment in send_game_item_state for more details.
-    std::map<uint32_t, std::shared_ptr<FloorItem>> items; // Keyed on item_id
-    std::array<std::map<uint64_t, std::shared_ptr<FloorItem>>, 12> queue_for_client;
+    // Items are stored by value in a single vector sorted by item_id, so
+    // adding an item doesn't allocate (once the vector has grown to the floor's
+    // working size) and iterating over the items in order is cheap. It's
+    // important that this is sorted by item_id; see the comment in
+    // send_game_item_state for more details. Which clients can see each item
+    // is given by its flags, so there are no per-client structures except for
+    // the visible item counts, which determine when items are evicted.
+    std::vector<FloorItem> items;
+    std::array<uint16_t, 12> num_items_visible_to_client;
 
     FloorItemManager(uint32_t lobby_id, uint8_t floor);
     ~FloorItemManager() = default;
 
     bool exists(uint32_t item_id) const;
-    std::shared_ptr<FloorItem> find(uint32_t item_id) const;
+    const FloorItem& find(uint32_t item_id) const;
     void add(const ItemData& item, float x, float z, uint16_t flags);
-    void add(std::shared_ptr<FloorItem> fi);
-    std::shared_ptr<FloorItem> remove(uint32_t item_id, uint8_t client_id);
-    std::unordered_set<std::shared_ptr<FloorItem>> evict();
+    void add(const FloorItem& fi);
+    FloorItem remove(uint32_t item_id, uint8_t client_id);
+    std::vector<FloorItem> evict();
     void clear_inaccessible(uint16_t remaining_clients_mask);
     void clear_private();
     void clear();
     uint32_t reassign_all_item_ids(uint32_t next_item_id);
+
+  private:
+    // Returns the index of the first item whose ID is not less than item_id
+    size_t lower_bound_index(uint32_t item_id) const;
+    FloorItem remove_at(size_t index);
+    size_t remove_if(std::function<bool(const FloorItem&)> pred);
   };
   enum class Flag {
     // clang-format off
@@ -77,6 +88,8 @@ struct Lobby : public std::enable_shared_from_this<Lobby> {
     START_BATTLE_PLAYER_IMMEDIATELY = 0x00010000,
     CANNOT_CHANGE_CHEAT_MODE        = 0x00020000,
     USE_CREATOR_SECTION_ID          = 0x00040000,
+    MAPS_LOADING                    = 0x00080000,
+    RESTORED_FROM_CHECKPOINT        = 0x00100000, // Persistent until a player joins
     // Flags used only for lobbies
     PUBLIC                          = 0x01000000,
     DEFAULT                         = 0x02000000,
@@ -110,6 +123,11 @@ struct Lobby : public std::enable_shared_from_this<Lobby> {
   std::unique_ptr<QuestFlags> quest_flags_known; // If null, ALL quest flags are known
   std::unique_ptr<QuestFlags> quest_flag_values;
   std::unique_ptr<SwitchFlags> switch_flags;
+  // Incremented whenever the floor items, the state of the map's objects,
+  // enemies, or events, or the quest or switch flags change. The checkpoint
+  // manager uses this to skip encoding games that haven't changed since the
+  // previous checkpoint.
+  uint64_t state_change_count;
 
   // Game config
   Version base_version;
@@ -232,7 +250,8 @@ struct Lobby : public std::enable_shared_from_this<Lobby> {
       uint32_t random_seed,
       std::shared_ptr<PSOLFGEncryption> opt_rand_crypt,
       const parray<le_uint32_t, 0x20>& variations,
-      const PrefixedLogger* log = nullptr);
+      const PrefixedLogger* log = nullptr,
+      std::shared_ptr<MapTemplateCache> template_cache = nullptr);
   static std::shared_ptr<Map> load_maps(
       const std::vector<std::string>& enemy_filenames,
       const std::vector<std::string>& object_filenames,
@@ -247,8 +266,15 @@ struct Lobby : public std::enable_shared_from_this<Lobby> {
       std::shared_ptr<const Map::RareEnemyRates> rare_rates,
       uint32_t random_seed,
       std::shared_ptr<PSOLFGEncryption> opt_rand_crypt,
-      const PrefixedLogger* log = nullptr);
+      const PrefixedLogger* log = nullptr,
+      std::shared_ptr<MapTemplateCache> template_cache = nullptr);
   void load_maps();
+  // Returns a function that generates this game's free-roam maps. The
+  // function captures everything it needs from the lobby and server state, so
+  // it can be called on any thread. The returned map should be passed to
+  // set_map on the event thread.
+  std::function<std::shared_ptr<Map>()> free_roam_map_generator() const;
+  void set_map(std::shared_ptr<Map> map);
   void create_ep3_server();
 
   [[nodiscard]] inline bool is_game() const {
@@ -297,11 +323,11 @@ struct Lobby : public std::enable_shared_from_this<Lobby> {
   JoinError join_error_for_client(std::shared_ptr<Client> c, const std::string* password) const;
 
   bool item_exists(uint8_t floor, uint32_t item_id) const;
-  std::shared_ptr<FloorItem> find_item(uint8_t floor, uint32_t item_id) const;
+  const FloorItem& find_item(uint8_t floor, uint32_t item_id) const;
   void add_item(uint8_t floor, const ItemData& item, float x, float z, uint16_t flags);
-  void add_item(uint8_t floor, std::shared_ptr<FloorItem>);
+  void add_item(uint8_t floor, const FloorItem& fi);
   void evict_items_from_floor(uint8_t floor);
-  std::shared_ptr<FloorItem> remove_item(uint8_t floor, uint32_t item_id, uint8_t requesting_client_id);
+  FloorItem remove_item(uint8_t floor, uint32_t item_id, uint8_t requesting_client_id);
 
   uint32_t generate_item_id(uint8_t client_id);
   void on_item_id_generated_externally(uint32_t item_id);
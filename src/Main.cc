@@ -26,6 +26,7 @@
 #include "Compression.hh"
 #include "DCSerialNumbers.hh"
 #include "DNSServer.hh"
+#include "FileDelta.hh"
 #include "GSLArchive.hh"
 #include "GVMEncoder.hh"
 #include "HTTPServer.hh"
@@ -38,6 +39,7 @@
 #include "ProxyServer.hh"
 #include "Quest.hh"
 #include "QuestScript.hh"
+#include "RareEnemySeedSearch.hh"
 #include "ReplaySession.hh"
 #include "Revision.hh"
 #include "SaveFileFormats.hh"
@@ -45,6 +47,7 @@
 #include "Server.hh"
 #include "ServerShell.hh"
 #include "ServerState.hh"
+#include "SocketHandoff.hh"
 #include "StaticGameData.hh"
 #include "Text.hh"
 #include "TextIndex.hh"
@@ -1720,6 +1723,254 @@ Action a_describe_item(
       log_info("Purchase price: %zu; sale price: %zu", purchase_price, sale_price);
     });
 
+Action a_simulate_drops(
+    "simulate-drops", "\
+  simulate-drops OPTIONS...\n\
+    Simulate many item drops using the server\'s drop tables, and report how\n\
+    often each item was generated. For items from the rare table, the expected\n\
+    rate (from the table) is shown along with a 95% confidence interval for\n\
+    the observed rate; items whose expected rate is outside the interval are\n\
+    marked with a *. A version option (e.g. --bb) and an episode option (--ep1,\n\
+    --ep2, or --ep4) are required. The difficulty and game mode may be given\n\
+    as for find-rare-enemy-seeds, and --section-id=NAME-OR-NUMBER gives the\n\
+    section ID (Viridia by default). Exactly one of the following options must\n\
+    be given to specify the drop source:\n\
+      --enemy=RT-INDEX: Simulate enemy drops for this rare table index (hex).\n\
+          --area=AREA (hex) must also be given, since the common drop tables\n\
+          differ by area.\n\
+      --box=AREA: Simulate box drops in this area (hex).\n\
+      --specialized-box=AREA:DEF0:DEF1:DEF2: Simulate drops from specialized\n\
+          boxes with these parameters (all in hex).\n\
+    --count=N specifies how many drops to simulate (default 100000000).\n\
+    --threads=COUNT controls the number of threads to use; by default, one\n\
+    thread per CPU core is used. --seed=SEED gives the first random seed (in\n\
+    hex); each block of 65536 drops uses the next seed, so the results do not\n\
+    depend on the number of threads. --rare-table=NAME uses a rare table from\n\
+    system/item-tables (e.g. rare-table-v4) instead of the version\'s default\n\
+    table, and --multiply=X multiplies all rare drop rates by X after the\n\
+    server\'s ServerGlobalDropRateMultiplier is applied.\n",
+    +[](Arguments& args) {
+      auto version = get_cli_version(args);
+      auto episode = get_cli_episode(args);
+      auto difficulty = get_cli_difficulty(args);
+      auto mode = get_cli_game_mode(args);
+      if (mode == GameMode::SOLO) {
+        mode = GameMode::NORMAL; // Same as in Lobby::create_item_creator
+      }
+      string section_id_str = args.get<string>("section-id", false);
+      uint8_t section_id = section_id_str.empty() ? 0 : section_id_for_name(section_id_str);
+      uint64_t count = args.get<uint64_t>("count", 100000000);
+      if (count == 0) {
+        throw runtime_error("--count must be nonzero");
+      }
+      size_t num_threads = args.get<size_t>("threads", 0);
+      uint32_t base_seed = args.get<int64_t>("seed", random_object<uint32_t>(), Arguments::IntFormat::HEX);
+      string rare_table_name = args.get<string>("rare-table", false);
+      double rate_factor = args.get<double>("multiply", 1.0);
+
+      int64_t enemy_rt_index = args.get<int64_t>("enemy", -1, Arguments::IntFormat::HEX);
+      int64_t enemy_area = args.get<int64_t>("area", -1, Arguments::IntFormat::HEX);
+      int64_t box_area = args.get<int64_t>("box", -1, Arguments::IntFormat::HEX);
+      string specialized_box_str = args.get<string>("specialized-box", false);
+      if ((enemy_rt_index >= 0) + (box_area >= 0) + !specialized_box_str.empty() != 1) {
+        throw runtime_error("exactly one of --enemy, --box, or --specialized-box must be given");
+      }
+      if ((enemy_rt_index >= 0) != (enemy_area >= 0)) {
+        throw runtime_error("--area must be given with --enemy, and only with --enemy");
+      }
+      uint8_t specialized_box_area = 0;
+      uint32_t specialized_box_def0 = 0, specialized_box_def1 = 0, specialized_box_def2 = 0;
+      if (!specialized_box_str.empty()) {
+        auto tokens = split(specialized_box_str, ':');
+        if (tokens.size() != 4) {
+          throw runtime_error("--specialized-box must be of the form AREA:DEF0:DEF1:DEF2");
+        }
+        specialized_box_area = stoul(tokens[0], nullptr, 16);
+        specialized_box_def0 = stoul(tokens[1], nullptr, 16);
+        specialized_box_def1 = stoul(tokens[2], nullptr, 16);
+        specialized_box_def2 = stoul(tokens[3], nullptr, 16);
+      }
+
+      auto s = make_shared<ServerState>(get_config_filename(args));
+      s->load_config_early();
+      s->load_patch_indexes(false);
+      s->load_text_index(false);
+      s->load_item_definitions(false);
+      s->load_item_name_indexes(false);
+      s->load_drop_tables(false);
+      // ItemCreator logs every step of every drop at the info level
+      lobby_log.min_level = LogLevel::WARNING;
+
+      shared_ptr<const RareItemSet> rare_item_set = rare_table_name.empty()
+          ? s->rare_item_set(version)
+          : s->rare_item_sets.at(rare_table_name);
+      if (rate_factor != 1.0) {
+        auto multiplied_set = make_shared<RareItemSet>(*rare_item_set);
+        multiplied_set->multiply_all_rates(rate_factor);
+        rare_item_set = multiplied_set;
+      }
+      auto common_item_set = s->common_item_set(version);
+      auto stack_limits = s->item_stack_limits(version);
+      auto make_item_creator = [&]() -> shared_ptr<ItemCreator> {
+        return make_shared<ItemCreator>(
+            common_item_set,
+            rare_item_set,
+            s->armor_random_set,
+            s->tool_random_set,
+            s->weapon_random_sets.at(difficulty),
+            s->tekker_adjustment_set,
+            s->item_parameter_table(version),
+            stack_limits,
+            episode,
+            mode,
+            difficulty,
+            section_id,
+            make_shared<PSOV2Encryption>(base_seed));
+      };
+
+      // Compute the expected rate for each rare item. The specs are checked in
+      // order until one produces an item, so each spec's effective rate
+      // depends on the rates of the specs before it.
+      map<uint32_t, double> expected_rare_rates;
+      if (mode != GameMode::CHALLENGE) {
+        vector<RareItemSet::ExpandedDrop> specs;
+        double gate_probability = 1.0;
+        if (enemy_rt_index >= 0) {
+          if ((enemy_rt_index > 0) && (enemy_rt_index < 0x58)) {
+            specs = rare_item_set->get_enemy_specs(mode, episode, difficulty, section_id, enemy_rt_index);
+            auto pt = common_item_set->get_table(episode, mode, difficulty, section_id);
+            gate_probability = static_cast<double>(pt->enemy_type_drop_probs.at(enemy_rt_index)) / 100.0;
+          }
+        } else if (box_area >= 0) {
+          uint8_t area_norm = make_item_creator()->normalize_area_number(box_area);
+          specs = rare_item_set->get_box_specs(mode, episode, difficulty, section_id, area_norm + 1);
+        }
+        double remaining_probability = gate_probability;
+        for (const auto& spec : specs) {
+          double p = static_cast<double>(spec.probability) / 4294967296.0;
+          expected_rare_rates[spec.data.primary_identifier()] += remaining_probability * p;
+          remaining_probability *= (1.0 - p);
+        }
+      }
+
+      // The drop functions used in the simulation loop throw if the area is
+      // invalid, so check it here instead of in the worker threads
+      {
+        auto item_creator = make_item_creator();
+        if (enemy_rt_index >= 0) {
+          item_creator->normalize_area_number(enemy_area);
+        } else if (box_area >= 0) {
+          item_creator->normalize_area_number(box_area);
+        } else {
+          item_creator->normalize_area_number(specialized_box_area);
+        }
+      }
+
+      if (num_threads == 0) {
+        num_threads = thread::hardware_concurrency();
+      }
+      struct ThreadState {
+        shared_ptr<ItemCreator> item_creator;
+        unordered_map<uint32_t, uint64_t> rare_counts;
+        unordered_map<uint32_t, uint64_t> common_counts;
+        uint64_t num_empty = 0;
+      };
+      vector<ThreadState> thread_states(num_threads);
+      for (auto& ts : thread_states) {
+        ts.item_creator = make_item_creator();
+      }
+
+      static constexpr uint64_t BLOCK_SIZE = 0x10000;
+      uint64_t num_blocks = (count + BLOCK_SIZE - 1) / BLOCK_SIZE;
+      auto thread_fn = [&](uint64_t block_index, size_t thread_num) -> bool {
+        auto& ts = thread_states[thread_num];
+        ts.item_creator->set_random_crypt(make_shared<PSOV2Encryption>(base_seed + block_index));
+        uint64_t block_count = min<uint64_t>(BLOCK_SIZE, count - block_index * BLOCK_SIZE);
+        ItemCreator::DropResult res;
+        for (uint64_t z = 0; z < block_count; z++) {
+          // These don't allocate memory (but unlike the other variants, they
+          // throw if the area is invalid; it was already checked above)
+          if (enemy_rt_index >= 0) {
+            ts.item_creator->on_monster_item_drop(res, enemy_rt_index, enemy_area);
+          } else if (box_area >= 0) {
+            ts.item_creator->on_box_item_drop(res, box_area);
+          } else {
+            ts.item_creator->on_specialized_box_item_drop(
+                res, specialized_box_area, 0.0f, specialized_box_def0, specialized_box_def1, specialized_box_def2);
+          }
+          if (res.item.empty()) {
+            ts.num_empty++;
+          } else {
+            auto& counts = res.is_from_rare_table ? ts.rare_counts : ts.common_counts;
+            counts[res.item.primary_identifier()]++;
+          }
+        }
+        return false;
+      };
+      auto progress_fn = [&](uint64_t, uint64_t, uint64_t current_value, uint64_t) -> void {
+        fprintf(stderr, "... %" PRIu64 "/%" PRIu64 " drops simulated\r",
+            min<uint64_t>(current_value * BLOCK_SIZE, count), count);
+      };
+      parallel_range<uint64_t>(thread_fn, 0, num_blocks, num_threads, progress_fn);
+      fputc('\n', stderr);
+
+      map<uint32_t, uint64_t> rare_counts;
+      map<uint32_t, uint64_t> common_counts;
+      uint64_t num_empty = 0;
+      for (const auto& ts : thread_states) {
+        for (const auto& it : ts.rare_counts) {
+          rare_counts[it.first] += it.second;
+        }
+        for (const auto& it : ts.common_counts) {
+          common_counts[it.first] += it.second;
+        }
+        num_empty += ts.num_empty;
+      }
+      for (const auto& it : expected_rare_rates) {
+        rare_counts.emplace(it.first, 0);
+      }
+
+      auto name_index = s->item_name_index(version);
+      auto describe = [&](uint32_t primary_identifier) -> string {
+        return name_index->describe_item(ItemData::from_primary_identifier(*stack_limits, primary_identifier));
+      };
+      // Wilson score interval, which behaves well even when very few (or no)
+      // instances of an item were observed
+      auto confidence_interval = [&](uint64_t k) -> pair<double, double> {
+        static constexpr double Z = 1.959963984540054;
+        double n = count;
+        double p = k / n;
+        double denom = 1.0 + (Z * Z) / n;
+        double center = (p + (Z * Z) / (2.0 * n)) / denom;
+        double half_width = (Z * sqrt((p * (1.0 - p)) / n + (Z * Z) / (4.0 * n * n))) / denom;
+        return make_pair(max<double>(0.0, center - half_width), min<double>(1.0, center + half_width));
+      };
+
+      fprintf(stdout, "%" PRIu64 " drops simulated; %" PRIu64 " produced no item\n", count, num_empty);
+      fprintf(stdout, "Rare items:\n");
+      for (const auto& it : rare_counts) {
+        auto ci = confidence_interval(it.second);
+        auto expected_it = expected_rare_rates.find(it.first);
+        string name = describe(it.first);
+        if (expected_it == expected_rare_rates.end()) {
+          fprintf(stdout, "  %08" PRIX32 " %12" PRIu64 " observed %.9f [%.9f, %.9f] expected (none) * %s\n",
+              it.first, it.second, static_cast<double>(it.second) / count, ci.first, ci.second, name.c_str());
+        } else {
+          bool is_outside = (expected_it->second < ci.first) || (expected_it->second > ci.second);
+          fprintf(stdout, "  %08" PRIX32 " %12" PRIu64 " observed %.9f [%.9f, %.9f] expected %.9f %c %s\n",
+              it.first, it.second, static_cast<double>(it.second) / count, ci.first, ci.second,
+              expected_it->second, is_outside ? '*' : ' ', name.c_str());
+        }
+      }
+      fprintf(stdout, "Common items:\n");
+      for (const auto& it : common_counts) {
+        auto ci = confidence_interval(it.second);
+        string name = describe(it.first);
+        fprintf(stdout, "  %08" PRIX32 " %12" PRIu64 " observed %.9f [%.9f, %.9f] %s\n",
+            it.first, it.second, static_cast<double>(it.second) / count, ci.first, ci.second, name.c_str());
+      }
+    });
+
 Action a_name_all_items(
     "name-all-items", nullptr, +[](Arguments& args) {
       auto s = make_shared<ServerState>(get_config_filename(args));
@@ -2029,6 +2280,29 @@ Action a_show_ep3_maps(
       }
     });
 
+Action a_load_ep3_tournament_state(
+    "load-ep3-tournament-state", "\
+  load-ep3-tournament-state [--state=FILENAME]\n\
+    Load the Episode 3 tournament state from the given snapshot file and its\n\
+    journal (by default, system/ep3/tournament-state.json), in the same way as\n\
+    the server does at startup, and print the resulting state as JSON. Like\n\
+    the server, this may write a new snapshot if the journal needs to be\n\
+    cleaned up.\n",
+    +[](Arguments& args) {
+      string state_filename = args.get<string>("state", false);
+      if (state_filename.empty()) {
+        state_filename = "system/ep3/tournament-state.json";
+      }
+
+      auto s = make_shared<ServerState>(get_config_filename(args));
+      s->load_ep3_cards(false);
+      s->load_ep3_maps(false);
+
+      Episode3::TournamentIndex index(s->ep3_map_index, s->ep3_com_deck_index, state_filename);
+      string json_data = index.json().serialize(JSON::SerializeOption::FORMAT | JSON::SerializeOption::HEX_INTEGERS);
+      fprintf(stdout, "%s\n", json_data.c_str());
+    });
+
 Action a_show_battle_params(
     "show-battle-params", "\
   show-battle-params\n\
@@ -2065,8 +2339,11 @@ Action a_find_rare_enemy_seeds(
     which variations are used on all versions and which rare rates to use for\n\
     BB. --threads=COUNT controls the number of threads to use for the search\n\
     by default, one thread per CPU core is used. --min-count specifies how many\n\
-    rare enemies must be found to output the seed. Finally, --quest=NAME may be\n\
-    given to use that quest\'s map instead of the free-roam maps.\n",
+    rare enemies must be found to output the seed. --floor=FLOOR considers only\n\
+    rare enemies on the given floor (in hex). --quest=NAME may be given to use\n\
+    that quest\'s map instead of the free-roam maps. If --csv is given, the\n\
+    output is a CSV table with one row per rare enemy (with the columns seed,\n\
+    floor, enemy_index, and enemy_type) instead of one line per seed.\n",
     +[](Arguments& args) {
       auto version = get_cli_version(args);
       auto episode = get_cli_episode(args);
@@ -2074,6 +2351,8 @@ Action a_find_rare_enemy_seeds(
       auto mode = get_cli_game_mode(args);
       size_t num_threads = args.get<size_t>("threads", 0);
       size_t min_count = args.get<size_t>("min-count", 1);
+      int64_t only_floor = args.get<int64_t>("floor", -1, Arguments::IntFormat::HEX);
+      bool csv = args.get<bool>("csv");
       string quest_name = args.get<string>("quest", false);
 
       auto s = make_shared<ServerState>(get_config_filename(args));
@@ -2106,52 +2385,63 @@ Action a_find_rare_enemy_seeds(
         rare_rates = s->rare_enemy_rates_by_difficulty[difficulty];
       }
 
+      // All map files are parsed here, so the per-seed work below only
+      // consists of the random draws that affect which enemies are rare
+      unique_ptr<RareEnemySeedSearch> search;
+      if (vq) {
+        if (!vq->dat_contents_decompressed) {
+          throw runtime_error("quest does not have DAT data");
+        }
+        search = make_unique<RareEnemySeedSearch>(
+            version, episode, difficulty, 0, vq->dat_contents_decompressed, rare_rates);
+        if (search->uses_fallback()) {
+          log_warning("Quest has random enemies; each seed will load the entire map");
+        }
+      } else {
+        search = make_unique<RareEnemySeedSearch>(
+            version,
+            episode,
+            mode,
+            difficulty,
+            0,
+            s->set_data_table(version, episode, mode, difficulty),
+            bind(&ServerState::load_map_file, s.get(), placeholders::_1, placeholders::_2),
+            rare_rates);
+      }
+
+      if (csv) {
+        fprintf(stdout, "seed,floor,enemy_index,enemy_type\n");
+      }
+
       mutex output_lock;
       auto thread_fn = [&](uint64_t seed, size_t) -> bool {
-        auto random_crypt = make_shared<PSOV2Encryption>(seed);
-        parray<le_uint32_t, 0x20> variations;
-
-        shared_ptr<Map> map;
-        if (vq) {
-          if (!vq->dat_contents_decompressed) {
-            throw runtime_error("quest does not have DAT data");
-          }
-          map = Lobby::load_maps(
-              version, episode, difficulty, 0, 0, rare_rates, seed, random_crypt, vq->dat_contents_decompressed);
+        // These are reused for all seeds processed on each thread
+        thread_local vector<RareEnemySeedSearch::RareEnemy> rares;
+        thread_local string line;
 
-        } else {
-          generate_variations_deprecated(variations, random_crypt, version, episode, (mode == GameMode::SOLO));
-          map = Lobby::load_maps(
-              version,
-              episode,
-              mode,
-              difficulty,
-              0,
-              0,
-              s->set_data_table(version, episode, mode, difficulty),
-              bind(&ServerState::load_map_file, s.get(), placeholders::_1, placeholders::_2),
-              rare_rates,
-              seed,
-              random_crypt,
-              variations);
-        }
-
-        vector<size_t> rare_indexes;
-        for (size_t z = 0; z < map->enemies.size(); z++) {
-          if (enemy_type_is_rare(map->enemies[z].type)) {
-            rare_indexes.emplace_back(z);
-          }
+        search->find_rare_enemies(rares, seed);
+        if (only_floor >= 0) {
+          erase_if(rares, [&](const auto& e) -> bool { return e.floor != only_floor; });
+        }
+        if (rares.empty() || (rares.size() < min_count)) {
+          return false;
         }
 
-        if (rare_indexes.size() >= min_count) {
-          lock_guard g(output_lock);
-          fprintf(stdout, "%08" PRIX64 ":", seed);
-          for (size_t index : rare_indexes) {
-            fprintf(stdout, " E-%zX:%s", index, name_for_enum(map->enemies[index].type));
+        line.clear();
+        if (csv) {
+          for (const auto& e : rares) {
+            line += string_printf("%08" PRIX64 ",%02hhX,%zX,%s\n", seed, e.floor, e.enemy_index, name_for_enum(e.type));
+          }
+        } else {
+          line += string_printf("%08" PRIX64 ":", seed);
+          for (const auto& e : rares) {
+            line += string_printf(" E-%zX:%s", e.enemy_index, name_for_enum(e.type));
           }
-          fprintf(stdout, "\n");
+          line.push_back('\n');
         }
 
+        lock_guard g(output_lock);
+        fwritex(stdout, line);
         return false;
       };
 
@@ -2399,6 +2689,63 @@ Action a_generate_hangame_creds(
       fprintf(stdout, "psobb.exe 1196310600 %s\n", hex.c_str());
     });
 
+Action a_migrate_accounts_to_log(
+    "migrate-accounts-to-log", "\
+  migrate-accounts-to-log [LOG-FILENAME]\n\
+    Copy all accounts from the files in system/licenses into an account log\n\
+    (system/licenses.log by default). Accounts that are already in the log are\n\
+    replaced. The server should not be running when this is done. To use the\n\
+    log afterward, set AccountLogFilename in config.json.\n",
+    +[](Arguments& args) {
+      string log_filename = args.get<string>(1, false);
+      if (log_filename.empty()) {
+        log_filename = "system/licenses.log";
+      }
+
+      AccountLog log(log_filename);
+      size_t num_accounts = 0;
+      for (const auto& item : list_directory("system/licenses")) {
+        if (ends_with(item, ".json")) {
+          try {
+            Account a(JSON::parse(load_file("system/licenses/" + item)));
+            log.save(a.account_id, a.json().serialize());
+            num_accounts++;
+          } catch (const exception& e) {
+            throw runtime_error(string_printf("cannot migrate account from %s: %s", item.c_str(), e.what()));
+          }
+        }
+      }
+      log.compact();
+      fprintf(stderr, "Migrated %zu account(s) to %s (%zu accounts in log)\n", num_accounts, log_filename.c_str(), log.count());
+    });
+
+Action a_export_character_file(
+    "export-character-file", "\
+  export-character-file CHARACTER-FILENAME OUTPUT-FILENAME\n\
+    Write a BB character file (.psochar), including any changes saved in its\n\
+    delta file (see CharacterFileDeltaSaves in config.json), to a single\n\
+    .psochar file that can be used without newserv.\n",
+    +[](Arguments& args) {
+      const string& input_filename = args.get<string>(1);
+      const string& output_filename = args.get<string>(2);
+      string data = load_file(input_filename);
+
+      string delta_filename = PlayerFilesManager::character_delta_filename(input_filename);
+      string delta_data;
+      try {
+        delta_data = load_file(delta_filename);
+      } catch (const cannot_open_file&) {
+      }
+      if (delta_data.empty()) {
+        fprintf(stderr, "No delta file found; the character file is already complete\n");
+      } else if (apply_file_delta(data, delta_data)) {
+        fprintf(stderr, "Applied changes from %s\n", delta_filename.c_str());
+      } else {
+        fprintf(stderr, "%s does not match the character file; ignoring it\n", delta_filename.c_str());
+      }
+      save_file(output_filename, data);
+    });
+
 Action a_format_ep3_battle_record(
     "format-ep3-battle-record", nullptr, +[](Arguments& args) {
       string data = read_input_data(args);
@@ -2526,7 +2873,29 @@ Action a_run_server_replay_log(
 
       shared_ptr<struct event_base> base(event_base_new(), event_base_free);
       auto state = make_shared<ServerState>(base, get_config_filename(args), is_replay);
-      state->load_all();
+      // Accounts, teams, and tournament state are loaded separately, since if
+      // another server process is running, it can change them until it hands
+      // off its listening sockets
+      state->load_all(false);
+
+      // If another server process is running, take over its listening sockets.
+      // This must be done before opening any sockets, and before loading the
+      // accounts, teams, tournament state, and game checkpoint, since the
+      // running server saves all of these (and disconnects all of its clients)
+      // before handing off its sockets.
+      shared_ptr<ListeningSocketSet> listening_sockets;
+      if (!is_replay) {
+        listening_sockets = make_shared<ListeningSocketSet>();
+        if (!state->handoff_socket_path.empty() &&
+            !listening_sockets->receive_handoff(state->handoff_socket_path)) {
+          config_log.info("No running server found on handoff socket; opening listening sockets normally");
+        }
+      }
+      state->load_persistent_state();
+
+      if (state->game_checkpoint_manager && state->game_checkpoint_interval_usecs) {
+        state->game_checkpoint_manager->restore(state->game_checkpoint_restore_timeout_usecs);
+      }
 
       if (state->dns_server_port && !is_replay) {
         if (!state->dns_server_addr.empty()) {
@@ -2536,7 +2905,7 @@ Action a_run_server_replay_log(
         }
         state->dns_server = make_shared<DNSServer>(
             base, state->local_address, state->external_address, state->banned_ipv4_ranges);
-        state->dns_server->listen(state->dns_server_addr, state->dns_server_port);
+        state->dns_server->add_socket(listening_sockets->open(state->dns_server_addr, state->dns_server_port, true));
       } else {
         config_log.info("DNS server is disabled");
       }
@@ -2578,14 +2947,14 @@ Action a_run_server_replay_log(
                 auto [ss, size] = make_sockaddr_storage(
                     state->proxy_destination_patch.first,
                     state->proxy_destination_patch.second);
-                state->proxy_server->listen(pc->addr, pc->port, pc->version, &ss);
+                state->proxy_server->add_socket(listening_sockets->open(pc->addr, pc->port), pc->port, pc->version, &ss);
               } else if (is_v4(pc->version)) {
                 auto [ss, size] = make_sockaddr_storage(
                     state->proxy_destination_bb.first,
                     state->proxy_destination_bb.second);
-                state->proxy_server->listen(pc->addr, pc->port, pc->version, &ss);
+                state->proxy_server->add_socket(listening_sockets->open(pc->addr, pc->port), pc->port, pc->version, &ss);
               } else {
-                state->proxy_server->listen(pc->addr, pc->port, pc->version);
+                state->proxy_server->add_socket(listening_sockets->open(pc->addr, pc->port), pc->port, pc->version);
               }
             }
 
@@ -2595,7 +2964,7 @@ Action a_run_server_replay_log(
               state->pc_patch_server = make_shared<PatchServer>(state->generate_patch_server_config(false));
             }
             string spec = string_printf("TU-%hu-%s-patch2", pc->port, pc->name.c_str());
-            state->pc_patch_server->listen(spec, pc->addr, pc->port, Version::PC_PATCH);
+            state->pc_patch_server->add_socket(spec, listening_sockets->open(pc->addr, pc->port), Version::PC_PATCH);
 
           } else if (pc->behavior == ServerBehavior::PATCH_SERVER_BB) {
             if (!state->bb_patch_server.get()) {
@@ -2603,7 +2972,7 @@ Action a_run_server_replay_log(
               state->bb_patch_server = make_shared<PatchServer>(state->generate_patch_server_config(true));
             }
             string spec = string_printf("TU-%hu-%s-patch4", pc->port, pc->name.c_str());
-            state->bb_patch_server->listen(spec, pc->addr, pc->port, Version::BB_PATCH);
+            state->bb_patch_server->add_socket(spec, listening_sockets->open(pc->addr, pc->port), Version::BB_PATCH);
 
           } else {
             if (!state->game_server.get()) {
@@ -2611,7 +2980,7 @@ Action a_run_server_replay_log(
               state->game_server = make_shared<Server>(base, state);
             }
             string spec = string_printf("TG-%hu-%s-%s-%s", pc->port, name_for_enum(pc->version), pc->name.c_str(), name_for_enum(pc->behavior));
-            state->game_server->listen(spec, pc->addr, pc->port, pc->version, pc->behavior);
+            state->game_server->add_socket(spec, listening_sockets->open(pc->addr, pc->port), pc->version, pc->behavior);
           }
         }
 
@@ -2621,20 +2990,20 @@ Action a_run_server_replay_log(
           for (const auto& it : state->ip_stack_addresses) {
             auto netloc = parse_netloc(it);
             string spec = (netloc.second == 0) ? ("T-IPS-" + netloc.first) : string_printf("T-IPS-%hu", netloc.second);
-            state->ip_stack_simulator->listen(
-                spec, netloc.first, netloc.second, IPStackSimulator::Protocol::ETHERNET_TAPSERVER);
+            state->ip_stack_simulator->add_socket(
+                spec, listening_sockets->open(netloc.first, netloc.second), IPStackSimulator::Protocol::ETHERNET_TAPSERVER);
           }
           for (const auto& it : state->ppp_stack_addresses) {
             auto netloc = parse_netloc(it);
             string spec = (netloc.second == 0) ? ("T-PPPST-" + netloc.first) : string_printf("T-PPPST-%hu", netloc.second);
-            state->ip_stack_simulator->listen(
-                spec, netloc.first, netloc.second, IPStackSimulator::Protocol::HDLC_TAPSERVER);
+            state->ip_stack_simulator->add_socket(
+                spec, listening_sockets->open(netloc.first, netloc.second), IPStackSimulator::Protocol::HDLC_TAPSERVER);
           }
           for (const auto& it : state->ppp_raw_addresses) {
             auto netloc = parse_netloc(it);
             string spec = (netloc.second == 0) ? ("T-PPPSR-" + netloc.first) : string_printf("T-PPPSR-%hu", netloc.second);
-            state->ip_stack_simulator->listen(
-                spec, netloc.first, netloc.second, IPStackSimulator::Protocol::HDLC_RAW);
+            state->ip_stack_simulator->add_socket(
+                spec, listening_sockets->open(netloc.first, netloc.second), IPStackSimulator::Protocol::HDLC_RAW);
             if (netloc.second) {
               if (state->local_address == state->external_address) {
                 config_log.info(
@@ -2656,9 +3025,46 @@ Action a_run_server_replay_log(
           http_server = make_shared<HTTPServer>(state);
           for (const auto& it : state->http_addresses) {
             auto netloc = parse_netloc(it);
-            http_server->listen(netloc.first, netloc.second);
+            http_server->add_socket(listening_sockets->open(netloc.first, netloc.second));
           }
         }
+
+        listening_sockets->close_unused_handoff_sockets();
+      }
+
+      shared_ptr<SocketHandoffServer> handoff_server;
+      if (listening_sockets && !state->handoff_socket_path.empty()) {
+        auto on_request = [state]() -> void {
+          state->prepare_for_handoff();
+        };
+        auto on_complete = [state, &http_server, base]() -> void {
+          if (state->dns_server) {
+            state->dns_server->stop_listening();
+          }
+          if (state->game_server) {
+            state->game_server->stop_listening();
+          }
+          if (state->proxy_server) {
+            state->proxy_server->stop_listening();
+          }
+          if (state->pc_patch_server) {
+            state->pc_patch_server->stop_listening();
+          }
+          if (state->bb_patch_server) {
+            state->bb_patch_server->stop_listening();
+          }
+          if (state->ip_stack_simulator) {
+            state->ip_stack_simulator->stop_listening();
+          }
+          if (http_server) {
+            http_server->stop_listening();
+          }
+          state->finish_handoff();
+          config_log.info("Listening sockets handed off; shutting down");
+          event_base_loopexit(base.get(), nullptr);
+        };
+        handoff_server = make_shared<SocketHandoffServer>(
+            base, state->handoff_socket_path, listening_sockets, on_request, on_complete);
       }
 
       if (!state->username.empty()) {
@@ -2678,6 +3084,10 @@ Action a_run_server_replay_log(
         should_run_shell = !replay_session.get();
       }
 
+      if (!is_replay) {
+        state->start_file_watcher();
+      }
+
       config_log.info("Ready");
       if (should_run_shell) {
         shell = make_shared<ServerShell>(state);
@@ -2715,6 +3125,14 @@ Action a_run_server_replay_log(
         config_log.info("Waiting for HTTP server to stop");
         http_server->wait_for_stop();
       }
+      config_log.info("Waiting for player data to be saved");
+      if (state->game_checkpoint_manager && state->game_checkpoint_interval_usecs) {
+        state->game_checkpoint_manager->checkpoint(true);
+      }
+      if (state->team_index) {
+        state->team_index->flush();
+      }
+      state->file_writer->stop();
       state->proxy_server.reset(); // Break reference cycle
     });
 
@@ -1,5 +1,7 @@
 #include "Map.hh"
 
+#include <algorithm>
+
 #include <phosg/Filesystem.hh>
 #include <phosg/Random.hh>
 #include <phosg/Strings.hh>
@@ -715,16 +717,134 @@ string Map::Object::str() const {
       this->item_drop_checked ? "true" : "false");
 }
 
+void Map::EntityIndex::add(uint64_t key, uint32_t entity_index) {
+  this->pending.emplace_back(key, entity_index);
+}
+
+void Map::EntityIndex::build() {
+  if (this->pending.empty()) {
+    return;
+  }
+
+  // If the index was already built, merge the existing entries with the new
+  // ones. The existing entries go first, since they were added earlier.
+  vector<pair<uint64_t, uint32_t>> entries;
+  entries.reserve(this->entity_indexes.size() + this->pending.size());
+  for (size_t z = 0; z < this->keys.size(); z++) {
+    for (size_t w = this->offsets[z]; w < this->offsets[z + 1]; w++) {
+      entries.emplace_back(this->keys[z], this->entity_indexes[w]);
+    }
+  }
+  entries.insert(entries.end(), this->pending.begin(), this->pending.end());
+  this->pending.clear();
+  this->pending.shrink_to_fit();
+
+  // Entities with the same key stay in the order they were added
+  stable_sort(entries.begin(), entries.end(), [](const auto& a, const auto& b) -> bool {
+    return a.first < b.first;
+  });
+
+  this->keys.clear();
+  this->offsets.clear();
+  this->entity_indexes.clear();
+  this->entity_indexes.reserve(entries.size());
+  for (const auto& it : entries) {
+    if (this->keys.empty() || (this->keys.back() != it.first)) {
+      this->keys.emplace_back(it.first);
+      this->offsets.emplace_back(this->entity_indexes.size());
+    }
+    this->entity_indexes.emplace_back(it.second);
+  }
+  this->offsets.emplace_back(this->entity_indexes.size());
+}
+
+void Map::EntityIndex::clear() {
+  this->pending.clear();
+  this->keys.clear();
+  this->offsets.clear();
+  this->entity_indexes.clear();
+}
+
+void Map::EntityIndex::check_built() const {
+  if (!this->pending.empty()) {
+    throw logic_error("entity index used before it was built");
+  }
+}
+
+span<const uint32_t> Map::EntityIndex::find(uint64_t key) const {
+  this->check_built();
+  auto it = lower_bound(this->keys.begin(), this->keys.end(), key);
+  if ((it == this->keys.end()) || (*it != key)) {
+    return span<const uint32_t>();
+  }
+  size_t z = it - this->keys.begin();
+  return span<const uint32_t>(this->entity_indexes.data() + this->offsets[z], this->offsets[z + 1] - this->offsets[z]);
+}
+
+span<const uint32_t> Map::EntityIndex::find_range(uint64_t start_key, uint64_t end_key) const {
+  this->check_built();
+  size_t start_z = lower_bound(this->keys.begin(), this->keys.end(), start_key) - this->keys.begin();
+  size_t end_z = lower_bound(this->keys.begin(), this->keys.end(), end_key) - this->keys.begin();
+  if (start_z >= end_z) {
+    return span<const uint32_t>();
+  }
+  return span<const uint32_t>(this->entity_indexes.data() + this->offsets[start_z], this->offsets[end_z] - this->offsets[start_z]);
+}
+
 Map::Map(Version version, uint32_t lobby_id, uint32_t rare_seed, std::shared_ptr<PSOLFGEncryption> opt_rand_crypt)
     : log(string_printf("[Lobby:%08" PRIX32 ":map] ", lobby_id), lobby_log.min_level),
       version(version),
       rare_seed(rare_seed),
       opt_rand_crypt(opt_rand_crypt) {}
 
+Map::Map(const Map& tmpl, uint32_t lobby_id, uint32_t rare_seed, std::shared_ptr<PSOLFGEncryption> opt_rand_crypt)
+    : log(string_printf("[Lobby:%08" PRIX32 ":map] ", lobby_id), lobby_log.min_level),
+      version(tmpl.version),
+      rare_seed(rare_seed),
+      opt_rand_crypt(opt_rand_crypt),
+      objects(tmpl.objects),
+      enemies(tmpl.enemies),
+      enemy_set_flags(tmpl.enemy_set_flags),
+      rare_enemy_indexes(tmpl.rare_enemy_indexes),
+      events(tmpl.events),
+      event_action_stream(tmpl.event_action_stream),
+      floor_and_event_id_to_index(tmpl.floor_and_event_id_to_index),
+      floor_section_and_group_to_object_index(tmpl.floor_section_and_group_to_object_index),
+      floor_section_and_wave_number_to_enemy_index(tmpl.floor_section_and_wave_number_to_enemy_index),
+      floor_section_and_wave_number_to_event_index(tmpl.floor_section_and_wave_number_to_event_index) {}
+
+shared_ptr<Map> Map::instantiate(
+    uint32_t lobby_id,
+    uint32_t rare_seed,
+    std::shared_ptr<PSOLFGEncryption> opt_rand_crypt,
+    std::shared_ptr<const RareEnemyRates> rare_rates) const {
+  // The constructor is private, so we can't use make_shared here
+  shared_ptr<Map> ret(new Map(*this, lobby_id, rare_seed, opt_rand_crypt));
+
+  // The deferred rolls are in the same order as they would have been done if
+  // the map had been loaded directly, so the results are the same as well
+  for (const auto& def : this->deferred_rare_enemies) {
+    if (ret->check_and_log_rare_enemy(false, (*rare_rates).*def.rate, def.enemy_index)) {
+      for (size_t z = 0; z < def.num_enemies; z++) {
+        ret->enemies[def.enemy_index + z].type = def.rare_type;
+      }
+    }
+  }
+  return ret;
+}
+
 void Map::clear() {
+  this->deferred_rare_enemies.clear();
   this->objects.clear();
   this->enemies.clear();
+  this->enemy_set_flags.clear();
   this->rare_enemy_indexes.clear();
+  this->events.clear();
+  this->event_action_stream.clear();
+  this->floor_and_event_id_to_index.clear();
+  this->floor_section_and_group_to_object_index.clear();
+  this->floor_section_and_wave_number_to_enemy_index.clear();
+  this->floor_section_and_wave_number_to_event_index.clear();
 }
 
 void Map::add_objects_from_map_data(uint8_t floor, const void* data, size_t size) {
@@ -753,11 +873,11 @@ void Map::add_objects_from_map_data(uint8_t floor, const void* data, size_t size
         .item_drop_checked = false,
     });
     uint64_t k = section_index_key(floor, objects[z].section, objects[z].group);
-    this->floor_section_and_group_to_object_index.emplace(k, object_id);
+    this->floor_section_and_group_to_object_index.add(k, object_id);
   }
 }
 
-bool Map::check_and_log_rare_enemy(bool default_is_rare, uint32_t rare_rate) {
+bool Map::check_and_log_rare_enemy(bool default_is_rare, uint32_t rare_rate, size_t enemy_index) {
   if (default_is_rare) {
     return true;
   }
@@ -768,20 +888,17 @@ bool Map::check_and_log_rare_enemy(bool default_is_rare, uint32_t rare_rate) {
   // computationally expensive.
   if (this->version == Version::BB_V4) {
     if ((this->rare_enemy_indexes.size() < 0x10) && (random_from_optional_crypt(this->opt_rand_crypt) < rare_rate)) {
-      this->rare_enemy_indexes.emplace_back(this->enemies.size());
+      this->rare_enemy_indexes.emplace_back(enemy_index);
       return true;
     }
 
   } else {
-    // TODO: We only need the first value from this crypt, so it's unfortunate
-    // that we have to initialize the entire thing. Find a way to make this
-    // faster.
-    PSOV2Encryption crypt(this->rare_seed + 0x1000 + this->enemies.size());
-    float det = (static_cast<float>((crypt.next() >> 16) & 0xFFFF) / 65536.0f);
+    uint32_t v = PSOV2RandomStream::first_value(this->rare_seed + 0x1000 + enemy_index);
+    float det = (static_cast<float>((v >> 16) & 0xFFFF) / 65536.0f);
     // On v1 and v2 (and GC NTE), the rare rate is 0.1% instead of 0.2%.
     float threshold = is_v1_or_v2(this->version) ? 0.001f : 0.002f;
     if (det < threshold) {
-      this->rare_enemy_indexes.emplace_back(this->enemies.size());
+      this->rare_enemy_indexes.emplace_back(enemy_index);
       return true;
     }
   }
@@ -804,7 +921,26 @@ void Map::add_enemy(
     uint16_t enemy_id = this->enemies.size();
     this->enemies.emplace_back(enemy_id, source_index, set_index, floor, e.section, e.wave_number, type);
     uint64_t k = section_index_key(floor, e.section, e.wave_number);
-    this->floor_section_and_wave_number_to_enemy_index.emplace(k, enemy_id);
+    this->floor_section_and_wave_number_to_enemy_index.add(k, enemy_id);
+  };
+
+  // Returns the type to add for an enemy that may be rare. If rare rolls are
+  // deferred, this always returns normal_type (unless the enemy is always
+  // rare) and the roll is done later in instantiate().
+  auto choose_rare = [&](bool default_is_rare, uint32_t RareEnemyRates::*rate, EnemyType normal_type, EnemyType rare_type) -> EnemyType {
+    if (default_is_rare) {
+      return rare_type;
+    }
+    if (this->defer_rare_enemies) {
+      this->deferred_rare_enemies.emplace_back(DeferredRareEnemy{
+          .enemy_index = this->enemies.size(),
+          .num_enemies = 1,
+          .rate = rate,
+          .rare_type = rare_type,
+      });
+      return normal_type;
+    }
+    return this->check_and_log_rare_enemy(false, (*rare_rates).*rate, this->enemies.size()) ? rare_type : normal_type;
   };
 
   EnemyType child_type = EnemyType::UNKNOWN;
@@ -877,47 +1013,46 @@ void Map::add_enemy(
 
     case 0x0040: { // TObjEneMoja
       bool default_is_rare = (this->version == Version::BB_V4) ? (e.uparam1 & 1) : (e.uparam1 != 0);
-      add(this->check_and_log_rare_enemy(default_is_rare, rare_rates->hildeblue)
-              ? EnemyType::HILDEBLUE
-              : EnemyType::HILDEBEAR);
+      add(choose_rare(default_is_rare, &RareEnemyRates::hildeblue, EnemyType::HILDEBEAR, EnemyType::HILDEBLUE));
       break;
     }
     case 0x0041: { // TObjEneLappy
       bool default_is_rare = (this->version == Version::BB_V4) ? (e.uparam1 & 1) : (e.uparam1 != 0);
-      bool is_rare = this->check_and_log_rare_enemy(default_is_rare, rare_rates->rappy);
+      EnemyType normal_type, rare_type;
       switch (episode) {
         case Episode::EP1:
-          add(is_rare ? EnemyType::AL_RAPPY : EnemyType::RAG_RAPPY);
+          normal_type = EnemyType::RAG_RAPPY;
+          rare_type = EnemyType::AL_RAPPY;
           break;
         case Episode::EP2:
-          if (is_rare) {
-            switch (event) {
-              case 0x01: // rappy_type 1
-                add(EnemyType::SAINT_RAPPY);
-                break;
-              case 0x04: // rappy_type 2
-                add(EnemyType::EGG_RAPPY);
-                break;
-              case 0x05: // rappy_type 3
-                add(EnemyType::HALLO_RAPPY);
-                break;
-              default:
-                add(EnemyType::LOVE_RAPPY);
-            }
-          } else {
-            add(EnemyType::RAG_RAPPY);
+          normal_type = EnemyType::RAG_RAPPY;
+          switch (event) {
+            case 0x01: // rappy_type 1
+              rare_type = EnemyType::SAINT_RAPPY;
+              break;
+            case 0x04: // rappy_type 2
+              rare_type = EnemyType::EGG_RAPPY;
+              break;
+            case 0x05: // rappy_type 3
+              rare_type = EnemyType::HALLO_RAPPY;
+              break;
+            default:
+              rare_type = EnemyType::LOVE_RAPPY;
           }
           break;
         case Episode::EP4:
           if (e.floor > 0x05) {
-            add(is_rare ? EnemyType::DEL_RAPPY_ALT : EnemyType::SAND_RAPPY_ALT);
+            normal_type = EnemyType::SAND_RAPPY_ALT;
+            rare_type = EnemyType::DEL_RAPPY_ALT;
           } else {
-            add(is_rare ? EnemyType::DEL_RAPPY : EnemyType::SAND_RAPPY);
+            normal_type = EnemyType::SAND_RAPPY;
+            rare_type = EnemyType::DEL_RAPPY;
           }
           break;
         default:
           throw logic_error("invalid episode");
       }
+      add(choose_rare(default_is_rare, &RareEnemyRates::rappy, normal_type, rare_type));
       break;
     }
     case 0x0042: // TObjEneBm3FlyNest
@@ -940,9 +1075,7 @@ void Map::add_enemy(
       if ((episode == Episode::EP2) && (e.floor == 0x11)) {
         add(EnemyType::DEL_LILY);
       } else {
-        add(this->check_and_log_rare_enemy(false, rare_rates->nar_lily)
-                ? EnemyType::NAR_LILY
-                : EnemyType::POISON_LILY);
+        add(choose_rare(false, &RareEnemyRates::nar_lily, EnemyType::POISON_LILY, EnemyType::NAR_LILY));
       }
       break;
     case 0x0062: // TObjEneNanoDrago
@@ -959,9 +1092,8 @@ void Map::add_enemy(
       }
       default_num_children = -1; // Skip adding children (because we do it here)
       for (size_t z = 0; z < 5; z++) {
-        add(this->check_and_log_rare_enemy((this->version == Version::BB_V4) && (e.uparam2 & 1), rare_rates->pouilly_slime)
-                ? EnemyType::POUILLY_SLIME
-                : EnemyType::POFUILLY_SLIME);
+        add(choose_rare((this->version == Version::BB_V4) && (e.uparam2 & 1), &RareEnemyRates::pouilly_slime,
+            EnemyType::POFUILLY_SLIME, EnemyType::POUILLY_SLIME));
       }
       break;
     case 0x0065: // TObjEnePanarms
@@ -1170,22 +1302,18 @@ void Map::add_enemy(
       }
       break;
     case 0x0112:
-      add(this->check_and_log_rare_enemy(e.uparam1 & 0x01, rare_rates->merissa_aa)
-              ? EnemyType::MERISSA_AA
-              : EnemyType::MERISSA_A);
+      add(choose_rare(e.uparam1 & 0x01, &RareEnemyRates::merissa_aa, EnemyType::MERISSA_A, EnemyType::MERISSA_AA));
       break;
     case 0x0113:
       add(EnemyType::GIRTABLULU);
       break;
-    case 0x0114: {
-      bool is_rare = this->check_and_log_rare_enemy(e.uparam1 & 0x01, rare_rates->pazuzu);
+    case 0x0114:
       if (e.floor > 0x05) {
-        add(is_rare ? EnemyType::PAZUZU_ALT : EnemyType::ZU_ALT);
+        add(choose_rare(e.uparam1 & 0x01, &RareEnemyRates::pazuzu, EnemyType::ZU_ALT, EnemyType::PAZUZU_ALT));
       } else {
-        add(is_rare ? EnemyType::PAZUZU : EnemyType::ZU);
+        add(choose_rare(e.uparam1 & 0x01, &RareEnemyRates::pazuzu, EnemyType::ZU, EnemyType::PAZUZU));
       }
       break;
-    }
     case 0x0115:
       if (e.uparam1 & 2) {
         add(EnemyType::BA_BOOTA);
@@ -1194,25 +1322,18 @@ void Map::add_enemy(
       }
       break;
     case 0x0116:
-      add(this->check_and_log_rare_enemy(e.uparam1 & 0x01, rare_rates->dorphon_eclair)
-              ? EnemyType::DORPHON_ECLAIR
-              : EnemyType::DORPHON);
+      add(choose_rare(e.uparam1 & 0x01, &RareEnemyRates::dorphon_eclair, EnemyType::DORPHON, EnemyType::DORPHON_ECLAIR));
       break;
     case 0x0117: {
       static const EnemyType types[3] = {EnemyType::GORAN, EnemyType::PYRO_GORAN, EnemyType::GORAN_DETONATOR};
       add(types[e.uparam1 % 3]);
       break;
     }
-    case 0x0119: {
-      bool is_rare = this->check_and_log_rare_enemy((e.fparam2 != 0.0f), rare_rates->kondrieu);
-      if (is_rare) {
-        add(EnemyType::KONDRIEU);
-      } else {
-        add((e.uparam1 & 1) ? EnemyType::SHAMBERTIN : EnemyType::SAINT_MILLION);
-      }
+    case 0x0119:
+      add(choose_rare((e.fparam2 != 0.0f), &RareEnemyRates::kondrieu,
+          (e.uparam1 & 1) ? EnemyType::SHAMBERTIN : EnemyType::SAINT_MILLION, EnemyType::KONDRIEU));
       default_num_children = 0x18;
       break;
-    }
 
     case 0x00C3: // TBoss3VoloptP01
     case 0x00C4: // TBoss3VoloptCore or subclass
@@ -1234,6 +1355,14 @@ void Map::add_enemy(
     size_t num_children = e.num_children ? e.num_children.load() : default_num_children;
     if ((child_type == EnemyType::UNKNOWN) && !this->enemies.empty()) {
       child_type = this->enemies.back().type;
+      // If the parent's rare roll was deferred, the children must change type
+      // along with it
+      if (!this->deferred_rare_enemies.empty()) {
+        auto& def = this->deferred_rare_enemies.back();
+        if (def.enemy_index + def.num_enemies == this->enemies.size()) {
+          def.num_enemies += num_children;
+        }
+      }
     }
     for (size_t x = 0; x < num_children; x++) {
       add(child_type);
@@ -1482,27 +1611,19 @@ void Map::add_event(uint32_t event_id, uint16_t flags, uint8_t floor, uint16_t s
   ev.action_stream_offset = action_stream_offset;
 
   uint64_t k = (static_cast<uint64_t>(floor) << 32) | event_id;
-  this->floor_and_event_id_to_index.emplace(k, index);
+  this->floor_and_event_id_to_index.add(k, index);
   k = section_index_key(floor, section, wave_number);
-  this->floor_section_and_wave_number_to_event_index.emplace(k, index);
+  this->floor_section_and_wave_number_to_event_index.add(k, index);
 }
 
-vector<Map::Event*> Map::get_events(uint8_t floor, uint32_t event_id) {
+Map::EntityView<Map::Event> Map::get_events(uint8_t floor, uint32_t event_id) {
   uint64_t k = (static_cast<uint64_t>(floor) << 32) | event_id;
-  vector<Event*> ret;
-  for (auto its = this->floor_and_event_id_to_index.equal_range(k); its.first != its.second; its.first++) {
-    ret.emplace_back(&this->events.at(its.first->second));
-  }
-  return ret;
+  return EntityView<Event>(this->events.data(), this->floor_and_event_id_to_index.find(k));
 }
 
-vector<const Map::Event*> Map::get_events(uint8_t floor, uint32_t event_id) const {
+Map::EntityView<const Map::Event> Map::get_events(uint8_t floor, uint32_t event_id) const {
   uint64_t k = (static_cast<uint64_t>(floor) << 32) | event_id;
-  vector<const Event*> ret;
-  for (auto its = this->floor_and_event_id_to_index.equal_range(k); its.first != its.second; its.first++) {
-    ret.emplace_back(&this->events.at(its.first->second));
-  }
-  return ret;
+  return EntityView<const Event>(this->events.data(), this->floor_and_event_id_to_index.find(k));
 }
 
 void Map::add_events_from_map_data(uint8_t floor, const void* data, size_t size) {
@@ -1671,43 +1792,32 @@ Map::Enemy& Map::find_enemy(uint8_t floor, EnemyType type) {
   throw out_of_range("enemy not found");
 }
 
-std::vector<Map::Object*> Map::get_objects(uint8_t floor, uint16_t section, uint16_t group) {
+void Map::build_indexes() {
+  this->floor_and_event_id_to_index.build();
+  this->floor_section_and_group_to_object_index.build();
+  this->floor_section_and_wave_number_to_enemy_index.build();
+  this->floor_section_and_wave_number_to_event_index.build();
+}
+
+Map::EntityView<Map::Object> Map::get_objects(uint8_t floor, uint16_t section, uint16_t group) {
   uint64_t k = section_index_key(floor, section, group);
-  vector<Object*> ret;
-  for (auto its = this->floor_section_and_group_to_object_index.equal_range(k); its.first != its.second; its.first++) {
-    ret.emplace_back(&this->objects.at(its.first->second));
-  }
-  return ret;
+  return EntityView<Object>(this->objects.data(), this->floor_section_and_group_to_object_index.find(k));
 }
 
-std::vector<Map::Enemy*> Map::get_enemies(uint8_t floor, uint16_t section, uint16_t wave_number) {
+Map::EntityView<Map::Enemy> Map::get_enemies(uint8_t floor, uint16_t section, uint16_t wave_number) {
   uint64_t k = section_index_key(floor, section, wave_number);
-  vector<Enemy*> ret;
-  for (auto its = this->floor_section_and_wave_number_to_enemy_index.equal_range(k); its.first != its.second; its.first++) {
-    ret.emplace_back(&this->enemies.at(its.first->second));
-  }
-  return ret;
+  return EntityView<Enemy>(this->enemies.data(), this->floor_section_and_wave_number_to_enemy_index.find(k));
 }
 
-std::vector<Map::Event*> Map::get_events(uint8_t floor, uint16_t section, uint16_t wave_number) {
+Map::EntityView<Map::Event> Map::get_events(uint8_t floor, uint16_t section, uint16_t wave_number) {
   uint64_t k = section_index_key(floor, section, wave_number);
-  vector<Event*> ret;
-  for (auto its = this->floor_section_and_wave_number_to_event_index.equal_range(k); its.first != its.second; its.first++) {
-    ret.emplace_back(&this->events.at(its.first->second));
-  }
-  return ret;
+  return EntityView<Event>(this->events.data(), this->floor_section_and_wave_number_to_event_index.find(k));
 }
 
-std::vector<Map::Event*> Map::get_events(uint8_t floor) {
+Map::EntityView<Map::Event> Map::get_events(uint8_t floor) {
   uint64_t k_start = (static_cast<uint64_t>(floor) << 32);
   uint64_t k_end = (static_cast<uint64_t>(floor + 1) << 32);
-  vector<Event*> ret;
-  for (auto it = this->floor_and_event_id_to_index.lower_bound(k_start);
-       (it != this->floor_and_event_id_to_index.end()) && (it->first < k_end);
-       it++) {
-    ret.emplace_back(&this->events.at(it->second));
-  }
-  return ret;
+  return EntityView<Event>(this->events.data(), this->floor_and_event_id_to_index.find_range(k_start, k_end));
 }
 
 template <typename EntryT>
@@ -1866,6 +1976,86 @@ string Map::disassemble_quest_data(const void* data, size_t size) {
   return join(ret, "\n") + "\n";
 }
 
+MapTemplateCache::MapTemplateCache(size_t max_entries) : max_entries(max_entries) {}
+
+shared_ptr<const Map> MapTemplateCache::get(const string& key, function<shared_ptr<const Map>()> generate, bool* generate_called) {
+  shared_ptr<Entry> entry;
+  promise<shared_ptr<const Map>> result_promise;
+  bool should_generate = false;
+  {
+    lock_guard g(this->lock);
+    auto it = this->entries.find(key);
+    if (it != this->entries.end()) {
+      entry = it->second;
+      if (entry->ready) {
+        this->lru.splice(this->lru.begin(), this->lru, entry->lru_it);
+      }
+    } else {
+      entry = make_shared<Entry>();
+      entry->future = result_promise.get_future().share();
+      this->entries.emplace(key, entry);
+      should_generate = true;
+    }
+  }
+  if (generate_called) {
+    *generate_called = should_generate;
+  }
+
+  if (!should_generate) {
+    // If another thread is still generating the template, this waits for it
+    // (and rethrows its exception, if generate() failed)
+    return entry->future.get();
+  }
+
+  // Parsing the map files can take a while, so don't block lookups for other
+  // keys during it
+  shared_ptr<const Map> ret;
+  try {
+    ret = generate();
+  } catch (...) {
+    result_promise.set_exception(current_exception());
+    lock_guard g(this->lock);
+    auto it = this->entries.find(key);
+    if ((it != this->entries.end()) && (it->second == entry)) {
+      this->entries.erase(it);
+    }
+    throw;
+  }
+  result_promise.set_value(ret);
+
+  lock_guard g(this->lock);
+  auto it = this->entries.find(key);
+  // If the cache was cleared while generating, the template may have been
+  // built from files that have since changed, so it isn't cached
+  if ((it == this->entries.end()) || (it->second != entry)) {
+    return ret;
+  }
+  if (!ret) {
+    this->entries.erase(it);
+    return ret;
+  }
+  entry->ready = true;
+  entry->lru_it = this->lru.emplace(this->lru.begin(), key);
+  while (this->max_entries && (this->entries.size() > this->max_entries) && !this->lru.empty()) {
+    this->entries.erase(this->lru.back());
+    this->lru.pop_back();
+  }
+  return ret;
+}
+
+void MapTemplateCache::clear() {
+  // Templates that are still being generated are removed too, so they won't
+  // be cached when they're done
+  lock_guard g(this->lock);
+  this->entries.clear();
+  this->lru.clear();
+}
+
+size_t MapTemplateCache::size() const {
+  lock_guard g(this->lock);
+  return this->entries.size();
+}
+
 SetDataTableBase::SetDataTableBase(Version version) : version(version) {}
 
 parray<le_uint32_t, 0x20> SetDataTableBase::generate_variations(
@@ -2,11 +2,17 @@
 
 #include <inttypes.h>
 
+#include <functional>
+#include <future>
+#include <list>
 #include <memory>
+#include <mutex>
 #include <phosg/Encoding.hh>
 #include <phosg/JSON.hh>
 #include <random>
+#include <span>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 #include "BattleParamsIndex.hh"
@@ -298,14 +304,107 @@ struct Map {
     void generate_shuffled_location_table(const Map::RandomEnemyLocationsHeader& header, StringReader r, uint16_t section);
   };
 
+  // Maps keys (floor/section/wave number, or floor/event ID) to entity
+  // indexes. Entries are added while the map is being loaded; build() then
+  // sorts them into a compressed sparse row layout (sorted unique keys, each
+  // with a range in a flat array of entity indexes), so lookups are binary
+  // searches that return spans and don't allocate. Lookups throw logic_error
+  // if entries have been added since the last call to build().
+  class EntityIndex {
+  public:
+    void add(uint64_t key, uint32_t entity_index);
+    void build();
+    void clear();
+
+    std::span<const uint32_t> find(uint64_t key) const;
+    // Returns the entity indexes for all keys in [start_key, end_key)
+    std::span<const uint32_t> find_range(uint64_t start_key, uint64_t end_key) const;
+
+  private:
+    std::vector<std::pair<uint64_t, uint32_t>> pending;
+    std::vector<uint64_t> keys;
+    std::vector<uint32_t> offsets; // keys.size() + 1 entries
+    std::vector<uint32_t> entity_indexes;
+
+    void check_built() const;
+  };
+
+  // Result of an EntityIndex lookup; iterating over it yields pointers to the
+  // entities (as the vectors of pointers returned by earlier versions of the
+  // get_* functions did).
+  template <typename EntityT>
+  class EntityView {
+  public:
+    class Iterator {
+    public:
+      Iterator(EntityT* entities, const uint32_t* it) : entities(entities), it(it) {}
+      inline EntityT* operator*() const {
+        return &this->entities[*this->it];
+      }
+      inline Iterator& operator++() {
+        this->it++;
+        return *this;
+      }
+      inline bool operator==(const Iterator& other) const {
+        return this->it == other.it;
+      }
+      inline bool operator!=(const Iterator& other) const {
+        return this->it != other.it;
+      }
+
+    private:
+      EntityT* entities;
+      const uint32_t* it;
+    };
+
+    EntityView(EntityT* entities, std::span<const uint32_t> indexes) : entities(entities), indexes(indexes) {}
+
+    inline Iterator begin() const {
+      return Iterator(this->entities, this->indexes.data());
+    }
+    inline Iterator end() const {
+      return Iterator(this->entities, this->indexes.data() + this->indexes.size());
+    }
+    inline size_t size() const {
+      return this->indexes.size();
+    }
+    inline bool empty() const {
+      return this->indexes.empty();
+    }
+
+  private:
+    EntityT* entities;
+    std::span<const uint32_t> indexes;
+  };
+
+  // When a map is built to be used as a template (see MapTemplateCache),
+  // rare enemy rolls are deferred: each enemy that could be rare is added with
+  // its non-rare type, and the roll is recorded here so it can be done later
+  // (in the same order) for each game that uses the template.
+  struct DeferredRareEnemy {
+    size_t enemy_index;
+    size_t num_enemies; // Includes children that have the same type
+    uint32_t RareEnemyRates::*rate;
+    EnemyType rare_type;
+  };
+
   Map(Version version, uint32_t lobby_id, uint32_t rare_seed, std::shared_ptr<PSOLFGEncryption> opt_rand_crypt);
   ~Map() = default;
 
+  // Returns a copy of this map for use in a game, with its own entity state.
+  // If this map was built with defer_rare_enemies set, the rare enemy rolls
+  // are done for the new map using the given seed, crypt, and rates.
+  std::shared_ptr<Map> instantiate(
+      uint32_t lobby_id,
+      uint32_t rare_seed,
+      std::shared_ptr<PSOLFGEncryption> opt_rand_crypt,
+      std::shared_ptr<const RareEnemyRates> rare_rates) const;
+
   void clear();
 
   void add_objects_from_map_data(uint8_t floor, const void* data, size_t size);
 
-  bool check_and_log_rare_enemy(bool default_is_rare, uint32_t rare_rate);
+  bool check_and_log_rare_enemy(bool default_is_rare, uint32_t rare_rate, size_t enemy_index);
   void add_enemy(
       Episode episode,
       uint8_t difficulty,
@@ -340,8 +439,8 @@ struct Map {
       uint16_t section,
       uint16_t wave_number,
       uint32_t action_stream_offset);
-  std::vector<Event*> get_events(uint8_t floor, uint32_t event_id);
-  std::vector<const Event*> get_events(uint8_t floor, uint32_t event_id) const;
+  EntityView<Event> get_events(uint8_t floor, uint32_t event_id);
+  EntityView<const Event> get_events(uint8_t floor, uint32_t event_id) const;
   void add_events_from_map_data(uint8_t floor, const void* data, size_t size);
 
   struct DATSectionsForFloor {
@@ -363,10 +462,13 @@ struct Map {
 
   const Enemy& find_enemy(uint8_t floor, EnemyType type) const;
   Enemy& find_enemy(uint8_t floor, EnemyType type);
-  std::vector<Object*> get_objects(uint8_t floor, uint16_t section, uint16_t wave_number);
-  std::vector<Enemy*> get_enemies(uint8_t floor, uint16_t section, uint16_t wave_number);
-  std::vector<Event*> get_events(uint8_t floor, uint16_t section, uint16_t wave_number);
-  std::vector<Event*> get_events(uint8_t floor);
+  // Must be called after all entities are added and before any of the get_*
+  // functions below (or get_events above) are used.
+  void build_indexes();
+  EntityView<Object> get_objects(uint8_t floor, uint16_t section, uint16_t wave_number);
+  EntityView<Enemy> get_enemies(uint8_t floor, uint16_t section, uint16_t wave_number);
+  EntityView<Event> get_events(uint8_t floor, uint16_t section, uint16_t wave_number);
+  EntityView<Event> get_events(uint8_t floor);
 
   static std::string disassemble_objects_data(const void* data, size_t size, size_t* object_number = nullptr);
   static std::string disassemble_enemies_data(const void* data, size_t size, size_t* enemy_number = nullptr);
@@ -377,16 +479,59 @@ struct Map {
   Version version;
   uint32_t rare_seed;
   std::shared_ptr<PSOLFGEncryption> opt_rand_crypt;
+  bool defer_rare_enemies = false;
+  std::vector<DeferredRareEnemy> deferred_rare_enemies;
   std::vector<Object> objects;
   std::vector<Enemy> enemies;
   std::vector<uint16_t> enemy_set_flags;
   std::vector<size_t> rare_enemy_indexes;
   std::vector<Event> events;
   std::string event_action_stream;
-  std::multimap<uint64_t, size_t> floor_and_event_id_to_index;
-  std::unordered_multimap<uint64_t, size_t> floor_section_and_group_to_object_index;
-  std::unordered_multimap<uint64_t, size_t> floor_section_and_wave_number_to_enemy_index;
-  std::unordered_multimap<uint64_t, size_t> floor_section_and_wave_number_to_event_index;
+  EntityIndex floor_and_event_id_to_index;
+  EntityIndex floor_section_and_group_to_object_index;
+  EntityIndex floor_section_and_wave_number_to_enemy_index;
+  EntityIndex floor_section_and_wave_number_to_event_index;
+
+private:
+  Map(const Map& tmpl, uint32_t lobby_id, uint32_t rare_seed, std::shared_ptr<PSOLFGEncryption> opt_rand_crypt);
+};
+
+// Caches parsed free-roam maps, so that games using the same set of map files
+// (which is most of them, since there are relatively few variations) don't
+// have to load and parse the files again. The cached maps are built with
+// deferred rare enemies and must not be modified; use Map::instantiate to make
+// a copy for each game.
+class MapTemplateCache {
+public:
+  explicit MapTemplateCache(size_t max_entries = 0x400);
+  MapTemplateCache(const MapTemplateCache&) = delete;
+  MapTemplateCache(MapTemplateCache&&) = delete;
+  MapTemplateCache& operator=(const MapTemplateCache&) = delete;
+  MapTemplateCache& operator=(MapTemplateCache&&) = delete;
+  ~MapTemplateCache() = default;
+
+  // Returns the cached template for key, or calls generate() to create it
+  // (without holding the cache's lock) if it isn't cached. If another thread
+  // is already generating the same template, waits for it instead of calling
+  // generate() again. If the result is null, or if clear() was called while
+  // generate() was running, it is not cached (but is still returned to the
+  // threads that were waiting for it).
+  std::shared_ptr<const Map> get(const std::string& key, std::function<std::shared_ptr<const Map>()> generate, bool* generate_called = nullptr);
+  void clear();
+
+  size_t size() const;
+
+private:
+  struct Entry {
+    std::shared_future<std::shared_ptr<const Map>> future;
+    bool ready = false; // If false, generate() is still running
+    std::list<std::string>::iterator lru_it; // Valid only if ready is true
+  };
+
+  mutable std::mutex lock;
+  size_t max_entries;
+  std::list<std::string> lru; // Most recently used first; only ready entries
+  std::unordered_map<std::string, std::shared_ptr<Entry>> entries;
 };
 
 class SetDataTableBase {
@@ -147,6 +147,44 @@ PSOEncryption::Type PSOV2Encryption::type() const {
   return Type::V2;
 }
 
+PSOV2RandomStream::PSOV2RandomStream(uint32_t seed) : offset(1) {
+  // This is the same as the PSOV2Encryption constructor
+  this->stream[0] = 0;
+  uint32_t a = 1, b = seed;
+  this->stream[0x37] = b;
+  for (uint16_t virtual_index = 0x15; virtual_index <= 0x36 * 0x15; virtual_index += 0x15) {
+    this->stream[virtual_index % 0x37] = a;
+    uint32_t c = b - a;
+    b = a;
+    a = c;
+  }
+  this->stream[0x38] = 0;
+  for (size_t x = 0; x < 5; x++) {
+    this->update_stream();
+  }
+}
+
+uint32_t PSOV2RandomStream::next() {
+  if (this->offset == 0x38) {
+    this->update_stream();
+  }
+  return this->stream[this->offset++];
+}
+
+uint32_t PSOV2RandomStream::first_value(uint32_t seed) {
+  return PSOV2RandomStream(seed).next();
+}
+
+void PSOV2RandomStream::update_stream() {
+  for (size_t z = 1; z < 0x19; z++) {
+    this->stream[z] -= this->stream[z + 0x1F];
+  }
+  for (size_t z = 0x19; z < 0x38; z++) {
+    this->stream[z] -= this->stream[z - 0x18];
+  }
+  this->offset = 1;
+}
+
 PSOV3Encryption::PSOV3Encryption(uint32_t seed)
     : PSOLFGEncryption(seed, STREAM_LENGTH, STREAM_LENGTH) {
   uint32_t x, y, basekey, source1, source2, source3;
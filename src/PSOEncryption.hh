@@ -85,6 +85,25 @@ protected:
   static constexpr size_t STREAM_LENGTH = 0x38;
 };
 
+// Produces the same values as PSOV2Encryption::next, but without any heap
+// allocation or virtual calls. This is intended for code that creates very
+// many short-lived generators (e.g. one per enemy when checking for rare
+// enemies on non-BB versions).
+class PSOV2RandomStream {
+public:
+  explicit PSOV2RandomStream(uint32_t seed);
+  uint32_t next();
+
+  // Equivalent to PSOV2RandomStream(seed).next()
+  static uint32_t first_value(uint32_t seed);
+
+private:
+  uint32_t stream[0x39];
+  size_t offset;
+
+  void update_stream();
+};
+
 class PSOV3Encryption : public PSOLFGEncryption {
 public:
   explicit PSOV3Encryption(uint32_t key);
@@ -1,36 +1,127 @@
 #include "PatchFileIndex.hh"
 
+#include <errno.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include <functional>
 #include <phosg/Filesystem.hh>
-#include <phosg/Hash.hh>
 #include <phosg/Strings.hh>
+#include <phosg/Tools.hh>
 #include <stdexcept>
 
+#include "CRC32.hh"
 #include "Loggers.hh"
 
 using namespace std;
 
+PatchFileIndex::Reader::Reader(const string& path)
+    : fd(::open(path.c_str(), O_RDONLY | O_CLOEXEC)),
+      bytes(0) {
+  if (this->fd < 0) {
+    throw cannot_open_file(path);
+  }
+  struct stat st;
+  if (::fstat(this->fd, &st) != 0) {
+    ::close(this->fd);
+    throw runtime_error("cannot stat " + path);
+  }
+  this->bytes = st.st_size;
+}
+
+PatchFileIndex::Reader::~Reader() {
+  ::close(this->fd);
+}
+
+void PatchFileIndex::Reader::read(void* dest, size_t offset, size_t size) const {
+  uint8_t* dest_bytes = reinterpret_cast<uint8_t*>(dest);
+  while (size > 0) {
+    ssize_t bytes_read = ::pread(this->fd, dest_bytes, size, offset);
+    if (bytes_read < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      throw runtime_error(string_printf("cannot read from patch file (%d)", errno));
+    }
+    if (bytes_read == 0) {
+      throw runtime_error("patch file is shorter than expected");
+    }
+    dest_bytes += bytes_read;
+    offset += bytes_read;
+    size -= bytes_read;
+  }
+}
+
 PatchFileIndex::File::File(PatchFileIndex* index)
     : index(index),
       crc32(0),
       size(0) {}
 
+string PatchFileIndex::File::full_path() const {
+  return this->index->root_dir + "/" + join(this->path_directories, "/") + "/" + this->name;
+}
+
 std::shared_ptr<const std::string> PatchFileIndex::File::load_data() {
-  if (!this->loaded_data) {
-    string relative_path = join(this->path_directories, "/") + "/" + this->name;
-    string full_path = this->index->root_dir + "/" + relative_path;
-    patch_index_log.info("Loading data for %s", relative_path.c_str());
-    this->loaded_data = make_shared<string>(load_file(full_path));
-    this->size = this->loaded_data->size();
+  {
+    lock_guard g(this->index->cache_lock);
+    if (this->loaded_data) {
+      auto& lru = this->index->loaded_data_lru;
+      lru.splice(lru.begin(), lru, this->loaded_data_lru_it);
+      return this->loaded_data;
+    }
+  }
+
+  // Don't hold the lock while reading the file, since it may be large
+  string full_path = this->full_path();
+  patch_index_log.info("Loading data for %s", full_path.c_str());
+  auto data = make_shared<const string>(load_file(full_path));
+
+  lock_guard g(this->index->cache_lock);
+  if (this->loaded_data) {
+    // Another thread loaded it while we were reading the file
+    return this->loaded_data;
   }
-  return this->loaded_data;
+  this->loaded_data = data;
+  this->index->loaded_data_lru.emplace_front(this);
+  this->loaded_data_lru_it = this->index->loaded_data_lru.begin();
+  this->index->loaded_data_bytes += data->size();
+  this->index->evict_loaded_data_locked();
+  return data;
 }
 
-PatchFileIndex::PatchFileIndex(const string& root_dir)
-    : root_dir(root_dir) {
+shared_ptr<const PatchFileIndex::Reader> PatchFileIndex::File::open() {
+  lock_guard g(this->index->cache_lock);
+  auto ret = this->reader.lock();
+  if (!ret) {
+    ret = make_shared<Reader>(this->full_path());
+    this->reader = ret;
+  }
+  return ret;
+}
+
+void PatchFileIndex::evict_loaded_data_locked() {
+  while ((this->loaded_data_bytes > this->loaded_data_max_bytes) && !this->loaded_data_lru.empty()) {
+    File* f = this->loaded_data_lru.back();
+    this->loaded_data_lru.pop_back();
+    this->loaded_data_bytes -= f->loaded_data->size();
+    // Callers that still hold the data can continue to use it; it's freed
+    // when the last of them is done
+    f->loaded_data.reset();
+  }
+}
+
+size_t PatchFileIndex::get_loaded_data_bytes() const {
+  lock_guard g(this->cache_lock);
+  return this->loaded_data_bytes;
+}
+
+PatchFileIndex::PatchFileIndex(const string& root_dir, size_t loaded_data_max_bytes)
+    : root_dir(root_dir),
+      loaded_data_max_bytes(loaded_data_max_bytes),
+      loaded_data_bytes(0) {
 
   string metadata_cache_filename = root_dir + "/.metadata-cache.json";
   JSON metadata_cache_json;
@@ -48,6 +139,20 @@ PatchFileIndex::PatchFileIndex(const string& root_dir)
   bool should_write_metadata_cache = false;
   JSON new_metadata_cache_json = JSON::dict();
 
+  // Files whose checksums need to be computed are collected first and hashed
+  // in parallel afterward, since this can take a long time for large patch
+  // trees (e.g. after a client update)
+  struct CollectedFile {
+    shared_ptr<File> file;
+    string relative_path;
+    string full_path;
+    uint64_t mtime;
+    JSON cache_item_json;
+    string compute_crc32s_message; // If not empty, should compute crc32s
+    exception_ptr compute_exc;
+  };
+  vector<CollectedFile> collected_files;
+
   vector<string> path_directories;
   function<void(const string&)> collect_dir = [&](const string& dir) -> void {
     path_directories.emplace_back(dir);
@@ -70,74 +175,112 @@ PatchFileIndex::PatchFileIndex(const string& root_dir)
 
         auto st = stat(full_item_path);
 
-        auto f = make_shared<File>(this);
-        f->path_directories = path_directories;
-        f->name = item;
+        auto& cf = collected_files.emplace_back();
+        cf.file = make_shared<File>(this);
+        cf.file->path_directories = path_directories;
+        cf.file->name = item;
+        cf.relative_path = relative_item_path;
+        cf.full_path = full_item_path;
+        cf.mtime = st.st_mtime;
 
-        string compute_crc32s_message; // If not empty, should compute crc32s
-        JSON cache_item_json;
         try {
-          cache_item_json = metadata_cache_json.at(relative_item_path);
-          uint64_t cached_size = cache_item_json.get_int(0);
-          uint64_t cached_mtime = cache_item_json.get_int(1);
+          cf.cache_item_json = metadata_cache_json.at(relative_item_path);
+          uint64_t cached_size = cf.cache_item_json.get_int(0);
+          uint64_t cached_mtime = cf.cache_item_json.get_int(1);
           if (static_cast<uint64_t>(st.st_mtime) != cached_mtime) {
             throw runtime_error("file has been modified");
           }
           if (static_cast<uint64_t>(st.st_size) != cached_size) {
             throw runtime_error("file size has changed");
           }
-          f->size = cached_size;
-          f->crc32 = cache_item_json.get_int(2);
-          for (const auto& chunk_crc32_json : cache_item_json.get_list(3)) {
-            f->chunk_crcs.emplace_back(chunk_crc32_json->as_int());
+          cf.file->size = cached_size;
+          cf.file->crc32 = cf.cache_item_json.get_int(2);
+          for (const auto& chunk_crc32_json : cf.cache_item_json.get_list(3)) {
+            cf.file->chunk_crcs.emplace_back(chunk_crc32_json->as_int());
           }
 
         } catch (const exception& e) {
-          compute_crc32s_message = e.what();
+          cf.compute_crc32s_message = e.what();
+          cf.file->chunk_crcs.clear();
         }
+      }
+    }
 
-        if (!compute_crc32s_message.empty()) {
-          auto data = f->load_data(); // Sets f->size
-          f->crc32 = crc32(data->data(), f->size);
-          for (size_t x = 0; x < data->size(); x += 0x4000) {
-            size_t chunk_bytes = min<size_t>(f->size - x, 0x4000);
-            f->chunk_crcs.emplace_back(::crc32(data->data() + x, chunk_bytes));
-          }
+    path_directories.pop_back();
+  };
 
-          // File was modified or cache item was missing; make a new cache item
-          auto chunk_crcs_item = JSON::list();
-          for (uint32_t chunk_crc : f->chunk_crcs) {
-            chunk_crcs_item.emplace_back(chunk_crc);
-          }
-          new_metadata_cache_json.emplace(
-              relative_item_path, JSON::list({f->size, st.st_mtime, f->crc32, std::move(chunk_crcs_item)}));
-          should_write_metadata_cache = true;
-
-        } else {
-          // File was not modified and cache item was valid; just use the
-          // existing cache item
-          new_metadata_cache_json.emplace(
-              relative_item_path, std::move(cache_item_json));
-        }
+  collect_dir(".");
 
-        this->files_by_patch_order.emplace_back(f);
-        this->files_by_name.emplace(relative_item_path, f);
-        if (compute_crc32s_message.empty()) {
-          patch_index_log.info(
-              "Added file %s (%" PRIu32 " bytes; %zu chunks; %08" PRIX32 " from cache)",
-              full_item_path.c_str(), f->size, f->chunk_crcs.size(), f->crc32);
-        } else {
-          patch_index_log.info(
-              "Added file %s (%" PRIu32 " bytes; %zu chunks; %08" PRIX32 " [%s])",
-              full_item_path.c_str(), f->size, f->chunk_crcs.size(), f->crc32, compute_crc32s_message.c_str());
+  vector<size_t> indexes_to_compute;
+  for (size_t z = 0; z < collected_files.size(); z++) {
+    if (!collected_files[z].compute_crc32s_message.empty()) {
+      indexes_to_compute.emplace_back(z);
+    }
+  }
+  if (!indexes_to_compute.empty()) {
+    patch_index_log.info("Computing checksums for %zu files (using %s)",
+        indexes_to_compute.size(), crc32_fast_implementation_name());
+    parallel_range<size_t>([&](size_t index, size_t) -> bool {
+      auto& cf = collected_files[indexes_to_compute[index]];
+      try {
+        // The file is read in chunks rather than loaded all at once, so
+        // indexing a large patch tree doesn't use much memory. The whole-file
+        // checksum is derived from the chunk checksums, so the data only needs
+        // to be read once.
+        auto r = cf.file->open();
+        cf.file->size = r->size();
+        uint32_t file_crc = 0;
+        string chunk_data(0x4000, '\0');
+        for (size_t x = 0; x < cf.file->size; x += 0x4000) {
+          size_t chunk_bytes = min<size_t>(cf.file->size - x, 0x4000);
+          r->read(chunk_data.data(), x, chunk_bytes);
+          uint32_t chunk_crc = crc32_fast(chunk_data.data(), chunk_bytes);
+          cf.file->chunk_crcs.emplace_back(chunk_crc);
+          file_crc = crc32_combine(file_crc, chunk_crc, chunk_bytes);
         }
+        cf.file->crc32 = file_crc;
+      } catch (const exception&) {
+        cf.compute_exc = current_exception();
       }
+      return false;
+    },
+        0, indexes_to_compute.size(), 0);
+  }
+
+  for (auto& cf : collected_files) {
+    if (cf.compute_exc) {
+      rethrow_exception(cf.compute_exc);
     }
+    const auto& f = cf.file;
 
-    path_directories.pop_back();
-  };
+    if (!cf.compute_crc32s_message.empty()) {
+      // File was modified or cache item was missing; make a new cache item
+      auto chunk_crcs_item = JSON::list();
+      for (uint32_t chunk_crc : f->chunk_crcs) {
+        chunk_crcs_item.emplace_back(chunk_crc);
+      }
+      new_metadata_cache_json.emplace(
+          cf.relative_path, JSON::list({f->size, cf.mtime, f->crc32, std::move(chunk_crcs_item)}));
+      should_write_metadata_cache = true;
 
-  collect_dir(".");
+    } else {
+      // File was not modified and cache item was valid; just use the
+      // existing cache item
+      new_metadata_cache_json.emplace(cf.relative_path, std::move(cf.cache_item_json));
+    }
+
+    this->files_by_patch_order.emplace_back(f);
+    this->files_by_name.emplace(cf.relative_path, f);
+    if (cf.compute_crc32s_message.empty()) {
+      patch_index_log.info(
+          "Added file %s (%" PRIu32 " bytes; %zu chunks; %08" PRIX32 " from cache)",
+          cf.full_path.c_str(), f->size, f->chunk_crcs.size(), f->crc32);
+    } else {
+      patch_index_log.info(
+          "Added file %s (%" PRIu32 " bytes; %zu chunks; %08" PRIX32 " [%s])",
+          cf.full_path.c_str(), f->size, f->chunk_crcs.size(), f->crc32, cf.compute_crc32s_message.c_str());
+    }
+  }
 
   if (should_write_metadata_cache) {
     try {
@@ -2,35 +2,89 @@
 
 #include <inttypes.h>
 
+#include <list>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <unordered_map>
 #include <vector>
 
 struct PatchFileIndex {
-  explicit PatchFileIndex(const std::string& root_dir);
+  // loaded_data_max_bytes limits how much file data is kept in memory by
+  // File::load_data. The patch server doesn't use load_data (it reads chunks
+  // from the files on demand instead), so this only affects files that the
+  // game server reads out of the patch directories, like data.gsl.
+  explicit PatchFileIndex(const std::string& root_dir, size_t loaded_data_max_bytes = 0x4000000);
+
+  // An open file descriptor for a patch file, from which chunks can be read
+  // on demand. This allows the patch server to send files to many clients at
+  // once without keeping all of their contents in memory.
+  class Reader {
+  public:
+    explicit Reader(const std::string& path);
+    Reader(const Reader&) = delete;
+    Reader(Reader&&) = delete;
+    Reader& operator=(const Reader&) = delete;
+    Reader& operator=(Reader&&) = delete;
+    ~Reader();
+
+    inline size_t size() const {
+      return this->bytes;
+    }
+    // Throws if the file is shorter than expected (e.g. if it was modified
+    // after it was indexed).
+    void read(void* dest, size_t offset, size_t size) const;
+
+  private:
+    int fd;
+    size_t bytes;
+  };
 
   struct File {
     PatchFileIndex* index;
     std::vector<std::string> path_directories;
     std::string name;
-    std::shared_ptr<const std::string> loaded_data;
     std::vector<uint32_t> chunk_crcs;
     uint32_t crc32;
     uint32_t size;
 
     explicit File(PatchFileIndex* index);
+
+    std::string full_path() const;
+    // Returns the entire contents of the file. The result is kept in a
+    // size-bounded cache, so repeated calls usually don't read the file again.
     std::shared_ptr<const std::string> load_data();
+    // Returns a reader for the file. The reader is shared by all callers until
+    // none of them are using it anymore, at which point the file is closed.
+    std::shared_ptr<const Reader> open();
+
+  private:
+    friend struct PatchFileIndex;
+    std::shared_ptr<const std::string> loaded_data;
+    std::list<File*>::iterator loaded_data_lru_it;
+    std::weak_ptr<const Reader> reader;
   };
 
   const std::vector<std::shared_ptr<File>>& all_files() const;
   std::shared_ptr<File> get(const std::string& filename) const;
 
+  size_t get_loaded_data_bytes() const;
+
 private:
   std::vector<std::shared_ptr<File>> files_by_patch_order;
   std::unordered_map<std::string, std::shared_ptr<File>> files_by_name;
   std::string root_dir;
+
+  // Protects File::loaded_data, File::reader, and the fields below, since the
+  // patch servers and the game server may use the same index on different
+  // threads
+  mutable std::mutex cache_lock;
+  size_t loaded_data_max_bytes;
+  size_t loaded_data_bytes;
+  std::list<File*> loaded_data_lru; // Most recently used first
+
+  void evict_loaded_data_locked();
 };
 
 struct PatchFileChecksumRequest {
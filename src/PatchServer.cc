@@ -249,33 +249,85 @@ void PatchServer::on_10(shared_ptr<Client> c, string&) {
 
   if (start_cmd.num_files) {
     c->channel.send(0x11, 0x00, start_cmd);
-    vector<string> path_directories;
     for (const auto& req : c->patch_file_checksum_requests) {
       if (req.needs_update()) {
-        this->change_to_directory(c, path_directories, req.file->path_directories);
+        c->download_queue.emplace_back(req.file);
+      }
+    }
+    // The file data is sent a few chunks at a time as the client receives it
+    // (see send_download_chunks), so we don't have to buffer all the files in
+    // memory at once
+    c->channel.on_output_drained = PatchServer::on_client_output_drained;
+    bufferevent_setwatermark(c->channel.bev.get(), EV_WRITE, this->DOWNLOAD_BUFFER_BYTES / 2, 0);
+    this->send_download_chunks(c);
+  } else {
+    c->channel.send(0x12, 0x00);
+  }
+}
+
+void PatchServer::send_download_chunks(shared_ptr<Client> c) {
+  if (!c->channel.connected() || !c->channel.on_output_drained) {
+    return;
+  }
 
-        S_OpenFile_Patch_06 open_cmd = {0, req.file->size, {req.file->name, 1}};
-        c->channel.send(0x06, 0x00, open_cmd);
+  struct evbuffer* out_buf = bufferevent_get_output(c->channel.bev.get());
+  string chunk_data;
+  while (evbuffer_get_length(out_buf) < this->DOWNLOAD_BUFFER_BYTES) {
+    if (c->download_queue.empty()) {
+      this->change_to_directory(c, c->download_path_directories, {});
+      c->channel.send(0x12, 0x00);
+      this->end_download(c);
+      break;
+    }
 
-        for (size_t x = 0; x < req.file->chunk_crcs.size(); x++) {
-          auto data = req.file->load_data();
-          size_t chunk_size = min<uint32_t>(req.file->size - (x * 0x4000), 0x4000);
+    const auto& file = c->download_queue.front();
+    if (!c->download_reader) {
+      this->change_to_directory(c, c->download_path_directories, file->path_directories);
+      S_OpenFile_Patch_06 open_cmd = {0, file->size, {file->name, 1}};
+      c->channel.send(0x06, 0x00, open_cmd);
+      c->download_reader = file->open();
+      c->download_chunk_index = 0;
+    }
 
-          vector<pair<const void*, size_t>> blocks;
-          S_WriteFileHeader_Patch_07 cmd_header = {x, req.file->chunk_crcs[x], chunk_size};
-          blocks.emplace_back(&cmd_header, sizeof(cmd_header));
-          blocks.emplace_back(data->data() + (x * 0x4000), chunk_size);
-          c->channel.send(0x07, 0x00, blocks);
-        }
+    if (c->download_chunk_index < file->chunk_crcs.size()) {
+      size_t offset = c->download_chunk_index * 0x4000;
+      size_t chunk_size = min<uint32_t>(file->size - offset, 0x4000);
+      chunk_data.resize(chunk_size);
+      c->download_reader->read(chunk_data.data(), offset, chunk_size);
 
-        S_CloseCurrentFile_Patch_08 close_cmd = {0};
-        c->channel.send(0x08, 0x00, close_cmd);
-      }
+      vector<pair<const void*, size_t>> blocks;
+      S_WriteFileHeader_Patch_07 cmd_header = {c->download_chunk_index, file->chunk_crcs[c->download_chunk_index], chunk_size};
+      blocks.emplace_back(&cmd_header, sizeof(cmd_header));
+      blocks.emplace_back(chunk_data.data(), chunk_size);
+      c->channel.send(0x07, 0x00, blocks);
+      c->download_chunk_index++;
+
+    } else {
+      S_CloseCurrentFile_Patch_08 close_cmd = {0};
+      c->channel.send(0x08, 0x00, close_cmd);
+      c->download_reader.reset();
+      c->download_queue.pop_front();
     }
-    this->change_to_directory(c, path_directories, {});
   }
 
-  c->channel.send(0x12, 0x00);
+  // The client isn't expected to send anything during the download, so don't
+  // disconnect it for being idle as long as it's still receiving data
+  c->reschedule_timeout_event();
+}
+
+void PatchServer::end_download(shared_ptr<Client> c) {
+  c->download_queue.clear();
+  c->download_reader.reset();
+  c->download_chunk_index = 0;
+  if (c->channel.on_output_drained) {
+    c->channel.on_output_drained = nullptr;
+    // Restore the default watermarks set in on_10, so later writes (and
+    // Channel::disconnect, which frees the bufferevent in its write callback)
+    // don't get called back before the output buffer is empty
+    if (c->channel.bev) {
+      bufferevent_setwatermark(c->channel.bev.get(), EV_WRITE, 0, 0);
+    }
+  }
 }
 
 void PatchServer::disconnect_client(shared_ptr<Client> c) {
@@ -288,6 +340,7 @@ void PatchServer::disconnect_client(shared_ptr<Client> c) {
   }
 
   this->channel_to_client.erase(&c->channel);
+  this->end_download(c);
   c->channel.disconnect();
 
   // We can't just let c be destroyed here, since disconnect_client can be
@@ -388,6 +441,18 @@ void PatchServer::on_client_input(Channel& ch, uint16_t command, uint32_t, std::
   }
 }
 
+void PatchServer::on_client_output_drained(Channel& ch) {
+  PatchServer* server = reinterpret_cast<PatchServer*>(ch.context_obj);
+  shared_ptr<Client> c = server->channel_to_client.at(&ch);
+
+  try {
+    server->send_download_chunks(c);
+  } catch (const exception& e) {
+    server_log.warning("Error sending patch file data: %s", e.what());
+    server->disconnect_client(c);
+  }
+}
+
 void PatchServer::on_client_error(Channel& ch, short events) {
   PatchServer* server = reinterpret_cast<PatchServer*>(ch.context_obj);
   shared_ptr<Client> c = server->channel_to_client.at(&ch);
@@ -463,6 +528,20 @@ void PatchServer::add_socket(const std::string& addr_str, int fd, Version versio
   this->listening_sockets.emplace(piecewise_construct, forward_as_tuple(fd), forward_as_tuple(this, addr_str, fd, version));
 }
 
+void PatchServer::stop_listening() {
+  auto stop = [s = this->shared_from_this()]() -> void {
+    for (const auto& it : s->listening_sockets) {
+      evconnlistener_disable(it.second.listener.get());
+      server_log.info("Stopped accepting connections on %s", it.second.addr_str.c_str());
+    }
+  };
+  if (this->base_is_shared) {
+    stop();
+  } else {
+    forward_to_event_thread(this->base, std::move(stop));
+  }
+}
+
 void PatchServer::thread_fn() {
   event_base_loop(this->base.get(), EVLOOP_NO_EXIT_ON_EMPTY);
 }
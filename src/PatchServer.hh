@@ -3,6 +3,7 @@
 #include <event2/event.h>
 #include <stdint.h>
 
+#include <deque>
 #include <memory>
 #include <string>
 #include <unordered_set>
@@ -42,6 +43,9 @@ public:
   void listen(const std::string& addr_str, const std::string& addr, int port, Version version);
   void listen(const std::string& addr_str, int port, Version version);
   void add_socket(const std::string& addr_str, int fd, Version version);
+  // Stops accepting new connections, but doesn't close the listening sockets
+  // (they may have been handed off to another process)
+  void stop_listening();
 
   void set_config(std::shared_ptr<const Config> config);
 
@@ -56,6 +60,13 @@ private:
     std::vector<PatchFileChecksumRequest> patch_file_checksum_requests;
     uint64_t idle_timeout_usecs;
 
+    // State for the download in progress, if any. The first file in
+    // download_queue is the one currently being sent.
+    std::deque<std::shared_ptr<PatchFileIndex::File>> download_queue;
+    std::shared_ptr<const PatchFileIndex::Reader> download_reader;
+    size_t download_chunk_index = 0;
+    std::vector<std::string> download_path_directories;
+
     std::unique_ptr<struct event, void (*)(struct event*)> idle_timeout_event;
 
     Client(
@@ -100,6 +111,10 @@ private:
 
   std::thread th;
 
+  // During downloads, more file data is sent when the amount of unsent data
+  // in a client's output buffer drops below half of this
+  static constexpr size_t DOWNLOAD_BUFFER_BYTES = 0x40000;
+
   void send_server_init(std::shared_ptr<Client> c) const;
   void send_message_box(std::shared_ptr<Client> c, const std::string& text) const;
   void send_enter_directory(std::shared_ptr<Client> c, const std::string& dir) const;
@@ -111,6 +126,8 @@ private:
   void on_04(std::shared_ptr<Client> c, std::string& data);
   void on_0F(std::shared_ptr<Client> c, std::string& data);
   void on_10(std::shared_ptr<Client> c, std::string& data);
+  void send_download_chunks(std::shared_ptr<Client> c);
+  void end_download(std::shared_ptr<Client> c);
 
   void disconnect_client(std::shared_ptr<Client> c);
 
@@ -125,6 +142,7 @@ private:
   void on_listen_error(struct evconnlistener* listener);
 
   static void on_client_input(Channel& ch, uint16_t command, uint32_t flag, std::string& data);
+  static void on_client_output_drained(Channel& ch);
   static void on_client_error(Channel& ch, short events);
 
   void thread_fn();
@@ -6,9 +6,13 @@
 
 #include <phosg/Filesystem.hh>
 #include <phosg/Hash.hh>
+#include <phosg/Strings.hh>
+#include <phosg/Time.hh>
 #include <stdexcept>
 
+#include "EventUtils.hh"
 #include "FileContentsCache.hh"
+#include "FileDelta.hh"
 #include "ItemData.hh"
 #include "Loggers.hh"
 #include "PSOEncryption.hh"
@@ -19,101 +23,359 @@
 
 using namespace std;
 
-PlayerFilesManager::PlayerFilesManager(std::shared_ptr<struct event_base> base)
+static const char* name_for_file_type(size_t type) {
+  static const array<const char*, 4> names = {"system", "character", "Guild Card", "bank"};
+  return names.at(type);
+}
+
+PlayerFilesManager::PlayerFilesManager(
+    shared_ptr<struct event_base> base, shared_ptr<DurableFileWriter> file_writer, size_t max_bytes)
     : base(base),
+      file_writer(file_writer),
       clear_expired_files_event(
           event_new(this->base.get(), -1, EV_TIMEOUT | EV_PERSIST, &PlayerFilesManager::clear_expired_files, this),
-          event_free) {
+          event_free),
+      max_bytes(max_bytes),
+      bytes(0),
+      hits(0),
+      misses(0),
+      evictions(0),
+      prefetch_hits(0),
+      prefetch_discards(0),
+      character_delta_saves_enabled(false),
+      character_snapshot_saves(0),
+      character_delta_saves(0),
+      character_bytes_written(0) {
   auto tv = usecs_to_timeval(30 * 1000 * 1000);
   event_add(this->clear_expired_files_event.get(), &tv);
 }
 
-template <typename KeyT, typename ValueT>
-size_t erase_unused(std::unordered_map<KeyT, std::shared_ptr<ValueT>>& m) {
-  size_t ret = 0;
-  for (auto it = m.begin(); it != m.end();) {
-    if (it->second.use_count() <= 1) {
-      it = m.erase(it);
-      ret++;
-    } else {
-      it++;
-    }
+PlayerFilesManager::~PlayerFilesManager() {
+  if (this->prefetch_workers) {
+    this->prefetch_workers->stop();
   }
-  return ret;
 }
 
-std::shared_ptr<PSOBBBaseSystemFile> PlayerFilesManager::get_system(const std::string& filename) {
-  try {
-    return this->loaded_system_files.at(filename);
-  } catch (const out_of_range&) {
-    return nullptr;
+void PlayerFilesManager::set_max_bytes(size_t max_bytes) {
+  this->max_bytes = max_bytes;
+  this->evict();
+}
+
+void PlayerFilesManager::set_prefetch_enabled(bool enabled) {
+  if (enabled && !this->prefetch_workers) {
+    this->prefetch_workers = make_shared<WorkerPool>(1);
+  } else if (!enabled && this->prefetch_workers) {
+    this->prefetch_workers->stop();
+    this->prefetch_workers.reset();
+    // Results of tasks that are still running are discarded
+    this->pending_prefetch_filenames.clear();
   }
 }
 
-std::shared_ptr<PSOBBCharacterFile> PlayerFilesManager::get_character(const std::string& filename) {
-  try {
-    return this->loaded_character_files.at(filename);
-  } catch (const out_of_range&) {
+void PlayerFilesManager::set_character_delta_saves_enabled(bool enabled) {
+  this->character_delta_saves_enabled = enabled;
+}
+
+template <typename T>
+shared_ptr<T> PlayerFilesManager::get(FileType type, const string& filename) {
+  auto it = this->entries.find(filename);
+  if (it == this->entries.end()) {
+    this->misses++;
     return nullptr;
   }
+  if (it->second.type != type) {
+    throw logic_error(string_printf("%s is loaded as a %s file, not a %s file",
+        filename.c_str(),
+        name_for_file_type(static_cast<size_t>(it->second.type)),
+        name_for_file_type(static_cast<size_t>(type))));
+  }
+  this->hits++;
+  this->lru.splice(this->lru.begin(), this->lru, it->second.lru_it);
+  return static_pointer_cast<T>(it->second.file);
 }
 
-std::shared_ptr<PSOBBGuildCardFile> PlayerFilesManager::get_guild_card(const std::string& filename) {
-  try {
-    return this->loaded_guild_card_files.at(filename);
-  } catch (const out_of_range&) {
-    return nullptr;
+template <typename T>
+void PlayerFilesManager::set(FileType type, const string& filename, shared_ptr<T> file) {
+  auto emplace_ret = this->entries.emplace(filename, Entry{.type = type, .file = file, .size = sizeof(T), .lru_it = this->lru.end()});
+  if (!emplace_ret.second) {
+    throw runtime_error(string_printf("%s file already loaded: %s",
+        name_for_file_type(static_cast<size_t>(type)), filename.c_str()));
+  }
+  this->lru.emplace_front(filename);
+  emplace_ret.first->second.lru_it = this->lru.begin();
+  this->bytes += sizeof(T);
+  this->discard_prefetched_file(filename);
+  if (type == FileType::CHARACTER) {
+    this->discard_prefetched_file(character_delta_filename(filename));
   }
+  this->evict();
 }
 
-std::shared_ptr<PlayerBank200> PlayerFilesManager::get_bank(const std::string& filename) {
+shared_ptr<PSOBBBaseSystemFile> PlayerFilesManager::get_system(const string& filename) {
+  return this->get<PSOBBBaseSystemFile>(FileType::SYSTEM, filename);
+}
+
+shared_ptr<PSOBBCharacterFile> PlayerFilesManager::get_character(const string& filename) {
+  return this->get<PSOBBCharacterFile>(FileType::CHARACTER, filename);
+}
+
+shared_ptr<PSOBBGuildCardFile> PlayerFilesManager::get_guild_card(const string& filename) {
+  return this->get<PSOBBGuildCardFile>(FileType::GUILD_CARD, filename);
+}
+
+shared_ptr<PlayerBank200> PlayerFilesManager::get_bank(const string& filename) {
+  return this->get<PlayerBank200>(FileType::BANK, filename);
+}
+
+void PlayerFilesManager::set_system(const string& filename, shared_ptr<PSOBBBaseSystemFile> file) {
+  this->set(FileType::SYSTEM, filename, file);
+}
+
+void PlayerFilesManager::set_character(const string& filename, shared_ptr<PSOBBCharacterFile> file) {
+  this->set(FileType::CHARACTER, filename, file);
+}
+
+void PlayerFilesManager::set_guild_card(const string& filename, shared_ptr<PSOBBGuildCardFile> file) {
+  this->set(FileType::GUILD_CARD, filename, file);
+}
+
+void PlayerFilesManager::set_bank(const string& filename, shared_ptr<PlayerBank200> file) {
+  this->set(FileType::BANK, filename, file);
+}
+
+bool PlayerFilesManager::evict_character(const string& filename) {
+  auto it = this->entries.find(filename);
+  if (it != this->entries.end()) {
+    if (it->second.type != FileType::CHARACTER) {
+      throw logic_error(filename + " is not a character file");
+    }
+    if (it->second.file.use_count() > 1) {
+      return false;
+    }
+    this->bytes -= it->second.size;
+    this->lru.erase(it->second.lru_it);
+    this->entries.erase(it);
+    this->evictions++;
+  }
+  this->character_snapshots.erase(filename);
+  this->discard_prefetched_file(filename);
+  this->discard_prefetched_file(character_delta_filename(filename));
+  return true;
+}
+
+shared_ptr<const string> PlayerFilesManager::read_file(const string& filename) {
+  auto it = this->prefetched_files.find(filename);
+  if (it != this->prefetched_files.end()) {
+    auto data = std::move(it->second.data);
+    this->prefetched_files.erase(it);
+    this->prefetch_hits++;
+    return data;
+  }
+
+  // A recent save of the file may not have been written to disk yet
+  this->file_writer->flush(filename);
   try {
-    return this->loaded_bank_files.at(filename);
-  } catch (const out_of_range&) {
+    return make_shared<string>(load_file(filename));
+  } catch (const cannot_open_file&) {
     return nullptr;
   }
 }
 
-void PlayerFilesManager::set_system(const std::string& filename, std::shared_ptr<PSOBBBaseSystemFile> file) {
-  if (!this->loaded_system_files.emplace(filename, file).second) {
-    throw runtime_error("Guild Card file already loaded: " + filename);
+void PlayerFilesManager::prefetch(vector<string>&& filenames) {
+  if (!this->prefetch_workers) {
+    return;
+  }
+
+  vector<string> filenames_to_read;
+  for (auto& filename : filenames) {
+    if (!this->entries.count(filename) &&
+        !this->prefetched_files.count(filename) &&
+        this->pending_prefetch_filenames.emplace(filename).second) {
+      filenames_to_read.emplace_back(std::move(filename));
+    }
+  }
+  if (filenames_to_read.empty()) {
+    return;
   }
+
+  this->prefetch_workers->enqueue([wself = this->weak_from_this(),
+                                      base = this->base,
+                                      file_writer = this->file_writer,
+                                      filenames = std::move(filenames_to_read)]() -> void {
+    vector<pair<string, shared_ptr<const string>>> results;
+    for (const auto& filename : filenames) {
+      try {
+        file_writer->flush(filename);
+        results.emplace_back(filename, make_shared<string>(load_file(filename)));
+      } catch (const cannot_open_file&) {
+        results.emplace_back(filename, nullptr);
+      } catch (const exception& e) {
+        // The file will be read again on the event thread when it's needed
+        player_data_log.warning("Failed to prefetch %s: %s", filename.c_str(), e.what());
+      }
+    }
+
+    forward_to_event_thread(base, [wself, filenames, results = std::move(results)]() -> void {
+      auto self = wself.lock();
+      if (!self) {
+        return;
+      }
+      uint64_t t = now();
+      for (const auto& [filename, data] : results) {
+        // If the file was loaded or evicted while it was being read, it was
+        // removed from the pending set, and the data read here might be out
+        // of date, so don't use it
+        if (self->pending_prefetch_filenames.erase(filename)) {
+          self->prefetched_files[filename] = PrefetchedFile{.data = data, .load_time = t};
+        }
+      }
+      for (const auto& filename : filenames) {
+        self->pending_prefetch_filenames.erase(filename);
+      }
+    });
+  });
+}
+
+string PlayerFilesManager::character_delta_filename(const string& filename) {
+  return filename + ".delta";
 }
 
-void PlayerFilesManager::set_character(const std::string& filename, std::shared_ptr<PSOBBCharacterFile> file) {
-  if (!this->loaded_character_files.emplace(filename, file).second) {
-    throw runtime_error("character file already loaded: " + filename);
+shared_ptr<const string> PlayerFilesManager::read_character_file(const string& filename) {
+  auto snapshot_data = this->read_file(filename);
+  if (!snapshot_data) {
+    return nullptr;
+  }
+
+  string delta_filename = character_delta_filename(filename);
+  auto delta_data = this->read_file(delta_filename);
+  bool has_delta = delta_data && !delta_data->empty();
+  shared_ptr<const string> ret = snapshot_data;
+  if (has_delta) {
+    auto data = make_shared<string>(*snapshot_data);
+    try {
+      if (apply_file_delta(*data, *delta_data)) {
+        player_data_log.info("Applied delta %s to character file", delta_filename.c_str());
+        ret = data;
+      } else {
+        player_data_log.info("Delta %s does not match the character file; ignoring it", delta_filename.c_str());
+      }
+    } catch (const exception& e) {
+      player_data_log.warning("Delta %s is invalid (%s); ignoring it", delta_filename.c_str(), e.what());
+    }
+  }
+
+  if (this->character_delta_saves_enabled || has_delta) {
+    this->character_snapshots[filename] = CharacterSnapshot{.data = *snapshot_data, .has_delta = has_delta};
   }
+  return ret;
 }
 
-void PlayerFilesManager::set_guild_card(const std::string& filename, std::shared_ptr<PSOBBGuildCardFile> file) {
-  if (!this->loaded_guild_card_files.emplace(filename, file).second) {
-    throw runtime_error("Guild Card file already loaded: " + filename);
+void PlayerFilesManager::save_character_file(const string& filename, string&& data) {
+  auto snapshot_it = this->character_snapshots.find(filename);
+  if (this->character_delta_saves_enabled && (snapshot_it != this->character_snapshots.end())) {
+    string delta = encode_file_delta(snapshot_it->second.data, data);
+    if (delta.size() <= MAX_CHARACTER_DELTA_SIZE) {
+      snapshot_it->second.has_delta = true;
+      this->character_delta_saves++;
+      this->character_bytes_written += delta.size();
+      this->file_writer->write(character_delta_filename(filename), std::move(delta));
+      return;
+    }
+  }
+
+  bool had_delta = (snapshot_it != this->character_snapshots.end()) && snapshot_it->second.has_delta;
+  if (this->character_delta_saves_enabled) {
+    this->character_snapshots[filename] = CharacterSnapshot{.data = data, .has_delta = false};
+  } else if (snapshot_it != this->character_snapshots.end()) {
+    this->character_snapshots.erase(snapshot_it);
+  }
+  this->character_snapshot_saves++;
+  this->character_bytes_written += data.size();
+  this->file_writer->write(filename, std::move(data));
+
+  // The existing delta won't match the new snapshot, so it would be ignored
+  // when loading anyway. But if delta saves were disabled, the delta would
+  // never be replaced, and it would apply again if the snapshot were ever
+  // written with exactly the same contents as before, so clear it instead.
+  if (had_delta && !this->character_delta_saves_enabled) {
+    this->file_writer->write(character_delta_filename(filename), "");
+  }
+}
+
+PlayerFilesManager::Stats PlayerFilesManager::stats() const {
+  return Stats{
+      .num_files = this->entries.size(),
+      .bytes = this->bytes,
+      .max_bytes = this->max_bytes,
+      .hits = this->hits,
+      .misses = this->misses,
+      .evictions = this->evictions,
+      .num_prefetched_files = this->prefetched_files.size(),
+      .prefetch_hits = this->prefetch_hits,
+      .prefetch_discards = this->prefetch_discards,
+      .character_snapshot_saves = this->character_snapshot_saves,
+      .character_delta_saves = this->character_delta_saves,
+      .character_bytes_written = this->character_bytes_written};
+}
+
+void PlayerFilesManager::discard_prefetched_file(const string& filename) {
+  if (this->prefetched_files.erase(filename) || this->pending_prefetch_filenames.erase(filename)) {
+    this->prefetch_discards++;
   }
 }
 
-void PlayerFilesManager::set_bank(const std::string& filename, std::shared_ptr<PlayerBank200> file) {
-  if (!this->loaded_bank_files.emplace(filename, file).second) {
-    throw runtime_error("bank file already loaded: " + filename);
+void PlayerFilesManager::evict() {
+  if (this->max_bytes == 0) {
+    return;
+  }
+  // Files that are in use can't be evicted, so this may not be able to get
+  // below max_bytes if many players are online
+  for (auto lru_it = this->lru.end(); (this->bytes > this->max_bytes) && (lru_it != this->lru.begin());) {
+    lru_it--;
+    auto it = this->entries.find(*lru_it);
+    if (it->second.file.use_count() > 1) {
+      continue;
+    }
+    this->bytes -= it->second.size;
+    if (it->second.type == FileType::CHARACTER) {
+      this->character_snapshots.erase(it->first);
+    }
+    this->entries.erase(it);
+    lru_it = this->lru.erase(lru_it);
+    this->evictions++;
   }
 }
 
 void PlayerFilesManager::clear_expired_files(evutil_socket_t, short, void* ctx) {
   auto* self = reinterpret_cast<PlayerFilesManager*>(ctx);
-  size_t num_deleted = erase_unused(self->loaded_system_files);
-  if (num_deleted) {
-    player_data_log.info("Cleared %zu expired system file(s)", num_deleted);
+
+  uint64_t prev_evictions = self->evictions;
+  self->evict();
+  if (self->evictions != prev_evictions) {
+    player_data_log.info("Evicted %" PRIu64 " unused player file(s)", self->evictions - prev_evictions);
   }
-  num_deleted = erase_unused(self->loaded_character_files);
-  if (num_deleted) {
-    player_data_log.info("Cleared %zu expired character file(s)", num_deleted);
+
+  uint64_t t = now();
+  size_t num_expired = 0;
+  for (auto it = self->prefetched_files.begin(); it != self->prefetched_files.end();) {
+    if (t - it->second.load_time >= PREFETCHED_FILE_LIFETIME_USECS) {
+      it = self->prefetched_files.erase(it);
+      num_expired++;
+    } else {
+      it++;
+    }
   }
-  num_deleted = erase_unused(self->loaded_guild_card_files);
-  if (num_deleted) {
-    player_data_log.info("Cleared %zu expired Guild Card file(s)", num_deleted);
+  if (num_expired) {
+    player_data_log.info("Cleared %zu unused prefetched file(s)", num_expired);
   }
-  num_deleted = erase_unused(self->loaded_bank_files);
-  if (num_deleted) {
-    player_data_log.info("Cleared %zu expired bank file(s)", num_deleted);
+
+  // Snapshots are also recorded for character files that were read but never
+  // loaded (for example, if the file couldn't be parsed)
+  for (auto it = self->character_snapshots.begin(); it != self->character_snapshots.end();) {
+    if (!self->entries.count(it->first)) {
+      it = self->character_snapshots.erase(it);
+    } else {
+      it++;
+    }
   }
 }
@@ -5,11 +5,16 @@
 #include <stddef.h>
 
 #include <array>
+#include <list>
+#include <memory>
 #include <phosg/Encoding.hh>
 #include <string>
+#include <unordered_map>
+#include <unordered_set>
 #include <utility>
 #include <vector>
 
+#include "DurableFileWriter.hh"
 #include "Episode3/DataIndexes.hh"
 #include "ItemCreator.hh"
 #include "ItemNameIndex.hh"
@@ -18,11 +23,66 @@
 #include "SaveFileFormats.hh"
 #include "Text.hh"
 #include "Version.hh"
+#include "WorkerPool.hh"
 
-class PlayerFilesManager {
+// Keeps BB player files (system, character, Guild Card, and shared bank files)
+// in memory. Clients that use the same file (for example, a character that is
+// also being used as another character's bank) share the same object, and
+// files don't have to be read from disk again when a player reconnects. Files
+// that are in use by any client are never evicted; files that aren't in use
+// are evicted in least-recently-used order when the total size of all cached
+// files exceeds max_bytes (0 means no limit).
+//
+// prefetch() reads files on a background thread, so they're already in memory
+// by the time a client needs them. Prefetched files are kept as unparsed file
+// contents and are returned by the next read_file() call for the same file;
+// the caller parses and validates them as if they had been read from disk. If
+// the file is set or evicted before then (so the prefetched contents may be
+// out of date), the prefetched contents are discarded.
+//
+// If character delta saves are enabled, character files are saved as a
+// snapshot (the .psochar file, in the same format as usual) plus a delta
+// file (see FileDelta.hh), which contains only the bytes that changed since
+// the snapshot was written. Most saves only change a few fields, so most
+// saves only write a small delta file. When the delta exceeds
+// MAX_CHARACTER_DELTA_SIZE, the full file is written as a new snapshot
+// instead, which makes the existing delta obsolete. The delta file is always
+// applied when loading a character (if it matches the snapshot), so delta
+// saves can be enabled or disabled at any time.
+//
+// This class must only be used from the event thread.
+class PlayerFilesManager : public std::enable_shared_from_this<PlayerFilesManager> {
 public:
-  explicit PlayerFilesManager(std::shared_ptr<struct event_base> base);
-  ~PlayerFilesManager() = default;
+  struct Stats {
+    size_t num_files;
+    size_t bytes;
+    size_t max_bytes;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    size_t num_prefetched_files;
+    uint64_t prefetch_hits;
+    uint64_t prefetch_discards;
+    uint64_t character_snapshot_saves;
+    uint64_t character_delta_saves;
+    uint64_t character_bytes_written;
+  };
+
+  static constexpr size_t MAX_CHARACTER_DELTA_SIZE = 0x1000;
+
+  PlayerFilesManager(
+      std::shared_ptr<struct event_base> base,
+      std::shared_ptr<DurableFileWriter> file_writer,
+      size_t max_bytes = 0);
+  PlayerFilesManager(const PlayerFilesManager&) = delete;
+  PlayerFilesManager(PlayerFilesManager&&) = delete;
+  PlayerFilesManager& operator=(const PlayerFilesManager&) = delete;
+  PlayerFilesManager& operator=(PlayerFilesManager&&) = delete;
+  ~PlayerFilesManager();
+
+  void set_max_bytes(size_t max_bytes);
+  void set_prefetch_enabled(bool enabled);
+  void set_character_delta_saves_enabled(bool enabled);
 
   std::shared_ptr<PSOBBBaseSystemFile> get_system(const std::string& filename);
   std::shared_ptr<PSOBBCharacterFile> get_character(const std::string& filename);
@@ -34,14 +94,87 @@ public:
   void set_guild_card(const std::string& filename, std::shared_ptr<PSOBBGuildCardFile> file);
   void set_bank(const std::string& filename, std::shared_ptr<PlayerBank200> file);
 
+  // Removes a character file from the cache before it's overwritten by
+  // something other than the client using it. Returns false (and does
+  // nothing) if the file is in use by a client.
+  bool evict_character(const std::string& filename);
+
+  // Returns the file's prefetched contents if present, or reads the file from
+  // disk otherwise. Returns null if the file doesn't exist.
+  std::shared_ptr<const std::string> read_file(const std::string& filename);
+  // Reads the given files on a background thread. Files that are already
+  // loaded or prefetched are skipped. Does nothing if prefetching is disabled.
+  void prefetch(std::vector<std::string>&& filenames);
+
+  static std::string character_delta_filename(const std::string& filename);
+  // Like read_file, but also applies the character's delta file, if any. The
+  // returned data is always in the classic .psochar format.
+  std::shared_ptr<const std::string> read_character_file(const std::string& filename);
+  // Saves a character file (in the classic .psochar format) as a snapshot or
+  // a delta, as described above
+  void save_character_file(const std::string& filename, std::string&& data);
+
+  Stats stats() const;
+
 private:
+  enum class FileType {
+    SYSTEM = 0,
+    CHARACTER,
+    GUILD_CARD,
+    BANK,
+  };
+  struct Entry {
+    FileType type;
+    std::shared_ptr<void> file;
+    size_t size;
+    std::list<std::string>::iterator lru_it;
+  };
+  struct PrefetchedFile {
+    std::shared_ptr<const std::string> data; // Null if the file doesn't exist
+    uint64_t load_time;
+  };
+  struct CharacterSnapshot {
+    std::string data; // Contents of the .psochar file, without the delta applied
+    bool has_delta; // True if a delta file for this snapshot may exist
+  };
+
+  // Prefetched files that haven't been used after this long are discarded
+  static constexpr uint64_t PREFETCHED_FILE_LIFETIME_USECS = 60 * 1000 * 1000;
+
   std::shared_ptr<struct event_base> base;
+  std::shared_ptr<DurableFileWriter> file_writer;
   std::unique_ptr<struct event, void (*)(struct event*)> clear_expired_files_event;
+  std::shared_ptr<WorkerPool> prefetch_workers; // Null if prefetching is disabled
+
+  std::unordered_map<std::string, Entry> entries;
+  std::list<std::string> lru; // Most recently used first
+  size_t max_bytes;
+  size_t bytes;
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t evictions;
+
+  std::unordered_map<std::string, PrefetchedFile> prefetched_files;
+  // Files being read by prefetch tasks. If a file is removed from this set
+  // before its task finishes, the task's result for that file is discarded.
+  std::unordered_set<std::string> pending_prefetch_filenames;
+  uint64_t prefetch_hits;
+  uint64_t prefetch_discards;
+
+  bool character_delta_saves_enabled;
+  // Snapshots of character files that are loaded or were recently saved.
+  // These are removed when the corresponding character file is evicted.
+  std::unordered_map<std::string, CharacterSnapshot> character_snapshots;
+  uint64_t character_snapshot_saves;
+  uint64_t character_delta_saves;
+  uint64_t character_bytes_written;
 
-  std::unordered_map<std::string, std::shared_ptr<PSOBBBaseSystemFile>> loaded_system_files;
-  std::unordered_map<std::string, std::shared_ptr<PSOBBCharacterFile>> loaded_character_files;
-  std::unordered_map<std::string, std::shared_ptr<PSOBBGuildCardFile>> loaded_guild_card_files;
-  std::unordered_map<std::string, std::shared_ptr<PlayerBank200>> loaded_bank_files;
+  template <typename T>
+  std::shared_ptr<T> get(FileType type, const std::string& filename);
+  template <typename T>
+  void set(FileType type, const std::string& filename, std::shared_ptr<T> file);
+  void discard_prefetched_file(const std::string& filename);
+  void evict();
 
   static void clear_expired_files(evutil_socket_t fd, short events, void* ctx);
 };
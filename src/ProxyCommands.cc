@@ -1697,7 +1697,8 @@ static HandlerResult S_64(shared_ptr<ProxyServer::LinkedSession> ses, uint16_t,
         ses->lobby_random_seed,
         make_shared<PSOV2Encryption>(ses->lobby_random_seed),
         cmd->variations,
-        &ses->log);
+        &ses->log,
+        s->map_template_cache);
   }
 
   bool modified = false;
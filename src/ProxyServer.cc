@@ -45,22 +45,33 @@ ProxyServer::ProxyServer(
       next_logged_out_session_id(this->MIN_LINKED_LOGGED_OUT_SESSION_ID) {}
 
 void ProxyServer::listen(const std::string& addr, uint16_t port, Version version, const struct sockaddr_storage* default_destination) {
-  auto socket_obj = make_shared<ListeningSocket>(this, addr, port, version, default_destination);
+  this->add_socket(::listen(addr, port, SOMAXCONN), port, version, default_destination);
+}
+
+void ProxyServer::add_socket(int fd, uint16_t port, Version version, const struct sockaddr_storage* default_destination) {
+  auto socket_obj = make_shared<ListeningSocket>(this, fd, port, version, default_destination);
   if (!this->listeners.emplace(port, socket_obj).second) {
     throw runtime_error("duplicate port in proxy server configuration");
   }
 }
 
+void ProxyServer::stop_listening() {
+  for (const auto& it : this->listeners) {
+    evconnlistener_disable(it.second->listener.get());
+    it.second->log.info("Stopped accepting connections");
+  }
+}
+
 ProxyServer::ListeningSocket::ListeningSocket(
     ProxyServer* server,
-    const std::string& addr,
+    int fd,
     uint16_t port,
     Version version,
     const struct sockaddr_storage* default_destination)
     : server(server),
       log(string_printf("[ProxyServer:T-%hu] ", port), proxy_server_log.min_level),
       port(port),
-      fd(::listen(addr, port, SOMAXCONN)),
+      fd(fd),
       listener(nullptr, evconnlistener_free),
       version(version) {
   if (!this->fd.is_open()) {
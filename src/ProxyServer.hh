@@ -27,6 +27,10 @@ public:
   virtual ~ProxyServer() = default;
 
   void listen(const std::string& addr, uint16_t port, Version version, const struct sockaddr_storage* default_destination = nullptr);
+  void add_socket(int fd, uint16_t port, Version version, const struct sockaddr_storage* default_destination = nullptr);
+  // Stops accepting new connections, but doesn't close the listening sockets
+  // (they may have been handed off to another process)
+  void stop_listening();
 
   void connect_virtual_client(struct bufferevent* bev, uint64_t virtual_network_id, uint16_t server_port);
 
@@ -225,7 +229,7 @@ private:
 
     ListeningSocket(
         ProxyServer* server,
-        const std::string& addr,
+        int fd,
         uint16_t port,
         Version version,
         const struct sockaddr_storage* default_destination);
@@ -1,5 +1,7 @@
 #include "Quest.hh"
 
+#include <sys/stat.h>
+
 #include <algorithm>
 #include <mutex>
 #include <phosg/Encoding.hh>
@@ -10,6 +12,7 @@
 #include <phosg/Tools.hh>
 #include <string>
 #include <unordered_map>
+#include <unordered_set>
 
 #include "CommandFormats.hh"
 #include "Compression.hh"
@@ -480,10 +483,23 @@ shared_ptr<const VersionedQuest> Quest::version(Version v, uint8_t language) con
   return it->second;
 }
 
+static bool get_file_cache_key(const string& path, uint64_t* mtime, uint64_t* size, uint64_t* inode) {
+  struct stat st;
+  if (::stat(path.c_str(), &st) != 0) {
+    return false;
+  }
+  *mtime = st.st_mtime;
+  *size = st.st_size;
+  *inode = st.st_ino;
+  return true;
+}
+
 QuestIndex::QuestIndex(
     const string& directory,
     std::shared_ptr<const QuestCategoryIndex> category_index,
-    bool is_ep3)
+    bool is_ep3,
+    std::shared_ptr<const QuestIndex> previous,
+    const std::unordered_set<std::string>* changed_paths)
     : directory(directory),
       category_index(category_index) {
 
@@ -503,19 +519,29 @@ QuestIndex::QuestIndex(
       continue;
     }
 
-    auto add_file = [&](map<string, FileData>& files, const string& basename, const string& filename, string&& value, bool check_chunk_size) {
+    auto add_file = [&](FileType type, const string& basename, const string& filename, shared_ptr<const string> data_ptr) {
       if (categories.emplace(basename, cat->category_id).first->second != cat->category_id) {
         throw runtime_error("file " + basename + " exists in multiple categories");
       }
-      auto data_ptr = make_shared<string>(std::move(value));
-      if (!files.emplace(basename, FileData{filename, data_ptr}).second) {
-        throw runtime_error("file " + basename + " already exists");
+      map<string, FileData>* files;
+      switch (type) {
+        case FileType::BIN:
+          files = &bin_files;
+          break;
+        case FileType::DAT:
+          files = &dat_files;
+          break;
+        case FileType::PVR:
+          files = &pvr_files;
+          break;
+        case FileType::JSON:
+          files = &json_files;
+          break;
+        default:
+          throw logic_error("invalid quest file type");
       }
-      // There is a bug in the client that prevents quests from loading properly
-      // if any file's size is a multiple of 0x400. See the comments on the 13
-      // command in CommandFormats.hh for more details.
-      if (check_chunk_size && !(data_ptr->size() & 0x3FF)) {
-        data_ptr->push_back(0x00);
+      if (!files->emplace(basename, FileData{filename, data_ptr}).second) {
+        throw runtime_error("file " + basename + " already exists");
       }
     };
 
@@ -532,24 +558,15 @@ QuestIndex::QuestIndex(
       string file_path = cat_path + "/" + filename;
       try {
         string orig_filename = filename;
-        string file_data;
-        if (ends_with(filename, ".gci")) {
-          file_data = decode_gci_data(load_file(file_path));
+        bool is_gci = ends_with(filename, ".gci");
+        bool is_vms = ends_with(filename, ".vms");
+        bool is_dlq = ends_with(filename, ".dlq");
+        bool is_txt = ends_with(filename, ".txt");
+        if (is_gci || is_vms || is_dlq || is_txt) {
           filename.resize(filename.size() - 4);
-        } else if (ends_with(filename, ".vms")) {
-          file_data = decode_vms_data(load_file(file_path));
-          filename.resize(filename.size() - 4);
-        } else if (ends_with(filename, ".dlq")) {
-          file_data = decode_dlq_data(load_file(file_path));
-          filename.resize(filename.size() - 4);
-        } else if (ends_with(filename, ".txt")) {
-          file_data = assemble_quest_script(load_file(file_path));
-          filename.resize(filename.size() - 4);
-          if (ends_with(filename, ".bin")) {
-            filename.push_back('d');
-          }
-        } else {
-          file_data = load_file(file_path);
+        }
+        if (is_txt && ends_with(filename, ".bin")) {
+          filename.push_back('d');
         }
 
         size_t dot_pos = filename.rfind('.');
@@ -562,33 +579,95 @@ QuestIndex::QuestIndex(
           file_basename = tolower(filename);
         }
 
-        if (extension == "json") {
-          add_file(json_files, file_basename, orig_filename, std::move(file_data), false);
-        } else if (extension == "bin" || extension == "mnm") {
-          add_file(bin_files, file_basename, orig_filename, std::move(file_data), true);
-        } else if (extension == "bind" || extension == "mnmd") {
-          add_file(bin_files, file_basename, orig_filename, prs_compress_optimal(file_data), true);
-        } else if (extension == "dat") {
-          add_file(dat_files, file_basename, orig_filename, std::move(file_data), true);
-        } else if (extension == "datd") {
-          add_file(dat_files, file_basename, orig_filename, prs_compress_optimal(file_data), true);
-        } else if (extension == "pvr") {
-          add_file(pvr_files, file_basename, orig_filename, std::move(file_data), true);
-        } else if (extension == "qst") {
-          auto files = decode_qst_data(file_data);
-          for (auto& it : files) {
-            if (ends_with(it.first, ".bin")) {
-              add_file(bin_files, file_basename, orig_filename, std::move(it.second), true);
-            } else if (ends_with(it.first, ".dat")) {
-              add_file(dat_files, file_basename, orig_filename, std::move(it.second), true);
-            } else if (ends_with(it.first, ".pvr")) {
-              add_file(pvr_files, file_basename, orig_filename, std::move(it.second), true);
-            } else {
-              throw runtime_error("qst file contains unsupported file type: " + it.first);
+        static const unordered_set<string> supported_extensions(
+            {"json", "bin", "mnm", "bind", "mnmd", "dat", "datd", "pvr", "qst"});
+        if (!supported_extensions.count(extension)) {
+          static_game_data_log.warning("(%s) Skipping file (unsupported format)", filename.c_str());
+          continue;
+        }
+
+        uint64_t mtime = 0, size = 0, inode = 0;
+        bool cache_key_valid = get_file_cache_key(file_path, &mtime, &size, &inode);
+
+        // If the file hasn't changed since the previous index was built, use
+        // its previously-decoded contents instead of reading it again
+        shared_ptr<const SourceFile> source_file;
+        if (previous && cache_key_valid && (!changed_paths || !changed_paths->count(file_path))) {
+          auto prev_it = previous->source_files.find(file_path);
+          if ((prev_it != previous->source_files.end()) &&
+              (prev_it->second->mtime == mtime) &&
+              (prev_it->second->size == size) &&
+              (prev_it->second->inode == inode)) {
+            source_file = prev_it->second;
+            this->num_reused_files++;
+          }
+        }
+
+        if (!source_file) {
+          string file_data;
+          if (is_gci) {
+            file_data = decode_gci_data(load_file(file_path));
+          } else if (is_vms) {
+            file_data = decode_vms_data(load_file(file_path));
+          } else if (is_dlq) {
+            file_data = decode_dlq_data(load_file(file_path));
+          } else if (is_txt) {
+            file_data = assemble_quest_script(load_file(file_path));
+          } else {
+            file_data = load_file(file_path);
+          }
+
+          auto new_source_file = make_shared<SourceFile>();
+          new_source_file->mtime = mtime;
+          new_source_file->size = size;
+          new_source_file->inode = inode;
+          auto add_entry = [&](FileType type, string&& value, bool check_chunk_size) -> void {
+            auto data_ptr = make_shared<string>(std::move(value));
+            // There is a bug in the client that prevents quests from loading
+            // properly if any file's size is a multiple of 0x400. See the
+            // comments on the 13 command in CommandFormats.hh for more details.
+            if (check_chunk_size && !(data_ptr->size() & 0x3FF)) {
+              data_ptr->push_back(0x00);
             }
+            new_source_file->entries.emplace_back(type, std::move(data_ptr));
+          };
+
+          if (extension == "json") {
+            add_entry(FileType::JSON, std::move(file_data), false);
+          } else if (extension == "bin" || extension == "mnm") {
+            add_entry(FileType::BIN, std::move(file_data), true);
+          } else if (extension == "bind" || extension == "mnmd") {
+            add_entry(FileType::BIN, prs_compress_optimal(file_data), true);
+          } else if (extension == "dat") {
+            add_entry(FileType::DAT, std::move(file_data), true);
+          } else if (extension == "datd") {
+            add_entry(FileType::DAT, prs_compress_optimal(file_data), true);
+          } else if (extension == "pvr") {
+            add_entry(FileType::PVR, std::move(file_data), true);
+          } else if (extension == "qst") {
+            auto files = decode_qst_data(file_data);
+            for (auto& it : files) {
+              if (ends_with(it.first, ".bin")) {
+                add_entry(FileType::BIN, std::move(it.second), true);
+              } else if (ends_with(it.first, ".dat")) {
+                add_entry(FileType::DAT, std::move(it.second), true);
+              } else if (ends_with(it.first, ".pvr")) {
+                add_entry(FileType::PVR, std::move(it.second), true);
+              } else {
+                throw runtime_error("qst file contains unsupported file type: " + it.first);
+              }
+            }
+          } else {
+            throw logic_error("unhandled quest file extension");
           }
-        } else {
-          static_game_data_log.warning("(%s) Skipping file (unsupported format)", filename.c_str());
+          source_file = std::move(new_source_file);
+        }
+
+        if (cache_key_valid) {
+          this->source_files.emplace(file_path, source_file);
+        }
+        for (const auto& entry : source_file->entries) {
+          add_file(entry.first, file_basename, orig_filename, entry.second);
         }
 
       } catch (const exception& e) {
@@ -684,14 +763,6 @@ QuestIndex::QuestIndex(
 
       // Load the quest's metadata JSON file, if it exists
       const FileData* json_filedata = nullptr;
-      shared_ptr<BattleRules> battle_rules;
-      ssize_t challenge_template_index = -1;
-      uint8_t description_flag = 0;
-      shared_ptr<const IntegralExpression> available_expression;
-      shared_ptr<const IntegralExpression> enabled_expression;
-      bool allow_start_from_chat_command = false;
-      bool force_joinable = false;
-      int16_t lock_status_register = -1;
       try {
         json_filedata = &json_files.at(basename);
       } catch (const out_of_range&) {
@@ -704,58 +775,93 @@ QuestIndex::QuestIndex(
           }
         }
       }
-      if (json_filedata) {
-        auto metadata_json = JSON::parse(*json_filedata->data);
-        try {
-          battle_rules = make_shared<BattleRules>(metadata_json.at("BattleRules"));
-        } catch (const out_of_range&) {
-        }
-        try {
-          challenge_template_index = metadata_json.at("ChallengeTemplateIndex").as_int();
-        } catch (const out_of_range&) {
-        }
-        try {
-          description_flag = metadata_json.at("DescriptionFlag").as_int();
-        } catch (const out_of_range&) {
-        }
-        try {
-          available_expression = make_shared<IntegralExpression>(metadata_json.get_string("AvailableIf"));
-        } catch (const out_of_range&) {
-        }
-        try {
-          enabled_expression = make_shared<IntegralExpression>(metadata_json.get_string("EnabledIf"));
-        } catch (const out_of_range&) {
-        }
-        try {
-          allow_start_from_chat_command = metadata_json.get_bool("AllowStartFromChatCommand");
-        } catch (const out_of_range&) {
-        }
-        try {
-          force_joinable = metadata_json.get_bool("Joinable");
-        } catch (const out_of_range&) {
-        }
-        try {
-          lock_status_register = metadata_json.get_bool("LockStatusRegister");
-        } catch (const out_of_range&) {
+      IndexedVersion indexed_version{
+          .category_id = category_id,
+          .bin_data = bin_filedata->data,
+          .dat_data = dat_filedata ? dat_filedata->data : nullptr,
+          .pvr_data = pvr_filedata ? pvr_filedata->data : nullptr,
+          .json_data = json_filedata ? json_filedata->data : nullptr,
+          .vq = nullptr,
+      };
+
+      // If none of this version's input files changed, use the VersionedQuest
+      // from the previous index instead of parsing it again
+      if (previous) {
+        auto prev_it = previous->versions_by_basename.find(basename);
+        if ((prev_it != previous->versions_by_basename.end()) &&
+            (prev_it->second.category_id == indexed_version.category_id) &&
+            (prev_it->second.bin_data == indexed_version.bin_data) &&
+            (prev_it->second.dat_data == indexed_version.dat_data) &&
+            (prev_it->second.pvr_data == indexed_version.pvr_data) &&
+            (prev_it->second.json_data == indexed_version.json_data)) {
+          indexed_version.vq = prev_it->second.vq;
+          this->num_reused_versions++;
         }
       }
 
-      auto vq = make_shared<VersionedQuest>(
-          quest_number,
-          category_id,
-          version,
-          language,
-          bin_filedata->data,
-          dat_filedata ? dat_filedata->data : nullptr,
-          pvr_filedata ? pvr_filedata->data : nullptr,
-          battle_rules,
-          challenge_template_index,
-          description_flag,
-          available_expression,
-          enabled_expression,
-          allow_start_from_chat_command,
-          force_joinable,
-          lock_status_register);
+      if (!indexed_version.vq) {
+        shared_ptr<BattleRules> battle_rules;
+        ssize_t challenge_template_index = -1;
+        uint8_t description_flag = 0;
+        shared_ptr<const IntegralExpression> available_expression;
+        shared_ptr<const IntegralExpression> enabled_expression;
+        bool allow_start_from_chat_command = false;
+        bool force_joinable = false;
+        int16_t lock_status_register = -1;
+        if (json_filedata) {
+          auto metadata_json = JSON::parse(*json_filedata->data);
+          try {
+            battle_rules = make_shared<BattleRules>(metadata_json.at("BattleRules"));
+          } catch (const out_of_range&) {
+          }
+          try {
+            challenge_template_index = metadata_json.at("ChallengeTemplateIndex").as_int();
+          } catch (const out_of_range&) {
+          }
+          try {
+            description_flag = metadata_json.at("DescriptionFlag").as_int();
+          } catch (const out_of_range&) {
+          }
+          try {
+            available_expression = make_shared<IntegralExpression>(metadata_json.get_string("AvailableIf"));
+          } catch (const out_of_range&) {
+          }
+          try {
+            enabled_expression = make_shared<IntegralExpression>(metadata_json.get_string("EnabledIf"));
+          } catch (const out_of_range&) {
+          }
+          try {
+            allow_start_from_chat_command = metadata_json.get_bool("AllowStartFromChatCommand");
+          } catch (const out_of_range&) {
+          }
+          try {
+            force_joinable = metadata_json.get_bool("Joinable");
+          } catch (const out_of_range&) {
+          }
+          try {
+            lock_status_register = metadata_json.get_bool("LockStatusRegister");
+          } catch (const out_of_range&) {
+          }
+        }
+
+        indexed_version.vq = make_shared<VersionedQuest>(
+            quest_number,
+            category_id,
+            version,
+            language,
+            bin_filedata->data,
+            dat_filedata ? dat_filedata->data : nullptr,
+            pvr_filedata ? pvr_filedata->data : nullptr,
+            battle_rules,
+            challenge_template_index,
+            description_flag,
+            available_expression,
+            enabled_expression,
+            allow_start_from_chat_command,
+            force_joinable,
+            lock_status_register);
+      }
+      auto vq = indexed_version.vq;
 
       auto category_name = this->category_index->at(vq->category_id)->name;
       string filenames_str = bin_filedata->filename;
@@ -793,12 +899,37 @@ QuestIndex::QuestIndex(
             vq->category_id,
             vq->joinable ? "joinable" : "not joinable");
       }
+      this->versions_by_basename.emplace(basename, std::move(indexed_version));
     } catch (const exception& e) {
       static_game_data_log.warning("(%s) Failed to index quest file: (%s)", basename.c_str(), e.what());
     }
   }
 }
 
+QuestIndex::Changes QuestIndex::changes_since(shared_ptr<const QuestIndex> previous) const {
+  Changes ret;
+  for (const auto& it : this->versions_by_basename) {
+    if (!previous) {
+      ret.added.emplace_back(it.first);
+      continue;
+    }
+    auto prev_it = previous->versions_by_basename.find(it.first);
+    if (prev_it == previous->versions_by_basename.end()) {
+      ret.added.emplace_back(it.first);
+    } else if (prev_it->second.vq != it.second.vq) {
+      ret.modified.emplace_back(it.first);
+    }
+  }
+  if (previous) {
+    for (const auto& it : previous->versions_by_basename) {
+      if (!this->versions_by_basename.count(it.first)) {
+        ret.removed.emplace_back(it.first);
+      }
+    }
+  }
+  return ret;
+}
+
 shared_ptr<const Quest> QuestIndex::get(uint32_t quest_number) const {
   try {
     return this->quests_by_number.at(quest_number);
@@ -6,6 +6,7 @@
 #include <memory>
 #include <string>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 #include "IntegralExpression.hh"
@@ -157,7 +158,56 @@ struct QuestIndex {
   std::map<std::string, std::shared_ptr<Quest>> quests_by_name;
   std::map<uint32_t, std::map<uint32_t, std::shared_ptr<Quest>>> quests_by_category_id_and_number;
 
-  QuestIndex(const std::string& directory, std::shared_ptr<const QuestCategoryIndex> category_index, bool is_ep3);
+  // These structures are used to rebuild the index incrementally. When a
+  // previous index is given to the constructor, source files whose size and
+  // modification time have not changed (and which are not in changed_paths)
+  // are not read or decoded again, and VersionedQuest objects whose input
+  // files are all unchanged are shared with the previous index.
+  enum class FileType {
+    BIN = 0,
+    DAT,
+    PVR,
+    JSON,
+  };
+  struct SourceFile {
+    uint64_t mtime;
+    uint64_t size;
+    uint64_t inode;
+    // .qst files can produce multiple entries; all other types produce one
+    std::vector<std::pair<FileType, std::shared_ptr<const std::string>>> entries;
+  };
+  struct IndexedVersion {
+    uint32_t category_id;
+    std::shared_ptr<const std::string> bin_data;
+    std::shared_ptr<const std::string> dat_data;
+    std::shared_ptr<const std::string> pvr_data;
+    std::shared_ptr<const std::string> json_data;
+    std::shared_ptr<const VersionedQuest> vq;
+  };
+  std::map<std::string, std::shared_ptr<const SourceFile>> source_files; // Keyed by path
+  std::map<std::string, IndexedVersion> versions_by_basename;
+  size_t num_reused_files = 0;
+  size_t num_reused_versions = 0;
+
+  QuestIndex(
+      const std::string& directory,
+      std::shared_ptr<const QuestCategoryIndex> category_index,
+      bool is_ep3,
+      std::shared_ptr<const QuestIndex> previous = nullptr,
+      const std::unordered_set<std::string>* changed_paths = nullptr);
+
+  struct Changes {
+    std::vector<std::string> added;
+    std::vector<std::string> modified;
+    std::vector<std::string> removed;
+
+    inline bool empty() const {
+      return this->added.empty() && this->modified.empty() && this->removed.empty();
+    }
+  };
+  // Returns the basenames of quest versions that differ from those in the
+  // given index. If previous is null, all versions are considered added.
+  Changes changes_since(std::shared_ptr<const QuestIndex> previous) const;
 
   std::shared_ptr<const Quest> get(uint32_t quest_number) const;
   std::shared_ptr<const Quest> get(const std::string& name) const;
@@ -0,0 +1,219 @@
+#include "RareEnemySeedSearch.hh"
+
+#include <algorithm>
+#include <phosg/Strings.hh>
+#include <unordered_map>
+
+#include "PSOEncryption.hh"
+
+using namespace std;
+
+RareEnemySeedSearch::RareEnemySeedSearch(
+    Version version,
+    Episode episode,
+    GameMode mode,
+    uint8_t difficulty,
+    uint8_t event,
+    shared_ptr<const SetDataTableBase> sdt,
+    function<shared_ptr<const string>(Version, const string&)> get_file_data,
+    shared_ptr<const Map::RareEnemyRates> rare_rates)
+    : version(version),
+      episode(episode),
+      difficulty(difficulty),
+      event(event),
+      rare_rates(rare_rates) {
+  // There are no free-roam maps in Challenge mode (see Lobby::load_maps), so
+  // the layouts are all empty and no rare rolls are done
+  this->floor_layouts.resize(0x12);
+  this->num_variations.resize(0x12, make_pair(1, 1));
+  if (mode == GameMode::CHALLENGE) {
+    auto empty_layout = make_shared<Layout>();
+    for (auto& layouts : this->floor_layouts) {
+      layouts.emplace_back(empty_layout);
+    }
+    return;
+  }
+
+  // These are the same limits that generate_variations_deprecated uses
+  auto maxes = variation_maxes_deprecated(version, episode, (mode == GameMode::SOLO));
+  for (uint8_t floor = 0; floor < 0x10; floor++) {
+    this->num_variations[floor] = make_pair(maxes[floor * 2] + 1, maxes[floor * 2 + 1] + 1);
+  }
+
+  unordered_map<string, shared_ptr<const Layout>> layout_for_filename;
+  for (uint8_t floor = 0; floor < 0x12; floor++) {
+    const auto& num_vars = this->num_variations[floor];
+    auto& layouts = this->floor_layouts[floor];
+    for (uint32_t var1 = 0; var1 < num_vars.first; var1++) {
+      for (uint32_t var2 = 0; var2 < num_vars.second; var2++) {
+        string filename = sdt->map_filename_for_variation(
+            floor, var1, var2, episode, mode, SetDataTableBase::FilenameType::ENEMIES);
+        // The floor is part of the key because each slot records its floor
+        string key = string_printf("%02hhX/", floor) + filename;
+        auto it = layout_for_filename.find(key);
+        if (it == layout_for_filename.end()) {
+          Map map(version, 0, 0, nullptr);
+          map.defer_rare_enemies = true;
+          if (!filename.empty()) {
+            auto map_data = get_file_data(version, filename);
+            if (map_data) {
+              map.add_enemies_from_map_data(
+                  episode, difficulty, event, floor, map_data->data(), map_data->size(), rare_rates);
+            }
+          }
+          it = layout_for_filename.emplace(key, this->layout_for_map(map)).first;
+        }
+        layouts.emplace_back(it->second);
+      }
+    }
+  }
+}
+
+RareEnemySeedSearch::RareEnemySeedSearch(
+    Version version,
+    Episode episode,
+    uint8_t difficulty,
+    uint8_t event,
+    shared_ptr<const string> quest_dat_contents_decompressed,
+    shared_ptr<const Map::RareEnemyRates> rare_rates)
+    : version(version),
+      episode(episode),
+      difficulty(difficulty),
+      event(event),
+      rare_rates(rare_rates) {
+  // If any floor has random enemies, the enemy list depends on the seed, so
+  // we can't precompute it
+  for (const auto& floor_sections : Map::collect_quest_map_data_sections(
+           quest_dat_contents_decompressed->data(), quest_dat_contents_decompressed->size())) {
+    if ((floor_sections.wave_events != 0xFFFFFFFF) &&
+        (floor_sections.random_enemy_locations != 0xFFFFFFFF) &&
+        (floor_sections.random_enemy_definitions != 0xFFFFFFFF)) {
+      this->quest_dat_contents_decompressed = quest_dat_contents_decompressed;
+      return;
+    }
+  }
+
+  Map map(version, 0, 0, nullptr);
+  map.defer_rare_enemies = true;
+  map.add_entities_from_quest_data(
+      episode,
+      difficulty,
+      event,
+      quest_dat_contents_decompressed->data(),
+      quest_dat_contents_decompressed->size(),
+      rare_rates);
+  this->quest_layout = this->layout_for_map(map);
+}
+
+shared_ptr<const RareEnemySeedSearch::Layout> RareEnemySeedSearch::layout_for_map(const Map& map) const {
+  auto ret = make_shared<Layout>();
+  ret->num_enemies = map.enemies.size();
+
+  for (const auto& e : map.enemies) {
+    if (enemy_type_is_rare(e.type)) {
+      ret->slots.emplace_back(Slot{
+          .enemy_index = e.enemy_id,
+          .num_enemies = 1,
+          .rate = 0,
+          .rare_type = e.type,
+          .floor = e.floor,
+          .is_fixed = true,
+      });
+    }
+  }
+  for (const auto& def : map.deferred_rare_enemies) {
+    ret->slots.emplace_back(Slot{
+        .enemy_index = def.enemy_index,
+        .num_enemies = def.num_enemies,
+        .rate = (*this->rare_rates).*def.rate,
+        .rare_type = def.rare_type,
+        .floor = map.enemies.at(def.enemy_index).floor,
+        .is_fixed = false,
+    });
+  }
+
+  // The deferred rolls are already in enemy index order, and no enemy can be
+  // both fixed and deferred, so a stable sort keeps the rolls in the order
+  // Map::instantiate does them
+  stable_sort(ret->slots.begin(), ret->slots.end(), [](const Slot& a, const Slot& b) -> bool {
+    return a.enemy_index < b.enemy_index;
+  });
+  return ret;
+}
+
+size_t RareEnemySeedSearch::apply_layout(
+    vector<RareEnemy>& ret,
+    const Layout& layout,
+    size_t base_index,
+    uint32_t seed,
+    PSOV2RandomStream& stream,
+    size_t num_rolled_rares) const {
+  // This must match Map::check_and_log_rare_enemy
+  bool is_bb = (this->version == Version::BB_V4);
+  float threshold = is_v1_or_v2(this->version) ? 0.001f : 0.002f;
+
+  for (const auto& slot : layout.slots) {
+    size_t enemy_index = base_index + slot.enemy_index;
+    bool is_rare;
+    if (slot.is_fixed) {
+      is_rare = true;
+    } else if (is_bb) {
+      is_rare = (num_rolled_rares < 0x10) && (stream.next() < slot.rate);
+      num_rolled_rares += is_rare;
+    } else {
+      uint32_t v = PSOV2RandomStream::first_value(seed + 0x1000 + enemy_index);
+      is_rare = (static_cast<float>((v >> 16) & 0xFFFF) / 65536.0f) < threshold;
+    }
+    if (is_rare) {
+      for (size_t z = 0; z < slot.num_enemies; z++) {
+        ret.emplace_back(RareEnemy{.enemy_index = enemy_index + z, .type = slot.rare_type, .floor = slot.floor});
+      }
+    }
+  }
+  return num_rolled_rares;
+}
+
+void RareEnemySeedSearch::find_rare_enemies(vector<RareEnemy>& ret, uint32_t seed) const {
+  ret.clear();
+
+  if (this->quest_dat_contents_decompressed) {
+    Map map(this->version, 0, seed, make_shared<PSOV2Encryption>(seed));
+    map.add_entities_from_quest_data(
+        this->episode,
+        this->difficulty,
+        this->event,
+        this->quest_dat_contents_decompressed->data(),
+        this->quest_dat_contents_decompressed->size(),
+        this->rare_rates);
+    for (const auto& e : map.enemies) {
+      if (enemy_type_is_rare(e.type)) {
+        ret.emplace_back(RareEnemy{.enemy_index = e.enemy_id, .type = e.type, .floor = e.floor});
+      }
+    }
+    return;
+  }
+
+  PSOV2RandomStream stream(seed);
+  if (this->quest_layout) {
+    this->apply_layout(ret, *this->quest_layout, 0, seed, stream, 0);
+    return;
+  }
+
+  // All variations are chosen before any rare rolls are done (see
+  // generate_variations_deprecated); floors 0x10 and 0x11 have no variations
+  uint32_t variations[0x10];
+  for (uint8_t floor = 0; floor < 0x10; floor++) {
+    const auto& num_vars = this->num_variations[floor];
+    uint32_t var1 = (num_vars.first > 1) ? (stream.next() % num_vars.first) : 0;
+    uint32_t var2 = (num_vars.second > 1) ? (stream.next() % num_vars.second) : 0;
+    variations[floor] = var1 * num_vars.second + var2;
+  }
+
+  size_t base_index = 0;
+  size_t num_rolled_rares = 0;
+  for (uint8_t floor = 0; floor < 0x12; floor++) {
+    const auto& layout = *this->floor_layouts[floor][(floor < 0x10) ? variations[floor] : 0];
+    num_rolled_rares = this->apply_layout(ret, layout, base_index, seed, stream, num_rolled_rares);
+    base_index += layout.num_enemies;
+  }
+}
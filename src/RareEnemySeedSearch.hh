@@ -0,0 +1,110 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "Map.hh"
+#include "StaticGameData.hh"
+
+// Finds the rare enemies that a given rare seed produces, without building a
+// Map for each seed. All of the map files that could be used are parsed once
+// when the search is created, and reduced to a table of the enemies on each
+// floor that are rare or could be rare. For each seed, only the random draws
+// that affect rare enemies (variation choices and rare rolls) are done, so
+// find_rare_enemies does no allocation once the output vector has grown to
+// its working size.
+//
+// The results match what Lobby::load_maps would produce for the same seed
+// (with a PSOV2Encryption seeded with the same value as the random crypt, as
+// the find-rare-enemy-seeds action uses). The exception is quests with random
+// enemy sections (as in Challenge mode), whose enemy lists themselves depend
+// on the seed; for those, the search falls back to loading the quest's map
+// for each seed, which is much slower.
+class RareEnemySeedSearch {
+public:
+  struct RareEnemy {
+    size_t enemy_index;
+    EnemyType type;
+    uint8_t floor;
+  };
+
+  // Free-roam maps
+  RareEnemySeedSearch(
+      Version version,
+      Episode episode,
+      GameMode mode,
+      uint8_t difficulty,
+      uint8_t event,
+      std::shared_ptr<const SetDataTableBase> sdt,
+      std::function<std::shared_ptr<const std::string>(Version, const std::string&)> get_file_data,
+      std::shared_ptr<const Map::RareEnemyRates> rare_rates);
+  // Quest maps
+  RareEnemySeedSearch(
+      Version version,
+      Episode episode,
+      uint8_t difficulty,
+      uint8_t event,
+      std::shared_ptr<const std::string> quest_dat_contents_decompressed,
+      std::shared_ptr<const Map::RareEnemyRates> rare_rates);
+  RareEnemySeedSearch(const RareEnemySeedSearch&) = delete;
+  RareEnemySeedSearch(RareEnemySeedSearch&&) = delete;
+  RareEnemySeedSearch& operator=(const RareEnemySeedSearch&) = delete;
+  RareEnemySeedSearch& operator=(RareEnemySeedSearch&&) = delete;
+  ~RareEnemySeedSearch() = default;
+
+  // Replaces the contents of ret with the rare enemies produced by the given
+  // seed, in enemy index order. This function is thread-safe.
+  void find_rare_enemies(std::vector<RareEnemy>& ret, uint32_t seed) const;
+
+  inline bool uses_fallback() const {
+    return this->quest_dat_contents_decompressed != nullptr;
+  }
+
+private:
+  // A slot is either an enemy that is always rare (in which case rate is
+  // ignored and num_enemies is 1), or a group of enemies (a parent and its
+  // children of the same type) that become rare together if a roll succeeds
+  struct Slot {
+    size_t enemy_index; // Relative to the start of the layout
+    size_t num_enemies;
+    uint32_t rate;
+    EnemyType rare_type;
+    uint8_t floor;
+    bool is_fixed;
+  };
+  struct Layout {
+    size_t num_enemies = 0;
+    std::vector<Slot> slots;
+  };
+
+  Version version;
+  Episode episode;
+  uint8_t difficulty;
+  uint8_t event;
+  std::shared_ptr<const Map::RareEnemyRates> rare_rates;
+
+  // For free-roam searches, layouts[floor] is indexed by
+  // (var1 * num_variations[floor].second + var2). Layouts for identical files
+  // are shared.
+  std::vector<std::vector<std::shared_ptr<const Layout>>> floor_layouts;
+  std::vector<std::pair<uint32_t, uint32_t>> num_variations;
+  // For quest searches without random enemies, there is only one layout
+  std::shared_ptr<const Layout> quest_layout;
+  // For quest searches with random enemies, each seed loads the entire map
+  std::shared_ptr<const std::string> quest_dat_contents_decompressed;
+
+  std::shared_ptr<const Layout> layout_for_map(const Map& map) const;
+  // Returns the number of rare enemies rolled so far (only relevant on BB)
+  size_t apply_layout(
+      std::vector<RareEnemy>& ret,
+      const Layout& layout,
+      size_t base_index,
+      uint32_t seed,
+      PSOV2RandomStream& stream,
+      size_t num_rolled_rares) const;
+};
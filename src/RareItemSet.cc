@@ -307,6 +307,31 @@ RareItemSet::RareItemSet(const string& rel_data, bool is_big_endian) {
 }
 
 RareItemSet::RareItemSet(const JSON& json, shared_ptr<const ItemNameIndex> name_index) {
+  // Most item descriptions appear many times in each table, so parse them all
+  // at once up front. The loop below visits them in the same order.
+  vector<ItemData> parsed_items;
+  size_t next_parsed_item_index = 0;
+  if (name_index) {
+    vector<string> item_descs;
+    for (const auto& mode_it : json.as_dict()) {
+      for (const auto& episode_it : mode_it.second->as_dict()) {
+        for (const auto& difficulty_it : episode_it.second->as_dict()) {
+          for (const auto& section_id_it : difficulty_it.second->as_dict()) {
+            for (const auto& item_it : section_id_it.second->as_dict()) {
+              for (const auto& spec_json : item_it.second->as_list()) {
+                const auto& item_desc = spec_json->at(1);
+                if (item_desc.is_string()) {
+                  item_descs.emplace_back(item_desc.as_string());
+                }
+              }
+            }
+          }
+        }
+      }
+    }
+    parsed_items = name_index->parse_item_descriptions(item_descs);
+  }
+
   for (const auto& mode_it : json.as_dict()) {
     static const unordered_map<string, GameMode> mode_keys(
         {{"Normal", GameMode::NORMAL}, {"Battle", GameMode::BATTLE}, {"Challenge", GameMode::CHALLENGE}, {"Solo", GameMode::SOLO}});
@@ -372,7 +397,7 @@ RareItemSet::RareItemSet(const JSON& json, shared_ptr<const ItemNameIndex> name_
                 if (!name_index) {
                   throw runtime_error("item name index is not available");
                 }
-                d.data = name_index->parse_item_description(item_desc.as_string());
+                d.data = parsed_items.at(next_parsed_item_index++);
               } else {
                 throw runtime_error("invalid item description type");
               }
@@ -531,10 +556,8 @@ void RareItemSet::print_collection(
     uint8_t difficulty,
     uint8_t section_id,
     shared_ptr<const ItemNameIndex> name_index) const {
-  const SpecCollection* collection;
-  try {
-    collection = &this->get_collection(mode, episode, difficulty, section_id);
-  } catch (const out_of_range&) {
+  const SpecCollection* collection = this->find_collection(mode, episode, difficulty, section_id);
+  if (!collection) {
     return;
   }
 
@@ -590,22 +613,20 @@ void RareItemSet::print_all_collections(FILE* stream, std::shared_ptr<const Item
 
 std::vector<RareItemSet::ExpandedDrop> RareItemSet::get_enemy_specs(
     GameMode mode, Episode episode, uint8_t difficulty, uint8_t secid, uint8_t rt_index) const {
-  try {
-    return this->get_collection(mode, episode, difficulty, secid).rt_index_to_specs.at(rt_index);
-  } catch (const out_of_range&) {
-    static const std::vector<ExpandedDrop> empty_vector;
-    return empty_vector;
+  const auto* collection = this->find_collection(mode, episode, difficulty, secid);
+  if (!collection || (rt_index >= collection->rt_index_to_specs.size())) {
+    return {};
   }
+  return collection->rt_index_to_specs[rt_index];
 }
 
 std::vector<RareItemSet::ExpandedDrop> RareItemSet::get_box_specs(
     GameMode mode, Episode episode, uint8_t difficulty, uint8_t secid, uint8_t area) const {
-  try {
-    return this->get_collection(mode, episode, difficulty, secid).box_area_to_specs.at(area);
-  } catch (const out_of_range&) {
-    static const std::vector<ExpandedDrop> empty_vector;
-    return empty_vector;
+  const auto* collection = this->find_collection(mode, episode, difficulty, secid);
+  if (!collection || (area >= collection->box_area_to_specs.size())) {
+    return {};
   }
+  return collection->box_area_to_specs[area];
 }
 
 const RareItemSet::SpecCollection& RareItemSet::get_collection(
@@ -613,6 +634,12 @@ const RareItemSet::SpecCollection& RareItemSet::get_collection(
   return this->collections.at(this->key_for_params(mode, episode, difficulty, secid));
 }
 
+const RareItemSet::SpecCollection* RareItemSet::find_collection(
+    GameMode mode, Episode episode, uint8_t difficulty, uint8_t secid) const {
+  auto it = this->collections.find(this->key_for_params(mode, episode, difficulty, secid));
+  return (it == this->collections.end()) ? nullptr : &it->second;
+}
+
 uint16_t RareItemSet::key_for_params(GameMode mode, Episode episode, uint8_t difficulty, uint8_t secid) {
   if (difficulty > 3) {
     throw logic_error("incorrect difficulty");
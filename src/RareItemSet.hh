@@ -104,6 +104,9 @@ protected:
   std::unordered_map<uint16_t, SpecCollection> collections;
 
   const SpecCollection& get_collection(GameMode mode, Episode episode, uint8_t difficulty, uint8_t secid) const;
+  // Like get_collection, but returns nullptr instead of throwing if the
+  // collection doesn't exist
+  const SpecCollection* find_collection(GameMode mode, Episode episode, uint8_t difficulty, uint8_t secid) const;
 
   static std::string gsl_entry_name_for_table(GameMode mode, Episode episode, uint8_t difficulty, uint8_t section_id);
   static uint16_t key_for_params(GameMode mode, Episode episode, uint8_t difficulty, uint8_t secid);
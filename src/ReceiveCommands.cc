@@ -1033,6 +1033,17 @@ static void on_93_BB(shared_ptr<Client> c, uint16_t, uint32_t, string& data) {
     return;
   }
 
+  // Start reading the player's files now, so they'll be in memory by the time
+  // the client asks for its system file and character previews
+  if (s->player_files_manager) {
+    vector<string> filenames{c->system_filename(), c->guild_card_filename()};
+    for (int8_t z = 0; z < 4; z++) {
+      filenames.emplace_back(c->character_filename(z));
+      filenames.emplace_back(PlayerFilesManager::character_delta_filename(filenames.back()));
+    }
+    s->player_files_manager->prefetch(std::move(filenames));
+  }
+
   if (base_cmd.guild_card_number != 0) {
     c->config.parse_from(config_data);
   } else {
@@ -3135,8 +3146,10 @@ static void on_61_98(shared_ptr<Client> c, uint16_t command, uint32_t flag, stri
           send_ep3_card_list_update(c);
           c->config.set_flag(Client::Flag::HAS_EP3_CARD_DEFS);
         }
-        if ((c->version() != Version::GC_EP3_NTE) && !c->config.check_flag(Client::Flag::HAS_EP3_MEDIA_UPDATES)) {
-          for (const auto& banner : s->ep3_lobby_banners) {
+        if ((c->version() != Version::GC_EP3_NTE) &&
+            !c->config.check_flag(Client::Flag::HAS_EP3_MEDIA_UPDATES) &&
+            s->ep3_lobby_banners) {
+          for (const auto& banner : *s->ep3_lobby_banners) {
             send_ep3_media_update(c, banner.type, banner.which, banner.data);
             c->config.set_flag(Client::Flag::HAS_EP3_MEDIA_UPDATES);
           }
@@ -3220,7 +3233,7 @@ static void on_61_98(shared_ptr<Client> c, uint16_t command, uint32_t flag, stri
             pending_export->dest_account->account_id, pending_export->character_index);
       }
 
-      if (s->player_files_manager->get_character(filename)) {
+      if (!s->player_files_manager->evict_character(filename)) {
         send_text_message(c, "$C6The target player\nis currently loaded.\nSign off in Blue\nBurst and try again.");
 
       } else {
@@ -3258,7 +3271,7 @@ static void on_61_98(shared_ptr<Client> c, uint16_t command, uint32_t flag, stri
         bb_player->challenge_records = player->challenge_records;
         bb_player->choice_search_config = player->choice_search_config;
         try {
-          Client::save_character_file(filename, c->system_file(), bb_player);
+          s->file_writer->write_sync(filename, Client::character_file_data(c->system_file(), bb_player));
           send_text_message(c, "$C7Character data saved\n(basic only)");
         } catch (const exception& e) {
           send_text_message_printf(c, "$C6Character data could\nnot be saved:\n%s", e.what());
@@ -3294,7 +3307,7 @@ static void on_30(shared_ptr<Client> c, uint16_t, uint32_t, string& data) {
   }
 
   auto s = c->require_server_state();
-  if (s->player_files_manager->get_character(filename)) {
+  if (!s->player_files_manager->evict_character(filename)) {
     send_text_message(c, "$C6The target player\nis currently loaded.\nSign off in Blue\nBurst and try again.");
     return;
   }
@@ -3330,7 +3343,7 @@ static void on_30(shared_ptr<Client> c, uint16_t, uint32_t, string& data) {
   bb_char->disp.visual.name_color_checksum = 0x00000000;
 
   try {
-    Client::save_character_file(filename, c->system_file(), bb_char);
+    s->file_writer->write_sync(filename, Client::character_file_data(c->system_file(), bb_char));
     send_text_message(c, "$C7Character data saved\n(full save file)");
   } catch (const exception& e) {
     send_text_message_printf(c, "$C6Character data could\nnot be saved:\n%s", e.what());
@@ -4152,6 +4165,13 @@ shared_ptr<Lobby> create_game_generic(
 
   auto current_lobby = c->require_lobby();
 
+  // The client is still in their current lobby while the maps for a game they
+  // created are being generated, so they could otherwise create another game
+  if (c->game_creation_in_progress) {
+    send_lobby_message_box(c, "$C7Your previous game is\nstill being created.");
+    return nullptr;
+  }
+
   size_t min_level = s->default_min_level_for_game(c->version(), episode, difficulty);
 
   auto p = c->character();
@@ -4364,7 +4384,13 @@ shared_ptr<Lobby> create_game_generic(
       auto sdt = s->set_data_table(game->base_version, game->episode, game->mode, game->difficulty);
       game->variations = sdt->generate_variations(game->episode, is_solo, game->opt_rand_crypt);
     }
-    game->load_maps();
+    if (s->map_generation_workers && (game->mode != GameMode::CHALLENGE)) {
+      // The maps will be generated on a worker thread, and the creator will
+      // join the game when they're ready (see join_created_game)
+      game->set_flag(Lobby::Flag::MAPS_LOADING);
+    } else {
+      game->load_maps();
+    }
   } else {
     game->variations.clear(0);
     game->map = make_shared<Map>(game->base_version, game->lobby_id, game->random_seed, game->opt_rand_crypt);
@@ -4408,6 +4434,68 @@ shared_ptr<Lobby> create_game_generic(
   return game;
 }
 
+// Adds a client to a game they just created with create_game_generic. If the
+// game's maps are being generated on a worker thread, the client stays in
+// their current lobby until the maps are ready, then joins the game (on the
+// event thread). on_joined is called after the client is in the game.
+static void join_created_game(
+    shared_ptr<ServerState> s, shared_ptr<Client> c, shared_ptr<Lobby> game, function<void()> on_joined = nullptr) {
+  auto join = [s, c, game, on_joined]() -> void {
+    s->change_client_lobby(c, game);
+    c->config.set_flag(Client::Flag::LOADING);
+    c->log.info("LOADING flag set");
+    if (on_joined) {
+      on_joined();
+    }
+  };
+
+  if (!game->check_flag(Lobby::Flag::MAPS_LOADING)) {
+    join();
+    return;
+  }
+
+  game->log.info("Generating maps on worker thread");
+  c->game_creation_in_progress = true;
+  weak_ptr<Lobby> origin_lobby = c->lobby;
+  auto generate = game->free_roam_map_generator();
+  s->map_generation_workers->enqueue([s, c, game, origin_lobby, generate = std::move(generate), join = std::move(join)]() -> void {
+    shared_ptr<Map> map;
+    string error_str;
+    try {
+      map = generate();
+    } catch (const exception& e) {
+      error_str = e.what();
+    }
+
+    s->forward_to_event_thread([s, c, game, origin_lobby, map = std::move(map), error_str = std::move(error_str), join = std::move(join)]() -> void {
+      game->clear_flag(Lobby::Flag::MAPS_LOADING);
+      c->game_creation_in_progress = false;
+      // If the client disconnected or left the lobby they created the game
+      // from while the maps were being generated, no one will ever join the
+      // game, so delete it
+      if (!c->channel.connected() || c->lobby.expired()) {
+        game->log.info("Creator disconnected before maps were ready; deleting game");
+        s->remove_lobby(game);
+        return;
+      }
+      auto current_lobby = c->lobby.lock();
+      if (!current_lobby || (current_lobby != origin_lobby.lock())) {
+        game->log.info("Creator changed lobbies before maps were ready; deleting game");
+        s->remove_lobby(game);
+        return;
+      }
+      if (!map) {
+        game->log.error("Failed to generate maps: %s", error_str.c_str());
+        s->remove_lobby(game);
+        send_lobby_message_box(c, "$C7The game could not\nbe created.");
+        return;
+      }
+      game->set_map(map);
+      join();
+    });
+  });
+}
+
 static void on_C1_PC(shared_ptr<Client> c, uint16_t, uint32_t, string& data) {
   const auto& cmd = check_size_t<C_CreateGame_PC_C1>(data);
   auto s = c->require_server_state();
@@ -4420,9 +4508,7 @@ static void on_C1_PC(shared_ptr<Client> c, uint16_t, uint32_t, string& data) {
   }
   auto game = create_game_generic(s, c, cmd.name.decode(c->language()), cmd.password.decode(c->language()), Episode::EP1, mode, cmd.difficulty, true);
   if (game) {
-    s->change_client_lobby(c, game);
-    c->config.set_flag(Client::Flag::LOADING);
-    c->log.info("LOADING flag set");
+    join_created_game(s, c, game);
   }
 }
 
@@ -4493,20 +4579,18 @@ static void on_0C_C1_E7_EC(shared_ptr<Client> c, uint16_t command, uint32_t, str
   }
 
   if (game) {
-    s->change_client_lobby(c, game);
-    c->config.set_flag(Client::Flag::LOADING);
-    c->log.info("LOADING flag set");
-
-    // There is a bug in DC NTE and 11/2000 that causes them to assign item IDs
-    // twice when joining a game. If there are other players in the game, this
-    // isn't an issue because the equivalent of the 6x6D command resets the next
-    // item ID before the second assignment, so the item IDs stay in sync with
-    // the server. If there was no one else in the game, however (as in this
-    // case, when it was just created), we need to artificially change the next
-    // item IDs during the client's loading procedure.
-    if (is_pre_v1(c->version())) {
-      c->config.set_flag(Client::Flag::SHOULD_SEND_ARTIFICIAL_ITEM_STATE);
-    }
+    join_created_game(s, c, game, [c]() -> void {
+      // There is a bug in DC NTE and 11/2000 that causes them to assign item
+      // IDs twice when joining a game. If there are other players in the game,
+      // this isn't an issue because the equivalent of the 6x6D command resets
+      // the next item ID before the second assignment, so the item IDs stay in
+      // sync with the server. If there was no one else in the game, however
+      // (as in this case, when it was just created), we need to artificially
+      // change the next item IDs during the client's loading procedure.
+      if (is_pre_v1(c->version())) {
+        c->config.set_flag(Client::Flag::SHOULD_SEND_ARTIFICIAL_ITEM_STATE);
+      }
+    });
   }
 }
 
@@ -4551,9 +4635,7 @@ static void on_C1_BB(shared_ptr<Client> c, uint16_t, uint32_t, string& data) {
 
   auto game = create_game_generic(s, c, cmd.name.decode(c->language()), cmd.password.decode(c->language()), episode, mode, cmd.difficulty);
   if (game) {
-    s->change_client_lobby(c, game);
-    c->config.set_flag(Client::Flag::LOADING);
-    c->log.info("LOADING flag set");
+    join_created_game(s, c, game);
   }
 }
 
@@ -519,6 +519,7 @@ static void on_sync_joining_player_compressed_state(shared_ptr<Client> c, uint8_
             l->log.warning("(K-%zX) Set flags from client (%04hX) do not match set flags from map (%04hX)",
                 z, flags, l->map->objects[z].set_flags);
             l->map->objects[z].set_flags = flags;
+            l->state_change_count++;
           }
         }
 
@@ -535,6 +536,7 @@ static void on_sync_joining_player_compressed_state(shared_ptr<Client> c, uint8_
             l->log.warning("(S-%zX) Set flags from client (%04hX) do not match set flags from map (%04hX)",
                 z, flags, l->map->enemy_set_flags[z]);
             l->map->enemy_set_flags[z] = flags;
+            l->state_change_count++;
           }
         }
 
@@ -557,6 +559,7 @@ static void on_sync_joining_player_compressed_state(shared_ptr<Client> c, uint8_
             l->log.warning("(W-%02hhX-%" PRIX32 ") Event flags from client (%04hX) do not match flags from map (%04hX)",
                 event.floor, event.event_id, flags, event.flags);
             event.flags = flags;
+            l->state_change_count++;
           }
         }
       }
@@ -587,6 +590,7 @@ static void on_sync_joining_player_compressed_state(shared_ptr<Client> c, uint8_
               l->log.warning("Switch flags do not match at %02zX[%02zX] (expected %02hhX, received %02hhX)",
                   floor, z, l_flags, r_flags);
               l_flags = r_flags;
+              l->state_change_count++;
             }
           }
         }
@@ -634,6 +638,7 @@ static void on_sync_joining_player_quest_flags_t(shared_ptr<Client> c, uint8_t c
   if (l->is_game() && l->any_client_loading() && (l->leader_id == c->lobby_client_id)) {
     l->quest_flags_known = nullptr; // All quest flags are now known
     l->quest_flag_values = make_unique<QuestFlags>(cmd.quest_flags);
+    l->state_change_count++;
     auto target = l->clients.at(flag);
     if (target) {
       send_game_flag_state(target);
@@ -1594,6 +1599,7 @@ static void on_switch_state_changed(shared_ptr<Client> c, uint8_t command, uint8
         send_text_message_printf(c, "$C5SW-%02hhX-%02hX OFF", cmd.switch_flag_floor, cmd.switch_flag_num.load());
       }
     }
+    l->state_change_count++;
   }
 
   if ((cmd.flags & 1) && cmd.header.object_id != 0xFFFF) {
@@ -2020,7 +2026,7 @@ static void on_pick_up_item_generic(
     auto p = c->character();
     auto s = c->require_server_state();
     auto fi = l->remove_item(floor, item_id, c->lobby_client_id);
-    if (!fi->visible_to_client(c->lobby_client_id)) {
+    if (!fi.visible_to_client(c->lobby_client_id)) {
       l->log.warning("Player %hu requests to pick up %08" PRIX32 ", but is it not visible to them; dropping command",
           client_id, item_id);
       l->add_item(floor, fi);
@@ -2028,7 +2034,7 @@ static void on_pick_up_item_generic(
     }
 
     try {
-      p->add_item(fi->data, *s->item_stack_limits(c->version()));
+      p->add_item(fi.data, *s->item_stack_limits(c->version()));
     } catch (const out_of_range&) {
       // Inventory is full; put the item back where it was
       l->log.warning("Player %hu requests to pick up %08" PRIX32 ", but their inventory is full; dropping command",
@@ -2039,7 +2045,7 @@ static void on_pick_up_item_generic(
 
     if (l->log.should_log(LogLevel::INFO)) {
       auto s = c->require_server_state();
-      auto name = s->describe_item(c->version(), fi->data, false);
+      auto name = s->describe_item(c->version(), fi.data, false);
       l->log.info("Player %hu picked up %08" PRIX32 " (%s)", client_id, item_id, name.c_str());
       c->print_inventory(stderr);
     }
@@ -2049,15 +2055,15 @@ static void on_pick_up_item_generic(
       if ((!lc) || (!is_request && (lc == c))) {
         continue;
       }
-      if (fi->visible_to_client(z)) {
+      if (fi.visible_to_client(z)) {
         send_pick_up_item_to_client(lc, client_id, item_id, floor);
       } else {
-        send_create_inventory_item_to_client(lc, client_id, fi->data);
+        send_create_inventory_item_to_client(lc, client_id, fi.data);
       }
     }
 
-    if (fi->flags & 0x1000) {
-      uint32_t pi = fi->data.primary_identifier();
+    if (fi.flags & 0x1000) {
+      uint32_t pi = fi.data.primary_identifier();
       bool should_send_game_notif, should_send_global_notif;
       if (is_v1_or_v2(c->version()) && (c->version() != Version::GC_NTE)) {
         should_send_game_notif = s->notify_game_for_item_primary_identifiers_v1_v2.count(pi);
@@ -2072,7 +2078,7 @@ static void on_pick_up_item_generic(
 
       if (should_send_game_notif || should_send_global_notif) {
         string p_name = p->disp.name.decode();
-        string desc = s->describe_item(c->version(), fi->data, true);
+        string desc = s->describe_item(c->version(), fi.data, true);
         string message = string_printf("$C6%s$C7 found\n%s", p_name.c_str(), desc.c_str());
         string bb_message = string_printf("$C6%s$C7 has found %s", p_name.c_str(), desc.c_str());
         if (should_send_global_notif) {
@@ -2649,6 +2655,7 @@ static void on_entity_drop_item_request(shared_ptr<Client> c, uint8_t command, u
   // their items in persistent games.
   G_SpecializableItemDropRequest_6xA2 cmd = normalize_drop_request(data, size);
   auto rec = reconcile_drop_request_with_map(c->log, c->channel, cmd, c->version(), l->episode, c->config, l->map, true);
+  l->state_change_count++;
 
   switch (l->drop_mode) {
     case Lobby::DropMode::CLIENT:
@@ -2782,6 +2789,7 @@ static void on_set_quest_flag(shared_ptr<Client> c, uint8_t command, uint8_t fla
   } else {
     l->quest_flag_values->clear(difficulty, flag_num);
   }
+  l->state_change_count++;
 
   if (c->version() == Version::BB_V4) {
     auto s = c->require_server_state();
@@ -2889,6 +2897,7 @@ static void on_set_entity_set_flag(shared_ptr<Client> c, uint8_t command, uint8_
 
   const auto& cmd = check_size_t<G_SetEntitySetFlags_6x76>(data, size);
   if (l->map) {
+    l->state_change_count++;
     if (cmd.header.enemy_id >= 0x4000) {
       uint16_t object_index = cmd.header.enemy_id - 0x4000;
       try {
@@ -3024,6 +3033,7 @@ static void on_trigger_set_event(shared_ptr<Client> c, uint8_t command, uint8_t
     for (auto* event : events) {
       event->flags |= 0x04;
     }
+    l->state_change_count++;
     l->log.info("Client triggered set event W-%02" PRIX32 "-%" PRIX32 " (%zu events)",
         cmd.floor.load(), cmd.event_id.load(), events.size());
     if (c->config.check_flag(Client::Flag::DEBUG_ENABLED)) {
@@ -3191,6 +3201,7 @@ static void on_update_enemy_state(shared_ptr<Client> c, uint8_t command, uint8_t
     enemy.game_flags = is_big_endian(c->version()) ? bswap32(cmd.flags) : cmd.flags.load();
     enemy.total_damage = cmd.total_damage;
     enemy.set_last_hit_by_client_id(c->lobby_client_id);
+    l->state_change_count++;
     l->log.info("E-%hX updated to damage=%hu game_flags=%08" PRIX32, cmd.enemy_index.load(), enemy.total_damage, enemy.game_flags);
   }
 
@@ -3223,6 +3234,7 @@ static void on_update_object_state(shared_ptr<Client> c, uint8_t command, uint8_
       return;
     }
     l->map->objects[cmd.object_index].game_flags = cmd.flags;
+    l->state_change_count++;
   }
 
   forward_subcommand(c, command, flag, data, size);
@@ -3426,6 +3438,7 @@ static void on_enemy_exp_request_bb(shared_ptr<Client> c, uint8_t, uint8_t, void
     return;
   }
   e.server_flags |= Map::Enemy::Flag::EXP_GIVEN;
+  l->state_change_count++;
 
   double base_exp = 0.0;
   try {
@@ -3680,13 +3693,13 @@ static void on_destroy_floor_item(shared_ptr<Client> c, uint8_t command, uint8_t
 
   auto s = c->require_server_state();
   auto fi = l->remove_item(cmd.floor, cmd.item_id, 0xFF);
-  auto name = s->describe_item(c->version(), fi->data, false);
+  auto name = s->describe_item(c->version(), fi.data, false);
   l->log.info("Player %hhu destroyed floor item %08" PRIX32 " (%s)", c->lobby_client_id, cmd.item_id.load(), name.c_str());
 
   // Only forward to players for whom the item was visible
   for (size_t z = 0; z < l->clients.size(); z++) {
     auto lc = l->clients[z];
-    if (lc && fi->visible_to_client(z)) {
+    if (lc && fi.visible_to_client(z)) {
       if (lc->version() != c->version()) {
         G_DestroyFloorItem_6x5C_6x63 out_cmd = cmd;
         switch (lc->version()) {
@@ -0,0 +1,152 @@
+#include "ReloadQueue.hh"
+
+#include <phosg/Strings.hh>
+#include <phosg/Time.hh>
+
+#include "Loggers.hh"
+
+using namespace std;
+
+ReloadQueue::cancelled::cancelled() : runtime_error("reload cancelled") {}
+
+void ReloadQueue::enqueue(Task&& task) {
+  lock_guard g(this->lock);
+  if (this->should_stop) {
+    throw runtime_error("reload thread is stopped");
+  }
+  this->queue.emplace_back(std::move(task));
+  if (!this->thread_started) {
+    // The thread holds a reference to this object, so it's safe for the
+    // owning ServerState to be destroyed while a task is running
+    thread t([self = this->shared_from_this()]() -> void { self->thread_fn(); });
+    this->thread_id = t.get_id();
+    t.detach();
+    this->thread_started = true;
+  }
+  this->cv.notify_one();
+}
+
+size_t ReloadQueue::cancel() {
+  deque<Task> cancelled_tasks;
+  size_t ret;
+  {
+    lock_guard g(this->lock);
+    cancelled_tasks.swap(this->queue);
+    ret = cancelled_tasks.size();
+    if (!this->current_task_name.empty()) {
+      this->current_task_cancelled = true;
+      ret++;
+    }
+    for (auto& task : cancelled_tasks) {
+      this->add_history_entry_locked(std::move(task.name), 0, "cancelled before starting");
+    }
+  }
+  for (const auto& task : cancelled_tasks) {
+    if (task.on_complete) {
+      task.on_complete(false);
+    }
+  }
+  return ret;
+}
+
+void ReloadQueue::stop() {
+  this->cancel();
+  lock_guard g(this->lock);
+  this->should_stop = true;
+  this->cv.notify_one();
+}
+
+bool ReloadQueue::is_reload_thread() const {
+  lock_guard g(this->lock);
+  return this->thread_started && (this_thread::get_id() == this->thread_id);
+}
+
+void ReloadQueue::check_cancelled() const {
+  if (this->current_task_cancelled && this->is_reload_thread()) {
+    throw cancelled();
+  }
+}
+
+string ReloadQueue::status() const {
+  lock_guard g(this->lock);
+  uint64_t t = now();
+
+  string ret;
+  if (this->current_task_name.empty()) {
+    ret = "No reload is running\n";
+  } else {
+    string duration_str = format_duration(t - this->current_task_start_time);
+    ret = string_printf("Running: %s (for %s)%s\n", this->current_task_name.c_str(), duration_str.c_str(),
+        this->current_task_cancelled ? " (cancellation requested)" : "");
+  }
+  for (const auto& task : this->queue) {
+    ret += string_printf("Queued: %s\n", task.name.c_str());
+  }
+  for (const auto& entry : this->history) {
+    if (entry.start_time) {
+      string duration_str = format_duration(entry.end_time - entry.start_time);
+      ret += string_printf("Finished: %s (%s): %s\n", entry.name.c_str(), duration_str.c_str(), entry.result.c_str());
+    } else {
+      ret += string_printf("Finished: %s: %s\n", entry.name.c_str(), entry.result.c_str());
+    }
+  }
+  return ret;
+}
+
+void ReloadQueue::add_history_entry_locked(string&& name, uint64_t start_time, string&& result) {
+  this->history.emplace_back(HistoryEntry{
+      .name = std::move(name),
+      .start_time = start_time,
+      .end_time = now(),
+      .result = std::move(result)});
+  while (this->history.size() > this->MAX_HISTORY_ENTRIES) {
+    this->history.pop_front();
+  }
+}
+
+void ReloadQueue::thread_fn() {
+  for (;;) {
+    Task task;
+    {
+      unique_lock g(this->lock);
+      this->cv.wait(g, [&]() -> bool { return this->should_stop || !this->queue.empty(); });
+      if (this->should_stop) {
+        return;
+      }
+      task = std::move(this->queue.front());
+      this->queue.pop_front();
+      this->current_task_name = task.name;
+      this->current_task_start_time = now();
+      this->current_task_cancelled = false;
+    }
+
+    string result;
+    bool succeeded = false;
+    try {
+      config_log.info("Reload started: %s", task.name.c_str());
+      task.run();
+      succeeded = true;
+      result = "done";
+      config_log.info("Reload complete: %s", task.name.c_str());
+    } catch (const cancelled&) {
+      result = "cancelled";
+      config_log.info("Reload cancelled: %s", task.name.c_str());
+    } catch (const exception& e) {
+      result = string_printf("failed: %s", e.what());
+      config_log.error("Reload failed: %s: %s", task.name.c_str(), e.what());
+    }
+
+    if (task.on_complete) {
+      try {
+        task.on_complete(succeeded);
+      } catch (const exception& e) {
+        config_log.error("Reload completion handler failed: %s: %s", task.name.c_str(), e.what());
+      }
+    }
+
+    lock_guard g(this->lock);
+    this->add_history_entry_locked(std::move(this->current_task_name), this->current_task_start_time, std::move(result));
+    this->current_task_name.clear();
+    this->current_task_cancelled = false;
+  }
+}
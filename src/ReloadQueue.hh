@@ -0,0 +1,88 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+// Runs reload tasks one at a time on a dedicated thread, so that expensive
+// work (parsing, decompression, compression, etc.) never happens on the event
+// thread. Tasks are expected to build their new objects entirely on the
+// reload thread and publish them with a single pointer swap on the event
+// thread (see ServerState::forward_or_call).
+//
+// Cancellation is cooperative: cancel() drops all queued tasks immediately,
+// and the running task is abandoned the next time it calls check_cancelled()
+// (which ServerState does between loading steps and before publishing any
+// results), so a cancelled task never publishes a partial result.
+class ReloadQueue : public std::enable_shared_from_this<ReloadQueue> {
+public:
+  class cancelled : public std::runtime_error {
+  public:
+    cancelled();
+    ~cancelled() = default;
+  };
+
+  struct Task {
+    std::string name;
+    std::function<void()> run;
+    // Called with succeeded = false if the task is dropped from the queue by
+    // cancel() (or stop()) before it starts; in that case, it's called on the
+    // thread that called cancel(), before cancel() returns. Otherwise, it's
+    // called on the reload thread after the task runs or fails. May be null.
+    std::function<void(bool succeeded)> on_complete;
+  };
+
+  ReloadQueue() = default;
+  ReloadQueue(const ReloadQueue&) = delete;
+  ReloadQueue(ReloadQueue&&) = delete;
+  ReloadQueue& operator=(const ReloadQueue&) = delete;
+  ReloadQueue& operator=(ReloadQueue&&) = delete;
+  ~ReloadQueue() = default;
+
+  void enqueue(Task&& task);
+  // Returns the number of tasks that were cancelled (including the running
+  // task, if any).
+  size_t cancel();
+  // Stops the reload thread after the current task (if any) finishes. Queued
+  // tasks are dropped.
+  void stop();
+
+  // Throws cancelled if called on the reload thread while the running task has
+  // been cancelled. Does nothing on any other thread.
+  void check_cancelled() const;
+  bool is_reload_thread() const;
+
+  std::string status() const;
+
+private:
+  struct HistoryEntry {
+    std::string name;
+    uint64_t start_time;
+    uint64_t end_time;
+    std::string result;
+  };
+
+  mutable std::mutex lock;
+  std::condition_variable cv;
+  std::deque<Task> queue;
+  std::deque<HistoryEntry> history;
+  std::string current_task_name;
+  uint64_t current_task_start_time = 0;
+  std::atomic<bool> current_task_cancelled = false;
+  bool should_stop = false;
+  bool thread_started = false;
+  std::thread::id thread_id;
+
+  static constexpr size_t MAX_HISTORY_ENTRIES = 10;
+
+  void thread_fn();
+  void add_history_entry_locked(std::string&& name, uint64_t start_time, std::string&& result);
+};
@@ -14,6 +14,7 @@
 #include <phosg/Time.hh>
 #include <set>
 
+#include "CRC32.hh"
 #include "CommandFormats.hh"
 #include "Compression.hh"
 #include "FileContentsCache.hh"
@@ -696,11 +697,11 @@ void send_stream_file_index_bb(shared_ptr<Client> c) {
     // data. If the cache result was just populated, then it may be different,
     // so we always recompute the checksum in that case.
     if (cache_res.generate_called) {
-      e.checksum = crc32(cache_res.file->data->data(), e.size);
+      e.checksum = crc32_fast(cache_res.file->data->data(), e.size);
       bb_stream_files_cache.replace_obj<uint32_t>(key + ".crc32", e.checksum);
     } else {
       auto compute_checksum = [&](const string&) -> uint32_t {
-        return crc32(cache_res.file->data->data(), e.size);
+        return crc32_fast(cache_res.file->data->data(), e.size);
       };
       e.checksum = bb_stream_files_cache.get_obj<uint32_t>(key + ".crc32", compute_checksum).obj;
     }
@@ -1485,6 +1486,7 @@ void send_game_menu_t(
         (client_has_debug || l->version_is_allowed(c->version())) &&
         (client_has_debug || (l->check_flag(Lobby::Flag::IS_CLIENT_CUSTOMIZATION) == c->config.check_flag(Client::Flag::IS_CLIENT_CUSTOMIZATION))) &&
         (l->check_flag(Lobby::Flag::IS_SPECTATOR_TEAM) == is_spectator_team_list) &&
+        !l->check_flag(Lobby::Flag::MAPS_LOADING) &&
         (!show_tournaments_only || l->tournament_match)) {
       games.emplace(l);
     }
@@ -2664,13 +2666,12 @@ void send_game_item_state(shared_ptr<Client> c) {
   for (size_t floor = 0; floor < 0x10; floor++) {
     const auto& m = l->floor_item_managers.at(floor);
     // It's important that these are added in increasing order of item_id (hence
-    // why items is a map and not an unordered_map), since the game uses binary
-    // search to find floor items when picking them up. If items aren't in the
-    // correct order, the game may fail to find an item when attempting to pick
-    // it up, causing "ghost items" which are visible but can't be picked up.
-    for (const auto& it : m.items) {
-      const auto& item = it.second;
-      if (!item->visible_to_client(c->lobby_client_id)) {
+    // why items is kept sorted by item_id), since the game uses binary search
+    // to find floor items when picking them up. If items aren't in the correct
+    // order, the game may fail to find an item when attempting to pick it up,
+    // causing "ghost items" which are visible but can't be picked up.
+    for (const auto& item : m.items) {
+      if (!item.visible_to_client(c->lobby_client_id)) {
         continue;
       }
 
@@ -2678,11 +2679,11 @@ void send_game_item_state(shared_ptr<Client> c) {
       fi.floor = floor;
       fi.from_enemy = 0;
       fi.entity_id = 0xFFFF;
-      fi.x = item->x;
-      fi.z = item->z;
+      fi.x = item.x;
+      fi.z = item.z;
       fi.unknown_a2 = 0;
       fi.drop_number = (floor == 0) ? 0xFFFF : (decompressed_header.next_drop_number_per_floor.at(floor - 1)++);
-      fi.item = item->data;
+      fi.item = item.data;
       fi.item.encode_for_version(c->version(), s->item_parameter_table_for_encode(c->version()));
       floor_items_w.put(fi);
 
@@ -277,6 +277,13 @@ void Server::add_socket(
       forward_as_tuple(this, addr_str, fd, version, behavior));
 }
 
+void Server::stop_listening() {
+  for (const auto& it : this->listening_sockets) {
+    evconnlistener_disable(it.second.listener.get());
+    server_log.info("Stopped accepting connections on %s", it.second.addr_str.c_str());
+  }
+}
+
 shared_ptr<Client> Server::get_client() const {
   if (this->state->channel_to_client.empty()) {
     throw runtime_error("no clients on game server");
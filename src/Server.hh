@@ -22,6 +22,9 @@ public:
   void listen(const std::string& addr_str, const std::string& addr, int port, Version version, ServerBehavior initial_state);
   void listen(const std::string& addr_str, int port, Version version, ServerBehavior initial_state);
   void add_socket(const std::string& addr_str, int fd, Version version, ServerBehavior initial_state);
+  // Stops accepting new connections, but doesn't close the listening sockets
+  // (they may have been handed off to another process)
+  void stop_listening();
 
   void connect_virtual_client(
       struct bufferevent* bev,
@@ -216,6 +216,10 @@ CommandDefinition c_reload(
       teams - reindex all BB teams\n\
       text-index - reload in-game text\n\
       word-select - regenerate the Word Select translation table\n\
+    Reloads run one at a time on a background thread, so clients are not\n\
+    affected while files are parsed or compressed; each new set of data is\n\
+    used only after it is completely loaded. Use reload-status to see the\n\
+    progress of queued reloads, and reload-cancel to abandon them.\n\
     Reloading will not affect items that are in use; for example, if an Episode\n\
     3 battle is in progress, it will continue to use the previous map and card\n\
     definitions. Similarly, BB clients are not forced to disconnect or reload\n\
@@ -224,58 +228,131 @@ CommandDefinition c_reload(
     actually received.",
     false,
     +[](CommandArgs& args) {
+      static const unordered_map<string, function<void(shared_ptr<ServerState>)>> reload_fns({
+          {"bb-keys", [](shared_ptr<ServerState> s) { s->load_bb_private_keys(true); }},
+          {"accounts", [](shared_ptr<ServerState> s) { s->load_accounts(true); }},
+          {"patch-files", [](shared_ptr<ServerState> s) { s->load_patch_indexes(true); }},
+          {"ep3-cards", [](shared_ptr<ServerState> s) { s->load_ep3_cards(true); }},
+          {"ep3-maps", [](shared_ptr<ServerState> s) { s->load_ep3_maps(true); }},
+          {"ep3-tournaments", [](shared_ptr<ServerState> s) { s->load_ep3_tournament_state(true); }},
+          {"functions", [](shared_ptr<ServerState> s) { s->compile_functions(true); }},
+          {"dol-files", [](shared_ptr<ServerState> s) { s->load_dol_files(true); }},
+          {"set-tables", [](shared_ptr<ServerState> s) { s->load_set_data_tables(true); }},
+          {"battle-params", [](shared_ptr<ServerState> s) { s->load_battle_params(true); }},
+          {"level-tables", [](shared_ptr<ServerState> s) { s->load_level_tables(true); }},
+          {"text-index", [](shared_ptr<ServerState> s) { s->load_text_index(true); }},
+          {"word-select", [](shared_ptr<ServerState> s) { s->load_word_select_table(true); }},
+          {"item-definitions", [](shared_ptr<ServerState> s) { s->load_item_definitions(true); }},
+          {"item-name-index", [](shared_ptr<ServerState> s) { s->load_item_name_indexes(true); }},
+          {"drop-tables", [](shared_ptr<ServerState> s) { s->load_drop_tables(true); }},
+          {"config", [](shared_ptr<ServerState> s) {
+             // The config fields are read directly by handlers on the event
+             // thread, so they must be replaced there. The lobby banners are
+             // the only expensive part, so they're built on the reload thread
+             s->call_on_event_thread<void>([s]() {
+               try {
+                 s->load_config_early();
+                 s->load_config_late();
+               } catch (const exception& e) {
+                 fprintf(stderr, "FAILED: %s\n", e.what());
+                 fprintf(stderr, "Some configuration may have been reloaded. Fix the underlying issue and try again.\n");
+               }
+             });
+             s->load_ep3_lobby_banners(true);
+           }},
+          {"teams", [](shared_ptr<ServerState> s) { s->load_teams(true); }},
+          {"quests", [](shared_ptr<ServerState> s) { s->load_quest_index(true); }},
+      });
+
       auto types = split(args.args, ' ');
       for (const auto& type : types) {
-        if (type == "bb-keys") {
-          args.s->load_bb_private_keys(true);
-        } else if (type == "accounts") {
-          args.s->load_accounts(true);
-        } else if (type == "patch-files") {
-          args.s->load_patch_indexes(true);
-        } else if (type == "ep3-cards") {
-          args.s->load_ep3_cards(true);
-        } else if (type == "ep3-maps") {
-          args.s->load_ep3_maps(true);
-        } else if (type == "ep3-tournaments") {
-          args.s->load_ep3_tournament_state(true);
-        } else if (type == "functions") {
-          args.s->compile_functions(true);
-        } else if (type == "dol-files") {
-          args.s->load_dol_files(true);
-        } else if (type == "set-tables") {
-          args.s->load_set_data_tables(true);
-        } else if (type == "battle-params") {
-          args.s->load_battle_params(true);
-        } else if (type == "level-tables") {
-          args.s->load_level_tables(true);
-        } else if (type == "text-index") {
-          args.s->load_text_index(true);
-        } else if (type == "word-select") {
-          args.s->load_word_select_table(true);
-        } else if (type == "item-definitions") {
-          args.s->load_item_definitions(true);
-        } else if (type == "item-name-index") {
-          args.s->load_item_name_indexes(true);
-        } else if (type == "drop-tables") {
-          args.s->load_drop_tables(true);
-        } else if (type == "config") {
-          args.s->forward_to_event_thread([s = args.s]() {
-            try {
-              s->load_config_early();
-              s->load_config_late();
-            } catch (const exception& e) {
-              fprintf(stderr, "FAILED: %s\n", e.what());
-              fprintf(stderr, "Some configuration may have been reloaded. Fix the underlying issue and try again.\n");
-            }
-          });
-        } else if (type == "teams") {
-          args.s->load_teams(true);
-        } else if (type == "quests") {
-          args.s->load_quest_index(true);
-        } else {
+        if (!reload_fns.count(type)) {
           throw runtime_error("invalid data type: " + type);
         }
       }
+      for (const auto& type : types) {
+        const auto& fn = reload_fns.at(type);
+        args.s->reload_queue->enqueue(ReloadQueue::Task{
+            .name = type,
+            .run = [s = args.s, fn]() -> void { fn(s); },
+            .on_complete = nullptr});
+      }
+      fprintf(stderr, "%zu reload(s) queued\n", types.size());
+    });
+
+CommandDefinition c_reload_status(
+    "reload-status", "reload-status\n\
+    Show the running reload (if any), all queued reloads, and the results of\n\
+    recently-finished reloads.",
+    false,
+    +[](CommandArgs& args) {
+      fputs(args.s->reload_queue->status().c_str(), stderr);
+    });
+
+CommandDefinition c_reload_cancel(
+    "reload-cancel", "reload-cancel\n\
+    Cancel all queued reloads, and abandon the running reload (if any). The\n\
+    running reload stops at its next checkpoint and does not replace any data\n\
+    that is in use.",
+    false,
+    +[](CommandArgs& args) {
+      size_t count = args.s->reload_queue->cancel();
+      fprintf(stderr, "%zu reload(s) cancelled\n", count);
+    });
+
+CommandDefinition c_show_map_file_caches(
+    "show-map-file-caches", "show-map-file-caches\n\
+    Show the size and hit rate of the map file cache for each game version,\n\
+    and the number of cached free-roam map templates.",
+    true,
+    +[](CommandArgs& args) {
+      for (size_t v_s = NUM_PATCH_VERSIONS; v_s < NUM_VERSIONS; v_s++) {
+        auto stats = args.s->map_file_caches[v_s]->stats();
+        uint64_t total_requests = stats.hits + stats.misses;
+        fprintf(stderr, "%s: %zu files, %zu/%zu bytes, %" PRIu64 " hits, %" PRIu64 " misses (%g%% hit rate), %" PRIu64 " evictions\n",
+            name_for_enum(static_cast<Version>(v_s)), stats.num_files, stats.bytes, stats.max_bytes,
+            stats.hits, stats.misses, total_requests ? (stats.hits * 100.0 / total_requests) : 0.0, stats.evictions);
+      }
+      fprintf(stderr, "Free-roam map templates: %zu\n", args.s->map_template_cache->size());
+    });
+
+CommandDefinition c_show_player_files_cache(
+    "show-player-files-cache", "show-player-files-cache\n\
+    Show the size and hit rate of the BB player files cache, the number of\n\
+    prefetched player files, and how many character saves were written as\n\
+    snapshots or deltas.",
+    true,
+    +[](CommandArgs& args) {
+      if (!args.s->player_files_manager) {
+        throw runtime_error("player files are not loaded by this server");
+      }
+      auto stats = args.s->player_files_manager->stats();
+      uint64_t total_requests = stats.hits + stats.misses;
+      fprintf(stderr, "Loaded: %zu files, %zu/%zu bytes, %" PRIu64 " hits, %" PRIu64 " misses (%g%% hit rate), %" PRIu64 " evictions\n",
+          stats.num_files, stats.bytes, stats.max_bytes,
+          stats.hits, stats.misses, total_requests ? (stats.hits * 100.0 / total_requests) : 0.0, stats.evictions);
+      fprintf(stderr, "Prefetched: %zu files, %" PRIu64 " used, %" PRIu64 " discarded\n",
+          stats.num_prefetched_files, stats.prefetch_hits, stats.prefetch_discards);
+      fprintf(stderr, "Character saves: %" PRIu64 " snapshots, %" PRIu64 " deltas, %" PRIu64 " bytes written\n",
+          stats.character_snapshot_saves, stats.character_delta_saves, stats.character_bytes_written);
+    });
+
+CommandDefinition c_checkpoint_games(
+    "checkpoint-games", "checkpoint-games\n\
+    Write the game checkpoint file now, if any game has changed since the last\n\
+    checkpoint, and show checkpoint statistics. Game checkpoints must be\n\
+    enabled in config.json (see GameCheckpointInterval).",
+    true,
+    +[](CommandArgs& args) {
+      if (!args.s->game_checkpoint_manager || !args.s->game_checkpoint_interval_usecs) {
+        throw runtime_error("game checkpoints are disabled");
+      }
+      args.s->game_checkpoint_manager->checkpoint();
+      auto stats = args.s->game_checkpoint_manager->stats();
+      fprintf(stderr, "Checkpoint contains %zu games; interval is %" PRIu64 " usecs\n",
+          stats.num_games, stats.interval_usecs);
+      fprintf(stderr, "Written: %" PRIu64 " checkpoints, %" PRIu64 " bytes; %" PRIu64 " games encoded, %" PRIu64 " reused\n",
+          stats.checkpoints_written, stats.bytes_written, stats.games_encoded, stats.games_reused);
     });
 
 CommandDefinition c_list_accounts(
@@ -3,6 +3,7 @@
 #include <string.h>
 
 #include <memory>
+#include <mutex>
 #include <phosg/Image.hh>
 #include <phosg/Network.hh>
 
@@ -37,15 +38,27 @@ ServerState::QuestF960Result::QuestF960Result(const JSON& json, std::shared_ptr<
 
 ServerState::ServerState(const string& config_filename)
     : creation_time(now()),
-      config_filename(config_filename) {}
+      config_filename(config_filename),
+      file_writer(make_shared<DurableFileWriter>()),
+      reload_queue(make_shared<ReloadQueue>()) {}
 
 ServerState::ServerState(shared_ptr<struct event_base> base, const string& config_filename, bool is_replay)
     : creation_time(now()),
       base(base),
       config_filename(config_filename),
       is_replay(is_replay),
-      player_files_manager(this->base ? make_shared<PlayerFilesManager>(base) : nullptr),
-      destroy_lobbies_event(this->base ? event_new(base.get(), -1, EV_TIMEOUT, &ServerState::dispatch_destroy_lobbies, this) : nullptr, event_free) {}
+      file_writer(make_shared<DurableFileWriter>()),
+      player_files_manager(this->base ? make_shared<PlayerFilesManager>(base, this->file_writer) : nullptr),
+      destroy_lobbies_event(this->base ? event_new(base.get(), -1, EV_TIMEOUT, &ServerState::dispatch_destroy_lobbies, this) : nullptr, event_free),
+      reload_queue(make_shared<ReloadQueue>()) {}
+
+ServerState::~ServerState() {
+  this->reload_queue->stop();
+  this->file_writer->stop();
+  if (this->map_generation_workers) {
+    this->map_generation_workers->stop();
+  }
+}
 
 void ServerState::add_client_to_available_lobby(shared_ptr<Client> c) {
   shared_ptr<Lobby> added_to_lobby;
@@ -421,6 +434,47 @@ shared_ptr<const ItemData::StackLimits> ServerState::item_stack_limits(Version v
   return ret;
 }
 
+shared_ptr<const CommonItemSet> ServerState::common_item_set(Version version) const {
+  switch (version) {
+    case Version::DC_NTE:
+    case Version::DC_V1_11_2000_PROTOTYPE:
+    case Version::DC_V1:
+      // TODO: We should probably have a v1 common item set at some point too
+    case Version::DC_V2:
+    case Version::PC_NTE:
+    case Version::PC_V2:
+      return this->common_item_set_v2;
+    case Version::GC_NTE:
+    case Version::GC_V3:
+    case Version::XB_V3:
+    case Version::BB_V4:
+      return this->common_item_set_v3_v4;
+    default:
+      throw runtime_error("no common item set exists for this version");
+  }
+}
+
+shared_ptr<const RareItemSet> ServerState::rare_item_set(Version version) const {
+  switch (version) {
+    case Version::DC_NTE:
+    case Version::DC_V1_11_2000_PROTOTYPE:
+    case Version::DC_V1:
+      return this->rare_item_sets.at("rare-table-v1");
+    case Version::DC_V2:
+    case Version::PC_NTE:
+    case Version::PC_V2:
+      return this->rare_item_sets.at("rare-table-v2");
+    case Version::GC_NTE:
+    case Version::GC_V3:
+    case Version::XB_V3:
+      return this->rare_item_sets.at("rare-table-v3");
+    case Version::BB_V4:
+      return this->rare_item_sets.at("rare-table-v4");
+    default:
+      throw runtime_error("no rare item set exists for this version");
+  }
+}
+
 shared_ptr<const ItemNameIndex> ServerState::item_name_index_opt(Version version) const {
   return this->item_name_indexes.at(static_cast<size_t>(version));
 }
@@ -517,8 +571,12 @@ shared_ptr<const string> ServerState::load_bb_file(
 
   // Finally, look in system/blueburst
   const string& effective_bb_directory_filename = bb_directory_filename.empty() ? patch_index_filename : bb_directory_filename;
+  // Map files may be loaded on worker threads (see create_game_generic), so
+  // this cache needs a lock
   static FileContentsCache cache(10 * 60 * 1000 * 1000); // 10 minutes
+  static mutex cache_lock;
   try {
+    lock_guard g(cache_lock);
     auto ret = cache.get_or_load("system/blueburst/" + effective_bb_directory_filename);
     return ret.file->data;
   } catch (const exception& e) {
@@ -720,11 +778,35 @@ void ServerState::load_config_early() {
   this->client_ping_interval_usecs = this->config_json->get_int("ClientPingInterval", 30000000);
   this->client_idle_timeout_usecs = this->config_json->get_int("ClientIdleTimeout", 60000000);
   this->patch_client_idle_timeout_usecs = this->config_json->get_int("PatchClientIdleTimeout", 300000000);
+  this->patch_file_cache_size = this->config_json->get_int("PatchFileCacheSize", 0x4000000);
+  this->map_file_cache_size = this->config_json->get_int("MapFileCacheSize", 0x2000000);
+  this->player_file_cache_size = this->config_json->get_int("PlayerFileCacheSize", 0x4000000);
+  this->character_file_delta_saves = this->config_json->get_bool("CharacterFileDeltaSaves", false);
+  if (this->player_files_manager) {
+    this->player_files_manager->set_max_bytes(this->player_file_cache_size);
+    // Prefetching doesn't change which data is loaded, but it does change when
+    // files are read, so it's disabled during replays to keep them predictable
+    this->player_files_manager->set_prefetch_enabled(!this->is_replay);
+    this->player_files_manager->set_character_delta_saves_enabled(this->character_file_delta_saves);
+  }
+  this->map_generation_threads = this->config_json->get_int("MapGenerationThreads", 2);
+  // Replays must be deterministic, so maps are always generated synchronously
+  // during replays
+  size_t effective_map_generation_threads = this->is_replay ? 0 : this->map_generation_threads;
+  if (!this->map_generation_workers || (this->map_generation_workers->num_threads() != effective_map_generation_threads)) {
+    if (this->map_generation_workers) {
+      this->map_generation_workers->stop();
+    }
+    this->map_generation_workers = effective_map_generation_threads
+        ? make_shared<WorkerPool>(effective_map_generation_threads)
+        : nullptr;
+  }
 
   this->ip_stack_debug = this->config_json->get_bool("IPStackDebug", false);
   this->allow_unregistered_users = this->config_json->get_bool("AllowUnregisteredUsers", false);
   this->allow_pc_nte = this->config_json->get_bool("AllowPCNTE", false);
   this->use_temp_accounts_for_prototypes = this->config_json->get_bool("UseTemporaryAccountsForPrototypes", true);
+  this->account_log_filename = this->config_json->get_string("AccountLogFilename", "");
   this->notify_server_for_max_level_achieved = this->config_json->get_bool("NotifyServerForMaxLevelAchieved", false);
   this->allowed_drop_modes_v1_v2_normal = this->config_json->get_int("AllowedDropModesV1V2Normal", 0x1F);
   this->allowed_drop_modes_v1_v2_battle = this->config_json->get_int("AllowedDropModesV1V2Battle", 0x07);
@@ -786,6 +868,19 @@ void ServerState::load_config_early() {
   }
 
   this->persistent_game_idle_timeout_usecs = this->config_json->get_int("PersistentGameIdleTimeout", 0);
+  this->game_checkpoint_interval_usecs = this->config_json->get_int("GameCheckpointInterval", 0);
+  this->game_checkpoint_restore_timeout_usecs = this->config_json->get_int("GameCheckpointRestoreTimeout", 600000000);
+  this->handoff_socket_path = this->config_json->get_string("HandoffSocketPath", "");
+  // Replays must not depend on timers or on games left over from a previous
+  // run, so checkpoints are never written or restored during replays. After a
+  // handoff, the new process owns the checkpoint file, so this process must
+  // not write it anymore.
+  if (this->base && !this->is_replay && !this->handoff_complete) {
+    if (!this->game_checkpoint_manager) {
+      this->game_checkpoint_manager = make_shared<GameCheckpointManager>(this->shared_from_this(), "system/game-checkpoint.json");
+    }
+    this->game_checkpoint_manager->set_interval(this->game_checkpoint_interval_usecs);
+  }
   this->cheat_mode_behavior = parse_behavior_switch("CheatModeBehavior", BehaviorSwitch::OFF_BY_DEFAULT);
   this->default_switch_assist_enabled = this->config_json->get_bool("EnableSwitchAssistByDefault", false);
   this->use_game_creator_section_id = this->config_json->get_bool("UseGameCreatorSectionID", false);
@@ -821,6 +916,7 @@ void ServerState::load_config_early() {
   this->ep3_behavior_flags = this->config_json->get_int("Episode3BehaviorFlags", 0);
   this->ep3_card_auction_points = this->config_json->get_int("CardAuctionPoints", 0);
   this->hide_download_commands = this->config_json->get_bool("HideDownloadCommands", true);
+  this->watch_for_file_changes = this->config_json->get_bool("WatchForFileChanges", false);
   this->proxy_allow_save_files = this->config_json->get_bool("ProxyAllowSaveFiles", true);
   this->proxy_enable_login_options = this->config_json->get_bool("ProxyEnableLoginOptions", false);
 
@@ -838,52 +934,6 @@ void ServerState::load_config_early() {
     this->ep3_card_auction_max_size = 0;
   }
 
-  if (!this->is_replay) {
-    this->ep3_lobby_banners.clear();
-    size_t banner_index = 0;
-    for (const auto& it : this->config_json->get("Episode3LobbyBanners", JSON::list()).as_list()) {
-      string path = "system/ep3/banners/" + it->at(2).as_string();
-
-      string compressed_gvm_data;
-      string decompressed_gvm_data;
-      string lower_path = tolower(path);
-      if (ends_with(lower_path, ".gvm.prs")) {
-        compressed_gvm_data = load_file(path);
-      } else if (ends_with(lower_path, ".gvm")) {
-        decompressed_gvm_data = load_file(path);
-      } else if (ends_with(lower_path, ".bmp")) {
-        Image img(path);
-        decompressed_gvm_data = encode_gvm(
-            img,
-            img.get_has_alpha() ? GVRDataFormat::RGB5A3 : GVRDataFormat::RGB565,
-            string_printf("bnr%zu", banner_index),
-            0x80 | banner_index);
-        banner_index++;
-      } else {
-        throw runtime_error(string_printf("banner %s is in an unknown format", path.c_str()));
-      }
-
-      size_t decompressed_size = decompressed_gvm_data.empty()
-          ? prs_decompress_size(compressed_gvm_data)
-          : decompressed_gvm_data.size();
-      if (decompressed_size > 0x37000) {
-        throw runtime_error(string_printf("banner %s is too large (0x%zX bytes; maximum size is 0x37000 bytes)", path.c_str(), decompressed_size));
-      }
-
-      if (compressed_gvm_data.empty()) {
-        compressed_gvm_data = prs_compress_optimal(decompressed_gvm_data);
-      }
-      if (compressed_gvm_data.size() > 0x3800) {
-        throw runtime_error(string_printf("banner %s cannot be compressed small enough (0x%zX bytes; maximum size is 0x3800 bytes compressed)", it->at(2).as_string().c_str(), compressed_gvm_data.size()));
-      }
-      config_log.info("Loaded Episode 3 lobby banner %s (0x%zX -> 0x%zX bytes)", path.c_str(), decompressed_size, compressed_gvm_data.size());
-      this->ep3_lobby_banners.emplace_back(
-          Ep3LobbyBannerEntry{.type = static_cast<uint32_t>(it->at(0).as_int()),
-              .which = static_cast<uint32_t>(it->at(1).as_int()),
-              .data = std::move(compressed_gvm_data)});
-    }
-  }
-
   {
     auto parse_ep3_ex_result_cmd = [&](const JSON& src) -> shared_ptr<G_SetEXResultValues_Ep3_6xB4x4B> {
       auto ret = make_shared<G_SetEXResultValues_Ep3_6xB4x4B>();
@@ -1125,6 +1175,7 @@ void ServerState::load_config_early() {
     this->team_reward_defs_json = std::move(this->config_json->at("TeamRewards"));
   } catch (const out_of_range&) {
   }
+  this->team_save_interval_usecs = this->config_json->get_int("TeamSaveInterval", 10000000);
 
   for (size_t z = 0; z < 4; z++) {
     shared_ptr<const Map::RareEnemyRates> prev = Map::DEFAULT_RARE_ENEMIES;
@@ -1332,6 +1383,62 @@ void ServerState::load_config_late() {
   }
 }
 
+void ServerState::load_ep3_lobby_banners(bool from_non_event_thread) {
+  config_log.info("Loading Episode 3 lobby banners");
+  auto config_json = this->config_json;
+  auto new_banners = make_shared<vector<Ep3LobbyBannerEntry>>();
+  if (!this->is_replay) {
+    size_t banner_index = 0;
+    for (const auto& it : config_json->get("Episode3LobbyBanners", JSON::list()).as_list()) {
+      this->reload_queue->check_cancelled();
+      string path = "system/ep3/banners/" + it->at(2).as_string();
+
+      string compressed_gvm_data;
+      string decompressed_gvm_data;
+      string lower_path = tolower(path);
+      if (ends_with(lower_path, ".gvm.prs")) {
+        compressed_gvm_data = load_file(path);
+      } else if (ends_with(lower_path, ".gvm")) {
+        decompressed_gvm_data = load_file(path);
+      } else if (ends_with(lower_path, ".bmp")) {
+        Image img(path);
+        decompressed_gvm_data = encode_gvm(
+            img,
+            img.get_has_alpha() ? GVRDataFormat::RGB5A3 : GVRDataFormat::RGB565,
+            string_printf("bnr%zu", banner_index),
+            0x80 | banner_index);
+        banner_index++;
+      } else {
+        throw runtime_error(string_printf("banner %s is in an unknown format", path.c_str()));
+      }
+
+      size_t decompressed_size = decompressed_gvm_data.empty()
+          ? prs_decompress_size(compressed_gvm_data)
+          : decompressed_gvm_data.size();
+      if (decompressed_size > 0x37000) {
+        throw runtime_error(string_printf("banner %s is too large (0x%zX bytes; maximum size is 0x37000 bytes)", path.c_str(), decompressed_size));
+      }
+
+      if (compressed_gvm_data.empty()) {
+        compressed_gvm_data = prs_compress_optimal(decompressed_gvm_data);
+      }
+      if (compressed_gvm_data.size() > 0x3800) {
+        throw runtime_error(string_printf("banner %s cannot be compressed small enough (0x%zX bytes; maximum size is 0x3800 bytes compressed)", it->at(2).as_string().c_str(), compressed_gvm_data.size()));
+      }
+      config_log.info("Loaded Episode 3 lobby banner %s (0x%zX -> 0x%zX bytes)", path.c_str(), decompressed_size, compressed_gvm_data.size());
+      new_banners->emplace_back(
+          Ep3LobbyBannerEntry{.type = static_cast<uint32_t>(it->at(0).as_int()),
+              .which = static_cast<uint32_t>(it->at(1).as_int()),
+              .data = std::move(compressed_gvm_data)});
+    }
+  }
+
+  auto set = [s = this->shared_from_this(), new_banners = std::move(new_banners)]() {
+    s->ep3_lobby_banners = std::move(new_banners);
+  };
+  this->forward_or_call(from_non_event_thread, std::move(set));
+}
+
 void ServerState::load_bb_private_keys(bool from_non_event_thread) {
   std::vector<std::shared_ptr<const PSOBBEncryption::KeyFile>> new_keys;
   for (const string& filename : list_directory("system/blueburst/keys")) {
@@ -1352,9 +1459,22 @@ void ServerState::load_bb_private_keys(bool from_non_event_thread) {
 
 void ServerState::load_accounts(bool from_non_event_thread) {
   config_log.info("Indexing accounts");
-  shared_ptr<AccountIndex> new_index = make_shared<AccountIndex>(this->is_replay);
+  // Recent saves may not have been written yet
+  this->file_writer->flush();
+  // The account log holds all accounts in memory, so it's only opened again
+  // (which reads the entire file) if the filename has changed
+  shared_ptr<AccountLog> new_log;
+  if (!this->is_replay && !this->account_log_filename.empty()) {
+    if (this->account_log && (this->account_log->get_filename() == this->account_log_filename)) {
+      new_log = this->account_log;
+    } else {
+      new_log = make_shared<AccountLog>(this->account_log_filename);
+    }
+  }
+  shared_ptr<AccountIndex> new_index = make_shared<AccountIndex>(this->is_replay, this->file_writer, new_log);
 
-  auto set = [s = this->shared_from_this(), new_index = std::move(new_index)]() {
+  auto set = [s = this->shared_from_this(), new_index = std::move(new_index), new_log = std::move(new_log)]() {
+    s->account_log = std::move(new_log);
     s->account_index = std::move(new_index);
     s->update_dependent_server_configs();
   };
@@ -1363,7 +1483,20 @@ void ServerState::load_accounts(bool from_non_event_thread) {
 
 void ServerState::load_teams(bool from_non_event_thread) {
   config_log.info("Indexing teams");
-  shared_ptr<TeamIndex> new_index = make_shared<TeamIndex>("system/teams", this->team_reward_defs_json);
+  // Changes to the existing teams may not have been saved yet
+  this->forward_or_call(from_non_event_thread, [s = this->shared_from_this()]() -> void {
+    if (s->team_index) {
+      s->team_index->flush();
+    }
+  });
+  this->file_writer->flush();
+  // Replays must not depend on timers, so team changes are saved immediately
+  shared_ptr<TeamIndex> new_index = make_shared<TeamIndex>(
+      "system/teams",
+      this->team_reward_defs_json,
+      this->file_writer,
+      this->base,
+      this->is_replay ? 0 : this->team_save_interval_usecs);
 
   auto set = [s = this->shared_from_this(), new_index = std::move(new_index)]() {
     s->team_index = std::move(new_index);
@@ -1378,13 +1511,14 @@ void ServerState::load_patch_indexes(bool from_non_event_thread) {
 
   if (isdir("system/patch-pc")) {
     config_log.info("Indexing PSO PC patch files");
-    pc_patch_file_index = make_shared<PatchFileIndex>("system/patch-pc");
+    pc_patch_file_index = make_shared<PatchFileIndex>("system/patch-pc", this->patch_file_cache_size);
   } else {
     config_log.info("PSO PC patch files not present");
   }
+  this->reload_queue->check_cancelled();
   if (isdir("system/patch-bb")) {
     config_log.info("Indexing PSO BB patch files");
-    bb_patch_file_index = make_shared<PatchFileIndex>("system/patch-bb");
+    bb_patch_file_index = make_shared<PatchFileIndex>("system/patch-bb", this->patch_file_cache_size);
     try {
       auto gsl_file = bb_patch_file_index->get("./data/data.gsl");
       bb_data_gsl = make_shared<GSLArchive>(gsl_file->load_data(), false);
@@ -1411,8 +1545,9 @@ void ServerState::load_patch_indexes(bool from_non_event_thread) {
 void ServerState::clear_map_file_caches() {
   config_log.info("Clearing map file caches");
   for (auto& cache : this->map_file_caches) {
-    cache = make_shared<ThreadSafeFileCache>();
+    cache = make_shared<ThreadSafeFileCache>(this->map_file_cache_size);
   }
+  this->map_template_cache = make_shared<MapTemplateCache>();
 }
 
 void ServerState::load_set_data_tables(bool from_non_event_thread) {
@@ -1424,6 +1559,7 @@ void ServerState::load_set_data_tables(bool from_non_event_thread) {
   std::shared_ptr<const SetDataTableBase> new_table_bb_solo_ep1_ult;
 
   auto load_table = [&](Version version) -> void {
+    this->reload_queue->check_cancelled();
     auto data = this->load_map_file(version, "SetDataTableOn.rel");
     new_tables[static_cast<size_t>(version)] = make_shared<SetDataTable>(version, *data);
     if (!is_v1(version) && (version != Version::PC_NTE)) {
@@ -1564,6 +1700,7 @@ void ServerState::load_word_select_table(bool from_non_event_thread) {
   config_log.info("(Word select) Loading BB_V4 data");
   WordSelectSet bb_v4_ws(load_file("system/text-sets/bb-v4/ws_data.bin"), Version::BB_V4, bb_unitxt_collection, false);
 
+  this->reload_queue->check_cancelled();
   config_log.info("(Word select) Generating table");
   auto new_table = make_shared<WordSelectTable>(
       dc_nte_ws, dc_112000_ws, dc_v1_ws, dc_v2_ws,
@@ -1612,6 +1749,7 @@ void ServerState::load_item_name_indexes(bool from_non_event_thread) {
 
   for (size_t v_s = NUM_PATCH_VERSIONS; v_s < NUM_VERSIONS; v_s++) {
     Version v = static_cast<Version>(v_s);
+    this->reload_queue->check_cancelled();
     config_log.info("Generating item name index for %s", name_for_enum(v));
     new_indexes[v_s] = this->create_item_name_index_for_version(
         this->item_parameter_table(v), this->item_stack_limits(v), this->text_index);
@@ -1633,6 +1771,7 @@ void ServerState::load_drop_tables(bool from_non_event_thread) {
     if (!starts_with(filename, "rare-table-")) {
       continue;
     }
+    this->reload_queue->check_cancelled();
 
     string path = "system/item-tables/" + filename;
     size_t ext_offset = filename.rfind('.');
@@ -1672,6 +1811,7 @@ void ServerState::load_drop_tables(bool from_non_event_thread) {
     }
   }
 
+  this->reload_queue->check_cancelled();
   config_log.info("Loading v2 common item table");
   auto ct_data_v2 = make_shared<string>(load_file("system/item-tables/ItemCT-pc-v2.afs"));
   auto pt_data_v2 = make_shared<string>(load_file("system/item-tables/ItemPT-pc-v2.afs"));
@@ -1738,6 +1878,7 @@ void ServerState::load_item_definitions(bool from_non_event_thread) {
   std::array<std::shared_ptr<const ItemParameterTable>, NUM_VERSIONS> new_item_parameter_tables;
   for (size_t v_s = NUM_PATCH_VERSIONS; v_s < NUM_VERSIONS; v_s++) {
     Version v = static_cast<Version>(v_s);
+    this->reload_queue->check_cancelled();
     string path = string_printf("system/item-tables/ItemPMT-%s.prs", file_path_token_for_version(v));
     config_log.info("Loading item definition table %s", path.c_str());
     auto data = make_shared<string>(prs_decompress(load_file(path)));
@@ -1767,6 +1908,7 @@ void ServerState::load_ep3_cards(bool from_non_event_thread) {
       "system/ep3/card-text.mnrd",
       "system/ep3/card-dice-text.mnr",
       "system/ep3/card-dice-text.mnrd");
+  this->reload_queue->check_cancelled();
   config_log.info("Loading Episode 3 trial card definitions");
   auto new_ep3_card_index_trial = make_shared<Episode3::CardIndex>(
       "system/ep3/card-definitions-trial.mnr",
@@ -1802,8 +1944,9 @@ void ServerState::load_ep3_maps(bool from_non_event_thread) {
 void ServerState::load_ep3_tournament_state(bool from_non_event_thread) {
   config_log.info("Loading Episode 3 tournament state");
   const string& tournament_state_filename = "system/ep3/tournament-state.json";
+  this->file_writer->flush(tournament_state_filename);
   auto new_ep3_tournament_index = make_shared<Episode3::TournamentIndex>(
-      this->ep3_map_index, this->ep3_com_deck_index, tournament_state_filename);
+      this->ep3_map_index, this->ep3_com_deck_index, tournament_state_filename, false, this->file_writer);
 
   auto set = [s = this->shared_from_this(),
                  new_ep3_tournament_index = std::move(new_ep3_tournament_index)]() {
@@ -1813,11 +1956,40 @@ void ServerState::load_ep3_tournament_state(bool from_non_event_thread) {
   this->forward_or_call(from_non_event_thread, std::move(set));
 }
 
-void ServerState::load_quest_index(bool from_non_event_thread) {
+static void log_quest_index_changes(
+    const char* index_name, shared_ptr<const QuestIndex> new_index, shared_ptr<const QuestIndex> prev_index) {
+  auto changes = new_index->changes_since(prev_index);
+  config_log.info("Updated %s: %zu added, %zu modified, %zu removed (reused %zu files and %zu quest versions)",
+      index_name, changes.added.size(), changes.modified.size(), changes.removed.size(),
+      new_index->num_reused_files, new_index->num_reused_versions);
+  for (const auto& basename : changes.added) {
+    config_log.info("(%s) Quest version added", basename.c_str());
+  }
+  for (const auto& basename : changes.modified) {
+    config_log.info("(%s) Quest version modified", basename.c_str());
+  }
+  for (const auto& basename : changes.removed) {
+    config_log.info("(%s) Quest version removed", basename.c_str());
+  }
+}
+
+void ServerState::load_quest_index(
+    bool from_non_event_thread, bool incremental, const unordered_set<string>* changed_paths) {
+  shared_ptr<const QuestIndex> prev_default_quest_index = incremental ? this->default_quest_index : nullptr;
+  shared_ptr<const QuestIndex> prev_ep3_download_quest_index = incremental ? this->ep3_download_quest_index : nullptr;
+
   config_log.info("Collecting quests");
-  auto new_default_quest_index = make_shared<QuestIndex>("system/quests", this->quest_category_index, false);
+  auto new_default_quest_index = make_shared<QuestIndex>(
+      "system/quests", this->quest_category_index, false, prev_default_quest_index, changed_paths);
+  this->reload_queue->check_cancelled();
   config_log.info("Collecting Episode 3 download quests");
-  auto new_ep3_download_quest_index = make_shared<QuestIndex>("system/ep3/maps-download", this->quest_category_index, true);
+  auto new_ep3_download_quest_index = make_shared<QuestIndex>(
+      "system/ep3/maps-download", this->quest_category_index, true, prev_ep3_download_quest_index, changed_paths);
+
+  if (incremental) {
+    log_quest_index_changes("quest index", new_default_quest_index, prev_default_quest_index);
+    log_quest_index_changes("Episode 3 download quest index", new_ep3_download_quest_index, prev_ep3_download_quest_index);
+  }
 
   auto set = [s = this->shared_from_this(),
                  new_default_quest_index = std::move(new_default_quest_index),
@@ -1893,16 +2065,21 @@ void ServerState::create_default_lobbies() {
   }
 }
 
-void ServerState::load_all() {
+void ServerState::load_persistent_state() {
+  this->load_accounts(false);
+  this->load_ep3_tournament_state(false);
+  this->load_teams(false);
+}
+
+void ServerState::load_all(bool load_persistent_state) {
   this->collect_network_addresses();
   this->load_config_early();
+  this->load_ep3_lobby_banners(false);
   this->load_bb_private_keys(false);
-  this->load_accounts(false);
   this->clear_map_file_caches();
   this->load_patch_indexes(false);
   this->load_ep3_cards(false);
   this->load_ep3_maps(false);
-  this->load_ep3_tournament_state(false);
   this->compile_functions(false);
   this->load_dol_files(false);
   this->create_default_lobbies();
@@ -1915,8 +2092,132 @@ void ServerState::load_all() {
   this->load_item_name_indexes(false);
   this->load_drop_tables(false);
   this->load_config_late();
-  this->load_teams(false);
   this->load_quest_index(false);
+  if (load_persistent_state) {
+    this->load_persistent_state();
+  }
+}
+
+void ServerState::start_file_watcher() {
+  if (!this->watch_for_file_changes || this->file_watcher) {
+    return;
+  }
+  if (!FileWatcher::is_available()) {
+    config_log.warning("WatchForFileChanges is enabled, but file watching is not supported on this platform");
+    return;
+  }
+  config_log.info("Watching quest, map, and Episode 3 directories for changes");
+  // The watcher is owned by this object, so its callback must not keep this
+  // object alive
+  this->file_watcher = make_shared<FileWatcher>(this->base, [wself = this->weak_from_this()](unordered_set<string>&& paths) -> void {
+    auto s = wself.lock();
+    if (s) {
+      s->on_files_changed(std::move(paths));
+    }
+  });
+  this->file_watcher->add_directory("system/quests");
+  this->file_watcher->add_directory("system/maps");
+  this->file_watcher->add_directory("system/ep3");
+}
+
+void ServerState::on_files_changed(unordered_set<string>&& changed_paths) {
+  this->pending_changed_paths.merge(changed_paths);
+  if (this->file_change_reload_in_progress || this->pending_changed_paths.empty()) {
+    return;
+  }
+
+  // Only one of these reloads is queued at a time; changes that occur while
+  // it's queued or running are collected in pending_changed_paths and handled
+  // when it's done
+  this->file_change_reload_in_progress = true;
+  auto paths = make_shared<unordered_set<string>>();
+  paths->swap(this->pending_changed_paths);
+  this->reload_queue->enqueue(ReloadQueue::Task{
+      .name = string_printf("changed files (%zu paths)", paths->size()),
+      .run = [s = this->shared_from_this(), paths]() -> void {
+        s->reload_changed_files(std::move(*paths));
+      },
+      .on_complete = [s = this->shared_from_this()](bool) -> void {
+        s->forward_to_event_thread([s]() -> void {
+          s->file_change_reload_in_progress = false;
+          s->on_files_changed(unordered_set<string>());
+        });
+      },
+  });
+}
+
+static bool path_is_within(const string& path, const string& dir) {
+  return (path == dir) || starts_with(path, dir + "/");
+}
+
+void ServerState::reload_changed_files(unordered_set<string>&& changed_paths) {
+  bool quests_changed = false;
+  bool ep3_maps_changed = false;
+  bool ep3_cards_changed = false;
+  bool set_data_tables_changed = false;
+  bool all_map_files_changed = false;
+  vector<pair<Version, string>> changed_map_files;
+
+  for (const auto& path : changed_paths) {
+    if (path_is_within(path, "system/quests") || path_is_within(path, "system/ep3/maps-download")) {
+      quests_changed = true;
+
+    } else if (path_is_within(path, "system/ep3/maps")) {
+      ep3_maps_changed = true;
+
+    } else if (starts_with(path, "system/ep3/card-") || (path == "system/ep3/com-decks.json")) {
+      ep3_cards_changed = true;
+
+    } else if (path_is_within(path, "system/maps")) {
+      // Paths within this directory are like system/maps/VERSION/FILENAME;
+      // anything else (e.g. a version directory being replaced entirely)
+      // invalidates all cached map files
+      auto tokens = split(path, '/');
+      if (tokens.size() != 4) {
+        all_map_files_changed = true;
+        continue;
+      }
+      for (size_t v_s = NUM_PATCH_VERSIONS; v_s < NUM_VERSIONS; v_s++) {
+        Version v = static_cast<Version>(v_s);
+        if (tokens[2] == file_path_token_for_version(v)) {
+          changed_map_files.emplace_back(v, tokens[3]);
+        }
+      }
+      if (starts_with(tokens[3], "SetDataTable")) {
+        set_data_tables_changed = true;
+      }
+    }
+  }
+
+  if (all_map_files_changed) {
+    this->call_on_event_thread<void>([s = this->shared_from_this()]() -> void {
+      s->clear_map_file_caches();
+    });
+    set_data_tables_changed = true;
+  } else if (!changed_map_files.empty()) {
+    for (const auto& it : changed_map_files) {
+      if (this->map_file_caches.at(static_cast<size_t>(it.first))->erase(it.second)) {
+        config_log.info("Evicted %s map file %s from cache", name_for_enum(it.first), it.second.c_str());
+      }
+    }
+    // Templates don't record which files they were built from, so they all
+    // have to be rebuilt. This must be done after the changed files are
+    // evicted, so a template can't be rebuilt from a stale file after it's
+    // cleared.
+    this->map_template_cache->clear();
+  }
+  if (set_data_tables_changed) {
+    this->load_set_data_tables(true);
+  }
+  if (ep3_cards_changed) {
+    this->load_ep3_cards(true);
+  }
+  if (ep3_maps_changed) {
+    this->load_ep3_maps(true);
+  }
+  if (quests_changed) {
+    this->load_quest_index(true, true, &changed_paths);
+  }
 }
 
 shared_ptr<PatchServer::Config> ServerState::generate_patch_server_config(bool is_bb) const {
@@ -1999,6 +2300,64 @@ void ServerState::disconnect_all_banned_clients() {
   }
 }
 
+void ServerState::prepare_for_handoff() {
+  // Non-persistent games are deleted when their last player leaves, so the
+  // checkpoint has to be written before anyone is disconnected. Nothing else
+  // runs on the event thread until the handoff is done, so the games can't
+  // change after this.
+  if (this->game_checkpoint_manager && this->game_checkpoint_interval_usecs) {
+    this->game_checkpoint_manager->checkpoint(true);
+  }
+
+  if (this->game_server) {
+    auto clients = this->game_server->all_clients();
+    config_log.info("Disconnecting %zu client(s) for handoff", clients.size());
+    for (const auto& c : clients) {
+      this->game_server->disconnect_client(c);
+    }
+    // Clients normally save their data when they're destroyed, but that
+    // happens after the new process has already started loading it
+    for (const auto& c : clients) {
+      if (c->version() == Version::BB_V4) {
+        try {
+          c->save_game_data();
+        } catch (const exception& e) {
+          c->log.warning("Failed to save game data before handoff: %s", e.what());
+        }
+      }
+    }
+  }
+
+  if (this->proxy_server) {
+    vector<uint64_t> session_ids;
+    for (const auto& it : this->proxy_server->all_sessions()) {
+      session_ids.emplace_back(it.first);
+    }
+    config_log.info("Closing %zu proxy session(s) for handoff", session_ids.size());
+    for (uint64_t session_id : session_ids) {
+      this->proxy_server->delete_session(session_id);
+    }
+  }
+
+  if (this->team_index) {
+    this->team_index->flush();
+  }
+  this->file_writer->flush();
+}
+
+void ServerState::finish_handoff() {
+  this->handoff_complete = true;
+  this->game_checkpoint_manager.reset();
+  // No clients are connected, so nothing should be written after this point,
+  // but if anything is (e.g. by a Client destructor saving data that was
+  // already saved in prepare_for_handoff), it must not overwrite the new
+  // process' files
+  this->file_writer->disable_writes();
+  if (this->account_log) {
+    this->account_log->close();
+  }
+}
+
 string ServerState::format_address_for_channel_name(
     const struct sockaddr_storage& remote_ss, uint64_t virtual_network_id) {
   if (!virtual_network_id) {
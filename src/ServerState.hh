@@ -15,10 +15,13 @@
 #include "Client.hh"
 #include "CommonItemSet.hh"
 #include "DNSServer.hh"
+#include "DurableFileWriter.hh"
 #include "Episode3/DataIndexes.hh"
 #include "Episode3/Tournament.hh"
 #include "EventUtils.hh"
+#include "FileWatcher.hh"
 #include "FunctionCompiler.hh"
+#include "GameCheckpointManager.hh"
 #include "GSLArchive.hh"
 #include "IPV4RangeSet.hh"
 #include "ItemNameIndex.hh"
@@ -29,8 +32,10 @@
 #include "PatchServer.hh"
 #include "PlayerFilesManager.hh"
 #include "Quest.hh"
+#include "ReloadQueue.hh"
 #include "TeamIndex.hh"
 #include "WordSelectTable.hh"
+#include "WorkerPool.hh"
 
 // Forward declarations due to reference cycles
 class ProxyServer;
@@ -87,10 +92,16 @@ struct ServerState : public std::enable_shared_from_this<ServerState> {
   uint64_t client_ping_interval_usecs = 30000000;
   uint64_t client_idle_timeout_usecs = 60000000;
   uint64_t patch_client_idle_timeout_usecs = 300000000;
+  size_t patch_file_cache_size = 0x4000000;
+  size_t map_file_cache_size = 0x2000000;
+  size_t player_file_cache_size = 0x4000000;
+  bool character_file_delta_saves = false;
+  size_t map_generation_threads = 2;
   bool ip_stack_debug = false;
   bool allow_unregistered_users = false;
   bool allow_pc_nte = false;
   bool use_temp_accounts_for_prototypes = true;
+  std::string account_log_filename; // If empty, accounts are stored in system/licenses
   bool allow_dc_pc_games = true;
   bool allow_gc_xb_games = true;
   bool enable_chat_commands = true;
@@ -119,6 +130,10 @@ struct ServerState : public std::enable_shared_from_this<ServerState> {
   std::unordered_map<uint16_t, IntegralExpression> quest_flag_rewrites_v4;
   std::unordered_map<std::string, std::pair<uint8_t, uint32_t>> quest_counter_fields; // For $qfread command
   uint64_t persistent_game_idle_timeout_usecs = 0;
+  uint64_t game_checkpoint_interval_usecs = 0;
+  uint64_t game_checkpoint_restore_timeout_usecs = 600000000;
+  std::string handoff_socket_path; // Only read at startup
+  bool handoff_complete = false; // True if listening sockets were handed off to another process
   bool ep3_send_function_call_enabled = false;
   bool enable_v3_v4_protected_subcommands = false;
   bool catch_handler_exceptions = true;
@@ -147,6 +162,7 @@ struct ServerState : public std::enable_shared_from_this<ServerState> {
   std::shared_ptr<const PatchFileIndex> pc_patch_file_index;
   std::shared_ptr<const PatchFileIndex> bb_patch_file_index;
   std::array<std::shared_ptr<ThreadSafeFileCache>, NUM_VERSIONS> map_file_caches;
+  std::shared_ptr<MapTemplateCache> map_template_cache;
   std::shared_ptr<const DOLFileIndex> dol_file_index;
   std::shared_ptr<const Episode3::CardIndex> ep3_card_index;
   std::shared_ptr<const Episode3::CardIndex> ep3_card_index_trial;
@@ -221,12 +237,14 @@ struct ServerState : public std::enable_shared_from_this<ServerState> {
     uint32_t which; // See B9 documentation in CommandFormats.hh
     std::string data;
   };
-  std::vector<Ep3LobbyBannerEntry> ep3_lobby_banners;
+  std::shared_ptr<const std::vector<Ep3LobbyBannerEntry>> ep3_lobby_banners;
 
   std::shared_ptr<AccountIndex> account_index;
+  std::shared_ptr<AccountLog> account_log;
   std::shared_ptr<IPV4RangeSet> banned_ipv4_ranges;
   std::shared_ptr<TeamIndex> team_index;
   JSON team_reward_defs_json;
+  uint64_t team_save_interval_usecs = 10000000;
 
   std::shared_ptr<const Menu> information_menu_v2;
   std::shared_ptr<const Menu> information_menu_v3;
@@ -246,7 +264,9 @@ struct ServerState : public std::enable_shared_from_this<ServerState> {
   std::string pc_patch_server_message;
   std::string bb_patch_server_message;
 
+  std::shared_ptr<DurableFileWriter> file_writer;
   std::shared_ptr<PlayerFilesManager> player_files_manager;
+  std::shared_ptr<GameCheckpointManager> game_checkpoint_manager; // Null during replays
   std::unordered_map<Channel*, std::shared_ptr<Client>> channel_to_client;
   std::map<int64_t, std::shared_ptr<Lobby>> id_to_lobby;
   std::unordered_set<std::shared_ptr<Lobby>> lobbies_to_destroy;
@@ -271,12 +291,22 @@ struct ServerState : public std::enable_shared_from_this<ServerState> {
   std::shared_ptr<PatchServer> pc_patch_server;
   std::shared_ptr<PatchServer> bb_patch_server;
 
+  std::shared_ptr<ReloadQueue> reload_queue;
+  // Null if maps for new games should be generated on the event thread
+  std::shared_ptr<WorkerPool> map_generation_workers;
+
+  bool watch_for_file_changes = false;
+  std::shared_ptr<FileWatcher> file_watcher;
+  bool file_change_reload_in_progress = false;
+  std::unordered_set<std::string> pending_changed_paths;
+
   explicit ServerState(const std::string& config_filename = "");
   ServerState(std::shared_ptr<struct event_base> base, const std::string& config_filename, bool is_replay);
   ServerState(const ServerState&) = delete;
   ServerState(ServerState&&) = delete;
   ServerState& operator=(const ServerState&) = delete;
   ServerState& operator=(ServerState&&) = delete;
+  ~ServerState();
 
   void add_client_to_available_lobby(std::shared_ptr<Client> c);
   void remove_client_from_lobby(std::shared_ptr<Client> c);
@@ -313,6 +343,8 @@ struct ServerState : public std::enable_shared_from_this<ServerState> {
   std::shared_ptr<const ItemParameterTable> item_parameter_table(Version version) const;
   std::shared_ptr<const ItemParameterTable> item_parameter_table_for_encode(Version version) const;
   std::shared_ptr<const ItemData::StackLimits> item_stack_limits(Version version) const;
+  std::shared_ptr<const CommonItemSet> common_item_set(Version version) const;
+  std::shared_ptr<const RareItemSet> rare_item_set(Version version) const;
   std::shared_ptr<const ItemNameIndex> item_name_index_opt(Version version) const; // Returns null if missing
   std::shared_ptr<const ItemNameIndex> item_name_index(Version version) const; // Throws if missing
   std::string describe_item(Version version, const ItemData& item, bool include_color_codes) const;
@@ -357,9 +389,15 @@ struct ServerState : public std::enable_shared_from_this<ServerState> {
   inline void forward_to_event_thread(std::function<void()>&& fn) {
     ::forward_to_event_thread(this->base, std::move(fn));
   }
+  // Loaders call this to publish their results. When called from a non-event
+  // thread, this waits until fn has run on the event thread, so a reload task
+  // that runs after this one always sees the newly-published objects. If the
+  // current reload was cancelled, this throws ReloadQueue::cancelled instead
+  // of publishing anything.
   inline void forward_or_call(bool from_non_event_thread, std::function<void()>&& fn) {
     if (from_non_event_thread) {
-      ::forward_to_event_thread(this->base, std::move(fn));
+      this->reload_queue->check_cancelled();
+      ::call_on_event_thread<void>(this->base, std::move(fn));
     } else {
       fn();
     }
@@ -375,6 +413,7 @@ struct ServerState : public std::enable_shared_from_this<ServerState> {
   void collect_network_addresses();
   void load_config_early();
   void load_config_late();
+  void load_ep3_lobby_banners(bool from_non_event_thread);
   void load_bb_private_keys(bool from_non_event_thread);
   void load_accounts(bool from_non_event_thread);
   void load_teams(bool from_non_event_thread);
@@ -395,15 +434,41 @@ struct ServerState : public std::enable_shared_from_this<ServerState> {
   void load_ep3_cards(bool from_non_event_thread);
   void load_ep3_maps(bool from_non_event_thread);
   void load_ep3_tournament_state(bool from_non_event_thread);
-  void load_quest_index(bool from_non_event_thread);
+  void load_quest_index(
+      bool from_non_event_thread,
+      bool incremental = false,
+      const std::unordered_set<std::string>* changed_paths = nullptr);
   void compile_functions(bool from_non_event_thread);
   void load_dol_files(bool from_non_event_thread);
-  void load_all();
+  // Loads the data that the server itself can change (accounts, teams, and
+  // Episode 3 tournament state). load_all calls this if load_persistent_state
+  // is true; otherwise, it must be called separately.
+  void load_persistent_state();
+  void load_all(bool load_persistent_state = true);
+
+  // Starts watching the quest, map, and Episode 3 directories for changes if
+  // enabled in the config. When files change, only the affected data is
+  // reloaded; this happens on the reload thread and the results are published
+  // on the event thread.
+  void start_file_watcher();
+  void on_files_changed(std::unordered_set<std::string>&& changed_paths);
+  void reload_changed_files(std::unordered_set<std::string>&& changed_paths);
 
   void enqueue_destroy_lobbies();
   static void dispatch_destroy_lobbies(evutil_socket_t, short, void* ctx);
 
   void disconnect_all_banned_clients();
 
+  // Called when another process requests this process' listening sockets (see
+  // SocketHandoff.hh), before they are sent. Writes a game checkpoint,
+  // disconnects all clients and proxy sessions, and waits until all of their
+  // data has been written, so the new process loads the latest data. Throws
+  // (which cancels the handoff) if any of it can't be written.
+  void prepare_for_handoff();
+  // Called after the new process has acknowledged the handoff. After this,
+  // this process doesn't write any account, team, player, or checkpoint files,
+  // since the new process owns them.
+  void finish_handoff();
+
   std::string format_address_for_channel_name(const struct sockaddr_storage& remote_ss, uint64_t virtual_network);
 };
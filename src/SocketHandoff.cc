@@ -0,0 +1,357 @@
+#include "SocketHandoff.hh"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <phosg/Encoding.hh>
+#include <phosg/Network.hh>
+#include <phosg/Strings.hh>
+#include <phosg/Time.hh>
+#include <stdexcept>
+
+#include "Loggers.hh"
+
+using namespace std;
+
+// Sent by the new process to request a handoff ('NSHR')
+static constexpr uint32_t HANDOFF_REQUEST_SIGNATURE = 0x4E534852;
+// Sent by the new process after it has received all sockets
+static constexpr uint8_t HANDOFF_ACK = 0x01;
+// If either process stops responding for this long, the handoff fails
+static constexpr uint64_t HANDOFF_IO_TIMEOUT_USECS = 10000000; // 10 seconds
+
+static void set_handoff_io_timeout(int fd) {
+  struct timeval tv = usecs_to_timeval(HANDOFF_IO_TIMEOUT_USECS);
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+  setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+}
+
+static void send_all(int fd, const void* data, size_t size) {
+  const uint8_t* bytes = reinterpret_cast<const uint8_t*>(data);
+  while (size > 0) {
+    ssize_t bytes_sent = ::send(fd, bytes, size, 0);
+    if (bytes_sent < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      throw runtime_error("cannot send handoff data: " + string_for_error(errno));
+    }
+    bytes += bytes_sent;
+    size -= bytes_sent;
+  }
+}
+
+// Receives exactly size bytes. If received_fd is not null, a file descriptor
+// passed along with the data (if any) is written there; the caller is
+// responsible for closing it, even if this function throws.
+static void recv_all(int fd, void* data, size_t size, int* received_fd = nullptr) {
+  uint8_t* bytes = reinterpret_cast<uint8_t*>(data);
+  while (size > 0) {
+    struct iovec iov;
+    iov.iov_base = bytes;
+    iov.iov_len = size;
+
+    union {
+      struct cmsghdr hdr;
+      char data[CMSG_SPACE(sizeof(int))];
+    } control;
+    memset(&control, 0, sizeof(control));
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    if (received_fd) {
+      msg.msg_control = control.data;
+      msg.msg_controllen = sizeof(control.data);
+    }
+
+    ssize_t bytes_received = ::recvmsg(fd, &msg, 0);
+    if (bytes_received < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      throw runtime_error("cannot receive handoff data: " + string_for_error(errno));
+    }
+
+    if (received_fd) {
+      for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if ((cmsg->cmsg_level == SOL_SOCKET) && (cmsg->cmsg_type == SCM_RIGHTS) &&
+            (cmsg->cmsg_len >= CMSG_LEN(sizeof(int)))) {
+          int new_fd;
+          memcpy(&new_fd, CMSG_DATA(cmsg), sizeof(int));
+          if (*received_fd >= 0) {
+            ::close(new_fd);
+            throw runtime_error("multiple sockets in handoff record");
+          }
+          *received_fd = new_fd;
+        }
+      }
+      if (msg.msg_flags & MSG_CTRUNC) {
+        throw runtime_error("handoff control data was truncated");
+      }
+    }
+
+    if (bytes_received == 0) {
+      throw runtime_error("handoff connection closed unexpectedly");
+    }
+    bytes += bytes_received;
+    size -= bytes_received;
+  }
+}
+
+// Each socket is sent as a record containing the length of its name (as a
+// le_uint16_t) followed by the name, with the socket itself attached to the
+// first byte. A record with an empty name and no socket ends the handoff.
+static void send_socket_record(int fd, const string& name, int socket_fd) {
+  if (name.size() > 0xFFFF) {
+    throw runtime_error("socket name is too long");
+  }
+  le_uint16_t name_size = name.size();
+  string data(reinterpret_cast<const char*>(&name_size), sizeof(name_size));
+  data += name;
+
+  struct iovec iov;
+  iov.iov_base = data.data();
+  iov.iov_len = data.size();
+
+  union {
+    struct cmsghdr hdr;
+    char data[CMSG_SPACE(sizeof(int))];
+  } control;
+  memset(&control, 0, sizeof(control));
+
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  if (socket_fd >= 0) {
+    msg.msg_control = control.data;
+    msg.msg_controllen = sizeof(control.data);
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &socket_fd, sizeof(int));
+  }
+
+  ssize_t bytes_sent;
+  do {
+    bytes_sent = ::sendmsg(fd, &msg, 0);
+  } while ((bytes_sent < 0) && (errno == EINTR));
+  if (bytes_sent < 0) {
+    throw runtime_error("cannot send handoff data: " + string_for_error(errno));
+  }
+  // The socket is attached to the first byte, so if the record was only
+  // partially sent, the rest of it can be sent normally
+  if (static_cast<size_t>(bytes_sent) < data.size()) {
+    send_all(fd, data.data() + bytes_sent, data.size() - bytes_sent);
+  }
+}
+
+string ListeningSocketSet::socket_name(const string& addr, int port, bool is_udp) {
+  if (port == 0) {
+    return (is_udp ? "unix-dgram:" : "unix:") + addr;
+  } else {
+    return (is_udp ? "udp:" : "tcp:") + render_netloc(addr, port);
+  }
+}
+
+bool ListeningSocketSet::receive_handoff(const string& handoff_socket_path) {
+  struct sockaddr_un sa;
+  if (handoff_socket_path.size() >= sizeof(sa.sun_path)) {
+    throw runtime_error("handoff socket path is too long");
+  }
+  memset(&sa, 0, sizeof(sa));
+  sa.sun_family = AF_UNIX;
+  strcpy(sa.sun_path, handoff_socket_path.c_str());
+
+  int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0) {
+    throw runtime_error("cannot create handoff socket: " + string_for_error(errno));
+  }
+  if (::connect(fd, reinterpret_cast<const struct sockaddr*>(&sa), sizeof(sa)) != 0) {
+    int error = errno;
+    ::close(fd);
+    // If the socket file doesn't exist or nothing is listening on it, there is
+    // no running server, so this process should open its sockets normally
+    if ((error == ENOENT) || (error == ECONNREFUSED)) {
+      return false;
+    }
+    throw runtime_error("cannot connect to handoff socket: " + string_for_error(error));
+  }
+
+  server_log.info("Requesting listening sockets from running server via %s", handoff_socket_path.c_str());
+  try {
+    set_handoff_io_timeout(fd);
+    be_uint32_t request = HANDOFF_REQUEST_SIGNATURE;
+    send_all(fd, &request, sizeof(request));
+
+    for (;;) {
+      int socket_fd = -1;
+      try {
+        le_uint16_t name_size;
+        recv_all(fd, &name_size, sizeof(name_size), &socket_fd);
+        if (name_size == 0) {
+          if (socket_fd >= 0) {
+            throw runtime_error("handoff end record includes a socket");
+          }
+          break;
+        }
+        if (socket_fd < 0) {
+          throw runtime_error("handoff record does not include a socket");
+        }
+        string name(name_size, '\0');
+        recv_all(fd, name.data(), name.size());
+        if (!this->handoff_fds.emplace(name, socket_fd).second) {
+          throw runtime_error("duplicate socket in handoff: " + name);
+        }
+        server_log.info("Received listening socket %s (fd %d) from running server", name.c_str(), socket_fd);
+      } catch (const exception&) {
+        if (socket_fd >= 0) {
+          ::close(socket_fd);
+        }
+        throw;
+      }
+    }
+
+    uint8_t ack = HANDOFF_ACK;
+    send_all(fd, &ack, sizeof(ack));
+
+  } catch (const exception&) {
+    ::close(fd);
+    for (const auto& it : this->handoff_fds) {
+      ::close(it.second);
+    }
+    this->handoff_fds.clear();
+    throw;
+  }
+
+  ::close(fd);
+  server_log.info("Received %zu listening sockets from running server", this->handoff_fds.size());
+  return true;
+}
+
+void ListeningSocketSet::send_handoff(int fd) const {
+  for (const auto& it : this->fds) {
+    send_socket_record(fd, it.first, it.second);
+  }
+  send_socket_record(fd, "", -1);
+
+  uint8_t ack;
+  recv_all(fd, &ack, sizeof(ack));
+  if (ack != HANDOFF_ACK) {
+    throw runtime_error("new process did not acknowledge the handoff");
+  }
+}
+
+int ListeningSocketSet::open(const string& addr, int port, bool is_udp) {
+  string name = this->socket_name(addr, port, is_udp);
+  if (this->fds.count(name)) {
+    throw runtime_error("duplicate listening socket: " + name);
+  }
+
+  int fd;
+  auto handoff_it = this->handoff_fds.find(name);
+  if (handoff_it != this->handoff_fds.end()) {
+    fd = handoff_it->second;
+    this->handoff_fds.erase(handoff_it);
+    server_log.info("Using listening socket %s (fd %d) from previous process", name.c_str(), fd);
+  } else {
+    // phosg's listen() opens a datagram socket if the backlog is zero
+    fd = ::listen(addr, port, is_udp ? 0 : SOMAXCONN);
+    server_log.info("Opened listening socket %s on fd %d", name.c_str(), fd);
+  }
+  this->fds.emplace(name, fd);
+  return fd;
+}
+
+void ListeningSocketSet::close_unused_handoff_sockets() {
+  for (const auto& it : this->handoff_fds) {
+    server_log.info("Closing unused listening socket %s (fd %d) from previous process", it.first.c_str(), it.second);
+    ::close(it.second);
+  }
+  this->handoff_fds.clear();
+}
+
+SocketHandoffServer::SocketHandoffServer(
+    shared_ptr<struct event_base> base,
+    const string& socket_path,
+    shared_ptr<const ListeningSocketSet> sockets,
+    function<void()> on_request,
+    function<void()> on_complete)
+    : socket_path(socket_path),
+      sockets(sockets),
+      on_request(on_request),
+      on_complete(on_complete),
+      listen_fd(-1),
+      accept_event(nullptr, event_free) {
+  // If the previous process handed off its sockets, it closed its handoff
+  // socket but left the file in place (and if it crashed, the file may also
+  // still exist), so delete it before listening on the same path
+  ::unlink(this->socket_path.c_str());
+  this->listen_fd = ::listen(this->socket_path, 0, SOMAXCONN);
+  // Anyone who can connect to this socket can take over the server's
+  // listening sockets, so only the server's user should be able to use it
+  ::chmod(this->socket_path.c_str(), 0600);
+
+  this->accept_event.reset(event_new(
+      base.get(), this->listen_fd, EV_READ | EV_PERSIST,
+      &SocketHandoffServer::dispatch_on_accept, this));
+  event_add(this->accept_event.get(), nullptr);
+  server_log.info("Listening for handoff requests on %s", this->socket_path.c_str());
+}
+
+SocketHandoffServer::~SocketHandoffServer() {
+  if (this->listen_fd >= 0) {
+    this->accept_event.reset();
+    ::close(this->listen_fd);
+    ::unlink(this->socket_path.c_str());
+  }
+}
+
+void SocketHandoffServer::dispatch_on_accept(evutil_socket_t, short, void* ctx) {
+  reinterpret_cast<SocketHandoffServer*>(ctx)->on_accept();
+}
+
+void SocketHandoffServer::on_accept() {
+  int fd = ::accept(this->listen_fd, nullptr, nullptr);
+  if (fd < 0) {
+    server_log.warning("Cannot accept handoff connection: %s", string_for_error(errno).c_str());
+    return;
+  }
+
+  try {
+    set_handoff_io_timeout(fd);
+    be_uint32_t request;
+    recv_all(fd, &request, sizeof(request));
+    if (request != HANDOFF_REQUEST_SIGNATURE) {
+      throw runtime_error("incorrect handoff request signature");
+    }
+    server_log.info("Received handoff request; preparing to hand off listening sockets");
+    if (this->on_request) {
+      this->on_request();
+    }
+    this->sockets->send_handoff(fd);
+  } catch (const exception& e) {
+    ::close(fd);
+    server_log.error("Handoff failed (continuing normally): %s", e.what());
+    return;
+  }
+  ::close(fd);
+
+  // Only one handoff can happen; the new process now owns the handoff socket
+  // path, so don't delete it
+  event_del(this->accept_event.get());
+  ::close(this->listen_fd);
+  this->listen_fd = -1;
+  server_log.info("Handoff complete");
+
+  if (this->on_complete) {
+    this->on_complete();
+  }
+}
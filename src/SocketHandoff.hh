@@ -0,0 +1,115 @@
+#pragma once
+
+#include <event2/event.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+// Support for upgrading the server without closing its listening sockets. A
+// running server can hand off all of its listening sockets to a newly-started
+// server process over a Unix socket (the handoff socket), so the new process
+// accepts connections on the same sockets instead of opening its own. This
+// way, no connections are refused while the server is restarting, and the
+// new process doesn't have to wait for the old one to release its ports.
+//
+// A handoff proceeds as follows:
+// 1. The running server listens on the handoff socket.
+// 2. The new process loads everything that the running server can't change
+//    (quests, maps, item tables, etc.), then connects to the handoff socket
+//    and sends a request.
+// 3. The running server prepares for the handoff: it writes a game
+//    checkpoint, disconnects all of its clients, and waits for all of their
+//    data to be saved. It then sends all of its listening sockets, each
+//    tagged with the address it's bound to.
+// 4. The new process acknowledges the handoff. It then loads the data that
+//    the running server could have changed (accounts, teams, etc.) and the
+//    game checkpoint, uses the received sockets for the addresses in its
+//    configuration (opening new sockets for any addresses that the old process
+//    wasn't listening on, and closing received sockets that it doesn't need),
+//    and listens on the handoff socket itself, so it can be upgraded the same
+//    way later. Connections made in the meantime wait in the sockets' backlogs.
+// 5. The running server stops accepting connections, stops writing any files
+//    (so it can't overwrite anything the new process saves), and shuts down.
+
+// The set of listening sockets that a server process has opened. Sockets
+// can be reused from a previous process (see receive_handoff) or opened
+// normally, and can be sent to the next process (see send_handoff).
+class ListeningSocketSet {
+public:
+  ListeningSocketSet() = default;
+  ListeningSocketSet(const ListeningSocketSet&) = delete;
+  ListeningSocketSet(ListeningSocketSet&&) = delete;
+  ListeningSocketSet& operator=(const ListeningSocketSet&) = delete;
+  ListeningSocketSet& operator=(ListeningSocketSet&&) = delete;
+  ~ListeningSocketSet() = default;
+
+  // Connects to the handoff socket of a running server and receives all of
+  // its listening sockets. Returns false if no server is listening on the
+  // handoff socket.
+  bool receive_handoff(const std::string& handoff_socket_path);
+  // Sends all sockets returned by open() over fd, which must be connected to
+  // a process that called receive_handoff. Returns after the other process
+  // has acknowledged the handoff; throws if it doesn't.
+  void send_handoff(int fd) const;
+
+  // Returns a listening socket for the given address. If port is zero, addr
+  // is the path to a Unix socket; otherwise, it's the address of the
+  // interface to listen on (or empty to listen on all interfaces). If a
+  // socket for the same address was received from the previous process, it
+  // is returned instead of opening a new socket.
+  int open(const std::string& addr, int port, bool is_udp = false);
+  // Closes all sockets received from the previous process that weren't
+  // returned by open()
+  void close_unused_handoff_sockets();
+
+  inline size_t num_handoff_sockets() const {
+    return this->handoff_fds.size();
+  }
+
+private:
+  // Keys in both maps are socket names (see socket_name)
+  std::unordered_map<std::string, int> handoff_fds;
+  std::map<std::string, int> fds;
+
+  static std::string socket_name(const std::string& addr, int port, bool is_udp);
+};
+
+// Listens on the handoff socket and sends this process' listening sockets to
+// any process that requests them. on_request is called before the sockets
+// are sent; on_complete is called after the other process has acknowledged
+// the handoff. After a successful handoff, the handoff socket is closed (but
+// not deleted, since the new process uses the same path).
+class SocketHandoffServer {
+public:
+  SocketHandoffServer(
+      std::shared_ptr<struct event_base> base,
+      const std::string& socket_path,
+      std::shared_ptr<const ListeningSocketSet> sockets,
+      std::function<void()> on_request,
+      std::function<void()> on_complete);
+  SocketHandoffServer(const SocketHandoffServer&) = delete;
+  SocketHandoffServer(SocketHandoffServer&&) = delete;
+  SocketHandoffServer& operator=(const SocketHandoffServer&) = delete;
+  SocketHandoffServer& operator=(SocketHandoffServer&&) = delete;
+  ~SocketHandoffServer();
+
+  inline bool handed_off() const {
+    return this->listen_fd < 0;
+  }
+
+private:
+  std::string socket_path;
+  std::shared_ptr<const ListeningSocketSet> sockets;
+  std::function<void()> on_request;
+  std::function<void()> on_complete;
+  int listen_fd;
+  std::unique_ptr<struct event, void (*)(struct event*)> accept_event;
+
+  static void dispatch_on_accept(evutil_socket_t fd, short events, void* ctx);
+  void on_accept();
+};
@@ -3,6 +3,8 @@
 #include <phosg/Filesystem.hh>
 #include <phosg/Image.hh>
 #include <phosg/Random.hh>
+#include <phosg/Time.hh>
+#include <phosg/Tools.hh>
 
 #include "BattleParamsIndex.hh"
 #include "GVMEncoder.hh"
@@ -77,7 +79,7 @@ void TeamIndex::Team::load_config() {
   this->reward_flags = json.get_int("RewardFlags");
 }
 
-void TeamIndex::Team::save_config() const {
+void TeamIndex::Team::save_config(DurableFileWriter* file_writer) const {
   JSON members_json = JSON::list();
   for (const auto& it : this->members) {
     members_json.emplace_back(it.second.json());
@@ -93,7 +95,12 @@ void TeamIndex::Team::save_config() const {
       {"RewardKeys", std::move(reward_keys_json)},
       {"RewardFlags", this->reward_flags},
   });
-  save_file(this->json_filename(), root.serialize(JSON::SerializeOption::FORMAT | JSON::SerializeOption::HEX_INTEGERS | JSON::SerializeOption::ESCAPE_CONTROLS_ONLY));
+  string data = root.serialize(JSON::SerializeOption::FORMAT | JSON::SerializeOption::HEX_INTEGERS | JSON::SerializeOption::ESCAPE_CONTROLS_ONLY);
+  if (file_writer) {
+    file_writer->write(this->json_filename(), std::move(data));
+  } else {
+    DurableFileWriter::write_file(this->json_filename(), data);
+  }
 }
 
 void TeamIndex::Team::load_flag() {
@@ -109,7 +116,7 @@ void TeamIndex::Team::load_flag() {
   }
 }
 
-void TeamIndex::Team::save_flag() const {
+void TeamIndex::Team::save_flag(DurableFileWriter* file_writer) const {
   if (!this->flag_data) {
     return;
   }
@@ -119,14 +126,24 @@ void TeamIndex::Team::save_flag() const {
       img.write_pixel(x, y, decode_argb1555_to_rgba8888(this->flag_data->at(y * 0x20 + x)));
     }
   }
-  img.save(this->flag_filename(), Image::Format::WINDOWS_BITMAP);
+  string data = img.save(Image::Format::WINDOWS_BITMAP);
+  if (file_writer) {
+    file_writer->write(this->flag_filename(), std::move(data));
+  } else {
+    DurableFileWriter::write_file(this->flag_filename(), data);
+  }
 }
 
-void TeamIndex::Team::delete_files() const {
+void TeamIndex::Team::delete_files(DurableFileWriter* file_writer) const {
   string json_filename = this->json_filename();
   string flag_filename = this->flag_filename();
-  remove(json_filename.c_str());
-  remove(flag_filename.c_str());
+  if (file_writer) {
+    file_writer->remove(json_filename);
+    file_writer->remove(flag_filename);
+  } else {
+    remove(json_filename.c_str());
+    remove(flag_filename.c_str());
+  }
 }
 
 PSOBBTeamMembership TeamIndex::Team::membership_for_member(uint32_t account_id) const {
@@ -228,8 +245,17 @@ TeamIndex::Reward::Reward(uint32_t menu_item_id, const JSON& def_json)
   }
 }
 
-TeamIndex::TeamIndex(const string& directory, const JSON& reward_defs_json)
+TeamIndex::TeamIndex(
+    const string& directory,
+    const JSON& reward_defs_json,
+    shared_ptr<DurableFileWriter> file_writer,
+    shared_ptr<struct event_base> base,
+    uint64_t save_interval_usecs)
     : directory(directory),
+      file_writer(file_writer),
+      base(base),
+      save_interval_usecs(save_interval_usecs),
+      save_event(this->base ? event_new(this->base.get(), -1, EV_TIMEOUT, &TeamIndex::dispatch_save_dirty_teams, this) : nullptr, event_free),
       next_team_id(1) {
   uint32_t reward_menu_item_id = 0;
   for (const auto& it : reward_defs_json.as_list()) {
@@ -240,30 +266,67 @@ TeamIndex::TeamIndex(const string& directory, const JSON& reward_defs_json)
     mkdir(this->directory.c_str(), 0755);
     return;
   }
+  vector<string> filenames;
   for (const auto& filename : list_directory(this->directory)) {
     string file_path = this->directory + "/" + filename;
     if (filename == "base.json") {
       auto json = JSON::parse(load_file(file_path));
       this->next_team_id = json.get_int("NextTeamID");
     } else if (ends_with(filename, ".json")) {
+      filenames.emplace_back(filename);
+    }
+  }
+
+  // Teams are read and parsed on multiple threads, then added to the indexes
+  // in directory order on this thread (and all logging is done here too), so
+  // the result is the same as if they were loaded one at a time
+  struct LoadResult {
+    shared_ptr<Team> team;
+    string error;
+    string flag_error;
+  };
+  vector<LoadResult> results(filenames.size());
+  parallel_range<size_t>([&](size_t z, size_t) -> bool {
+    auto& res = results[z];
+    const auto& filename = filenames[z];
+    try {
+      uint32_t team_id = stoul(filename.substr(0, filename.size() - 5), nullptr, 16);
+      auto team = make_shared<Team>(team_id);
+      team->load_config();
       try {
-        uint32_t team_id = stoul(filename.substr(0, filename.size() - 5), nullptr, 16);
-        auto team = make_shared<Team>(team_id);
-        team->load_config();
-        try {
-          team->load_flag();
-        } catch (const exception& e) {
-          static_game_data_log.warning("Failed to load flag for team %08" PRIX32 ": %s", team_id, e.what());
-        }
-        this->add_to_indexes(team);
-        static_game_data_log.info("Indexed team %08" PRIX32 " (%s) (%zu members)", team_id, team->name.c_str(), team->num_members());
+        team->load_flag();
       } catch (const exception& e) {
-        static_game_data_log.warning("Failed to index team from %s: %s", filename.c_str(), e.what());
+        res.flag_error = e.what();
       }
+      res.team = std::move(team);
+    } catch (const exception& e) {
+      res.error = e.what();
+    }
+    return false;
+  },
+      0, filenames.size(), 0);
+
+  for (size_t z = 0; z < filenames.size(); z++) {
+    const auto& res = results[z];
+    try {
+      if (!res.team) {
+        throw runtime_error(res.error);
+      }
+      if (!res.flag_error.empty()) {
+        static_game_data_log.warning("Failed to load flag for team %08" PRIX32 ": %s", res.team->team_id, res.flag_error.c_str());
+      }
+      this->add_to_indexes(res.team);
+      static_game_data_log.info("Indexed team %08" PRIX32 " (%s) (%zu members)", res.team->team_id, res.team->name.c_str(), res.team->num_members());
+    } catch (const exception& e) {
+      static_game_data_log.warning("Failed to index team from %s: %s", filenames[z].c_str(), e.what());
     }
   }
 }
 
+TeamIndex::~TeamIndex() {
+  this->flush();
+}
+
 size_t TeamIndex::count() const {
   return this->id_to_team.size();
 }
@@ -302,7 +365,13 @@ vector<shared_ptr<const TeamIndex::Team>> TeamIndex::all() const {
 
 shared_ptr<const TeamIndex::Team> TeamIndex::create(const string& name, uint32_t master_account_id, const string& master_name) {
   auto team = make_shared<Team>(this->next_team_id++);
-  save_file(this->directory + "/base.json", JSON::dict({{"NextTeamID", this->next_team_id}}).serialize());
+  string base_filename = this->directory + "/base.json";
+  string base_data = JSON::dict({{"NextTeamID", this->next_team_id}}).serialize();
+  if (this->file_writer) {
+    this->file_writer->write(base_filename, std::move(base_data));
+  } else {
+    DurableFileWriter::write_file(base_filename, base_data);
+  }
 
   Team::Member m;
   m.account_id = master_account_id;
@@ -313,7 +382,7 @@ shared_ptr<const TeamIndex::Team> TeamIndex::create(const string& name, uint32_t
   team->members.emplace(master_account_id, std::move(m));
   team->name = name;
 
-  team->save_config();
+  team->save_config(this->file_writer.get());
   this->add_to_indexes(team);
   return team;
 }
@@ -321,7 +390,8 @@ shared_ptr<const TeamIndex::Team> TeamIndex::create(const string& name, uint32_t
 void TeamIndex::disband(uint32_t team_id) {
   auto team = this->id_to_team.at(team_id);
   this->remove_from_indexes(team);
-  team->delete_files();
+  this->dirty_team_ids.erase(team_id);
+  team->delete_files(this->file_writer.get());
 }
 
 void TeamIndex::rename(uint32_t team_id, const std::string& new_team_name) {
@@ -331,7 +401,7 @@ void TeamIndex::rename(uint32_t team_id, const std::string& new_team_name) {
   }
   this->name_to_team.erase(team->name);
   team->name = new_team_name;
-  team->save_config();
+  this->save_config_later(team);
 }
 
 void TeamIndex::add_member(uint32_t team_id, uint32_t account_id, const string& name) {
@@ -347,7 +417,7 @@ void TeamIndex::add_member(uint32_t team_id, uint32_t account_id, const string&
   m.name = name;
   team->members.emplace(account_id, std::move(m));
 
-  team->save_config();
+  this->save_config_later(team);
 }
 
 void TeamIndex::remove_member(uint32_t account_id) {
@@ -361,7 +431,7 @@ void TeamIndex::remove_member(uint32_t account_id) {
   if (team->members.empty()) {
     this->disband(team->team_id);
   } else {
-    team->save_config();
+    this->save_config_later(team);
   }
 }
 
@@ -369,7 +439,7 @@ void TeamIndex::update_member_name(uint32_t account_id, const std::string& name)
   auto team = this->account_id_to_team.at(account_id);
   auto& m = team->members.at(account_id);
   m.name = name;
-  team->save_config();
+  this->save_config_later(team);
 }
 
 void TeamIndex::add_member_points(uint32_t account_id, uint32_t points) {
@@ -377,13 +447,17 @@ void TeamIndex::add_member_points(uint32_t account_id, uint32_t points) {
   auto& m = team->members.at(account_id);
   m.points += points;
   team->points += points;
-  team->save_config();
+  this->save_config_later(team);
 }
 
 void TeamIndex::set_flag_data(uint32_t team_id, const parray<le_uint16_t, 0x20 * 0x20>& flag_data) {
   auto team = this->id_to_team.at(team_id);
+  // If the flag didn't change, don't re-encode and rewrite the image
+  if (team->flag_data && (*team->flag_data == flag_data)) {
+    return;
+  }
   team->flag_data.reset(new parray<le_uint16_t, 0x20 * 0x20>(flag_data));
-  team->save_flag();
+  team->save_flag(this->file_writer.get());
 }
 
 bool TeamIndex::promote_leader(uint32_t master_account_id, uint32_t leader_account_id) {
@@ -398,7 +472,7 @@ bool TeamIndex::promote_leader(uint32_t master_account_id, uint32_t leader_accou
     return false;
   }
   other_m.set_flag(TeamIndex::Team::Member::Flag::IS_LEADER);
-  team->save_config();
+  this->save_config_later(team);
   return true;
 }
 
@@ -414,7 +488,7 @@ bool TeamIndex::demote_leader(uint32_t master_account_id, uint32_t leader_accoun
     return false;
   }
   other_m.clear_flag(TeamIndex::Team::Member::Flag::IS_LEADER);
-  team->save_config();
+  this->save_config_later(team);
   return true;
 }
 
@@ -431,7 +505,7 @@ void TeamIndex::change_master(uint32_t master_account_id, uint32_t new_master_ac
   new_master_m.clear_flag(TeamIndex::Team::Member::Flag::IS_LEADER);
   new_master_m.set_flag(TeamIndex::Team::Member::Flag::IS_MASTER);
   team->master_account_id = new_master_account_id;
-  team->save_config();
+  this->save_config_later(team);
 }
 
 void TeamIndex::buy_reward(uint32_t team_id, const string& key, uint32_t points, Team::RewardFlag reward_flag) {
@@ -444,7 +518,7 @@ void TeamIndex::buy_reward(uint32_t team_id, const string& key, uint32_t points,
   if (reward_flag != Team::RewardFlag::NONE) {
     team->set_reward_flag(reward_flag);
   }
-  team->save_config();
+  this->save_config_later(team);
 }
 
 void TeamIndex::add_to_indexes(shared_ptr<Team> team) {
@@ -470,3 +544,42 @@ void TeamIndex::remove_from_indexes(shared_ptr<Team> team) {
     this->account_id_to_team.erase(it.second.account_id);
   }
 }
+
+void TeamIndex::save_config_later(shared_ptr<Team> team) {
+  if (!this->save_event || (this->save_interval_usecs == 0)) {
+    team->save_config(this->file_writer.get());
+    return;
+  }
+
+  this->dirty_team_ids.emplace(team->team_id);
+  // The timer isn't restarted if it's already pending, so a team that changes
+  // continuously is still saved once per interval
+  if (!event_pending(this->save_event.get(), EV_TIMEOUT, nullptr)) {
+    auto tv = usecs_to_timeval(this->save_interval_usecs);
+    event_add(this->save_event.get(), &tv);
+  }
+}
+
+void TeamIndex::flush() {
+  if (this->save_event) {
+    event_del(this->save_event.get());
+  }
+
+  unordered_set<uint32_t> team_ids;
+  team_ids.swap(this->dirty_team_ids);
+  for (uint32_t team_id : team_ids) {
+    auto it = this->id_to_team.find(team_id);
+    if (it == this->id_to_team.end()) {
+      continue;
+    }
+    try {
+      it->second->save_config(this->file_writer.get());
+    } catch (const exception& e) {
+      player_data_log.error("Failed to save team %08" PRIX32 ": %s", team_id, e.what());
+    }
+  }
+}
+
+void TeamIndex::dispatch_save_dirty_teams(evutil_socket_t, short, void* ctx) {
+  reinterpret_cast<TeamIndex*>(ctx)->flush();
+}
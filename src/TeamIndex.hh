@@ -1,5 +1,6 @@
 #pragma once
 
+#include <event2/event.h>
 #include <stdint.h>
 
 #include <array>
@@ -7,13 +8,21 @@
 #include <phosg/JSON.hh>
 #include <random>
 #include <string>
+#include <unordered_set>
 
+#include "DurableFileWriter.hh"
 #include "ItemNameIndex.hh"
 #include "SaveFileFormats.hh"
 #include "StaticGameData.hh"
 #include "Text.hh"
 #include "Version.hh"
 
+// Most changes to teams (e.g. adding member points after each enemy kill) are
+// not written to disk immediately. Instead, the team is marked dirty, and all
+// dirty teams are saved together when the save timer fires, so each team's
+// file is written at most once per save interval. If there is no event base
+// or the save interval is zero, changes are saved immediately. Dirty teams are
+// also saved by flush() and when the index is destroyed.
 class TeamIndex {
 public:
   struct Team {
@@ -73,11 +82,12 @@ public:
     std::string json_filename() const;
     std::string flag_filename() const;
 
+    // If file_writer is null, these write or delete the files synchronously
     void load_config();
-    void save_config() const;
+    void save_config(DurableFileWriter* file_writer) const;
     void load_flag();
-    void save_flag() const;
-    void delete_files() const;
+    void save_flag(DurableFileWriter* file_writer) const;
+    void delete_files(DurableFileWriter* file_writer) const;
 
     PSOBBTeamMembership membership_for_member(uint32_t account_id) const;
 
@@ -115,8 +125,17 @@ public:
     Reward(uint32_t menu_item_id, const JSON& def_json);
   };
 
-  TeamIndex(const std::string& directory, const JSON& reward_defs_json);
-  ~TeamIndex() = default;
+  TeamIndex(
+      const std::string& directory,
+      const JSON& reward_defs_json,
+      std::shared_ptr<DurableFileWriter> file_writer = nullptr,
+      std::shared_ptr<struct event_base> base = nullptr,
+      uint64_t save_interval_usecs = 0);
+  TeamIndex(const TeamIndex&) = delete;
+  TeamIndex(TeamIndex&&) = delete;
+  TeamIndex& operator=(const TeamIndex&) = delete;
+  TeamIndex& operator=(TeamIndex&&) = delete;
+  ~TeamIndex();
 
   inline const std::vector<Reward>& reward_definitions() const {
     return this->reward_defs;
@@ -142,8 +161,17 @@ public:
   void change_master(uint32_t master_account_id, uint32_t new_master_account_id);
   void buy_reward(uint32_t team_id, const std::string& key, uint32_t points, Team::RewardFlag reward_flag);
 
+  // Saves all dirty teams now. This must be called before reading the team
+  // files from disk (e.g. when reloading teams).
+  void flush();
+
 protected:
   std::string directory;
+  std::shared_ptr<DurableFileWriter> file_writer;
+  std::shared_ptr<struct event_base> base;
+  uint64_t save_interval_usecs;
+  std::unique_ptr<struct event, void (*)(struct event*)> save_event;
+  std::unordered_set<uint32_t> dirty_team_ids;
   uint32_t next_team_id;
   std::unordered_map<uint32_t, std::shared_ptr<Team>> id_to_team;
   std::unordered_map<std::string, std::shared_ptr<Team>> name_to_team;
@@ -152,4 +180,7 @@ protected:
 
   void add_to_indexes(std::shared_ptr<Team> team);
   void remove_from_indexes(std::shared_ptr<Team> team);
+  void save_config_later(std::shared_ptr<Team> team);
+
+  static void dispatch_save_dirty_teams(evutil_socket_t fd, short events, void* ctx);
 };
@@ -0,0 +1,64 @@
+#include "WorkerPool.hh"
+
+#include <stdexcept>
+#include <thread>
+
+#include "Loggers.hh"
+
+using namespace std;
+
+WorkerPool::WorkerPool(size_t num_threads) : max_threads(num_threads) {
+  if (this->max_threads == 0) {
+    throw invalid_argument("worker pool must have at least one thread");
+  }
+}
+
+void WorkerPool::enqueue(function<void()>&& fn) {
+  lock_guard g(this->lock);
+  if (this->should_stop) {
+    throw runtime_error("worker pool is stopped");
+  }
+  this->queue.emplace_back(std::move(fn));
+  // Threads are started only when needed, so an idle server doesn't have any
+  if ((this->num_idle_threads == 0) && (this->num_started_threads < this->max_threads)) {
+    thread t([self = this->shared_from_this()]() -> void { self->thread_fn(); });
+    t.detach();
+    this->num_started_threads++;
+  }
+  this->cv.notify_one();
+}
+
+void WorkerPool::stop() {
+  lock_guard g(this->lock);
+  this->should_stop = true;
+  this->cv.notify_all();
+}
+
+size_t WorkerPool::num_pending_tasks() const {
+  lock_guard g(this->lock);
+  return this->queue.size();
+}
+
+void WorkerPool::thread_fn() {
+  for (;;) {
+    function<void()> fn;
+    {
+      unique_lock g(this->lock);
+      this->num_idle_threads++;
+      this->cv.wait(g, [&]() -> bool { return this->should_stop || !this->queue.empty(); });
+      this->num_idle_threads--;
+      if (this->queue.empty()) { // should_stop must be true
+        this->num_started_threads--;
+        return;
+      }
+      fn = std::move(this->queue.front());
+      this->queue.pop_front();
+    }
+
+    try {
+      fn();
+    } catch (const exception& e) {
+      server_log.error("Worker task failed: %s", e.what());
+    }
+  }
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <stddef.h>
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+
+// Runs tasks on a fixed number of background threads, in the order they were
+// enqueued (though tasks may finish in any order if there are multiple
+// threads). This is used for work that would otherwise cause visible hitches
+// on the event thread, such as generating maps for new games. Tasks that need
+// to modify server state must do so via forward_to_event_thread.
+//
+// Like ReloadQueue, the threads hold a reference to the pool, so the owner
+// may be destroyed while tasks are running; stop() prevents new tasks from
+// being enqueued, and the threads exit after all queued tasks are done.
+class WorkerPool : public std::enable_shared_from_this<WorkerPool> {
+public:
+  explicit WorkerPool(size_t num_threads);
+  WorkerPool(const WorkerPool&) = delete;
+  WorkerPool(WorkerPool&&) = delete;
+  WorkerPool& operator=(const WorkerPool&) = delete;
+  WorkerPool& operator=(WorkerPool&&) = delete;
+  ~WorkerPool() = default;
+
+  // Tasks should not throw; if one does, the exception is logged and ignored.
+  void enqueue(std::function<void()>&& fn);
+  void stop();
+
+  inline size_t num_threads() const {
+    return this->max_threads;
+  }
+  size_t num_pending_tasks() const;
+
+private:
+  mutable std::mutex lock;
+  std::condition_variable cv;
+  std::deque<std::function<void()>> queue;
+  size_t max_threads;
+  size_t num_started_threads = 0;
+  size_t num_idle_threads = 0;
+  bool should_stop = false;
+
+  void thread_fn();
+};
@@ -0,0 +1,62 @@
+#!/bin/sh
+
+set -e
+
+EXECUTABLE="$1"
+if [ -z "$EXECUTABLE" ]; then
+  EXECUTABLE="./newserv"
+fi
+
+STATE=tests/ep3-tournament-journal-test.json
+JOURNAL=$STATE.journal
+OUTPUT=tests/ep3-tournament-journal-test.out
+
+team() {
+  echo "{\"max_players\": 1, \"player_specs\": [], \"name\": \"$1\", \"password\": \"\", \"num_rounds_cleared\": 0}"
+}
+tournament() {
+  echo "{\"name\": \"Test\", \"map_number\": 901, \"rules\": {}, \"flags\": 2, \"is_registration_complete\": false, \"teams\": [$(team "$1"), $(team B), $(team C), $(team D)]}"
+}
+load() {
+  $EXECUTABLE --config=tests/config.json load-ep3-tournament-state --state=$STATE > $OUTPUT
+}
+
+echo "... crash after writing a snapshot but before clearing the journal"
+echo "{\"Generation\": 2, \"Tournaments\": {\"Test\": $(tournament After)}}" > $STATE
+echo "{\"Generation\": 1, \"Op\": \"set\", \"Name\": \"Test\", \"State\": $(tournament Before)}" > $JOURNAL
+echo "{\"Generation\": 1, \"Op\": \"team\", \"Name\": \"Test\", \"Index\": 0, \"State\": $(team Before)}" >> $JOURNAL
+load
+grep -q '"After"' $OUTPUT
+if grep -q '"Before"' $OUTPUT; then
+  echo "stale journal records were applied"
+  exit 1
+fi
+# The stale records should have been discarded by writing a new snapshot
+[ ! -s $JOURNAL ]
+load
+grep -q '"After"' $OUTPUT
+
+echo "... records from the current generation are applied"
+echo "{\"Generation\": 2, \"Tournaments\": {\"Test\": $(tournament After)}}" > $STATE
+echo "{\"Generation\": 2, \"Op\": \"team\", \"Name\": \"Test\", \"Index\": 0, \"State\": $(team Later)}" > $JOURNAL
+load
+grep -q '"Later"' $OUTPUT
+
+echo "... snapshots and records without generation numbers are applied"
+echo "{\"Test\": $(tournament After)}" > $STATE
+echo "{\"Op\": \"team\", \"Name\": \"Test\", \"Index\": 0, \"State\": $(team Later)}" > $JOURNAL
+load
+grep -q '"Later"' $OUTPUT
+
+echo "... records from a later generation make loading fail"
+echo "{\"Generation\": 2, \"Tournaments\": {\"Test\": $(tournament After)}}" > $STATE
+echo "{\"Generation\": 3, \"Op\": \"team\", \"Name\": \"Test\", \"Index\": 0, \"State\": $(team Later)}" > $JOURNAL
+cp $JOURNAL $JOURNAL.orig
+if load 2>/dev/null; then
+  echo "loading should have failed"
+  exit 1
+fi
+cmp $JOURNAL $JOURNAL.orig
+
+echo "... clean up"
+rm -f $STATE $JOURNAL $JOURNAL.orig $OUTPUT